@@ -0,0 +1,14 @@
+# Generates a C++ source file that defines a null-terminated char array 
+# with the contents of a file, so that it can be compiled into a binary
+#
+# Usage: cmake -D INPUT=<file> -D OUTPUT=<file.cpp> -D SYMBOL=<name> -P EmbedFile.cmake
+
+file ( READ ${INPUT} CONTENTS HEX )
+string ( REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1, " CONTENTS "${CONTENTS}" )
+string ( REGEX REPLACE "(0x.., 0x.., 0x.., 0x.., 0x.., 0x.., 0x.., 0x.., 0x.., 0x.., 0x.., 0x.., )" "\\1\n    " CONTENTS "${CONTENTS}" )
+
+file ( WRITE ${OUTPUT} 
+    "// Generated from ${INPUT}. Do not edit\n\n"
+    "extern const char ${SYMBOL}[];\n"
+    "const char ${SYMBOL}[] = {\n    ${CONTENTS}0x00\n};\n"
+)
@@ -0,0 +1,98 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: coefficients.hpp
+ * File description: Generation of the filter coefficients on the host 
+ *                   (Gaussian, and LoG), and a cache of the objects built 
+ *                   for each (sigma, width) pair of the Gaussian.
+ */
+
+#ifndef KINECTFILTER_COEFFICIENTS_HPP
+#define KINECTFILTER_COEFFICIENTS_HPP
+
+#include <map>
+#include <vector>
+#include <utility>
+#include <functional>
+
+
+// Gaussian parameters (of the Fused LoG and Separable methods), tuned live 
+// with +/- (sigma) and [/] (width). The steps keep the cache keys exact
+const float sigmaStep = 0.25f;
+const float minSigma = 0.5f;
+const float maxSigma = 4.f;
+const int minGaussianWidth = 3;
+const int maxGaussianWidth = 15;
+
+// The 3x3 filters of the Box method (a box filter, applied twice, 
+// approximates a Gaussian), and of the edge detection
+extern const float boxFilter3x3[9];
+extern const float laplacianFilter3x3[9];
+
+// Samples a normalized Gaussian of the given sigma over width (odd) pixels
+std::vector<float> gaussianFilter (float sigma, int width);
+
+// Convolves two square filters. Applying the resulting filter, of width 
+// (widthA + widthB - 1), is equivalent to applying the two filters in succession
+std::vector<float> combineFilters (const float *a, int widthA, const float *b, int widthB);
+
+// Returns the LoG filter of a Gaussian, i.e. the 2D Gaussian convolved 
+// with the 3x3 Laplacian filter (so it sums to 0, and responds like 
+// the Laplacian pass of the other methods), of (width + 2) x (width + 2)
+std::vector<float> logFilter (float sigma, int width);
+
+
+// A cache of the objects built for the Gaussian of each (sigma, width) pair 
+// (e.g. the uploaded LoG filter, and the separable program specialized 
+// for the pair), so that going through the pairs again builds nothing
+template <typename T>
+class GaussianCache
+{
+public:
+    typedef std::function<void (float sigma, int width, T &entry)> Build;
+
+    // Returns the entry of a pair, which build fills in the first time the pair is used
+    T &get (float sigma, int width, const Build &build)
+    {
+        const std::pair<float, int> key (sigma, width);
+        typename std::map<std::pair<float, int>, T>::iterator entry = entries.find (key);
+        if (entry != entries.end ())
+            return entry->second;
+
+        // A failed build leaves no entry behind
+        T &created = entries[key];
+        try
+        {
+            build (sigma, width, created);
+        }
+        catch (...)
+        {
+            entries.erase (key);
+            throw;
+        }
+
+        return created;
+    }
+
+    // Calls fn for each entry (e.g. to release its objects)
+    void forEach (const std::function<void (T &entry)> &fn)
+    {
+        for (auto &entry : entries)
+            fn (entry.second);
+    }
+
+private:
+    std::map<std::pair<float, int>, T> entries;
+};
+
+#endif  // KINECTFILTER_COEFFICIENTS_HPP
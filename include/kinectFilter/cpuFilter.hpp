@@ -0,0 +1,122 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: cpuFilter.hpp
+ * File description: A CPU backend for the kernels of the filter pipeline, 
+ *                   vectorized with SSE2, AVX2 or NEON (selected at runtime), 
+ *                   and multithreaded across stripes of rows.
+ */
+
+#ifndef KINECTFILTER_CPUFILTER_HPP
+#define KINECTFILTER_CPUFILTER_HPP
+
+#include <cstdint>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+
+// A class that runs the kernels of the filter pipeline on the CPU, for when 
+// there is no OpenCL device, and as a baseline for the benchmark. The results 
+// match the ones of the buffer-based kernels (convolutionVec, convolutionRGBVec, 
+// rgb2rgbaNorm, depthTo3DRays) up to rounding. The frames get split in stripes 
+// of rows, one per thread, and each thread convolves its stripe out of a small 
+// window of gray-scale rows (the filter width of them), that stays in the cache
+class CpuFilter
+{
+public:
+    // The instruction sets with an implementation of the kernels
+    enum Isa { SCALAR, SSE2, AVX2, NEON };
+
+    // Starts threads - 1 worker threads (the calling thread takes a stripe too). 
+    // With threads = 0, there is a thread per hardware thread
+    explicit CpuFilter (int threads = 0);
+
+    ~CpuFilter ();
+
+    // Returns the best instruction set that the processor supports
+    static Isa detectIsa ();
+
+    static const char *isaName (Isa isa);
+
+    // Sets the instruction set to use (at most the detected one, e.g. 
+    // for a comparison with the scalar code). It's the detected one by default
+    void setIsa (Isa isa);
+
+    Isa isa () const
+    {
+        return activeIsa;
+    }
+
+    int threads () const
+    {
+        return workers.size () + 1;
+    }
+
+    // Transforms a raw RGB frame to gray-scale (same weights with rgb2gray)
+    void rgb2gray (const uint8_t *rgb, uint8_t *gray, int rows, int cols);
+
+    // Convolves a gray-scale image with a filterWidth x filterWidth filter 
+    // (the pixels outside of the image are clamped to the edge, and 
+    // the results are truncated and saturated, like convolutionVec does)
+    void convolve (const uint8_t *source, uint8_t *output, int rows, int cols, 
+                   const float *filter, int filterWidth);
+
+    // Same as convolve, but the source is a raw RGB frame, 
+    // that's transformed to gray-scale on the fly
+    void convolveRGB (const uint8_t *rgb, uint8_t *output, int rows, int cols, 
+                      const float *filter, int filterWidth);
+
+    // Transforms a raw RGB frame to normalized RGBA (4 floats per pixel, 
+    // the channels divided by their sum), like rgb2rgbaNorm does
+    void normalizeRGB (const uint8_t *rgb, float *rgba, int rows, int cols);
+
+    // Builds a point cloud (4 floats per point) out of a Depth frame, with 
+    // the ray table of the camera (X/Z, Y/Z per pixel, see computeRays), 
+    // like depthTo3DRays does
+    void depthTo3DRays (const uint16_t *depth, const float *rays, float *cloud, int rows, int cols);
+
+private:
+    CpuFilter (const CpuFilter &);
+    CpuFilter &operator= (const CpuFilter &);
+
+    // Runs job (first row, last row, stripe index) over the rows 
+    // [0, rows), split in stripes over the threads, and waits for it
+    void parallelRows (int rows, const std::function<void (int, int, int)> &job);
+
+    // Runs stripe index of the current job
+    void runStripe (int index);
+
+    // The loop of worker thread index (1 and up)
+    void work (int index);
+
+    // Convolves a stripe of rows, with rgb telling the format of the source
+    void convolveStripe (const uint8_t *source, bool rgb, uint8_t *output, int rows, int cols, 
+                         const float *filter, int filterWidth, int first, int last, 
+                         std::vector<float> &window);
+
+    Isa activeIsa;
+
+    std::vector<std::thread> workers;
+    std::vector<std::vector<float> > windows;  // The row window of each stripe
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    const std::function<void (int, int, int)> *job;
+    int jobRows, stripes, pending;
+    uint64_t generation;
+    bool stopping;
+};
+
+#endif  // KINECTFILTER_CPUFILTER_HPP
@@ -0,0 +1,130 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: cpuPipeline.hpp
+ * File description: The filter pipeline of the image applications on the CPU 
+ *                   (see CpuFilter), for when there is no OpenCL device.
+ */
+
+#ifndef KINECTFILTER_CPUPIPELINE_HPP
+#define KINECTFILTER_CPUPIPELINE_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <kinectFilter/cpuFilter.hpp>
+#include <kinectFilter/coefficients.hpp>
+#include <kinectFilter/profiler.hpp>
+#include <kinectFilter/resolution.hpp>
+
+
+// A class for filtering an image on the CPU (see CpuFilter), for when there is 
+// no OpenCL device, or with --cpu. It has the smoothing methods that come down 
+// to plain convolutions (Box, and Fused LoG), and no pipelined mode
+class CpuPipeline
+{
+public:
+    // Filters frames of frameWidth x frameHeight pixels, at 1 / 2^levels 
+    // of their size (see setResolution). The passes get recorded on 
+    // profiler, when it's given
+    CpuPipeline (int frameWidth, int frameHeight, int levels = 0, Profiler *profiler = NULL);
+
+    // Applies the filters on a raw RGB frame from Kinect, 
+    // and stores the resulting gray-scale image in image
+    void convolve (const uint8_t *rgb, uint8_t *image);
+
+    // Returns a description of the backend (the instruction set, and the threads)
+    std::string name ();
+
+    // Returns the host buffers that the RGB frames get written into
+    uint8_t *const *rgbSlots ()
+    {
+        return slots;
+    }
+
+    // Switches to frames of frameWidth x frameHeight pixels, 
+    // filtered at 1 / 2^levels of their size
+    void setResolution (int frameWidth, int frameHeight, int levels);
+
+    int imageWidth ()
+    {
+        return width;
+    }
+
+    int imageHeight ()
+    {
+        return height;
+    }
+
+    bool smoothing ()
+    {
+        return smoothed;
+    }
+
+    bool toggleSmoothing ()
+    {
+        smoothed = !smoothed;
+        return smoothed;
+    }
+
+    const char *smoothingMethod ()
+    {
+        return fused ? "Fused LoG" : "Box";
+    }
+
+    const char *nextSmoothingMethod ()
+    {
+        fused = !fused;
+        return smoothingMethod ();
+    }
+
+    // Sets the Gaussian of the Fused LoG method
+    void setGaussian (float sigma, int width);
+
+    float smoothingSigma ()
+    {
+        return gaussianSigma;
+    }
+
+    int smoothingWidth ()
+    {
+        return gaussianWidth;
+    }
+
+private:
+    // Convolves a frame (an RGB one, or a gray-scale one) with a 
+    // square filter, and records the duration of the pass, when profiling
+    void pass (const char *stage, const uint8_t *source, bool rgb, uint8_t *output, 
+               const std::vector<float> &filter);
+
+    // Halves the dimensions of a raw RGB frame, by averaging 2x2 blocks of pixels 
+    // (like downsampleRGB in kernels.cl). rows and cols are the dimensions of the output
+    static void downsample (const uint8_t *rgb, uint8_t *out, int rows, int cols);
+
+    CpuFilter cpu;
+    Profiler *profiler;
+    int frameWidth, frameHeight, levels;
+    int width, height;  // Of the filtered images
+    bool smoothed, fused;
+    std::vector<float> boxFilter, laplacianFilter;
+    float gaussianSigma;
+    int gaussianWidth;
+    GaussianCache<std::vector<float> > logCache;
+    std::vector<float> *logFilter;
+    std::vector<uint8_t> interImage1, interImage2;
+    std::vector<uint8_t> pyramid[maxPyramidLevels];  // The RGB frame at each level above it
+    std::vector<uint8_t> hostRGB[3];
+    uint8_t *slots[3];
+};
+
+#endif  // KINECTFILTER_CPUPIPELINE_HPP
@@ -0,0 +1,181 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: frameQueue.hpp
+ * File description: A lock-free queue of timestamped frames for handing
+ *                   frames over between two threads.
+ */
+
+#ifndef KINECTFILTER_FRAMEQUEUE_HPP
+#define KINECTFILTER_FRAMEQUEUE_HPP
+
+#include <cstdint>
+#include <atomic>
+
+
+// A lock-free queue that hands timestamped frames over from a single producer 
+// (the libfreenect thread) to a single consumer (the rendering thread). 
+// Unlike TripleBuffer, the consumer gets to see the last few frames, so it can 
+// pick the one it needs (e.g. the one closest in time to a frame of another 
+// stream). The producer never waits: when the queue is full, the oldest frame 
+// gets overwritten. The consumer holds on to one frame at a time
+template <typename T>
+class FrameQueue
+{
+public:
+    static const int maxSlots = 8;
+
+    // A frame in the queue, as seen by the consumer
+    struct Frame
+    {
+        int slot;
+        uint32_t timestamp;
+        uint64_t tag;  // The state of the slot when it was seen
+    };
+
+    // The slotCount (3 to maxSlots) buffers are owned by the caller 
+    // (they are pinned host buffers of the OpenCL context the frames go to). 
+    // The producer and the consumer have one each, the rest hold the queue
+    FrameQueue (T *const *slots, int slotCount) 
+        : slotCount (slotCount), writeIdx (0), readIdx (1), sequence (0)
+    {
+        for (int i = 0; i < slotCount; ++i)
+        {
+            buffers[i] = slots[i];
+            state[i] = FREE;
+        }
+        state[writeIdx] = WRITING;
+        state[readIdx] = HELD;
+    }
+
+    // Returns the buffer the producer writes the next frame into
+    T *writeBuffer () { return buffers[writeIdx]; }
+
+    // Returns the buffer with the frame the consumer currently holds
+    const T *readBuffer () { return buffers[readIdx]; }
+
+    // Called by the producer when the frame in the write buffer is complete. 
+    // It moves on to a free buffer, or else to the one with the oldest frame
+    // Returns true if a frame had to be overwritten
+    bool publish (uint32_t timestamp)
+    {
+        state[writeIdx].store ((uint64_t) timestamp << 32 | (++sequence & SEQUENCE_MASK) << 2 | READY, 
+                               std::memory_order_release);
+
+        // The consumer may take frames in the meantime, so it's retried until a slot is won
+        bool overwritten;
+        while (true)
+        {
+            int oldest = -1;
+            uint64_t oldestTag = 0;
+            for (int i = 0; i < slotCount; ++i)
+            {
+                uint64_t tag = state[i].load (std::memory_order_acquire);
+                if ((tag & STATUS_MASK) == FREE || 
+                    ((tag & STATUS_MASK) == READY && i != writeIdx && 
+                     (oldest < 0 || older (tag, oldestTag))))
+                {
+                    oldest = i;
+                    oldestTag = tag;
+                    if ((tag & STATUS_MASK) == FREE)
+                        break;
+                }
+            }
+
+            if (oldest >= 0 && state[oldest].compare_exchange_strong (oldestTag, WRITING, std::memory_order_acq_rel))
+            {
+                writeIdx = oldest;
+                overwritten = (oldestTag & STATUS_MASK) == READY;
+                break;
+            }
+        }
+
+        return overwritten;
+    }
+
+    // Tells whether the queue is full, i.e. the next frame would overwrite one
+    bool full () const
+    {
+        for (int i = 0; i < slotCount; ++i)
+            if ((state[i].load (std::memory_order_acquire) & STATUS_MASK) == FREE)
+                return false;
+
+        return true;
+    }
+
+    // Called by the consumer to list the frames in the queue, oldest first
+    // Returns the number of frames
+    int frames (Frame out[maxSlots]) const
+    {
+        int count = 0;
+        for (int i = 0; i < slotCount; ++i)
+        {
+            uint64_t tag = state[i].load (std::memory_order_acquire);
+            if ((tag & STATUS_MASK) != READY)
+                continue;
+
+            // Insertion sort on the sequence numbers
+            int j = count++;
+            for (; j > 0 && older (tag, out[j - 1].tag); --j)
+                out[j] = out[j - 1];
+            out[j].slot = i;
+            out[j].timestamp = tag >> 32;
+            out[j].tag = tag;
+        }
+
+        return count;
+    }
+
+    // Called by the consumer to get hold of a listed frame, in place of the 
+    // frame it was holding. Returns false if the frame got overwritten since
+    bool take (const Frame &frame)
+    {
+        uint64_t tag = frame.tag;
+        if (!state[frame.slot].compare_exchange_strong (tag, HELD, std::memory_order_acq_rel))
+            return false;
+
+        state[readIdx].store (FREE, std::memory_order_release);
+        readIdx = frame.slot;
+        return true;
+    }
+
+    // Called by the consumer to discard a listed frame
+    // Returns false if the producer overwrote the frame in the meantime
+    bool drop (const Frame &frame)
+    {
+        uint64_t tag = frame.tag;
+        return state[frame.slot].compare_exchange_strong (tag, FREE, std::memory_order_acq_rel);
+    }
+
+private:
+    // The state of a slot packs its status, and for a READY one, 
+    // the timestamp and the sequence number of the frame (so that 
+    // a frame that gets overwritten is never mistaken for the listed one)
+    static const uint64_t FREE = 0, WRITING = 1, READY = 2, HELD = 3;
+    static const uint64_t STATUS_MASK = 0x03;
+    static const uint64_t SEQUENCE_MASK = 0x3FFFFFFF;
+
+    // Tells whether the frame of tag a was published before the one of tag b
+    static bool older (uint64_t a, uint64_t b)
+    {
+        return ((((b >> 2) - (a >> 2)) & SEQUENCE_MASK) - 1) < SEQUENCE_MASK / 2;
+    }
+
+    T *buffers[maxSlots];
+    int slotCount;
+    int writeIdx, readIdx;
+    uint32_t sequence;  // Of the last published frame (producer only)
+    std::atomic<uint64_t> state[maxSlots];
+};
+
+#endif  // KINECTFILTER_FRAMEQUEUE_HPP
@@ -0,0 +1,146 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: frameSource.hpp
+ * File description: A source of RGB and Depth frames (a Kinect, or a
+ *                   recording) that hands them over to the rendering
+ *                   thread through triple buffers, or frame queues.
+ */
+
+#ifndef KINECTFILTER_FRAMESOURCE_HPP
+#define KINECTFILTER_FRAMESOURCE_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <memory>
+#include <kinectFilter/tripleBuffer.hpp>
+#include <kinectFilter/frameQueue.hpp>
+#include <kinectFilter/profiler.hpp>
+
+class Recorder;
+
+
+// The frame counters of a stream. A frame gets dropped when it's overwritten 
+// before the rendering thread picks it up, or when it can't be paired
+struct FrameCounts
+{
+    uint64_t captured, processed, dropped;
+};
+
+
+// A class that takes the RGB and Depth frames of a source, and copies them 
+// into buffers given by the caller (pinned host buffers of the OpenCL context), 
+// which are cycled through triple buffers, so that the source thread and 
+// the rendering thread never wait on each other
+class FrameSource
+{
+public:
+    FrameSource ();
+
+    virtual ~FrameSource ();
+
+    // Sets the buffers the RGB and Depth frames get written into. It has to be called 
+    // before the streams are started (depthSlots can be NULL, if the Depth stream 
+    // isn't used). With a profiler, the copies out of the source thread get timed
+    void attach (uint8_t *const rgbSlots[3], uint16_t *const depthSlots[3] = NULL, 
+                 Profiler *profiler = NULL);
+
+    // Like attach, but sets slotCount (3 to FrameQueue::maxSlots) buffers per stream, 
+    // that keep a short queue of frames, so that the frames can be handed over 
+    // in pairs of RGB and Depth frames that were captured together (see getPair)
+    void attachPaired (uint8_t *const *rgbSlots, uint16_t *const *depthSlots, 
+                       int slotCount, Profiler *profiler = NULL);
+
+    // Sets a recorder that gets a copy of every frame (NULL stops the recording)
+    void record (Recorder *recorder);
+
+    // Points to the most recently received RGB frame
+    // Returns true if the frame is a new one
+    bool getRGB (const uint8_t *&rgb);
+
+    // Throws away the RGB frame waiting to be picked up, if any (see attach), 
+    // e.g. one of an old resolution. It counts as a dropped frame
+    void discardRGB ();
+
+    // Points to the most recently received Depth frame
+    // Returns true if the frame is a new one
+    bool getDepth (const uint16_t *&depth);
+
+    // Points to the newest RGB and Depth frames (see attachPaired) whose 
+    // timestamps are at most tolerance apart. The older frames get dropped, 
+    // and so do the ones that can't be paired any more
+    // Returns true if the pair is a new one
+    bool getPair (const uint8_t *&rgb, const uint16_t *&depth, uint32_t tolerance);
+
+    // Return the frame counters of a stream (they can be read from any thread)
+    FrameCounts rgbCounts () const;
+    FrameCounts depthCounts () const;
+
+    // Return the host time (see Profiler::now) at which the frame that 
+    // getRGB, getDepth or getPair points to arrived from the source
+    double rgbArrival () const
+    {
+        return rgbStream.held;
+    }
+
+    double depthArrival () const
+    {
+        return depthStream.held;
+    }
+
+protected:
+    // Hands over a new RGB frame of size bytes (called on the source thread)
+    void deliverRGB (const uint8_t *rgb, size_t size, uint32_t timestamp);
+
+    // Hands over a new Depth frame of size bytes (called on the source thread)
+    void deliverDepth (const uint16_t *depth, size_t size, uint32_t timestamp);
+
+    // Tell whether the last frame of a stream is yet to be picked up by 
+    // the rendering thread, or with frame queues, whether the queue is full 
+    // (false for a stream that isn't attached)
+    bool rgbPending () const;
+    bool depthPending () const;
+
+private:
+    // The counters, and the arrival times of the frames in the slots of a stream. 
+    // An arrival time gets written while the source thread owns its slot, 
+    // so the hand-over of the slot hands it over as well
+    struct Stream
+    {
+        Stream ();
+        void setSlots (const void *const *slots, int count);
+        void arrived (const void *slot, double time);
+        void pickedUp (const void *slot);
+        FrameCounts counts () const;
+
+        std::atomic<uint64_t> captured, processed, dropped;
+        const void *slots[FrameQueue<uint8_t>::maxSlots];
+        double arrivals[FrameQueue<uint8_t>::maxSlots];
+        int slotCount;
+        double held;  // The arrival time of the frame the rendering thread holds
+    };
+
+    std::unique_ptr<TripleBuffer<uint8_t> > rgbFrames;
+    std::unique_ptr<TripleBuffer<uint16_t> > depthFrames;
+    std::unique_ptr<FrameQueue<uint8_t> > rgbQueue;
+    std::unique_ptr<FrameQueue<uint16_t> > depthQueue;
+    Profiler *profiler;
+    std::atomic<Recorder *> recorder;
+    Stream rgbStream, depthStream;
+
+    // Durations of the last copies out of the source thread (for profiling)
+    std::atomic<double> rgbCopyTime, depthCopyTime;
+};
+
+#endif  // KINECTFILTER_FRAMESOURCE_HPP
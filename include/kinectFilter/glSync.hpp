@@ -0,0 +1,42 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: glSync.hpp
+ * File description: Detection of the extensions for the synchronization 
+ *                   of OpenCL and OpenGL on the objects they share.
+ */
+
+#ifndef KINECTFILTER_GLSYNC_HPP
+#define KINECTFILTER_GLSYNC_HPP
+
+#include <GL/glew.h>
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+#define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#if defined(__APPLE__) || defined(__MACOSX)
+#include <OpenCL/cl.hpp>
+#else
+#include <CL/cl.hpp>
+#endif
+
+
+// Detects the extensions for fine-grained CL-GL synchronization (cl_khr_gl_event, 
+// GL_ARB_cl_event) on device, of platform. createEvent receives 
+// clCreateEventFromGLsyncKHR (or NULL), and glCLEvent tells if OpenGL can wait 
+// for a CL event. Without them, the pipelines of the two APIs have to be drained
+void checkGLSync (const cl::Platform &platform, const cl::Device &device, 
+                  clCreateEventFromGLsyncKHR_fn &createEvent, bool &glCLEvent);
+
+#endif  // KINECTFILTER_GLSYNC_HPP
@@ -0,0 +1,45 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: kinectDevice.hpp
+ * File description: A libfreenect device that hands its frames over to
+ *                   the rendering thread through triple buffers.
+ */
+
+#ifndef KINECTFILTER_KINECTDEVICE_HPP
+#define KINECTFILTER_KINECTDEVICE_HPP
+
+#include <cstdint>
+#include <libfreenect.hpp>
+#include <kinectFilter/frameSource.hpp>
+
+
+// A class that extends Freenect::FreenectDevice by defining the VideoCallback 
+// and DepthCallback callback functions, so we can get updates with the latest 
+// RGB and Depth frames. The frames get handed over to the rendering thread 
+// by FrameSource
+class KinectDevice : public Freenect::FreenectDevice, public FrameSource
+{
+public:
+    KinectDevice (freenect_context *ctx, int index);
+
+    // Delivers the latest RGB frame
+    // Do not call directly, it's only used by the library
+    void VideoCallback (void *rgb, uint32_t timestamp);
+
+    // Delivers the latest Depth frame
+    // Do not call directly, it's only used by the library
+    void DepthCallback (void *depth, uint32_t timestamp);
+};
+
+#endif  // KINECTFILTER_KINECTDEVICE_HPP
@@ -0,0 +1,83 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: metrics.hpp
+ * File description: Frame-level metrics (frame counters, frame rate, and
+ *                   end-to-end latency), reported periodically in a log
+ *                   line, and in a file in the Prometheus text format.
+ */
+
+#ifndef KINECTFILTER_METRICS_HPP
+#define KINECTFILTER_METRICS_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <kinectFilter/frameSource.hpp>
+
+
+// A class that keeps the frame-level metrics of an application: the frame 
+// counters of its sources, the rate of the frames it delivers (displays or 
+// publishes), and a histogram of their end-to-end latency, from their arrival 
+// from the sensor to their delivery. It's cheap enough to be always on. 
+// Every interval, it writes a log line with the figures of the interval 
+// (flagged when frames got dropped), and rewrites the metrics file, if set 
+// (e.g. for the textfile collector of the Prometheus node exporter)
+class Metrics
+{
+public:
+    // The application name goes in the log line, and in the labels of the metrics
+    Metrics (const std::string &app, double interval = 10.);
+
+    // Adds a source to report the frame counters of, 
+    // labeled with its index among the added sources
+    void addSource (const FrameSource *source);
+
+    // Sets the file that the metrics get written to (replaced in one go)
+    void setFile (const std::string &path)
+    {
+        fileName = path;
+    }
+
+    // Counts a delivered frame, and records its latency, from 
+    // its arrival time (see FrameSource::rgbArrival) to now
+    void frameDelivered (double arrival);
+
+    // Reports the metrics, once interval has passed since the last report
+    // (it's meant to be called on every iteration of the main loop, 
+    // so that a stalled pipeline gets reported as well)
+    void update ();
+
+private:
+    // The upper bounds of the latency buckets (in ms)
+    static const double bucketBounds[];
+    static const int bucketCount;
+
+    // Returns the bucket bound below which the p-th quantile of histogram lies
+    static double percentile (const std::vector<uint64_t> &histogram, double p);
+
+    void writeFile () const;
+
+    std::string app;
+    std::string fileName;
+    double interval, lastReport;
+    std::vector<const FrameSource *> sources;
+    std::vector<FrameCounts> lastCounts[2];  // RGB and Depth counters at the last report
+
+    // Since the start, and since the last report
+    uint64_t delivered, intervalDelivered;
+    double latencySum;
+    std::vector<uint64_t> histogram, intervalHistogram;  // One more bucket, for anything above the bounds
+};
+
+#endif  // KINECTFILTER_METRICS_HPP
@@ -0,0 +1,195 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: pipeline.hpp
+ * File description: A stage graph for chains of OpenCL kernels. The stages
+ *                   declare the memory objects they read and write, and the
+ *                   graph assigns the intermediate ones from a shared pool.
+ */
+
+#ifndef KINECTFILTER_PIPELINE_HPP
+#define KINECTFILTER_PIPELINE_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+#define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#if defined(__APPLE__) || defined(__MACOSX)
+#include <OpenCL/cl.hpp>
+#else
+#include <CL/cl.hpp>
+#endif
+
+
+// Describes an intermediate memory object. Objects with 
+// the same description are interchangeable, so they get pooled
+struct MemSpec
+{
+    // An image with the given format and dimensions
+    static MemSpec image (const cl::ImageFormat &format, size_t width, size_t height);
+
+    // A buffer of the given size (in bytes)
+    static MemSpec buffer (size_t size);
+
+    bool operator< (const MemSpec &other) const;
+
+    bool isImage;
+    cl_channel_order order;
+    cl_channel_type type;
+    size_t width, height;
+    size_t size;
+};
+
+
+// A pool of intermediate memory objects. It can be shared by all the pipelines 
+// that execute on the same in-order queue, since only one of them runs at a time
+class MemPool
+{
+public:
+    MemPool (const cl::Context &context) : context (context)
+    {
+    }
+
+    // The same, for callers of the C API (the context gets retained)
+    explicit MemPool (cl_context context);
+
+    // Returns the index-th object with the given description 
+    // (the objects get created on their first request)
+    cl::Memory get (const MemSpec &spec, size_t index);
+
+private:
+    cl::Context context;
+    std::map<MemSpec, std::vector<cl::Memory> > objects;
+};
+
+
+// A stage of a pipeline: a kernel launch, along with 
+// the (named) memory objects it reads and writes
+class Stage
+{
+public:
+    typedef std::function<void (cl::Kernel &)> Setup;
+    typedef std::function<void (cl::NDRange &offset, cl::NDRange &global)> Range;
+
+    Stage (const std::string &name, const cl::Kernel &kernel, 
+           const cl::NDRange &global, const cl::NDRange &local) 
+        : name (name), kernel (kernel), global (global), local (local)
+    {
+    }
+
+    // Declares that kernel argument arg reads the memory object resource
+    Stage &input (cl_uint arg, const std::string &resource);
+
+    // Declares that kernel argument arg writes the memory object resource
+    Stage &output (cl_uint arg, const std::string &resource);
+
+    // Sets a function that sets the rest of the kernel arguments, right before 
+    // the launch (needed when the kernel is shared with other stages)
+    Stage &setup (const Setup &fn);
+
+    // Sets a function that picks the offset and the size of the workspace, right 
+    // before the launch (e.g. for a stripe of rows). Otherwise, the workspace 
+    // is the global range of the stage, without an offset
+    Stage &range (const Range &fn);
+
+private:
+    friend class Pipeline;
+
+    std::string name;
+    cl::Kernel kernel;
+    cl::NDRange global, local;
+    std::vector<std::pair<cl_uint, std::string> > inputs, outputs;
+    Setup fn;
+    Range rangeFn;
+};
+
+
+// A graph of stages that get enqueued, in the order they were added, in one batch. 
+// The memory objects are referred to by name. External ones get bound by the caller,
+// while intermediate ones get declared with a description, and are assigned from 
+// the pool. Two intermediates share an object, when their lifetimes (from the stage 
+// that writes them, to the last stage that reads them) don't overlap, so 
+// ping-pong buffers come out of the assignment without having to be wired by hand
+class Pipeline
+{
+public:
+    // Returns the event for the command of a stage (or NULL)
+    typedef std::function<cl::Event *(const std::string &stage)> EventSource;
+    typedef std::function<cl_event *(const std::string &stage)> RawEventSource;
+
+    Pipeline (MemPool &pool) : pool (&pool), assigned (false)
+    {
+    }
+
+    // Binds an external memory object
+    void bind (const std::string &name, const cl::Memory &mem);
+
+    // Declares an intermediate memory object
+    void intermediate (const std::string &name, const MemSpec &spec);
+
+    // Appends a stage to the pipeline
+    Stage &addStage (const std::string &name, const cl::Kernel &kernel, 
+                     const cl::NDRange &global, const cl::NDRange &local = cl::NullRange);
+
+    // Enqueues all the stages. If waits is given, the first stage waits for those 
+    // events. If done is given, it receives the event of the last stage (instead 
+    // of the one from events). The events for the rest of the stages come from events
+    void enqueue (cl::CommandQueue &queue, const std::vector<cl::Event> *waits = NULL, 
+                  cl::Event *done = NULL, const EventSource &events = EventSource ());
+
+    // The same, for callers of the C API (e.g. kinectFilter_clc). The handles 
+    // get retained, so the caller keeps its own references. The first stage 
+    // waits for wait, if it's given. Instead of throwing, the C API version 
+    // of enqueue returns the status of the first call that failed (including 
+    // the ones in the setup functions of the stages)
+    void bind (const std::string &name, cl_mem mem);
+
+    Stage &addStage (const std::string &name, cl_kernel kernel, 
+                     const cl::NDRange &global, const cl::NDRange &local = cl::NullRange);
+
+    cl_int enqueue (cl_command_queue queue, cl_event wait = NULL, 
+                    cl_event *done = NULL, const RawEventSource &events = RawEventSource ());
+
+    // Returns the name of the last stage
+    const std::string &lastStage () const;
+
+private:
+    // Assigns pool objects to the intermediates, based on their lifetimes
+    void assign ();
+
+    MemPool *pool;
+    std::vector<Stage> stages;
+    std::map<std::string, cl::Memory> resources;
+    std::vector<std::pair<std::string, MemSpec> > intermediates;
+    bool assigned;
+};
+
+
+// Prepends to a pipeline the stages that downsample the RGB frame source 
+// (frameWidth x frameHeight pixels) to the top level of a pyramid with levels 
+// levels above it, with downsample (a downsampleRGB kernel). The levels are 
+// intermediates named "rgb1", "rgb2", ... Returns the name of the frame to filter
+std::string addPyramid (Pipeline &pipeline, const cl::Kernel &downsample, const std::string &source, 
+                        int frameWidth, int frameHeight, int levels);
+
+
+// Generates the build options that bake a separable filter into a program
+std::string separableOptions (const std::vector<float> &rowFilter, 
+                              const std::vector<float> &columnFilter);
+
+#endif  // KINECTFILTER_PIPELINE_HPP
@@ -0,0 +1,116 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: profiler.hpp
+ * File description: Collects the durations of the pipeline stages (host
+ *                   ones, and device commands timed from their events), and
+ *                   reports rolling percentiles and a CSV export of them.
+ */
+
+#ifndef KINECTFILTER_PROFILER_HPP
+#define KINECTFILTER_PROFILER_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <algorithm>
+#include <chrono>
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+#define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#if defined(__APPLE__) || defined(__MACOSX)
+#include <OpenCL/cl.hpp>
+#else
+#include <CL/cl.hpp>
+#endif
+
+
+// A class that collects the durations of the pipeline stages. It keeps 
+// the last history samples of each stage for the CSV export, and reports 
+// rolling percentiles over the most recent window ones for the status text
+class Profiler
+{
+public:
+    Profiler (size_t window = 120, size_t history = 100000) 
+        : window (window), history (std::max (window, history))
+    {
+    }
+
+    // Returns a host timestamp in milliseconds
+    static double now ()
+    {
+        return std::chrono::duration<double, std::milli> (
+            std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+    }
+
+    // Records the duration (in milliseconds) of a stage
+    void record (const std::string &stage, double ms);
+
+    // Returns an event for timing a device command of a stage (the queue needs 
+    // CL_QUEUE_PROFILING_ENABLE). The command gets recorded by collect
+    cl::Event *profile (const std::string &stage);
+
+    // The same, for callers of the C API (the event belongs to the profiler)
+    cl_event *profileRaw (const std::string &stage);
+
+    // Times an existing event as a device command of a stage
+    void track (const std::string &stage, const cl::Event &event);
+
+    // The same, for callers of the C API (the event gets retained)
+    void track (const std::string &stage, cl_event event);
+
+    // Records the durations of the timed commands that have completed. The 
+    // commands get recorded in the order they were profiled, so it stops at 
+    // the first one that hasn't completed (the rest wait for the next call)
+    void collect ();
+
+    // Draws the summary on the current GLUT window, a line 
+    // every 15 pixels from (x, y) (see profilerDraw.cpp)
+    void draw (int x, int y) const;
+
+    // Returns one line per stage with the p50 and p99 
+    // durations over the most recent samples
+    std::vector<std::string> summary () const;
+
+    // Writes the kept samples in a CSV file, one row per sample
+    void dump (const char *fileName) const;
+
+    // Writes the kept samples in fileName, when the application exits
+    void dumpAtExit (const char *fileName);
+
+private:
+    // Returns the p-th quantile of the samples (which get reordered)
+    static double percentile (std::vector<double> &samples, double p);
+
+    // A ring of the samples of a stage. Sample n goes into ring[n % history]
+    struct Samples
+    {
+        Samples () : count (0)
+        {
+        }
+
+        std::vector<double> ring;
+        uint64_t count;  // Samples recorded so far
+    };
+
+    size_t window, history;
+    std::vector<std::string> stages;
+    std::map<std::string, Samples> samples;
+    std::deque<std::pair<std::string, cl::Event> > events;
+};
+
+#endif  // KINECTFILTER_PROFILER_HPP
@@ -0,0 +1,45 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: programCache.hpp
+ * File description: An on-disk cache of OpenCL program binaries, and the 
+ *                   kernel source that gets embedded in the applications.
+ */
+
+#ifndef KINECTFILTER_PROGRAMCACHE_HPP
+#define KINECTFILTER_PROGRAMCACHE_HPP
+
+#include <string>
+
+#if defined(__APPLE__) || defined(__MACOSX)
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+
+// The source of kernels/kernels.cl, embedded at build time
+extern const char kernelSource[];
+
+// Creates a program from source, and builds it for device with options. 
+// The binary of the program gets cached, keyed by the device name, the 
+// driver version, the options and the source, so the next process to ask 
+// for the same program creates it from the binary, and skips the compilation. 
+// Any mismatch, or a binary that fails to load, falls back to a source build.
+// The cache lives in $KINECTFILTER_CACHE_DIR, or $XDG_CACHE_HOME/kinectFilter, 
+// or ~/.cache/kinectFilter. If status is an error, log receives the build log
+cl_program buildCachedProgram (cl_context context, cl_device_id device, 
+                               const std::string &source, const std::string &options, 
+                               cl_int *status, std::string *log = NULL);
+
+#endif  // KINECTFILTER_PROGRAMCACHE_HPP
@@ -0,0 +1,173 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: recording.hpp
+ * File description: Recording of the raw RGB and Depth streams of a Kinect 
+ *                   to a file, and memory-mapped replay of a recording 
+ *                   as a frame source.
+ */
+
+#ifndef KINECTFILTER_RECORDING_HPP
+#define KINECTFILTER_RECORDING_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <kinectFilter/frameSource.hpp>
+
+
+// The layout of a recording: a RecordingHeader, followed by the frames of both 
+// streams, in the order they arrived. Each frame is a RecordedFrame, followed 
+// by its payload, padded to 8 bytes
+struct RecordingHeader
+{
+    char magic[8];        // "KFREC1"
+    uint32_t width, height;
+};
+
+struct RecordedFrame
+{
+    enum Stream : uint32_t { RGB = 0, DEPTH = 1 };
+
+    // RAW: the frame as it came from the source 
+    // DELTA_LZ4: (Depth only) the differences of consecutive pixels, 
+    //            split in a plane of low and a plane of high bytes, 
+    //            and compressed with LZ4
+    enum Encoding : uint32_t { RAW = 0, DELTA_LZ4 = 1 };
+
+    uint32_t stream;
+    uint32_t encoding;
+    uint32_t timestamp;   // The timestamp of libfreenect
+    uint32_t size;        // Bytes of payload
+    uint32_t rawSize;     // Bytes of the decoded frame
+    uint32_t reserved;
+    uint64_t hostTime;    // Arrival time (steady clock), in ns
+};
+
+
+// A class that writes the frames of a source to a recording 
+// (see FrameSource::record). It can be fed from any thread. The frames get 
+// copied into a bounded queue, and a writer thread compresses them and writes 
+// them out, so that a slow disk never stalls the source thread. When the queue 
+// is full, the new frames get dropped (and counted)
+class Recorder
+{
+public:
+    // Creates the recording fileName, for frames of width x height pixels. 
+    // The Depth frames get compressed with compressDepth, in builds with LZ4. 
+    // The queue holds up to queueFrames frames (of both streams)
+    Recorder (const std::string &fileName, uint32_t width, uint32_t height, 
+              bool compressDepth = true, size_t queueFrames = 60);
+
+    // Writes out the frames still in the queue, and closes the recording
+    ~Recorder ();
+
+    void writeRGB (const uint8_t *rgb, size_t size, uint32_t timestamp);
+
+    void writeDepth (const uint16_t *depth, size_t size, uint32_t timestamp);
+
+    // Returns the number of frames dropped so far, because the queue was full
+    uint64_t dropped () const
+    {
+        return droppedFrames;
+    }
+
+private:
+    Recorder (const Recorder &);
+    Recorder &operator= (const Recorder &);
+
+    // A frame in the queue
+    struct Pending
+    {
+        RecordedFrame frame;
+        std::vector<uint8_t> payload;  // Keeps its capacity, once a frame has been through
+    };
+
+    // Copies a frame into the queue (called on the source thread)
+    void enqueue (RecordedFrame::Stream stream, const uint8_t *payload, size_t size, uint32_t timestamp);
+
+    // The loop of the writer thread
+    void run ();
+
+    // Encodes (a Depth frame, with compressDepth) and writes a frame
+    void writeFrame (Pending &pending);
+
+    void write (RecordedFrame &frame, const uint8_t *payload);
+
+    std::FILE *file;
+    bool compressDepth;
+    std::atomic<bool> failed;
+    std::atomic<uint64_t> droppedFrames;
+
+    // The queue is a ring of slots. The producers fill the slot at head (one at 
+    // a time, under producerMutex), and the writer empties the one at tail
+    std::vector<Pending> slots;
+    size_t head, tail, count;
+    bool stopping;
+    std::mutex mutex, producerMutex;
+    std::condition_variable ready;
+    std::thread writer;
+
+    std::vector<uint8_t> planes, packed;  // Writer thread only
+};
+
+
+// A class that replays a recording, as if the frames came from a Kinect. 
+// The file gets memory-mapped, so the raw frames get copied straight from 
+// the page cache into the buffers of the consumer
+class ReplayDevice : public FrameSource
+{
+public:
+    // Maps the recording fileName. With maxSpeed, each frame gets handed over 
+    // as soon as the previous one of its stream has been picked up, instead 
+    // of at the pace it was recorded. With loop, the replay starts over at the end
+    ReplayDevice (const std::string &fileName, bool maxSpeed = false, bool loop = true);
+
+    ~ReplayDevice ();
+
+    // Starts the thread that hands over the frames (call attach first)
+    void start ();
+
+    // Stops the thread
+    void stop ();
+
+    uint32_t width () const;
+
+    uint32_t height () const;
+
+private:
+    ReplayDevice (const ReplayDevice &);
+    ReplayDevice &operator= (const ReplayDevice &);
+
+    void run ();
+
+    // Decodes a DELTA_LZ4 Depth frame into depth
+    void decodeDepth (const RecordedFrame &frame, const uint8_t *payload);
+
+    const uint8_t *data;
+    size_t mappedSize;
+    std::vector<size_t> frames;  // Offsets of the frames
+    bool maxSpeed, loop;
+    std::thread thread;
+    std::atomic<bool> running;
+    std::vector<uint8_t> planes;
+    std::vector<uint16_t> depth;
+};
+
+#endif  // KINECTFILTER_RECORDING_HPP
@@ -0,0 +1,57 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: resolution.hpp
+ * File description: The selection of the resolution of the RGB stream, 
+ *                   and of the level of the image pyramid that the image 
+ *                   applications filter the frames on.
+ */
+
+#ifndef KINECTFILTER_RESOLUTION_HPP
+#define KINECTFILTER_RESOLUTION_HPP
+
+#include <functional>
+#include <libfreenect.hpp>
+#include <kinectFilter/kinectDevice.hpp>
+#include <kinectFilter/recording.hpp>
+
+
+// The largest frames (the high RGB resolution), and the most pyramid levels 
+// above them. The buffers that take the frames get sized for those
+const int maxFrameWidth = 1280;
+const int maxFrameHeight = 1024;
+const int maxPyramidLevels = 2;
+
+// Gets the new frame dimensions, and the levels of the pyramid 
+// above them (e.g. to call setResolution on the filter)
+typedef std::function<void (int frameWidth, int frameHeight, int levels)> Resize;
+
+// Returns the dimensions of the frames of the source: the ones of the recording 
+// on a replay (when replay is given), or the ones of the RGB mode of resolution
+void frameDimensions (const ReplayDevice *replay, freenect_resolution resolution, 
+                      int &width, int &height);
+
+// Switches the Kinect between the medium (640x480) and the high (1280x1024) 
+// RGB resolution. The stream gets restarted, and after resize, a frame of 
+// the old resolution that might still be waiting gets discarded (it counts 
+// as dropped). The resolution is fixed on a replay (no device), and during 
+// a recording
+void toggleResolution (KinectDevice *device, bool recording, freenect_resolution &resolution, 
+                       int levels, const Resize &resize);
+
+// Moves levels on to the next level of the image pyramid 
+// (the full frame after the top one), and calls resize
+void nextPyramidLevel (const ReplayDevice *replay, freenect_resolution resolution, 
+                       int &levels, const Resize &resize);
+
+#endif  // KINECTFILTER_RESOLUTION_HPP
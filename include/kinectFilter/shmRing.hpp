@@ -0,0 +1,133 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: shmRing.hpp
+ * File description: A ring of frames in POSIX shared memory, that the
+ *                   headless mode publishes its results into, and that
+ *                   other processes read in place.
+ */
+
+#ifndef KINECTFILTER_SHMRING_HPP
+#define KINECTFILTER_SHMRING_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <string>
+
+static_assert (ATOMIC_LLONG_LOCK_FREE == 2, "The ring needs lock-free 64-bit atomics");
+
+
+// The layout of the shared memory object: a header, followed by slotCount
+// slots, slotStride bytes apart. Each slot is a descriptor, followed by
+// the payload. Frame n (the sequence numbers start from 1) goes into slot
+// n % slotCount. The descriptor keeps the sequence number of the frame in
+// the slot, and 0 while it is being written, so a reader can tell if the
+// frame got overwritten while it was reading it (see ShmRingReader::intact)
+struct ShmRingHeader
+{
+    char magic[8];                // "KFRING1"
+    uint32_t slotCount;
+    uint32_t slotStride;          // Bytes between the slots
+    uint32_t slotSize;            // Bytes of payload in a slot
+    uint32_t reserved;
+    std::atomic<uint64_t> head;   // Sequence number of the newest frame (0 before the first)
+};
+
+struct ShmRingSlot
+{
+    // Payload formats
+    // GRAY8: width x height bytes (a filtered gray-scale frame)
+    // PACKED_POINTS: width points of short4 position (in mm) and uchar4 color
+    enum Format : uint32_t { GRAY8 = 1, PACKED_POINTS = 2 };
+
+    std::atomic<uint64_t> sequence;
+    uint64_t timestamp;           // CLOCK_MONOTONIC, in ns
+    uint32_t size;                // Bytes of payload
+    uint32_t width, height;
+    uint32_t format;
+    uint32_t source;              // The sensor the frame comes from
+    uint32_t reserved;
+};
+
+
+// A class that publishes frames into a ring in shared memory. The payload
+// of a slot can be written in place (e.g. by a readback from the device)
+class ShmRing
+{
+public:
+    // Creates the shared memory object name (e.g. "/kinectFilter"), replacing
+    // any previous one, with slotCount slots for up to slotSize bytes each
+    ShmRing (const std::string &name, uint32_t slotCount, uint32_t slotSize);
+
+    // Unmaps, and removes the shared memory object
+    // (readers that have it mapped keep their mapping)
+    ~ShmRing ();
+
+    // Returns the payload of the slot that the next frame goes into,
+    // and marks the slot as being written
+    uint8_t *begin ();
+
+    // Publishes the frame written in the slot returned by begin
+    void publish (uint32_t size, uint32_t width, uint32_t height,
+                  ShmRingSlot::Format format, uint32_t source = 0);
+
+    // Returns the capacity of a slot in bytes
+    uint32_t slotSize () const
+    {
+        return header->slotSize;
+    }
+
+private:
+    ShmRing (const ShmRing &);
+    ShmRing &operator= (const ShmRing &);
+
+    ShmRingSlot *slot (uint64_t sequence);
+
+    std::string name;
+    size_t mappedSize;
+    ShmRingHeader *header;
+    uint64_t next;
+};
+
+
+// A class that reads the frames of a ring published by another process,
+// in place. A frame has to be checked with intact after reading it
+class ShmRingReader
+{
+public:
+    // Maps the shared memory object name (read-only)
+    explicit ShmRingReader (const std::string &name);
+
+    ~ShmRingReader ();
+
+    // Returns the sequence number of the newest frame (0 before the first)
+    uint64_t head () const;
+
+    // Returns the descriptor of frame sequence, and sets data to its payload,
+    // or returns NULL if the slot holds another frame by now
+    const ShmRingSlot *frame (uint64_t sequence, const uint8_t *&data) const;
+
+    // Tells if frame sequence is still in its slot, i.e. the data read
+    // from it since frame returned it are valid
+    bool intact (const ShmRingSlot *slot, uint64_t sequence) const;
+
+private:
+    ShmRingReader (const ShmRingReader &);
+    ShmRingReader &operator= (const ShmRingReader &);
+
+    size_t mappedSize;
+    const ShmRingHeader *header;
+};
+
+#endif  // KINECTFILTER_SHMRING_HPP
@@ -0,0 +1,74 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: textureStream.hpp
+ * File description: A ring of pixel-unpack buffers that streams the
+ *                   frames read back from OpenCL into a texture.
+ */
+
+#ifndef KINECTFILTER_TEXTURESTREAM_HPP
+#define KINECTFILTER_TEXTURESTREAM_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <GL/glew.h>
+
+
+// A class that updates a texture with frames written straight into pixel-unpack 
+// buffers (for when the frames can't be shared with OpenCL). The texture gets 
+// allocated once (and again only when the dimensions change), and the updates 
+// with glTexSubImage2D are DMA transfers out of the buffers, that don't block. 
+// With ARB_buffer_storage, the slots are regions of one buffer that stays 
+// mapped, and a fence per slot keeps a frame from being written over 
+// before its transfer is over. Otherwise, each slot is a buffer that 
+// gets orphaned and mapped for each frame
+class TextureStream
+{
+public:
+    // Streams into texture frames of format (GL_LUMINANCE, GL_RGB, ...) 
+    // of type GL_UNSIGNED_BYTE, of up to slotSize bytes each
+    // It needs a current OpenGL context, with ARB_pixel_buffer_object
+    TextureStream (GLuint texture, GLenum format, size_t slotSize, int slotCount = 3);
+
+    ~TextureStream ();
+
+    // Returns the memory that the next frame gets written into. It's the same 
+    // one until commit, and it waits, if its last frame is still being transferred
+    uint8_t *begin ();
+
+    // Updates the texture with the frame of width x height pixels written at begin
+    void commit (GLsizei width, GLsizei height);
+
+    // Tells whether the slots are persistently mapped
+    bool persistent () const
+    {
+        return persistentMap != NULL;
+    }
+
+private:
+    TextureStream (const TextureStream &);
+    TextureStream &operator= (const TextureStream &);
+
+    GLuint texture;
+    GLenum format;
+    size_t slotSize;
+    GLsizei width, height;  // Of the texture, once allocated
+    int current;
+    uint8_t *mapped;        // The memory returned by begin (NULL before it)
+    uint8_t *persistentMap;
+    std::vector<GLuint> buffers;
+    std::vector<GLsync> fences;
+};
+
+#endif  // KINECTFILTER_TEXTURESTREAM_HPP
@@ -0,0 +1,88 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: tripleBuffer.hpp
+ * File description: A lock-free triple buffer for handing frames over
+ *                   between two threads.
+ */
+
+#ifndef KINECTFILTER_TRIPLEBUFFER_HPP
+#define KINECTFILTER_TRIPLEBUFFER_HPP
+
+#include <cstdint>
+#include <atomic>
+
+
+// A lock-free triple buffer that hands frames over from a single producer 
+// (the libfreenect thread) to a single consumer (the rendering thread).
+// The producer always has a free buffer to write the next frame into, and 
+// the consumer always holds on to the most recent complete frame, 
+// so neither side ever has to wait on the other
+template <typename T>
+class TripleBuffer
+{
+public:
+    // The three buffers are owned by the caller (they are pinned 
+    // host buffers of the OpenCL context the frames go to)
+    TripleBuffer (T *const slots[3]) 
+        : writeIdx (0), readIdx (1), state (2)
+    {
+        for (int i = 0; i < 3; ++i)
+            buffers[i] = slots[i];
+    }
+
+    // Returns the buffer the producer writes the next frame into
+    T *writeBuffer () { return buffers[writeIdx]; }
+
+    // Returns the buffer with the frame the consumer currently holds
+    const T *readBuffer () { return buffers[readIdx]; }
+
+    // Called by the producer when the frame in the write buffer is complete
+    // Returns true if the previous frame was never picked up by the consumer
+    bool publish ()
+    {
+        uint8_t prev = state.exchange (writeIdx | NEW_FRAME, std::memory_order_acq_rel);
+        writeIdx = prev & INDEX_MASK;
+        return prev & NEW_FRAME;
+    }
+
+    // Tells whether the last published frame is yet to be picked up by the consumer
+    bool pending () const
+    {
+        return state.load (std::memory_order_acquire) & NEW_FRAME;
+    }
+
+    // Called by the consumer to get hold of the most recent frame
+    // Returns false if there is no new frame since the last call
+    bool update ()
+    {
+        if (!(state.load (std::memory_order_acquire) & NEW_FRAME))
+            return false;
+
+        uint8_t prev = state.exchange (readIdx, std::memory_order_acq_rel);
+        readIdx = prev & INDEX_MASK;
+        return true;
+    }
+
+private:
+    // The shared state holds the index of the buffer in the middle, 
+    // and whether that buffer holds a frame the consumer hasn't seen yet
+    static const uint8_t INDEX_MASK = 0x03;
+    static const uint8_t NEW_FRAME = 0x04;
+
+    T *buffers[3];
+    uint8_t writeIdx, readIdx;
+    std::atomic<uint8_t> state;
+};
+
+#endif  // KINECTFILTER_TRIPLEBUFFER_HPP
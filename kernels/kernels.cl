@@ -112,6 +112,674 @@ void convolutionGL ( read_only image2d_t sourceImage,
 }
 
 
+// Loads a tile of the source image into local memory. The tile covers the
+// image region of the work-group, extended by a halo of halfwidth pixels on
+// each side. Out of bounds pixels are resolved by the sampler. The origin 
+// comes from the global ids, so it honors a global work offset.
+void loadTile ( read_only image2d_t sourceImage, sampler_t sampler,
+                local float *tile, int halfwidth )
+{
+    int lX = get_local_id (0);
+    int lY = get_local_id (1);
+    int lWidth = get_local_size (0);
+    int lHeight = get_local_size (1);
+
+    // Tile dimensions
+    int tileWidth = lWidth + 2 * halfwidth;
+    int tileHeight = lHeight + 2 * halfwidth;
+
+    // Image coordinates of the tile's top-left pixel
+    int2 tileOrigin = (int2) ((int) get_global_id (0) - lX - halfwidth,
+                              (int) get_global_id (1) - lY - halfwidth);
+
+    // The work-items stride over the tile, so that each pixel is read once
+    for (int y = lY; y < tileHeight; y += lHeight)
+        for (int x = lX; x < tileWidth; x += lWidth)
+            tile[y * tileWidth + x] = 
+                read_imageui (sourceImage, sampler, tileOrigin + (int2) (x, y)).x;
+
+    barrier (CLK_LOCAL_MEM_FENCE);
+}
+
+
+// Same as loadTile, but for images with float channel types
+void loadTileF ( read_only image2d_t sourceImage, sampler_t sampler,
+                 local float *tile, int halfwidth )
+{
+    int lX = get_local_id (0);
+    int lY = get_local_id (1);
+    int lWidth = get_local_size (0);
+    int lHeight = get_local_size (1);
+
+    // Tile dimensions
+    int tileWidth = lWidth + 2 * halfwidth;
+    int tileHeight = lHeight + 2 * halfwidth;
+
+    // Image coordinates of the tile's top-left pixel
+    int2 tileOrigin = (int2) ((int) get_global_id (0) - lX - halfwidth,
+                              (int) get_global_id (1) - lY - halfwidth);
+
+    // The work-items stride over the tile, so that each pixel is read once
+    for (int y = lY; y < tileHeight; y += lHeight)
+        for (int x = lX; x < tileWidth; x += lWidth)
+            tile[y * tileWidth + x] = 
+                read_imagef (sourceImage, sampler, tileOrigin + (int2) (x, y)).x;
+
+    barrier (CLK_LOCAL_MEM_FENCE);
+}
+
+
+// Converts an RGB pixel to gray-scale
+// The weights are the same with the ones of OpenCV's CV_RGB2GRAY
+float rgb2gray (uchar3 pixel)
+{
+    return dot (convert_float3 (pixel), (float3) (0.299f, 0.587f, 0.114f));
+}
+
+
+// Same as loadTile, but the source is a raw RGB frame (3 bytes per pixel) 
+// that gets converted to gray-scale on the fly. The pixel values are 
+// multiplied with scale. Out of bounds pixels are clamped to the edge
+void loadTileRGB ( global uchar *rgb, uint rows, uint cols,
+                   local float *tile, int halfwidth, float scale )
+{
+    int lX = get_local_id (0);
+    int lY = get_local_id (1);
+    int lWidth = get_local_size (0);
+    int lHeight = get_local_size (1);
+
+    // Tile dimensions
+    int tileWidth = lWidth + 2 * halfwidth;
+    int tileHeight = lHeight + 2 * halfwidth;
+
+    // Image coordinates of the tile's top-left pixel
+    int2 tileOrigin = (int2) ((int) get_global_id (0) - lX - halfwidth,
+                              (int) get_global_id (1) - lY - halfwidth);
+
+    // The work-items stride over the tile, so that each pixel is read once
+    for (int y = lY; y < tileHeight; y += lHeight)
+    {
+        int row = clamp (tileOrigin.y + y, 0, (int) rows - 1);
+
+        for (int x = lX; x < tileWidth; x += lWidth)
+        {
+            int column = clamp (tileOrigin.x + x, 0, (int) cols - 1);
+            tile[y * tileWidth + x] = scale * rgb2gray (vload3 (row * cols + column, rgb));
+        }
+    }
+
+    barrier (CLK_LOCAL_MEM_FENCE);
+}
+
+
+// Convolves the tile, loaded in local memory, with the filter, 
+// around the pixel that corresponds to the work-item
+float convolveTile ( local float *tile, constant float *filter, int filterWidth )
+{
+    int lX = get_local_id (0);
+    int lY = get_local_id (1);
+    int tileWidth = get_local_size (0) + filterWidth - 1;
+
+    float sum = 0;
+
+    // Iterator for the filter
+    int filterIdx = 0;
+
+    // Iterate over the filter rows
+    for (int i = 0; i < filterWidth; ++i)
+    {
+        local float *tileRow = tile + (lY + i) * tileWidth + lX;
+
+        // Iterate over the filter columns
+        for (int j = 0; j < filterWidth; ++j)
+            sum += tileRow[j] * filter[filterIdx++];
+    }
+
+    return sum;
+}
+
+
+// Tiled version of the convolution kernel. Each work-group loads its region
+// of the image, plus the halo required by the filter, into local memory once,
+// and then all the work-items convolve from there. The local buffer has to 
+// hold (localWidth + filterWidth - 1) * (localHeight + filterWidth - 1) floats.
+// The workspace can be larger than the image (multiple of the work-group size)
+kernel
+void convolutionTiled ( read_only image2d_t sourceImage,
+                        write_only image2d_t outputImage,
+                        uint rows, uint cols,
+                        constant float *filter,
+                        uint filterWidth,
+                        local float *tile,
+                        sampler_t sampler )
+{
+    // Store each work-item's unique row column
+    uint column = get_global_id (0);
+    uint row = get_global_id (1);
+
+    // All work-items have to take part in the loading of the tile, 
+    // even the ones that fall outside of the image
+    loadTile (sourceImage, sampler, tile, filterWidth / 2);
+
+    float sum = convolveTile (tile, filter, filterWidth);
+
+    // Copy the data to the output image,
+    // if the work-item is within bounds
+    if (row < rows && column < cols)
+    {
+        int2 coords = (int2) (column, row);
+        uint4 color = { sum, 0, 0, 0 };
+        write_imageui (outputImage, coords, color);
+    }
+}
+
+
+// Tiled version of the convolutionGL kernel
+kernel
+void convolutionTiledGL ( read_only image2d_t sourceImage,
+                          write_only image2d_t outputImage,
+                          uint rows, uint cols,
+                          constant float *filter,
+                          uint filterWidth,
+                          local float *tile,
+                          sampler_t sampler )
+{
+    // Store each work-item's unique row column
+    uint column = get_global_id (0);
+    uint row = get_global_id (1);
+
+    // All work-items have to take part in the loading of the tile, 
+    // even the ones that fall outside of the image
+    loadTileF (sourceImage, sampler, tile, filterWidth / 2);
+
+    float sum = convolveTile (tile, filter, filterWidth);
+
+    // Copy the data to the output image,
+    // if the work-item is within bounds
+    if (row < rows && column < cols)
+    {
+        int2 coords = (int2) (column, row);
+        float4 color = { sum, sum, sum, 1.f };
+        write_imagef (outputImage, coords, color);
+    }
+}
+
+
+// Same as convolutionTiled, but the source is the raw RGB frame from Kinect.
+// The gray-scale transformation is fused into the loading of the tile
+kernel
+void convolutionRGB ( global uchar *rgb,
+                      write_only image2d_t outputImage,
+                      uint rows, uint cols,
+                      constant float *filter,
+                      uint filterWidth,
+                      local float *tile )
+{
+    // Store each work-item's unique row column
+    uint column = get_global_id (0);
+    uint row = get_global_id (1);
+
+    // All work-items have to take part in the loading of the tile, 
+    // even the ones that fall outside of the image
+    loadTileRGB (rgb, rows, cols, tile, filterWidth / 2, 1.f);
+
+    float sum = convolveTile (tile, filter, filterWidth);
+
+    // Copy the data to the output image,
+    // if the work-item is within bounds
+    if (row < rows && column < cols)
+    {
+        int2 coords = (int2) (column, row);
+        uint4 color = { sum, 0, 0, 0 };
+        write_imageui (outputImage, coords, color);
+    }
+}
+
+
+// Same as convolutionTiledGL, but the source is the raw RGB frame from Kinect.
+// The gray-scale transformation, and the normalization 
+// of the values to [0,1], are fused into the loading of the tile
+kernel
+void convolutionRGBGL ( global uchar *rgb,
+                        write_only image2d_t outputImage,
+                        uint rows, uint cols,
+                        constant float *filter,
+                        uint filterWidth,
+                        local float *tile )
+{
+    // Store each work-item's unique row column
+    uint column = get_global_id (0);
+    uint row = get_global_id (1);
+
+    // All work-items have to take part in the loading of the tile, 
+    // even the ones that fall outside of the image
+    loadTileRGB (rgb, rows, cols, tile, filterWidth / 2, 1.f / 255.f);
+
+    float sum = convolveTile (tile, filter, filterWidth);
+
+    // Copy the data to the output image,
+    // if the work-item is within bounds
+    if (row < rows && column < cols)
+    {
+        int2 coords = (int2) (column, row);
+        float4 color = { sum, sum, sum, 1.f };
+        write_imagef (outputImage, coords, color);
+    }
+}
+
+
+// Number of adjacent pixels that each work-item of the vectorized 
+// convolution kernels produces (matches the vload/vstore width)
+#define VEC_WIDTH 8
+
+
+// Loads VEC_WIDTH adjacent pixels of a row of a gray-scale buffer, starting 
+// at column. Out of bounds pixels are clamped to the edge (only the vectors 
+// on the left and right borders of the image take the scalar path)
+float8 loadGray8 ( global uchar *row, int column, int cols )
+{
+    if (column >= 0 && column + VEC_WIDTH <= cols)
+        return convert_float8 (vload8 (0, row + column));
+
+    float pixels[VEC_WIDTH];
+    for (int k = 0; k < VEC_WIDTH; ++k)
+        pixels[k] = row[clamp (column + k, 0, cols - 1)];
+
+    return vload8 (0, pixels);
+}
+
+
+// Same as loadGray8, but the row is in a raw RGB frame (3 bytes per pixel), 
+// and the pixels get converted to gray-scale (same weights with rgb2gray)
+float8 loadRGB8 ( global uchar *row, int column, int cols )
+{
+    if (column >= 0 && column + VEC_WIDTH <= cols)
+    {
+        // The 24 bytes of the 8 pixels, deinterleaved into the channels
+        uchar16 a = vload16 (0, row + 3 * column);
+        uchar8 b = vload8 (0, row + 3 * column + 16);
+
+        float8 r = convert_float8 ((uchar8) (a.s0369, a.scf, b.s25));
+        float8 g = convert_float8 ((uchar8) (a.s147a, a.sd, b.s036));
+        float8 bl = convert_float8 ((uchar8) (a.s258b, a.se, b.s147));
+
+        return 0.299f * r + 0.587f * g + 0.114f * bl;
+    }
+
+    float pixels[VEC_WIDTH];
+    for (int k = 0; k < VEC_WIDTH; ++k)
+        pixels[k] = rgb2gray (vload3 (clamp (column + k, 0, cols - 1), row));
+
+    return vload8 (0, pixels);
+}
+
+
+// Stores VEC_WIDTH adjacent pixels in a row of a gray-scale buffer, 
+// starting at column. The pixels past the right border are dropped
+void storeGray8 ( float8 sum, global uchar *row, int column, int cols )
+{
+    uchar8 pixels = convert_uchar8_sat (sum);
+
+    if (column + VEC_WIDTH <= cols)
+    {
+        vstore8 (pixels, 0, row + column);
+        return;
+    }
+
+    uchar values[VEC_WIDTH];
+    vstore8 (pixels, 0, values);
+    for (int k = 0; column + k < cols; ++k)
+        row[column + k] = values[k];
+}
+
+
+// Buffer-based version of the convolution kernel, for CPU and small integrated 
+// GPU devices, where the samplers and the local memory tiles only add overhead. 
+// Each work-item produces VEC_WIDTH adjacent pixels with vector loads and stores, 
+// so the global workspace is (ceil (cols / VEC_WIDTH), rows). The taps of 
+// neighboring columns overlap, and get served from the cache
+kernel
+void convolutionVec ( global uchar *source, global uchar *output,
+                      uint rows, uint cols,
+                      constant float *filter,
+                      uint filterWidth )
+{
+    int column = get_global_id (0) * VEC_WIDTH;
+    int row = get_global_id (1);
+
+    if (row >= (int) rows || column >= (int) cols)
+        return;
+
+    int halfwidth = filterWidth / 2;
+    float8 sum = 0.f;
+
+    // Iterator for the filter
+    int filterIdx = 0;
+
+    // Iterate over the filter rows
+    for (int i = -halfwidth; i <= halfwidth; ++i)
+    {
+        global uchar *sourceRow = source + clamp (row + i, 0, (int) rows - 1) * cols;
+
+        // Iterate over the filter columns
+        for (int j = -halfwidth; j <= halfwidth; ++j)
+            sum += filter[filterIdx++] * loadGray8 (sourceRow, column + j, cols);
+    }
+
+    storeGray8 (sum, output + row * cols, column, cols);
+}
+
+
+// Same as convolutionVec, but the source is the raw RGB frame from Kinect.
+// The gray-scale transformation is fused into the loads
+kernel
+void convolutionRGBVec ( global uchar *rgb, global uchar *output,
+                         uint rows, uint cols,
+                         constant float *filter,
+                         uint filterWidth )
+{
+    int column = get_global_id (0) * VEC_WIDTH;
+    int row = get_global_id (1);
+
+    if (row >= (int) rows || column >= (int) cols)
+        return;
+
+    int halfwidth = filterWidth / 2;
+    float8 sum = 0.f;
+
+    // Iterator for the filter
+    int filterIdx = 0;
+
+    // Iterate over the filter rows
+    for (int i = -halfwidth; i <= halfwidth; ++i)
+    {
+        global uchar *sourceRow = rgb + 3 * clamp (row + i, 0, (int) rows - 1) * cols;
+
+        // Iterate over the filter columns
+        for (int j = -halfwidth; j <= halfwidth; ++j)
+            sum += filter[filterIdx++] * loadRGB8 (sourceRow, column + j, cols);
+    }
+
+    storeGray8 (sum, output + row * cols, column, cols);
+}
+
+
+// Applies a bilateral filter of the given radius around the pixel that 
+// corresponds to the work-item, on the tile loaded in local memory. The weight 
+// of each neighbor falls off with its distance (sigmaSpatial, in pixels) and 
+// with its difference in value from the center pixel (sigmaRange), 
+// so that the smoothing doesn't cross the edges
+float bilateralTile ( local float *tile, int radius, 
+                      float sigmaSpatial, float sigmaRange )
+{
+    int lX = get_local_id (0);
+    int lY = get_local_id (1);
+    int tileWidth = get_local_size (0) + 2 * radius;
+
+    float center = tile[(lY + radius) * tileWidth + lX + radius];
+    float spatial = -0.5f / (sigmaSpatial * sigmaSpatial);
+    float range = -0.5f / (sigmaRange * sigmaRange);
+
+    float sum = 0.f, norm = 0.f;
+
+    for (int i = -radius; i <= radius; ++i)
+    {
+        local float *tileRow = tile + (lY + radius + i) * tileWidth + lX + radius;
+
+        for (int j = -radius; j <= radius; ++j)
+        {
+            float value = tileRow[j];
+            float diff = value - center;
+            float weight = native_exp ((i * i + j * j) * spatial + diff * diff * range);
+
+            sum += weight * value;
+            norm += weight;
+        }
+    }
+
+    return sum / norm;
+}
+
+
+// Bilateral filter on the raw RGB frame from Kinect. The gray-scale 
+// transformation is fused into the loading of the tile. The local buffer 
+// has to hold (localWidth + 2 * radius) * (localHeight + 2 * radius) floats
+kernel
+void bilateralRGB ( global uchar *rgb,
+                    write_only image2d_t outputImage,
+                    uint rows, uint cols,
+                    local float *tile,
+                    int radius, float sigmaSpatial, float sigmaRange )
+{
+    // Store each work-item's unique row column
+    uint column = get_global_id (0);
+    uint row = get_global_id (1);
+
+    loadTileRGB (rgb, rows, cols, tile, radius, 1.f);
+
+    float sum = bilateralTile (tile, radius, sigmaSpatial, sigmaRange);
+
+    // Copy the data to the output image,
+    // if the work-item is within bounds
+    if (row < rows && column < cols)
+    {
+        int2 coords = (int2) (column, row);
+        uint4 color = { sum, 0, 0, 0 };
+        write_imageui (outputImage, coords, color);
+    }
+}
+
+
+// Same as bilateralRGB, but the values are normalized to [0,1] 
+// (sigmaRange is given in the same units)
+kernel
+void bilateralRGBGL ( global uchar *rgb,
+                      write_only image2d_t outputImage,
+                      uint rows, uint cols,
+                      local float *tile,
+                      int radius, float sigmaSpatial, float sigmaRange )
+{
+    // Store each work-item's unique row column
+    uint column = get_global_id (0);
+    uint row = get_global_id (1);
+
+    loadTileRGB (rgb, rows, cols, tile, radius, 1.f / 255.f);
+
+    float sum = bilateralTile (tile, radius, sigmaSpatial, sigmaRange);
+
+    // Copy the data to the output image,
+    // if the work-item is within bounds
+    if (row < rows && column < cols)
+    {
+        int2 coords = (int2) (column, row);
+        float4 color = { sum, sum, sum, 1.f };
+        write_imagef (outputImage, coords, color);
+    }
+}
+
+
+// Computes the box sums of radius radius around the pixel that corresponds 
+// to the work-item, for the two channels of the tile loaded in local memory. 
+// The sums are separable: the work-items first sum the rows of the tile 
+// (rowSums has to hold (localHeight + 2 * radius) * localWidth float2s), 
+// and then sum the row sums of their columns
+float2 boxSumsTile ( local float2 *tile, local float2 *rowSums, int radius )
+{
+    int lX = get_local_id (0);
+    int lY = get_local_id (1);
+    int lWidth = get_local_size (0);
+    int lHeight = get_local_size (1);
+    int tileWidth = lWidth + 2 * radius;
+    int tileHeight = lHeight + 2 * radius;
+
+    for (int y = lY; y < tileHeight; y += lHeight)
+    {
+        float2 sum = 0.f;
+        for (int j = 0; j <= 2 * radius; ++j)
+            sum += tile[y * tileWidth + lX + j];
+        rowSums[y * lWidth + lX] = sum;
+    }
+
+    barrier (CLK_LOCAL_MEM_FENCE);
+
+    float2 sum = 0.f;
+    for (int i = 0; i <= 2 * radius; ++i)
+        sum += rowSums[(lY + i) * lWidth + lX];
+
+    return sum;
+}
+
+
+// First pass of the guided filter, with the gray-scale image as its own guide 
+// (edge-preserving smoothing). It computes the linear coefficients (a, b) of 
+// each window from the mean and the variance of the pixel values, with the 
+// box sums of the values and of their squares. The pixel values are multiplied 
+// with scale (eps is given in the same units). The local buffers have to hold 
+// (localWidth + 2 * radius) * (localHeight + 2 * radius) float2s (tile), and 
+// (localHeight + 2 * radius) * localWidth float2s (rowSums)
+kernel
+void guidedCoeffsRGB ( global uchar *rgb, global float2 *coeffs,
+                       uint rows, uint cols,
+                       local float2 *tile, local float2 *rowSums,
+                       int radius, float eps, float scale )
+{
+    // Store each work-item's unique row column
+    uint column = get_global_id (0);
+    uint row = get_global_id (1);
+
+    int lX = get_local_id (0);
+    int lY = get_local_id (1);
+    int lWidth = get_local_size (0);
+    int lHeight = get_local_size (1);
+    int tileWidth = lWidth + 2 * radius;
+    int tileHeight = lHeight + 2 * radius;
+
+    // Load the tile with the pixel values and their squares
+    int2 tileOrigin = (int2) ((int) get_global_id (0) - lX - radius,
+                              (int) get_global_id (1) - lY - radius);
+
+    for (int y = lY; y < tileHeight; y += lHeight)
+    {
+        int r = clamp (tileOrigin.y + y, 0, (int) rows - 1);
+
+        for (int x = lX; x < tileWidth; x += lWidth)
+        {
+            int c = clamp (tileOrigin.x + x, 0, (int) cols - 1);
+            float value = scale * rgb2gray (vload3 (r * cols + c, rgb));
+            tile[y * tileWidth + x] = (float2) (value, value * value);
+        }
+    }
+
+    barrier (CLK_LOCAL_MEM_FENCE);
+
+    float n = (2 * radius + 1) * (2 * radius + 1);
+    float2 means = boxSumsTile (tile, rowSums, radius) / n;
+    float variance = means.y - means.x * means.x;
+
+    float a = variance / (variance + eps);
+    float b = means.x - a * means.x;
+
+    if (row < rows && column < cols)
+        coeffs[row * cols + column] = (float2) (a, b);
+}
+
+
+// Second pass of the guided filter. It averages the coefficients of all the 
+// windows that cover the pixel, and applies them to its value (q = a * I + b). 
+// The local buffers are the same as in guidedCoeffsRGB. Returns q
+float guidedTile ( global uchar *rgb, global float2 *coeffs,
+                   uint rows, uint cols,
+                   local float2 *tile, local float2 *rowSums,
+                   int radius, float scale )
+{
+    uint column = get_global_id (0);
+    uint row = get_global_id (1);
+
+    int lX = get_local_id (0);
+    int lY = get_local_id (1);
+    int lWidth = get_local_size (0);
+    int lHeight = get_local_size (1);
+    int tileWidth = lWidth + 2 * radius;
+    int tileHeight = lHeight + 2 * radius;
+
+    // Load the tile with the coefficients
+    int2 tileOrigin = (int2) ((int) get_global_id (0) - lX - radius,
+                              (int) get_global_id (1) - lY - radius);
+
+    for (int y = lY; y < tileHeight; y += lHeight)
+    {
+        int r = clamp (tileOrigin.y + y, 0, (int) rows - 1);
+
+        for (int x = lX; x < tileWidth; x += lWidth)
+        {
+            int c = clamp (tileOrigin.x + x, 0, (int) cols - 1);
+            tile[y * tileWidth + x] = coeffs[r * cols + c];
+        }
+    }
+
+    barrier (CLK_LOCAL_MEM_FENCE);
+
+    float n = (2 * radius + 1) * (2 * radius + 1);
+    float2 means = boxSumsTile (tile, rowSums, radius) / n;
+
+    uint idx = min (row, rows - 1) * cols + min (column, cols - 1);
+    float value = scale * rgb2gray (vload3 (idx, rgb));
+
+    return means.x * value + means.y;
+}
+
+
+// Second pass of the guided filter on the raw RGB frame from Kinect
+kernel
+void guidedRGB ( global uchar *rgb, global float2 *coeffs,
+                 write_only image2d_t outputImage,
+                 uint rows, uint cols,
+                 local float2 *tile, local float2 *rowSums,
+                 int radius )
+{
+    // Store each work-item's unique row column
+    uint column = get_global_id (0);
+    uint row = get_global_id (1);
+
+    float sum = guidedTile (rgb, coeffs, rows, cols, tile, rowSums, radius, 1.f);
+
+    // Copy the data to the output image,
+    // if the work-item is within bounds
+    if (row < rows && column < cols)
+    {
+        int2 coords = (int2) (column, row);
+        uint4 color = { clamp (sum, 0.f, 255.f), 0, 0, 0 };
+        write_imageui (outputImage, coords, color);
+    }
+}
+
+
+// Same as guidedRGB, but the values are normalized to [0,1] 
+// (the coefficients have to be computed with a scale of 1/255)
+kernel
+void guidedRGBGL ( global uchar *rgb, global float2 *coeffs,
+                   write_only image2d_t outputImage,
+                   uint rows, uint cols,
+                   local float2 *tile, local float2 *rowSums,
+                   int radius )
+{
+    // Store each work-item's unique row column
+    uint column = get_global_id (0);
+    uint row = get_global_id (1);
+
+    float sum = guidedTile (rgb, coeffs, rows, cols, tile, rowSums, radius, 1.f / 255.f);
+
+    // Copy the data to the output image,
+    // if the work-item is within bounds
+    if (row < rows && column < cols)
+    {
+        int2 coords = (int2) (column, row);
+        float4 color = { sum, sum, sum, 1.f };
+        write_imagef (outputImage, coords, color);
+    }
+}
+
+
 kernel
 void normalizeImg ( read_only image2d_t sourceImage,
                     write_only image2d_t outputImage,
@@ -127,20 +795,90 @@ void normalizeImg ( read_only image2d_t sourceImage,
 
     uint4 pixel = read_imageui (sourceImage, sampler, coords);
 
-    // Copy the data to the output image,
-    // if the work-item is within bounds
+    // Copy the data to the output image,
+    // if the work-item is within bounds
+    if (row < rows && column < cols)
+    {
+        float4 pixelf = convert_float4 (pixel) / 255.f;
+        pixelf.w = 1.f;
+        write_imagef (outputImage, coords, pixelf);
+    }
+}
+
+
+// Elementwise steps of the color transformation. The kernels below
+// compose them, so a chain of steps takes a single pass over the frame
+
+// Expands an RGB pixel to RGBA, with normalized values [0,1]
+float4 pixelToRGBA (uchar3 pixel)
+{
+    return (float4) (convert_float3 (pixel) / 255.f, 1.f);
+}
+
+
+// Divides the channels of an RGBA pixel by their sum
+float4 pixelNormalizeRGB (float4 pixel)
+{
+    float sum = pixel.x + pixel.y + pixel.z;
+
+    pixel /= sum;
+    pixel.w = 1.f;
+
+    return pixel;
+}
+
+
+kernel
+void rgb2rgba ( global uchar *rgb, global float4 *rgba,
+                uint rows, uint cols )
+{
+    // Store each work-item's unique row column
+    uint column = get_global_id (0);
+    uint row = get_global_id (1);
+
+    // Flatten indices
+    uint idx = row * cols + column;
+
+    // Read pixel in
+    uchar3 pixel = vload3 (idx, rgb);
+
+    // Copy the data to the output image,
+    // if the work-item is within bounds
+    if (row < rows && column < cols)
+    {
+        rgba[idx] = pixelToRGBA (pixel);
+    }
+}
+
+
+// Halves the dimensions of a raw RGB frame, by averaging 2x2 blocks of pixels 
+// (a level of an image pyramid). rows and cols are the dimensions of the output, 
+// so the source is 2 * rows x 2 * cols
+kernel
+void downsampleRGB ( global uchar *rgb, global uchar *out,
+                     uint rows, uint cols )
+{
+    // Store each work-item's unique row column
+    uint column = get_global_id (0);
+    uint row = get_global_id (1);
+
     if (row < rows && column < cols)
     {
-        float4 pixelf = convert_float4 (pixel) / 255.f;
-        pixelf.w = 1.f;
-        write_imagef (outputImage, coords, pixelf);
+        uint idx = 2 * row * 2 * cols + 2 * column;
+
+        uint3 sum = convert_uint3 (vload3 (idx, rgb)) + 
+                    convert_uint3 (vload3 (idx + 1, rgb)) + 
+                    convert_uint3 (vload3 (idx + 2 * cols, rgb)) + 
+                    convert_uint3 (vload3 (idx + 2 * cols + 1, rgb));
+
+        vstore3 (convert_uchar3 ((sum + 2) / 4), row * cols + column, out);
     }
 }
 
 
 kernel
-void rgb2rgba ( global uchar *rgb, global float4 *rgba,
-                uint rows, uint cols )
+void normalizeRGB ( global float4 *in, global float4 *out,
+                    uint rows, uint cols )
 {
     // Store each work-item's unique row column
     uint column = get_global_id (0);
@@ -149,20 +887,21 @@ void rgb2rgba ( global uchar *rgb, global float4 *rgba,
     // Flatten indices
     uint idx = row * cols + column;
 
-    // Read pixel in
-    uchar3 pixel = vload3 (idx, rgb);
-
     // Copy the data to the output image,
     // if the work-item is within bounds
     if (row < rows && column < cols)
     {
-        rgba[idx] = (float4) (convert_float3 (pixel) / 255.f, 1.f);
+        // Normalize and store
+        out[idx] = pixelNormalizeRGB (in[idx]);
     }
 }
 
 
+// Fused rgb2rgba and normalizeRGB. Goes from the raw RGB frame 
+// to the normalized RGBA one in one pass, without the intermediate
+// RGBA buffer (16 bytes per pixel written and read back)
 kernel
-void normalizeRGB ( global float4 *in, global float4 *out,
+void rgb2rgbaNorm ( global uchar *rgb, global float4 *rgba,
                     uint rows, uint cols )
 {
     // Store each work-item's unique row column
@@ -172,18 +911,12 @@ void normalizeRGB ( global float4 *in, global float4 *out,
     // Flatten indices
     uint idx = row * cols + column;
 
-    // Calculate normalizing factor
-    float4 pixel = in[idx];
-    float sum = pixel.x + pixel.y + pixel.z;
-    
     // Copy the data to the output image,
     // if the work-item is within bounds
     if (row < rows && column < cols)
     {
-        // Normalize and store
-        pixel /= sum;
-        pixel.w = 1.f;
-        out[idx] = pixel;
+        uchar3 pixel = vload3 (idx, rgb);
+        rgba[idx] = pixelNormalizeRGB (pixelToRGBA (pixel));
     }
 }
 
@@ -209,3 +942,461 @@ void depthTo3D (global ushort *depth, global float4 *pCloud, float f)
 
     pCloud[idx] = point;
 }
+
+
+// Computes the ray (X/Z, Y/Z) through each pixel, given the camera intrinsics 
+// (fx, fy, cx, cy) and the distortion coefficients (k1, k2, p1, p2, k3). 
+// The table is computed once, so that depthTo3D reduces to a multiplication. 
+// The distortion is removed iteratively, the way OpenCV's undistortPoints does it
+kernel
+void computeRays ( global float2 *rays, float4 intrinsics, 
+                   float4 distortion, float k3 )
+{
+    // Workspace dimensions
+    uint cols = get_global_size (0);
+
+    // Workspace indices
+    uint gX = get_global_id (0);
+    uint gY = get_global_id (1);
+
+    // Distorted normalized coordinates
+    float2 pd = (float2) ((gX - intrinsics.z) / intrinsics.x, 
+                          (gY - intrinsics.w) / intrinsics.y);
+
+    float k1 = distortion.x, k2 = distortion.y;
+    float p1 = distortion.z, p2 = distortion.w;
+
+    float2 p = pd;
+    for (int i = 0; i < 5; ++i)
+    {
+        float r2 = dot (p, p);
+        float radial = 1.f + r2 * (k1 + r2 * (k2 + r2 * k3));
+        float2 tangential = (float2) (2.f * p1 * p.x * p.y + p2 * (r2 + 2.f * p.x * p.x), 
+                                      p1 * (r2 + 2.f * p.y * p.y) + 2.f * p2 * p.x * p.y);
+        p = (pd - tangential) / radial;
+    }
+
+    rays[gY * cols + gX] = p;
+}
+
+
+// Maximum number of depth frames in the history of temporalMedian
+#define TEMPORAL_MAX_FRAMES 8
+
+
+// Filters the depth temporally, over a history of frames that stays on the device 
+// (the ring buffer holds the frames one after the other). Each pixel gets the median 
+// of its valid (non-zero) samples over the history, so flicker is suppressed, and 
+// holes in the latest frame get filled from the previous ones
+kernel
+void temporalMedian ( global ushort *ring, uint frames, global ushort *depth )
+{
+    // Flatten indices
+    uint pixels = get_global_size (0) * get_global_size (1);
+    uint idx = get_global_id (1) * get_global_size (0) + get_global_id (0);
+
+    // Collect the valid samples, in sorted order (insertion sort)
+    ushort samples[TEMPORAL_MAX_FRAMES];
+    uint n = 0;
+    for (uint i = 0; i < min (frames, (uint) TEMPORAL_MAX_FRAMES); ++i)
+    {
+        ushort d = ring[i * pixels + idx];
+        if (d == 0)
+            continue;
+
+        uint j = n++;
+        for (; j > 0 && samples[j - 1] > d; --j)
+            samples[j] = samples[j - 1];
+        samples[j] = d;
+    }
+
+    depth[idx] = n ? samples[n / 2] : 0;
+}
+
+
+// Same as depthTo3D, but the rays through the pixels come from 
+// a precomputed table (see computeRays), instead of a single focal length
+kernel
+void depthTo3DRays (global ushort *depth, global float2 *rays, global float4 *pCloud)
+{
+    // Flatten indices
+    uint idx = get_global_id (1) * get_global_size (0) + get_global_id (0);
+
+    float d = convert_float (depth[idx]);
+    pCloud[idx] = (float4) (rays[idx] * d, d, 1.f);  // (X, Y, Z) = (X/Z, Y/Z, 1) * d
+}
+
+
+// Stores a vertex in the packed point-cloud format. A vertex holds the position 
+// in 16-bit fixed point (in mm) and the RGBA8 color of the point, 12 bytes in total
+void storeVertex (float4 point, float3 color, global short *vertices, uint vIdx)
+{
+    // Position: short4 at the start of the vertex
+    vstore4 (convert_short4_sat_rte (point), 0, vertices + 6 * vIdx);
+
+    // Color: uchar4 after the position
+    uchar4 rgba = convert_uchar4_sat_rte ((float4) (color, 255.f));
+    vstore4 (rgba, 0, (global uchar *) (vertices + 6 * vIdx + 4));
+}
+
+
+// Reads the color of a pixel (in [0,255]), and optionally normalizes it
+float3 loadColor (global uchar *rgb, uint idx, uint rgbNorm)
+{
+    float3 pixel = convert_float3 (vload3 (idx, rgb));
+    if (rgbNorm)
+        pixel *= 255.f / fmax (pixel.x + pixel.y + pixel.z, 1.f);
+
+    return pixel;
+}
+
+
+// Computes the vertex of a pixel in the packed point-cloud format, 
+// and stores it at the given vertex index
+void packVertex (float d, global uchar *rgb, global float2 *rays, 
+                 uint idx, uint rgbNorm, global short *vertices, uint vIdx)
+{
+    float4 point = (float4) (rays[idx] * d, d, 1.f);
+    storeVertex (point, loadColor (rgb, idx, rgbNorm), vertices, vIdx);
+}
+
+
+// Same as depthTo3DRays, but it writes the point cloud in a packed, interleaved 
+// vertex format (12 bytes per point, instead of 32 bytes for the separate 
+// float4 position and color buffers). The transformation of the color 
+// to RGBA (and the optional RGB normalization) is fused in
+kernel
+void depthTo3DPacked ( global ushort *depth, global uchar *rgb,
+                       global short *vertices, global float2 *rays, uint rgbNorm )
+{
+    // Flatten indices
+    uint idx = get_global_id (1) * get_global_size (0) + get_global_id (0);
+
+    float d = convert_float (depth[idx]);
+    packVertex (d, rgb, rays, idx, rgbNorm, vertices, idx);
+}
+
+
+// Same as depthTo3DPacked, but only the points with a valid (non-zero) depth 
+// are written, densely packed at the front of the vertex buffer. The order 
+// of the points is not preserved. Each work-group counts its valid points 
+// in local memory, and reserves space for them with a single atomic on 
+// the global counter (the vertex count of a glDrawArraysIndirect command)
+kernel
+void depthTo3DPackedCompact ( global ushort *depth, global uchar *rgb,
+                              global short *vertices, global float2 *rays, uint rgbNorm, 
+                              global uint *count )
+{
+    local uint groupCount, groupOffset;
+
+    // Flatten indices
+    uint idx = get_global_id (1) * get_global_size (0) + get_global_id (0);
+    uint lIdx = get_local_id (1) * get_local_size (0) + get_local_id (0);
+
+    if (lIdx == 0)
+        groupCount = 0;
+    barrier (CLK_LOCAL_MEM_FENCE);
+
+    // Reserve a slot within the work-group
+    float d = convert_float (depth[idx]);
+    uint slot = 0;
+    if (d > 0.f)
+        slot = atomic_inc (&groupCount);
+    barrier (CLK_LOCAL_MEM_FENCE);
+
+    // Reserve the work-group's range in the vertex buffer
+    if (lIdx == 0)
+        groupOffset = atomic_add (count, groupCount);
+    barrier (CLK_LOCAL_MEM_FENCE);
+
+    if (d > 0.f)
+        packVertex (d, rgb, rays, idx, rgbNorm, vertices, groupOffset + slot);
+}
+
+
+// The voxel grid is a hash table with open addressing. Each slot holds the key 
+// of a voxel, and 8 accumulators (X, Y, Z, R, G, B, count, unused). The grid 
+// covers 2048 x 1024 x 2047 cells, centered on the optical axis in X and Y
+#define VOXEL_EMPTY 0xFFFFFFFF
+#define VOXEL_PROBES 32
+
+
+// Accumulates the points of a frame into the voxel grid. The point of each 
+// pixel is computed like in depthTo3DRays, and its position (in mm) and color 
+// get added to the voxel it falls in. Slots get claimed with compare-and-swap, 
+// and points that find no slot within VOXEL_PROBES probes are dropped
+kernel
+void voxelAccumulate ( global ushort *depth, global uchar *rgb, 
+                       global float2 *rays, uint rgbNorm, float cellSize, 
+                       global uint *keys, global int *voxels, uint tableMask )
+{
+    // Flatten indices
+    uint idx = get_global_id (1) * get_global_size (0) + get_global_id (0);
+
+    float d = convert_float (depth[idx]);
+    if (d <= 0.f)
+        return;
+
+    float4 point = (float4) (rays[idx] * d, d, 1.f);
+
+    // Voxel coordinates (points outside of the grid are dropped)
+    int3 cell = convert_int3_rtn (point.xyz / cellSize) + (int3) (1024, 512, 0);
+    if (any (cell < 0) || cell.x > 2047 || cell.y > 1023 || cell.z > 2046)
+        return;
+
+    uint key = ((uint) cell.x << 21) | ((uint) cell.y << 11) | (uint) cell.z;
+    uint slot = (key * 2654435761u) & tableMask;
+
+    int3 position = convert_int3_rte (point.xyz);
+    int3 color = convert_int3_rte (loadColor (rgb, idx, rgbNorm));
+
+    for (int i = 0; i < VOXEL_PROBES; ++i)
+    {
+        uint prev = atomic_cmpxchg (keys + slot, VOXEL_EMPTY, key);
+        if (prev == VOXEL_EMPTY || prev == key)
+        {
+            global int *voxel = voxels + 8 * slot;
+            atomic_add (voxel + 0, position.x);
+            atomic_add (voxel + 1, position.y);
+            atomic_add (voxel + 2, position.z);
+            atomic_add (voxel + 3, color.x);
+            atomic_add (voxel + 4, color.y);
+            atomic_add (voxel + 5, color.z);
+            atomic_inc (voxel + 6);
+            return;
+        }
+
+        slot = (slot + 1) & tableMask;
+    }
+}
+
+
+// Writes one packed vertex, with the averaged position and color, per occupied 
+// voxel (appended through the count of a glDrawArraysIndirect command), and 
+// clears the slot for the next frame. The global workspace is the table size
+kernel
+void voxelResolve ( global uint *keys, global int *voxels, 
+                    global short *vertices, global uint *count )
+{
+    uint slot = get_global_id (0);
+    if (keys[slot] == VOXEL_EMPTY)
+        return;
+
+    global int *voxel = voxels + 8 * slot;
+    int8 sums = vload8 (0, voxel);
+    float n = convert_float (sums.s6);
+
+    float4 point = (float4) (convert_float3 (sums.s012) / n, 1.f);
+    float3 color = convert_float3 (sums.s345) / n;
+    storeVertex (point, color, vertices, atomic_inc (count));
+
+    keys[slot] = VOXEL_EMPTY;
+    vstore8 ((int8) (0), 0, voxel);
+}
+
+
+#ifdef SEPARABLE_WIDTH
+
+// The separable kernels are compiled in a separate program, with the width
+// and the coefficients of the filters given as build options, e.g.
+// -D SEPARABLE_WIDTH=5 -D SEPARABLE_ROW=... -D SEPARABLE_COLUMN=...
+// The loops get fully unrolled, and the coefficients become immediates
+constant float rowFilter[SEPARABLE_WIDTH] = { SEPARABLE_ROW };
+constant float columnFilter[SEPARABLE_WIDTH] = { SEPARABLE_COLUMN };
+
+
+// Applies the row filter of a separable filter
+kernel
+void separableRow ( read_only image2d_t sourceImage,
+                    write_only image2d_t outputImage,
+                    uint rows, uint cols,
+                    sampler_t sampler )
+{
+    // Store each work-item's unique row column
+    uint column = get_global_id (0);
+    uint row = get_global_id (1);
+
+    float sum = 0;
+
+    // Iterate over the filter columns
+    #pragma unroll
+    for (int j = 0; j < SEPARABLE_WIDTH; ++j)
+    {
+        int2 coords = (int2) (column + j - SEPARABLE_WIDTH / 2, row);
+        sum += read_imageui (sourceImage, sampler, coords).x * rowFilter[j];
+    }
+
+    // Copy the data to the output image,
+    // if the work-item is within bounds
+    if (row < rows && column < cols)
+    {
+        int2 coords = (int2) (column, row);
+        uint4 color = { sum, 0, 0, 0 };
+        write_imageui (outputImage, coords, color);
+    }
+}
+
+
+// Same as separableRow, but the source is the raw RGB frame from Kinect,
+// which gets converted to gray-scale on the fly
+kernel
+void separableRowRGB ( global uchar *rgb,
+                       write_only image2d_t outputImage,
+                       uint rows, uint cols )
+{
+    // Store each work-item's unique row column
+    uint column = get_global_id (0);
+    uint row = get_global_id (1);
+
+    float sum = 0;
+    int r = min (row, rows - 1);
+
+    // Iterate over the filter columns
+    #pragma unroll
+    for (int j = 0; j < SEPARABLE_WIDTH; ++j)
+    {
+        int c = clamp ((int) column + j - SEPARABLE_WIDTH / 2, 0, (int) cols - 1);
+        sum += rgb2gray (vload3 (r * cols + c, rgb)) * rowFilter[j];
+    }
+
+    // Copy the data to the output image,
+    // if the work-item is within bounds
+    if (row < rows && column < cols)
+    {
+        int2 coords = (int2) (column, row);
+        uint4 color = { sum, 0, 0, 0 };
+        write_imageui (outputImage, coords, color);
+    }
+}
+
+
+// Applies the column filter of a separable filter
+kernel
+void separableColumn ( read_only image2d_t sourceImage,
+                       write_only image2d_t outputImage,
+                       uint rows, uint cols,
+                       sampler_t sampler )
+{
+    // Store each work-item's unique row column
+    uint column = get_global_id (0);
+    uint row = get_global_id (1);
+
+    float sum = 0;
+
+    // Iterate over the filter rows
+    #pragma unroll
+    for (int i = 0; i < SEPARABLE_WIDTH; ++i)
+    {
+        int2 coords = (int2) (column, row + i - SEPARABLE_WIDTH / 2);
+        sum += read_imageui (sourceImage, sampler, coords).x * columnFilter[i];
+    }
+
+    // Copy the data to the output image,
+    // if the work-item is within bounds
+    if (row < rows && column < cols)
+    {
+        int2 coords = (int2) (column, row);
+        uint4 color = { sum, 0, 0, 0 };
+        write_imageui (outputImage, coords, color);
+    }
+}
+
+
+// Same as separableRow, but for images with float channel types
+kernel
+void separableRowGL ( read_only image2d_t sourceImage,
+                      write_only image2d_t outputImage,
+                      uint rows, uint cols,
+                      sampler_t sampler )
+{
+    // Store each work-item's unique row column
+    uint column = get_global_id (0);
+    uint row = get_global_id (1);
+
+    float sum = 0;
+
+    // Iterate over the filter columns
+    #pragma unroll
+    for (int j = 0; j < SEPARABLE_WIDTH; ++j)
+    {
+        int2 coords = (int2) (column + j - SEPARABLE_WIDTH / 2, row);
+        sum += read_imagef (sourceImage, sampler, coords).x * rowFilter[j];
+    }
+
+    // Copy the data to the output image,
+    // if the work-item is within bounds
+    if (row < rows && column < cols)
+    {
+        int2 coords = (int2) (column, row);
+        float4 color = { sum, sum, sum, 1.f };
+        write_imagef (outputImage, coords, color);
+    }
+}
+
+
+// Same as separableRowGL, but the source is the raw RGB frame from Kinect,
+// which gets converted to gray-scale, and normalized to [0,1], on the fly
+kernel
+void separableRowRGBGL ( global uchar *rgb,
+                         write_only image2d_t outputImage,
+                         uint rows, uint cols )
+{
+    // Store each work-item's unique row column
+    uint column = get_global_id (0);
+    uint row = get_global_id (1);
+
+    float sum = 0;
+    int r = min (row, rows - 1);
+
+    // Iterate over the filter columns
+    #pragma unroll
+    for (int j = 0; j < SEPARABLE_WIDTH; ++j)
+    {
+        int c = clamp ((int) column + j - SEPARABLE_WIDTH / 2, 0, (int) cols - 1);
+        sum += rgb2gray (vload3 (r * cols + c, rgb)) * rowFilter[j];
+    }
+    sum /= 255.f;
+
+    // Copy the data to the output image,
+    // if the work-item is within bounds
+    if (row < rows && column < cols)
+    {
+        int2 coords = (int2) (column, row);
+        float4 color = { sum, sum, sum, 1.f };
+        write_imagef (outputImage, coords, color);
+    }
+}
+
+
+// Same as separableColumn, but for images with float channel types
+kernel
+void separableColumnGL ( read_only image2d_t sourceImage,
+                         write_only image2d_t outputImage,
+                         uint rows, uint cols,
+                         sampler_t sampler )
+{
+    // Store each work-item's unique row column
+    uint column = get_global_id (0);
+    uint row = get_global_id (1);
+
+    float sum = 0;
+
+    // Iterate over the filter rows
+    #pragma unroll
+    for (int i = 0; i < SEPARABLE_WIDTH; ++i)
+    {
+        int2 coords = (int2) (column, row + i - SEPARABLE_WIDTH / 2);
+        sum += read_imagef (sourceImage, sampler, coords).x * columnFilter[i];
+    }
+
+    // Copy the data to the output image,
+    // if the work-item is within bounds
+    if (row < rows && column < cols)
+    {
+        int2 coords = (int2) (column, row);
+        float4 color = { sum, sum, sum, 1.f };
+        write_imagef (outputImage, coords, color);
+    }
+}
+
+#endif  // SEPARABLE_WIDTH
@@ -0,0 +1,75 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: coefficients.cpp
+ * File description: Implementation of the filter coefficient generation.
+ */
+
+#include <cmath>
+#include <kinectFilter/coefficients.hpp>
+
+
+const float boxFilter3x3[9] = { 0.125f, 0.125f, 0.125f,
+                                0.125f, 0.125f, 0.125f,
+                                0.125f, 0.125f, 0.125f };
+
+const float laplacianFilter3x3[9] = { 1.f,  1.f, 1.f,
+                                      1.f, -8.f, 1.f,
+                                      1.f,  1.f, 1.f };
+
+
+std::vector<float> gaussianFilter (float sigma, int width)
+{
+    std::vector<float> filter (width);
+    float sum = 0.f;
+    for (int i = 0; i < width; ++i)
+    {
+        const float x = i - width / 2;
+        filter[i] = std::exp (-x * x / (2.f * sigma * sigma));
+        sum += filter[i];
+    }
+
+    for (float &f : filter)
+        f /= sum;
+
+    return filter;
+}
+
+
+std::vector<float> combineFilters (const float *a, int widthA, const float *b, int widthB)
+{
+    const int width = widthA + widthB - 1;
+    std::vector<float> c (width * width, 0.f);
+
+    for (int ay = 0; ay < widthA; ++ay)
+        for (int ax = 0; ax < widthA; ++ax)
+            for (int by = 0; by < widthB; ++by)
+                for (int bx = 0; bx < widthB; ++bx)
+                    c[(ay + by) * width + ax + bx] += 
+                        a[ay * widthA + ax] * b[by * widthB + bx];
+
+    return c;
+}
+
+
+std::vector<float> logFilter (float sigma, int width)
+{
+    const std::vector<float> gaussian = gaussianFilter (sigma, width);
+
+    std::vector<float> gaussian2D (width * width);
+    for (int y = 0; y < width; ++y)
+        for (int x = 0; x < width; ++x)
+            gaussian2D[y * width + x] = gaussian[y] * gaussian[x];
+
+    return combineFilters (gaussian2D.data (), width, laplacianFilter3x3, 3);
+}
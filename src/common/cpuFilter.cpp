@@ -0,0 +1,573 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: cpuFilter.cpp
+ * File description: Implementation of the CpuFilter class.
+ */
+
+#include <algorithm>
+#include <kinectFilter/cpuFilter.hpp>
+
+// The vectorized code paths get compiled for their instruction set with 
+// function attributes, so that the rest of the code keeps the baseline flags, 
+// and the one to run gets picked at runtime
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KINECTFILTER_X86
+#include <immintrin.h>
+#define SSE2_TARGET __attribute__ ((target ("sse2")))
+#define AVX2_TARGET __attribute__ ((target ("avx2,fma")))
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define KINECTFILTER_NEON
+#include <arm_neon.h>
+#endif
+
+
+namespace
+{
+
+// The gray-scale weights of rgb2gray
+const float weightR = 0.299f, weightG = 0.587f, weightB = 0.114f;
+
+// Stripes get at least as many rows, so that small frames stay on fewer threads
+const int minStripeRows = 16;
+
+// The floats past the padded end of a window row, that the 
+// vector loads of the last (partial) block of a row may read
+const int rowSlack = 16;
+
+typedef void (*RowLoader) (const uint8_t *row, float *out, int cols);
+typedef void (*RowConvolver) (const float *const *rows, const float *filter, int filterWidth, 
+                              uint8_t *out, int cols);
+
+// Truncates and saturates, like convert_uchar_sat
+inline uint8_t saturate (float value)
+{
+    return value <= 0.f ? 0 : value >= 255.f ? 255 : (uint8_t) value;
+}
+
+void grayRow (const uint8_t *row, float *out, int cols)
+{
+    for (int x = 0; x < cols; ++x)
+        out[x] = row[x];
+}
+
+void rgbRowScalar (const uint8_t *row, float *out, int cols)
+{
+    for (int x = 0; x < cols; ++x)
+        out[x] = weightR * row[3 * x] + weightG * row[3 * x + 1] + weightB * row[3 * x + 2];
+}
+
+// rows[i] points to column -filterWidth / 2 of row i of the window
+void convolveRowScalar (const float *const *rows, const float *filter, int filterWidth, 
+                        uint8_t *out, int cols)
+{
+    for (int x = 0; x < cols; ++x)
+    {
+        float sum = 0.f;
+        const float *f = filter;
+        for (int i = 0; i < filterWidth; ++i)
+            for (int j = 0; j < filterWidth; ++j)
+                sum += *f++ * rows[i][x + j];
+
+        out[x] = saturate (sum);
+    }
+}
+
+void normalizeRowScalar (const uint8_t *row, float *out, int cols)
+{
+    for (int x = 0; x < cols; ++x, row += 3, out += 4)
+    {
+        const float r = row[0], g = row[1], b = row[2];
+        const float sum = r + g + b;
+        out[0] = r / sum;
+        out[1] = g / sum;
+        out[2] = b / sum;
+        out[3] = 1.f;
+    }
+}
+
+// xs holds (x - cx) / f for each column
+void depthRowScalar (const uint16_t *row, const float *rays, float *out, int cols)
+{
+    for (int x = 0; x < cols; ++x, out += 4)
+    {
+        const float d = row[x];
+        out[0] = rays[2 * x] * d;
+        out[1] = rays[2 * x + 1] * d;
+        out[2] = d;
+        out[3] = 1.f;
+    }
+}
+
+#ifdef KINECTFILTER_X86
+
+// There is no cheap deinterleaving of the channels in SSE2, so the 
+// gray-scale transformation stays scalar on this path
+
+// 8 pixels per iteration, in two accumulators, 
+// so that each broadcast filter tap gets used twice
+SSE2_TARGET
+void convolveRowSSE2 (const float *const *rows, const float *filter, int filterWidth, 
+                      uint8_t *out, int cols)
+{
+    for (int x = 0; x < cols; x += 8)
+    {
+        __m128 sum0 = _mm_setzero_ps (), sum1 = _mm_setzero_ps ();
+        const float *f = filter;
+        for (int i = 0; i < filterWidth; ++i)
+        {
+            const float *row = rows[i] + x;
+            for (int j = 0; j < filterWidth; ++j)
+            {
+                const __m128 tap = _mm_set1_ps (*f++);
+                sum0 = _mm_add_ps (sum0, _mm_mul_ps (tap, _mm_loadu_ps (row + j)));
+                sum1 = _mm_add_ps (sum1, _mm_mul_ps (tap, _mm_loadu_ps (row + j + 4)));
+            }
+        }
+
+        const __m128i words = _mm_packs_epi32 (_mm_cvttps_epi32 (sum0), _mm_cvttps_epi32 (sum1));
+        const __m128i pixels = _mm_packus_epi16 (words, words);
+        if (x + 8 <= cols)
+            _mm_storel_epi64 (reinterpret_cast<__m128i *> (out + x), pixels);
+        else
+        {
+            uint8_t values[16];
+            _mm_storeu_si128 (reinterpret_cast<__m128i *> (values), pixels);
+            std::copy (values, values + cols - x, out + x);
+        }
+    }
+}
+
+// A float4 per pixel is a vector, so the pixels go one at a time 
+// (this is also the path of the AVX2 level)
+SSE2_TARGET
+void normalizeRowSSE2 (const uint8_t *row, float *out, int cols)
+{
+    const __m128 xyz = _mm_castsi128_ps (_mm_setr_epi32 (-1, -1, -1, 0));
+    const __m128 w = _mm_setr_ps (0.f, 0.f, 0.f, 1.f);
+
+    for (int x = 0; x < cols; ++x, row += 3, out += 4)
+    {
+        const __m128 pixel = _mm_cvtepi32_ps (_mm_setr_epi32 (row[0], row[1], row[2], 0));
+        const __m128 sum = _mm_set1_ps ((float) (row[0] + row[1] + row[2]));
+        _mm_storeu_ps (out, _mm_or_ps (_mm_and_ps (_mm_div_ps (pixel, sum), xyz), w));
+    }
+}
+
+SSE2_TARGET
+void depthRowSSE2 (const uint16_t *row, const float *rays, float *out, int cols)
+{
+    const __m128 w = _mm_setr_ps (0.f, 0.f, 0.f, 1.f);
+
+    for (int x = 0; x < cols; ++x, out += 4)
+    {
+        const __m128 ray = _mm_setr_ps (rays[2 * x], rays[2 * x + 1], 1.f, 0.f);
+        _mm_storeu_ps (out, _mm_add_ps (_mm_mul_ps (_mm_set1_ps (row[x]), ray), w));
+    }
+}
+
+// 8 pixels per iteration, each gathered as the 4 bytes at its offset. The last 
+// pixel of a block is never the last of the row, so no read goes past the frame
+AVX2_TARGET
+void rgbRowAVX2 (const uint8_t *row, float *out, int cols)
+{
+    const __m256i offsets = _mm256_setr_epi32 (0, 3, 6, 9, 12, 15, 18, 21);
+    const __m256i mask = _mm256_set1_epi32 (0xFF);
+    const __m256 wr = _mm256_set1_ps (weightR), wg = _mm256_set1_ps (weightG), wb = _mm256_set1_ps (weightB);
+
+    int x = 0;
+    for (; x + 8 < cols; x += 8)
+    {
+        const __m256i pixels = _mm256_i32gather_epi32 (reinterpret_cast<const int *> (row + 3 * x), offsets, 1);
+        const __m256 r = _mm256_cvtepi32_ps (_mm256_and_si256 (pixels, mask));
+        const __m256 g = _mm256_cvtepi32_ps (_mm256_and_si256 (_mm256_srli_epi32 (pixels, 8), mask));
+        const __m256 b = _mm256_cvtepi32_ps (_mm256_and_si256 (_mm256_srli_epi32 (pixels, 16), mask));
+        _mm256_storeu_ps (out + x, _mm256_fmadd_ps (b, wb, _mm256_fmadd_ps (g, wg, _mm256_mul_ps (r, wr))));
+    }
+
+    rgbRowScalar (row + 3 * x, out + x, cols - x);
+}
+
+// 16 pixels per iteration, in two accumulators
+AVX2_TARGET
+void convolveRowAVX2 (const float *const *rows, const float *filter, int filterWidth, 
+                      uint8_t *out, int cols)
+{
+    for (int x = 0; x < cols; x += 16)
+    {
+        __m256 sum0 = _mm256_setzero_ps (), sum1 = _mm256_setzero_ps ();
+        const float *f = filter;
+        for (int i = 0; i < filterWidth; ++i)
+        {
+            const float *row = rows[i] + x;
+            for (int j = 0; j < filterWidth; ++j)
+            {
+                const __m256 tap = _mm256_set1_ps (*f++);
+                sum0 = _mm256_fmadd_ps (tap, _mm256_loadu_ps (row + j), sum0);
+                sum1 = _mm256_fmadd_ps (tap, _mm256_loadu_ps (row + j + 8), sum1);
+            }
+        }
+
+        // The packs work within the 128-bit lanes, so the halves get packed in order
+        const __m256i ints0 = _mm256_cvttps_epi32 (sum0), ints1 = _mm256_cvttps_epi32 (sum1);
+        const __m128i words0 = _mm_packs_epi32 (_mm256_castsi256_si128 (ints0), _mm256_extracti128_si256 (ints0, 1));
+        const __m128i words1 = _mm_packs_epi32 (_mm256_castsi256_si128 (ints1), _mm256_extracti128_si256 (ints1, 1));
+        const __m128i pixels = _mm_packus_epi16 (words0, words1);
+        if (x + 16 <= cols)
+            _mm_storeu_si128 (reinterpret_cast<__m128i *> (out + x), pixels);
+        else
+        {
+            uint8_t values[16];
+            _mm_storeu_si128 (reinterpret_cast<__m128i *> (values), pixels);
+            std::copy (values, values + cols - x, out + x);
+        }
+    }
+}
+
+#endif  // KINECTFILTER_X86
+
+#ifdef KINECTFILTER_NEON
+
+// 8 pixels per iteration, deinterleaved by the load
+void rgbRowNEON (const uint8_t *row, float *out, int cols)
+{
+    int x = 0;
+    for (; x + 8 <= cols; x += 8)
+    {
+        const uint8x8x3_t pixels = vld3_u8 (row + 3 * x);
+        const uint16x8_t r = vmovl_u8 (pixels.val[0]), g = vmovl_u8 (pixels.val[1]), b = vmovl_u8 (pixels.val[2]);
+
+        float32x4_t low = vmulq_n_f32 (vcvtq_f32_u32 (vmovl_u16 (vget_low_u16 (r))), weightR);
+        low = vmlaq_n_f32 (low, vcvtq_f32_u32 (vmovl_u16 (vget_low_u16 (g))), weightG);
+        low = vmlaq_n_f32 (low, vcvtq_f32_u32 (vmovl_u16 (vget_low_u16 (b))), weightB);
+
+        float32x4_t high = vmulq_n_f32 (vcvtq_f32_u32 (vmovl_u16 (vget_high_u16 (r))), weightR);
+        high = vmlaq_n_f32 (high, vcvtq_f32_u32 (vmovl_u16 (vget_high_u16 (g))), weightG);
+        high = vmlaq_n_f32 (high, vcvtq_f32_u32 (vmovl_u16 (vget_high_u16 (b))), weightB);
+
+        vst1q_f32 (out + x, low);
+        vst1q_f32 (out + x + 4, high);
+    }
+
+    rgbRowScalar (row + 3 * x, out + x, cols - x);
+}
+
+// 8 pixels per iteration, in two accumulators
+void convolveRowNEON (const float *const *rows, const float *filter, int filterWidth, 
+                      uint8_t *out, int cols)
+{
+    for (int x = 0; x < cols; x += 8)
+    {
+        float32x4_t sum0 = vdupq_n_f32 (0.f), sum1 = vdupq_n_f32 (0.f);
+        const float *f = filter;
+        for (int i = 0; i < filterWidth; ++i)
+        {
+            const float *row = rows[i] + x;
+            for (int j = 0; j < filterWidth; ++j)
+            {
+                const float tap = *f++;
+                sum0 = vmlaq_n_f32 (sum0, vld1q_f32 (row + j), tap);
+                sum1 = vmlaq_n_f32 (sum1, vld1q_f32 (row + j + 4), tap);
+            }
+        }
+
+        const int16x8_t words = vcombine_s16 (vqmovn_s32 (vcvtq_s32_f32 (sum0)), 
+                                              vqmovn_s32 (vcvtq_s32_f32 (sum1)));
+        const uint8x8_t pixels = vqmovun_s16 (words);
+        if (x + 8 <= cols)
+            vst1_u8 (out + x, pixels);
+        else
+        {
+            uint8_t values[8];
+            vst1_u8 (values, pixels);
+            std::copy (values, values + cols - x, out + x);
+        }
+    }
+}
+
+void normalizeRowNEON (const uint8_t *row, float *out, int cols)
+{
+    for (int x = 0; x < cols; ++x, row += 3, out += 4)
+    {
+        const float values[4] = { (float) row[0], (float) row[1], (float) row[2], 0.f };
+        float32x4_t pixel = vmulq_n_f32 (vld1q_f32 (values), 1.f / (row[0] + row[1] + row[2]));
+        vst1q_f32 (out, vsetq_lane_f32 (1.f, pixel, 3));
+    }
+}
+
+void depthRowNEON (const uint16_t *row, const float *rays, float *out, int cols)
+{
+    for (int x = 0; x < cols; ++x, out += 4)
+    {
+        const float ray[4] = { rays[2 * x], rays[2 * x + 1], 1.f, 0.f };
+        const float32x4_t point = vmulq_n_f32 (vld1q_f32 (ray), row[x]);
+        vst1q_f32 (out, vsetq_lane_f32 (1.f, point, 3));
+    }
+}
+
+#endif  // KINECTFILTER_NEON
+
+}
+
+
+CpuFilter::CpuFilter (int threads) 
+    : activeIsa (detectIsa ()), job (NULL), jobRows (0), stripes (0), pending (0), 
+      generation (0), stopping (false)
+{
+    if (threads <= 0)
+        threads = std::max (std::thread::hardware_concurrency (), 1u);
+
+    windows.resize (threads);
+    for (int i = 1; i < threads; ++i)
+        workers.push_back (std::thread (&CpuFilter::work, this, i));
+}
+
+
+CpuFilter::~CpuFilter ()
+{
+    {
+        std::lock_guard<std::mutex> lock (mutex);
+        stopping = true;
+    }
+    wake.notify_all ();
+
+    for (std::thread &worker : workers)
+        worker.join ();
+}
+
+
+CpuFilter::Isa CpuFilter::detectIsa ()
+{
+#if defined(KINECTFILTER_X86)
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma"))
+        return AVX2;
+    if (__builtin_cpu_supports ("sse2"))
+        return SSE2;
+#elif defined(KINECTFILTER_NEON)
+    return NEON;
+#endif
+
+    return SCALAR;
+}
+
+
+const char *CpuFilter::isaName (Isa isa)
+{
+    static const char *names[] = { "Scalar", "SSE2", "AVX2", "NEON" };
+    return names[isa];
+}
+
+
+void CpuFilter::setIsa (Isa isa)
+{
+    const Isa detected = detectIsa ();
+
+    // SSE2 is the baseline of the processors with AVX2
+    const bool supported = isa == SCALAR || isa == detected || (isa == SSE2 && detected == AVX2);
+    activeIsa = supported ? isa : detected;
+}
+
+
+void CpuFilter::rgb2gray (const uint8_t *rgb, uint8_t *gray, int rows, int cols)
+{
+    RowLoader load = rgbRowScalar;
+#ifdef KINECTFILTER_X86
+    if (activeIsa == AVX2)
+        load = rgbRowAVX2;
+#endif
+#ifdef KINECTFILTER_NEON
+    if (activeIsa == NEON)
+        load = rgbRowNEON;
+#endif
+
+    parallelRows (rows, [&] (int first, int last, int stripe) {
+        std::vector<float> &row = windows[stripe];
+        row.resize (cols);
+
+        for (int y = first; y < last; ++y)
+        {
+            load (rgb + 3 * y * cols, row.data (), cols);
+            for (int x = 0; x < cols; ++x)
+                gray[y * cols + x] = saturate (row[x]);
+        }
+    });
+}
+
+
+void CpuFilter::convolve (const uint8_t *source, uint8_t *output, int rows, int cols, 
+                          const float *filter, int filterWidth)
+{
+    parallelRows (rows, [&] (int first, int last, int stripe) {
+        convolveStripe (source, false, output, rows, cols, filter, filterWidth, 
+                        first, last, windows[stripe]);
+    });
+}
+
+
+void CpuFilter::convolveRGB (const uint8_t *rgb, uint8_t *output, int rows, int cols, 
+                             const float *filter, int filterWidth)
+{
+    parallelRows (rows, [&] (int first, int last, int stripe) {
+        convolveStripe (rgb, true, output, rows, cols, filter, filterWidth, 
+                        first, last, windows[stripe]);
+    });
+}
+
+
+void CpuFilter::normalizeRGB (const uint8_t *rgb, float *rgba, int rows, int cols)
+{
+    void (*normalize) (const uint8_t *, float *, int) = normalizeRowScalar;
+#ifdef KINECTFILTER_X86
+    if (activeIsa != SCALAR)
+        normalize = normalizeRowSSE2;
+#endif
+#ifdef KINECTFILTER_NEON
+    if (activeIsa == NEON)
+        normalize = normalizeRowNEON;
+#endif
+
+    parallelRows (rows, [&] (int first, int last, int) {
+        for (int y = first; y < last; ++y)
+            normalize (rgb + 3 * y * cols, rgba + 4 * y * cols, cols);
+    });
+}
+
+
+void CpuFilter::depthTo3DRays (const uint16_t *depth, const float *rays, float *cloud, int rows, int cols)
+{
+    void (*project) (const uint16_t *, const float *, float *, int) = depthRowScalar;
+#ifdef KINECTFILTER_X86
+    if (activeIsa != SCALAR)
+        project = depthRowSSE2;
+#endif
+#ifdef KINECTFILTER_NEON
+    if (activeIsa == NEON)
+        project = depthRowNEON;
+#endif
+
+    parallelRows (rows, [&] (int first, int last, int) {
+        for (int y = first; y < last; ++y)
+            project (depth + y * cols, rays + 2 * y * cols, cloud + 4 * y * cols, cols);
+    });
+}
+
+
+// The window keeps filterWidth rows of the source, converted to floats and 
+// padded with the edge pixels, in a ring: source row k goes in slot k % filterWidth. 
+// Moving on to the next output row takes converting a single source row
+void CpuFilter::convolveStripe (const uint8_t *source, bool rgb, uint8_t *output, int rows, int cols, 
+                                const float *filter, int filterWidth, int first, int last, 
+                                std::vector<float> &window)
+{
+    RowLoader load = rgb ? rgbRowScalar : grayRow;
+    RowConvolver convolveRow = convolveRowScalar;
+#ifdef KINECTFILTER_X86
+    if (activeIsa != SCALAR)
+        convolveRow = convolveRowSSE2;
+    if (activeIsa == AVX2)
+    {
+        if (rgb)
+            load = rgbRowAVX2;
+        convolveRow = convolveRowAVX2;
+    }
+#endif
+#ifdef KINECTFILTER_NEON
+    if (activeIsa == NEON)
+    {
+        if (rgb)
+            load = rgbRowNEON;
+        convolveRow = convolveRowNEON;
+    }
+#endif
+
+    const int halfwidth = filterWidth / 2;
+    const int stride = cols + filterWidth - 1 + rowSlack;
+    window.resize (filterWidth * stride);
+
+    std::vector<const float *> windowRows (filterWidth);
+    int loaded = first - halfwidth - 1;  // The last source row in the window
+
+    for (int y = first; y < last; ++y)
+    {
+        for (int k = std::max (loaded + 1, y - halfwidth); k <= y + halfwidth; ++k)
+        {
+            float *row = window.data () + (k + filterWidth) % filterWidth * stride;
+            const int sourceRow = std::min (std::max (k, 0), rows - 1);
+            load (source + (rgb ? 3 : 1) * sourceRow * cols, row + halfwidth, cols);
+
+            std::fill (row, row + halfwidth, row[halfwidth]);
+            std::fill (row + halfwidth + cols, row + 2 * halfwidth + cols, row[halfwidth + cols - 1]);
+        }
+        loaded = y + halfwidth;
+
+        for (int i = 0; i < filterWidth; ++i)
+            windowRows[i] = window.data () + (y - halfwidth + i + filterWidth) % filterWidth * stride;
+
+        convolveRow (windowRows.data (), filter, filterWidth, output + y * cols, cols);
+    }
+}
+
+
+void CpuFilter::parallelRows (int rows, const std::function<void (int, int, int)> &job)
+{
+    {
+        std::lock_guard<std::mutex> lock (mutex);
+        this->job = &job;
+        jobRows = rows;
+        stripes = std::max (std::min (threads (), rows / minStripeRows), 1);
+        pending = stripes - 1;
+        ++generation;
+    }
+    wake.notify_all ();
+
+    // The calling thread takes the first stripe
+    runStripe (0);
+
+    std::unique_lock<std::mutex> lock (mutex);
+    done.wait (lock, [this] { return pending == 0; });
+}
+
+
+void CpuFilter::runStripe (int index)
+{
+    const int first = (int64_t) jobRows * index / stripes;
+    const int last = (int64_t) jobRows * (index + 1) / stripes;
+    (*job) (first, last, index);
+}
+
+
+void CpuFilter::work (int index)
+{
+    uint64_t seen = 0;
+
+    while (true)
+    {
+        std::unique_lock<std::mutex> lock (mutex);
+        wake.wait (lock, [&] { return stopping || generation != seen; });
+        if (stopping)
+            return;
+
+        // A job with fewer stripes than threads leaves some of them out
+        seen = generation;
+        if (index >= stripes)
+            continue;
+
+        lock.unlock ();
+        runStripe (index);
+        lock.lock ();
+
+        if (--pending == 0)
+            done.notify_one ();
+    }
+}
@@ -0,0 +1,134 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: cpuPipeline.cpp
+ * File description: Implementation of the filter pipeline on the CPU.
+ */
+
+#include <cmath>
+#include <sstream>
+#include <kinectFilter/cpuPipeline.hpp>
+
+
+CpuPipeline::CpuPipeline (int frameWidth, int frameHeight, int levels, Profiler *profiler) 
+    : profiler (profiler), smoothed (true), fused (false), logFilter (NULL)
+{
+    // The same filters with the OpenCL ones
+    boxFilter.assign (boxFilter3x3, boxFilter3x3 + 9);
+    laplacianFilter.assign (laplacianFilter3x3, laplacianFilter3x3 + 9);
+    setGaussian (1.f, 5);
+
+    // The frames from Kinect get filtered straight out of these 
+    // (which take frames of any resolution)
+    for (int i = 0; i < 3; ++i)
+    {
+        hostRGB[i].resize (3 * maxFrameWidth * maxFrameHeight);
+        slots[i] = hostRGB[i].data ();
+    }
+
+    setResolution (frameWidth, frameHeight, levels);
+}
+
+
+void CpuPipeline::convolve (const uint8_t *rgb, uint8_t *image)
+{
+    // Downsample the frame to the top level of the pyramid
+    for (int l = 1; l <= levels; ++l)
+    {
+        const double start = profiler ? Profiler::now () : 0.;
+        downsample (rgb, pyramid[l - 1].data (), frameHeight >> l, frameWidth >> l);
+        rgb = pyramid[l - 1].data ();
+
+        if (profiler)
+        {
+            std::ostringstream stage;
+            stage << "Pyramid level " << l;
+            profiler->record (stage.str (), Profiler::now () - start);
+        }
+    }
+
+    if (smoothed && !fused)
+    {
+        pass ("Box filter 1", rgb, true, interImage1.data (), boxFilter);
+        pass ("Box filter 2", interImage1.data (), false, interImage2.data (), boxFilter);
+        pass ("Laplacian filter", interImage2.data (), false, image, laplacianFilter);
+    }
+    else if (smoothed)
+        pass ("LoG filter", rgb, true, image, *logFilter);
+    else
+        pass ("Laplacian filter", rgb, true, image, laplacianFilter);
+}
+
+
+std::string CpuPipeline::name ()
+{
+    std::ostringstream name;
+    name << "CPU (" << CpuFilter::isaName (cpu.isa ()) << ", " << cpu.threads () << " threads)";
+    return name.str ();
+}
+
+
+void CpuPipeline::setResolution (int frameWidth, int frameHeight, int levels)
+{
+    this->frameWidth = frameWidth;
+    this->frameHeight = frameHeight;
+    this->levels = levels;
+    width = frameWidth >> levels;
+    height = frameHeight >> levels;
+
+    for (int l = 1; l <= levels; ++l)
+        pyramid[l - 1].resize (3 * (frameWidth >> l) * (frameHeight >> l));
+    interImage1.resize (width * height);
+    interImage2.resize (width * height);
+}
+
+
+void CpuPipeline::setGaussian (float sigma, int width)
+{
+    logFilter = &logCache.get (sigma, width, [] (float sigma, int width, std::vector<float> &entry) {
+        entry = ::logFilter (sigma, width);
+    });
+    gaussianSigma = sigma;
+    gaussianWidth = width;
+}
+
+
+void CpuPipeline::pass (const char *stage, const uint8_t *source, bool rgb, uint8_t *output, 
+                        const std::vector<float> &filter)
+{
+    const double start = profiler ? Profiler::now () : 0.;
+    const int width = std::sqrt (filter.size ()) + 0.5;
+
+    if (rgb)
+        cpu.convolveRGB (source, output, height, this->width, filter.data (), width);
+    else
+        cpu.convolve (source, output, height, this->width, filter.data (), width);
+
+    if (profiler)
+        profiler->record (stage, Profiler::now () - start);
+}
+
+
+void CpuPipeline::downsample (const uint8_t *rgb, uint8_t *out, int rows, int cols)
+{
+    for (int row = 0; row < rows; ++row)
+    {
+        const uint8_t *top = rgb + 3 * (2 * row) * (2 * cols);
+        const uint8_t *bottom = top + 3 * (2 * cols);
+        for (int i = 0; i < 3 * cols; ++i)
+        {
+            const int j = 6 * (i / 3) + i % 3;
+            out[3 * row * cols + i] = (top[j] + top[j + 3] + bottom[j] + bottom[j + 3] + 2) / 4;
+        }
+    }
+}
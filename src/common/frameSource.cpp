@@ -0,0 +1,294 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: frameSource.cpp
+ * File description: Implementation of the FrameSource class.
+ */
+
+#include <algorithm>
+#include <kinectFilter/frameSource.hpp>
+#include <kinectFilter/recording.hpp>
+
+
+FrameSource::FrameSource ()
+    : profiler (NULL), recorder (NULL), rgbCopyTime (0.), depthCopyTime (0.)
+{
+}
+
+
+FrameSource::~FrameSource ()
+{
+}
+
+
+FrameSource::Stream::Stream ()
+    : captured (0), processed (0), dropped (0), slotCount (0), held (0.)
+{
+}
+
+
+void FrameSource::Stream::setSlots (const void *const *slots, int count)
+{
+    std::copy (slots, slots + count, this->slots);
+    std::fill (arrivals, arrivals + count, 0.);
+    slotCount = count;
+}
+
+
+void FrameSource::Stream::arrived (const void *slot, double time)
+{
+    for (int i = 0; i < slotCount; ++i)
+        if (slots[i] == slot)
+            arrivals[i] = time;
+
+    captured.fetch_add (1, std::memory_order_relaxed);
+}
+
+
+void FrameSource::Stream::pickedUp (const void *slot)
+{
+    for (int i = 0; i < slotCount; ++i)
+        if (slots[i] == slot)
+            held = arrivals[i];
+
+    processed.fetch_add (1, std::memory_order_relaxed);
+}
+
+
+FrameCounts FrameSource::Stream::counts () const
+{
+    FrameCounts c = { captured.load (std::memory_order_relaxed), 
+                      processed.load (std::memory_order_relaxed), 
+                      dropped.load (std::memory_order_relaxed) };
+    return c;
+}
+
+
+void FrameSource::attach (uint8_t *const rgbSlots[3], uint16_t *const depthSlots[3], 
+                          Profiler *profiler)
+{
+    rgbFrames.reset (new TripleBuffer<uint8_t> (rgbSlots));
+    rgbStream.setSlots (reinterpret_cast<const void *const *> (rgbSlots), 3);
+    if (depthSlots)
+    {
+        depthFrames.reset (new TripleBuffer<uint16_t> (depthSlots));
+        depthStream.setSlots (reinterpret_cast<const void *const *> (depthSlots), 3);
+    }
+    this->profiler = profiler;
+}
+
+
+void FrameSource::attachPaired (uint8_t *const *rgbSlots, uint16_t *const *depthSlots, 
+                                int slotCount, Profiler *profiler)
+{
+    rgbQueue.reset (new FrameQueue<uint8_t> (rgbSlots, slotCount));
+    depthQueue.reset (new FrameQueue<uint16_t> (depthSlots, slotCount));
+    rgbStream.setSlots (reinterpret_cast<const void *const *> (rgbSlots), slotCount);
+    depthStream.setSlots (reinterpret_cast<const void *const *> (depthSlots), slotCount);
+    this->profiler = profiler;
+}
+
+
+void FrameSource::record (Recorder *recorder)
+{
+    this->recorder = recorder;
+}
+
+
+void FrameSource::deliverRGB (const uint8_t *rgb, size_t size, uint32_t timestamp)
+{
+    if (Recorder *r = recorder)
+        r->writeRGB (rgb, size, timestamp);
+
+    const double start = Profiler::now ();
+    uint8_t *slot = rgbQueue ? rgbQueue->writeBuffer () : rgbFrames->writeBuffer ();
+
+    std::copy (rgb, rgb + size, slot);
+
+    if (profiler)
+        rgbCopyTime = Profiler::now () - start;
+
+    rgbStream.arrived (slot, start);
+    if (rgbQueue ? rgbQueue->publish (timestamp) : rgbFrames->publish ())
+        rgbStream.dropped.fetch_add (1, std::memory_order_relaxed);
+}
+
+
+void FrameSource::deliverDepth (const uint16_t *depth, size_t size, uint32_t timestamp)
+{
+    if (Recorder *r = recorder)
+        r->writeDepth (depth, size, timestamp);
+
+    if (!depthFrames && !depthQueue)
+        return;
+
+    const double start = Profiler::now ();
+    uint16_t *slot = depthQueue ? depthQueue->writeBuffer () : depthFrames->writeBuffer ();
+
+    std::copy (depth, depth + size / 2, slot);
+
+    if (profiler)
+        depthCopyTime = Profiler::now () - start;
+
+    depthStream.arrived (slot, start);
+    if (depthQueue ? depthQueue->publish (timestamp) : depthFrames->publish ())
+        depthStream.dropped.fetch_add (1, std::memory_order_relaxed);
+}
+
+
+bool FrameSource::rgbPending () const
+{
+    if (rgbQueue)
+        return rgbQueue->full ();
+
+    return rgbFrames && rgbFrames->pending ();
+}
+
+
+bool FrameSource::depthPending () const
+{
+    if (depthQueue)
+        return depthQueue->full ();
+
+    return depthFrames && depthFrames->pending ();
+}
+
+
+bool FrameSource::getRGB (const uint8_t *&rgb)
+{
+    bool newFrame = rgbFrames->update ();
+    rgb = rgbFrames->readBuffer ();
+
+    if (newFrame)
+        rgbStream.pickedUp (rgb);
+    if (newFrame && profiler)
+        profiler->record ("RGB callback copy", rgbCopyTime);
+
+    return newFrame;
+}
+
+
+void FrameSource::discardRGB ()
+{
+    // The frame the rendering thread held (and its arrival time) 
+    // doesn't get used either way, once the slot is swapped
+    if (rgbFrames->update ())
+        rgbStream.dropped.fetch_add (1, std::memory_order_relaxed);
+}
+
+
+bool FrameSource::getDepth (const uint16_t *&depth)
+{
+    bool newFrame = depthFrames->update ();
+    depth = depthFrames->readBuffer ();
+
+    if (newFrame)
+        depthStream.pickedUp (depth);
+    if (newFrame && profiler)
+        profiler->record ("Depth callback copy", depthCopyTime);
+
+    return newFrame;
+}
+
+
+bool FrameSource::getPair (const uint8_t *&rgb, const uint16_t *&depth, uint32_t tolerance)
+{
+    FrameQueue<uint8_t>::Frame rgbQueued[FrameQueue<uint8_t>::maxSlots];
+    FrameQueue<uint16_t>::Frame depthQueued[FrameQueue<uint16_t>::maxSlots];
+    const int rgbCount = rgbQueue->frames (rgbQueued);
+    const int depthCount = depthQueue->frames (depthQueued);
+
+    // A frame overwritten in the meantime has been counted already
+    auto dropRGB = [this] (const FrameQueue<uint8_t>::Frame &frame) {
+        if (rgbQueue->drop (frame))
+            rgbStream.dropped.fetch_add (1, std::memory_order_relaxed);
+    };
+    auto dropDepth = [this] (const FrameQueue<uint16_t>::Frame &frame) {
+        if (depthQueue->drop (frame))
+            depthStream.dropped.fetch_add (1, std::memory_order_relaxed);
+    };
+
+    // The distance in time, with the wrap-around of the timestamps
+    auto distance = [] (uint32_t a, uint32_t b) { return std::min (a - b, b - a); };
+
+    // Look for the newest RGB frame with a Depth frame close enough to it
+    int r = -1, d = -1;
+    for (int i = rgbCount - 1; i >= 0 && d < 0; --i)
+        for (int j = depthCount - 1; j >= 0; --j)
+        {
+            uint32_t dt = distance (rgbQueued[i].timestamp, depthQueued[j].timestamp);
+            if (dt <= tolerance && (d < 0 || dt < distance (rgbQueued[i].timestamp, depthQueued[d].timestamp)))
+            {
+                r = i;
+                d = j;
+            }
+        }
+
+    bool paired = false;
+    if (d >= 0)
+    {
+        // A frame overwritten in the meantime has been counted already, but an RGB 
+        // frame taken without its Depth frame is lost too, and gets counted here
+        if (rgbQueue->take (rgbQueued[r]))
+        {
+            paired = depthQueue->take (depthQueued[d]);
+            if (!paired)
+                rgbStream.dropped.fetch_add (1, std::memory_order_relaxed);
+        }
+
+        // Anything older than the pair is stale
+        for (int i = 0; i < r; ++i)
+            dropRGB (rgbQueued[i]);
+        for (int i = 0; i < d; ++i)
+            dropDepth (depthQueued[i]);
+    }
+    else
+    {
+        // The frames of a stream come in order, so a frame that is 
+        // too far behind the newest frame of the other stream never gets paired
+        for (int i = 0; i < rgbCount; ++i)
+            if (depthCount > 0 && (int32_t) (depthQueued[depthCount - 1].timestamp - rgbQueued[i].timestamp) > (int32_t) tolerance)
+                dropRGB (rgbQueued[i]);
+        for (int i = 0; i < depthCount; ++i)
+            if (rgbCount > 0 && (int32_t) (rgbQueued[rgbCount - 1].timestamp - depthQueued[i].timestamp) > (int32_t) tolerance)
+                dropDepth (depthQueued[i]);
+    }
+
+    rgb = rgbQueue->readBuffer ();
+    depth = depthQueue->readBuffer ();
+
+    if (paired)
+    {
+        rgbStream.pickedUp (rgb);
+        depthStream.pickedUp (depth);
+    }
+    if (paired && profiler)
+    {
+        profiler->record ("RGB callback copy", rgbCopyTime);
+        profiler->record ("Depth callback copy", depthCopyTime);
+    }
+
+    return paired;
+}
+
+
+FrameCounts FrameSource::rgbCounts () const
+{
+    return rgbStream.counts ();
+}
+
+
+FrameCounts FrameSource::depthCounts () const
+{
+    return depthStream.counts ();
+}
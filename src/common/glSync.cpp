@@ -0,0 +1,35 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: glSync.cpp
+ * File description: Implementation of the CL-GL synchronization detection.
+ */
+
+#include <string>
+#include <kinectFilter/glSync.hpp>
+
+
+void checkGLSync (const cl::Platform &platform, const cl::Device &device, 
+                  clCreateEventFromGLsyncKHR_fn &createEvent, bool &glCLEvent)
+{
+    std::string exts = device.getInfo<CL_DEVICE_EXTENSIONS> ();
+
+    createEvent = NULL;
+    #if !defined(__APPLE__) && !defined(__MACOSX)
+    if (exts.find ("cl_khr_gl_event") != std::string::npos && GLEW_ARB_sync)
+        createEvent = (clCreateEventFromGLsyncKHR_fn) 
+            clGetExtensionFunctionAddressForPlatform (platform (), "clCreateEventFromGLsyncKHR");
+    #endif
+
+    glCLEvent = GLEW_ARB_cl_event && GLEW_ARB_sync;
+}
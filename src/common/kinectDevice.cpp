@@ -0,0 +1,36 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: kinectDevice.cpp
+ * File description: Implementation of the KinectDevice class.
+ */
+
+#include <kinectFilter/kinectDevice.hpp>
+
+
+KinectDevice::KinectDevice (freenect_context *ctx, int index)
+    : Freenect::FreenectDevice (ctx, index)
+{
+}
+
+
+void KinectDevice::VideoCallback (void *rgb, uint32_t timestamp)
+{
+    deliverRGB (static_cast<uint8_t *> (rgb), getVideoBufferSize (), timestamp);
+}
+
+
+void KinectDevice::DepthCallback (void *depth, uint32_t timestamp)
+{
+    deliverDepth (static_cast<uint16_t *> (depth), getDepthBufferSize (), timestamp);
+}
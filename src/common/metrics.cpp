@@ -0,0 +1,208 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: metrics.cpp
+ * File description: Implementation of the Metrics class.
+ */
+
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <fstream>
+#include <limits>
+#include <unistd.h>
+#include <kinectFilter/metrics.hpp>
+
+
+const double Metrics::bucketBounds[] = { 5., 10., 20., 33., 50., 67., 100., 200., 500., 1000. };
+const int Metrics::bucketCount = sizeof (bucketBounds) / sizeof (bucketBounds[0]);
+
+
+Metrics::Metrics (const std::string &app, double interval) 
+    : app (app), interval (interval), lastReport (Profiler::now ()), 
+      delivered (0), intervalDelivered (0), latencySum (0.), 
+      histogram (bucketCount + 1, 0), intervalHistogram (bucketCount + 1, 0)
+{
+}
+
+
+void Metrics::addSource (const FrameSource *source)
+{
+    sources.push_back (source);
+    lastCounts[0].push_back (source->rgbCounts ());
+    lastCounts[1].push_back (source->depthCounts ());
+}
+
+
+void Metrics::frameDelivered (double arrival)
+{
+    ++delivered;
+    ++intervalDelivered;
+
+    const double ms = Profiler::now () - arrival;
+
+    int bucket = 0;
+    while (bucket < bucketCount && ms > bucketBounds[bucket])
+        ++bucket;
+
+    ++histogram[bucket];
+    ++intervalHistogram[bucket];
+    latencySum += ms;
+}
+
+
+void Metrics::update ()
+{
+    const double now = Profiler::now ();
+    if (now - lastReport < 1000. * interval)
+        return;
+
+    auto latency = [] (double bound) {
+        std::ostringstream s;
+        if (bound > bucketBounds[bucketCount - 1])
+            s << "> " << bucketBounds[bucketCount - 1];
+        else
+            s << "<= " << bound;
+        return s.str ();
+    };
+
+    std::ostringstream line;
+    line << std::fixed << std::setprecision (1) << "[" << app << "] " 
+         << intervalDelivered / ((now - lastReport) / 1000.) << " fps";
+    if (intervalDelivered > 0)
+        line << ", latency p50 " << latency (percentile (intervalHistogram, 0.50)) 
+             << " ms, p99 " << latency (percentile (intervalHistogram, 0.99)) << " ms";
+
+    // The Depth stream gets reported only when it's in use
+    bool behind = false;
+    for (size_t i = 0; i < sources.size (); ++i)
+    {
+        const FrameCounts counts[2] = { sources[i]->rgbCounts (), sources[i]->depthCounts () };
+        const char *names[2] = { "RGB", "Depth" };
+
+        for (int s = 0; s < 2; ++s)
+        {
+            if (counts[s].captured == 0)
+                continue;
+
+            const FrameCounts &last = lastCounts[s][i];
+            line << " | " << names[s];
+            if (sources.size () > 1)
+                line << " " << i;
+            line << ": " << counts[s].captured - last.captured << " captured, " 
+                 << counts[s].processed - last.processed << " processed, " 
+                 << counts[s].dropped - last.dropped << " dropped";
+
+            behind |= counts[s].dropped != last.dropped;
+            lastCounts[s][i] = counts[s];
+        }
+    }
+
+    if (behind)
+        line << " | FALLING BEHIND";
+
+    std::clog << line.str () << std::endl;
+
+    if (!fileName.empty ())
+        writeFile ();
+
+    intervalDelivered = 0;
+    std::fill (intervalHistogram.begin (), intervalHistogram.end (), 0);
+    lastReport = now;
+}
+
+
+double Metrics::percentile (const std::vector<uint64_t> &histogram, double p)
+{
+    uint64_t total = 0;
+    for (uint64_t count : histogram)
+        total += count;
+
+    uint64_t cumulative = 0;
+    for (int i = 0; i < bucketCount; ++i)
+    {
+        cumulative += histogram[i];
+        if (cumulative >= p * total)
+            return bucketBounds[i];
+    }
+
+    return std::numeric_limits<double>::infinity ();
+}
+
+
+// Writes the metrics in the Prometheus text format. The file gets written 
+// under a temporary name, and renamed into place, so that a scrape 
+// never reads a partial file
+void Metrics::writeFile () const
+{
+    std::ostringstream tmp;
+    tmp << fileName << ".tmp" << getpid ();
+
+    {
+        std::ofstream file (tmp.str ().c_str ());
+        const std::string label = "app=\"" + app + "\"";
+
+        const char *counters[3][2] = {
+            { "kinectfilter_frames_captured_total", "Frames received from the sensor." }, 
+            { "kinectfilter_frames_processed_total", "Frames picked up for processing." }, 
+            { "kinectfilter_frames_dropped_total", "Frames dropped before processing." } };
+
+        for (int c = 0; c < 3; ++c)
+        {
+            file << "# HELP " << counters[c][0] << " " << counters[c][1] << "\n";
+            file << "# TYPE " << counters[c][0] << " counter\n";
+
+            for (size_t i = 0; i < sources.size (); ++i)
+            {
+                const FrameCounts counts[2] = { sources[i]->rgbCounts (), sources[i]->depthCounts () };
+                const char *streams[2] = { "rgb", "depth" };
+
+                for (int s = 0; s < 2; ++s)
+                {
+                    const uint64_t values[3] = { counts[s].captured, counts[s].processed, counts[s].dropped };
+                    file << counters[c][0] << "{" << label << ",source=\"" << i 
+                         << "\",stream=\"" << streams[s] << "\"} " << values[c] << "\n";
+                }
+            }
+        }
+
+        file << "# HELP kinectfilter_frames_delivered_total Frames displayed or published.\n";
+        file << "# TYPE kinectfilter_frames_delivered_total counter\n";
+        file << "kinectfilter_frames_delivered_total{" << label << "} " << delivered << "\n";
+
+        file << "# HELP kinectfilter_latency_seconds Latency from the arrival of a frame to its delivery.\n";
+        file << "# TYPE kinectfilter_latency_seconds histogram\n";
+        uint64_t cumulative = 0;
+        for (int i = 0; i < bucketCount; ++i)
+        {
+            cumulative += histogram[i];
+            file << "kinectfilter_latency_seconds_bucket{" << label << ",le=\"" 
+                 << bucketBounds[i] / 1000. << "\"} " << cumulative << "\n";
+        }
+        cumulative += histogram[bucketCount];
+        file << "kinectfilter_latency_seconds_bucket{" << label << ",le=\"+Inf\"} " << cumulative << "\n";
+        file << "kinectfilter_latency_seconds_sum{" << label << "} " << latencySum / 1000. << "\n";
+        file << "kinectfilter_latency_seconds_count{" << label << "} " << cumulative << "\n";
+
+        if (!file)
+        {
+            file.close ();
+            std::remove (tmp.str ().c_str ());
+            return;
+        }
+    }
+
+    if (std::rename (tmp.str ().c_str (), fileName.c_str ()) != 0)
+        std::remove (tmp.str ().c_str ());
+}
@@ -0,0 +1,323 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: pipeline.cpp
+ * File description: Implementation of the Pipeline classes.
+ */
+
+#include <stdexcept>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+#include <kinectFilter/pipeline.hpp>
+
+
+MemSpec MemSpec::image (const cl::ImageFormat &format, size_t width, size_t height)
+{
+    MemSpec spec = { true, format.image_channel_order, format.image_channel_data_type, 
+                     width, height, 0 };
+    return spec;
+}
+
+
+MemSpec MemSpec::buffer (size_t size)
+{
+    MemSpec spec = { false, 0, 0, 0, 0, size };
+    return spec;
+}
+
+
+bool MemSpec::operator< (const MemSpec &other) const
+{
+    if (isImage != other.isImage) return isImage < other.isImage;
+    if (order != other.order) return order < other.order;
+    if (type != other.type) return type < other.type;
+    if (width != other.width) return width < other.width;
+    if (height != other.height) return height < other.height;
+    return size < other.size;
+}
+
+
+MemPool::MemPool (cl_context context)
+{
+    clRetainContext (context);
+    this->context = cl::Context (context);
+}
+
+
+cl::Memory MemPool::get (const MemSpec &spec, size_t index)
+{
+    std::vector<cl::Memory> &pooled = objects[spec];
+
+    while (pooled.size () <= index)
+    {
+        if (spec.isImage)
+            pooled.push_back (cl::Image2D (context, CL_MEM_READ_WRITE, 
+                cl::ImageFormat (spec.order, spec.type), spec.width, spec.height));
+        else
+            pooled.push_back (cl::Buffer (context, CL_MEM_READ_WRITE, spec.size));
+    }
+
+    return pooled[index];
+}
+
+
+Stage &Stage::input (cl_uint arg, const std::string &resource)
+{
+    inputs.push_back (std::make_pair (arg, resource));
+    return *this;
+}
+
+
+Stage &Stage::output (cl_uint arg, const std::string &resource)
+{
+    outputs.push_back (std::make_pair (arg, resource));
+    return *this;
+}
+
+
+Stage &Stage::setup (const Setup &fn)
+{
+    this->fn = fn;
+    return *this;
+}
+
+
+Stage &Stage::range (const Range &fn)
+{
+    rangeFn = fn;
+    return *this;
+}
+
+
+void Pipeline::bind (const std::string &name, const cl::Memory &mem)
+{
+    resources[name] = mem;
+}
+
+
+void Pipeline::bind (const std::string &name, cl_mem mem)
+{
+    clRetainMemObject (mem);
+    resources[name] = cl::Memory (mem);
+}
+
+
+void Pipeline::intermediate (const std::string &name, const MemSpec &spec)
+{
+    intermediates.push_back (std::make_pair (name, spec));
+    assigned = false;
+}
+
+
+Stage &Pipeline::addStage (const std::string &name, const cl::Kernel &kernel, 
+                           const cl::NDRange &global, const cl::NDRange &local)
+{
+    stages.push_back (Stage (name, kernel, global, local));
+    assigned = false;
+    return stages.back ();
+}
+
+
+Stage &Pipeline::addStage (const std::string &name, cl_kernel kernel, 
+                           const cl::NDRange &global, const cl::NDRange &local)
+{
+    clRetainKernel (kernel);
+    return addStage (name, cl::Kernel (kernel), global, local);
+}
+
+
+void Pipeline::enqueue (cl::CommandQueue &queue, const std::vector<cl::Event> *waits, 
+                        cl::Event *done, const EventSource &events)
+{
+    if (!assigned)
+        assign ();
+
+    for (size_t i = 0; i < stages.size (); ++i)
+    {
+        Stage &stage = stages[i];
+
+        for (const auto &arg : stage.inputs)
+            stage.kernel.setArg (arg.first, resources.at (arg.second));
+        for (const auto &arg : stage.outputs)
+            stage.kernel.setArg (arg.first, resources.at (arg.second));
+        if (stage.fn)
+            stage.fn (stage.kernel);
+
+        cl::NDRange offset, global = stage.global;
+        if (stage.rangeFn)
+            stage.rangeFn (offset, global);
+
+        const bool last = (i + 1 == stages.size ());
+        cl::Event *event = (last && done) ? done : (events ? events (stage.name) : NULL);
+
+        queue.enqueueNDRangeKernel (stage.kernel, offset, global, stage.local, 
+                                    i == 0 ? waits : NULL, event);
+    }
+}
+
+
+cl_int Pipeline::enqueue (cl_command_queue queue, cl_event wait, 
+                          cl_event *done, const RawEventSource &events)
+{
+    // The pool objects get created on the first run, and the setup functions 
+    // may go through cl.hpp, so its errors become status codes here
+    try
+    {
+        if (!assigned)
+            assign ();
+
+        for (size_t i = 0; i < stages.size (); ++i)
+        {
+            Stage &stage = stages[i];
+            cl_kernel kernel = stage.kernel ();
+
+            cl_int status = CL_SUCCESS;
+            for (const auto &arg : stage.inputs)
+            {
+                cl_mem mem = resources.at (arg.second) ();
+                status |= clSetKernelArg (kernel, arg.first, sizeof (cl_mem), &mem);
+            }
+            for (const auto &arg : stage.outputs)
+            {
+                cl_mem mem = resources.at (arg.second) ();
+                status |= clSetKernelArg (kernel, arg.first, sizeof (cl_mem), &mem);
+            }
+            if (status != CL_SUCCESS)
+                return status;
+            if (stage.fn)
+                stage.fn (stage.kernel);
+
+            cl::NDRange offset, global = stage.global;
+            if (stage.rangeFn)
+                stage.rangeFn (offset, global);
+
+            const bool last = (i + 1 == stages.size ());
+            cl_event *event = (last && done) ? done : (events ? events (stage.name) : NULL);
+            const bool waits = (i == 0 && wait);
+
+            status = clEnqueueNDRangeKernel (queue, kernel, global.dimensions (), 
+                                             offset.dimensions () ? (const size_t *) offset : NULL, global, 
+                                             stage.local.dimensions () ? (const size_t *) stage.local : NULL, 
+                                             waits ? 1 : 0, waits ? &wait : NULL, event);
+            if (status != CL_SUCCESS)
+                return status;
+        }
+    }
+    catch (const cl::Error &error)
+    {
+        return error.err ();
+    }
+
+    return CL_SUCCESS;
+}
+
+
+const std::string &Pipeline::lastStage () const
+{
+    return stages.back ().name;
+}
+
+
+void Pipeline::assign ()
+{
+    // The lifetime of each intermediate, in stage indices
+    std::map<std::string, std::pair<int, int> > lifetimes;
+
+    for (size_t i = 0; i < stages.size (); ++i)
+    {
+        for (const auto &arg : stages[i].outputs)
+            if (!lifetimes.count (arg.second))
+                lifetimes[arg.second] = std::make_pair ((int) i, (int) i);
+        for (const auto &arg : stages[i].inputs)
+            if (lifetimes.count (arg.second))
+                lifetimes[arg.second].second = (int) i;
+    }
+
+    // Stage index after which each pooled object becomes free, per description. 
+    // The intermediates are visited in the order they are written
+    std::map<MemSpec, std::vector<int> > freeAfter;
+    std::vector<std::pair<std::pair<int, int>, size_t> > order;
+    for (size_t i = 0; i < intermediates.size (); ++i)
+    {
+        if (!lifetimes.count (intermediates[i].first))
+            throw std::runtime_error ("Pipeline: intermediate " + 
+                                      intermediates[i].first + " is never written");
+        order.push_back (std::make_pair (lifetimes[intermediates[i].first], i));
+    }
+    std::sort (order.begin (), order.end ());
+
+    for (const auto &entry : order)
+    {
+        const std::pair<int, int> &lifetime = entry.first;
+        const std::string &name = intermediates[entry.second].first;
+        const MemSpec &spec = intermediates[entry.second].second;
+        std::vector<int> &slots = freeAfter[spec];
+
+        // An object can be reused, once the last stage that reads it has come 
+        // before the stage that writes the new intermediate
+        size_t slot = 0;
+        while (slot < slots.size () && slots[slot] >= lifetime.first)
+            ++slot;
+        if (slot == slots.size ())
+            slots.push_back (0);
+        slots[slot] = lifetime.second;
+
+        resources[name] = pool->get (spec, slot);
+    }
+
+    assigned = true;
+}
+
+
+std::string addPyramid (Pipeline &pipeline, const cl::Kernel &downsample, const std::string &source, 
+                        int frameWidth, int frameHeight, int levels)
+{
+    std::string frame = source;
+    for (int l = 1; l <= levels; ++l)
+    {
+        const int rows = frameHeight >> l;
+        const int cols = frameWidth >> l;
+        std::ostringstream level;
+        level << "rgb" << l;
+
+        pipeline.intermediate (level.str (), MemSpec::buffer (3 * rows * cols));
+        pipeline.addStage ("Pyramid level " + level.str ().substr (3), downsample, cl::NDRange (cols, rows))
+            .input (0, frame).output (1, level.str ())
+            .setup ([rows, cols] (cl::Kernel &kernel) {
+                kernel.setArg (2, rows);
+                kernel.setArg (3, cols);
+            });
+        frame = level.str ();
+    }
+
+    return frame;
+}
+
+
+std::string separableOptions (const std::vector<float> &rowFilter, 
+                              const std::vector<float> &columnFilter)
+{
+    std::ostringstream options;
+    options << std::scientific << std::setprecision (9);
+
+    options << "-D SEPARABLE_WIDTH=" << rowFilter.size () << " -D SEPARABLE_ROW=";
+    for (size_t i = 0; i < rowFilter.size (); ++i)
+        options << (i ? "," : "") << rowFilter[i] << "f";
+
+    options << " -D SEPARABLE_COLUMN=";
+    for (size_t i = 0; i < columnFilter.size (); ++i)
+        options << (i ? "," : "") << columnFilter[i] << "f";
+
+    return options.str ();
+}
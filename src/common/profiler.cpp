@@ -0,0 +1,158 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: profiler.cpp
+ * File description: Implementation of the Profiler class.
+ */
+
+#include <iostream>
+#include <cstdlib>
+#include <sstream>
+#include <iomanip>
+#include <fstream>
+#include <algorithm>
+#include <kinectFilter/profiler.hpp>
+
+
+void Profiler::record (const std::string &stage, double ms)
+{
+    if (samples.find (stage) == samples.end ())
+        stages.push_back (stage);
+
+    Samples &s = samples[stage];
+    if (s.ring.size () < history)
+        s.ring.push_back (ms);
+    else
+        s.ring[s.count % history] = ms;
+    ++s.count;
+}
+
+
+cl::Event *Profiler::profile (const std::string &stage)
+{
+    events.push_back (std::make_pair (stage, cl::Event ()));
+    return &events.back ().second;
+}
+
+
+cl_event *Profiler::profileRaw (const std::string &stage)
+{
+    // The C API writes the new event in the wrapper, which releases it later
+    return &(*profile (stage)) ();
+}
+
+
+void Profiler::track (const std::string &stage, const cl::Event &event)
+{
+    events.push_back (std::make_pair (stage, event));
+}
+
+
+void Profiler::track (const std::string &stage, cl_event event)
+{
+    clRetainEvent (event);
+    events.push_back (std::make_pair (stage, cl::Event (event)));
+}
+
+
+void Profiler::collect ()
+{
+    while (!events.empty ())
+    {
+        cl_event event = events.front ().second ();
+
+        // An event that can't be queried (e.g. of a command that 
+        // failed to get enqueued) gets dropped, rather than block the rest
+        cl_int execStatus;
+        cl_int status = event ? clGetEventInfo (event, CL_EVENT_COMMAND_EXECUTION_STATUS, 
+                                                sizeof (cl_int), &execStatus, NULL) : CL_INVALID_EVENT;
+        if (status == CL_SUCCESS && execStatus > CL_COMPLETE)
+            break;
+
+        cl_ulong start, end;
+        if (status == CL_SUCCESS && execStatus == CL_COMPLETE)
+        {
+            status = clGetEventProfilingInfo (event, CL_PROFILING_COMMAND_START, sizeof (cl_ulong), &start, NULL);
+            status |= clGetEventProfilingInfo (event, CL_PROFILING_COMMAND_END, sizeof (cl_ulong), &end, NULL);
+            if (status == CL_SUCCESS)
+                record (events.front ().first, (end - start) * 1e-6);
+        }
+
+        events.pop_front ();
+    }
+}
+
+
+std::vector<std::string> Profiler::summary () const
+{
+    std::vector<std::string> lines;
+
+    for (const std::string &stage : stages)
+    {
+        const Samples &s = samples.at (stage);
+        std::vector<double> recent;
+        for (uint64_t n = s.count - std::min (window, s.ring.size ()); n < s.count; ++n)
+            recent.push_back (s.ring[n % history]);
+
+        std::ostringstream line;
+        line << std::fixed << std::setprecision (2) << stage << ": " 
+             << percentile (recent, 0.50) << " / " 
+             << percentile (recent, 0.99) << " ms";
+        lines.push_back (line.str ());
+    }
+
+    return lines;
+}
+
+
+void Profiler::dump (const char *fileName) const
+{
+    std::ofstream file (fileName);
+    file << "stage,sample,ms\n";
+
+    for (const std::string &stage : stages)
+    {
+        // From the oldest kept sample, numbered from the start of the run
+        const Samples &s = samples.at (stage);
+        for (uint64_t n = s.count - s.ring.size (); n < s.count; ++n)
+            file << stage << "," << n << "," << s.ring[n % history] << "\n";
+    }
+
+    std::cout << "Profiling data written to " << fileName << std::endl;
+}
+
+
+// The profiler that dumps its samples when the application exits
+static const Profiler *exitProfiler = NULL;
+static const char *exitProfileName = NULL;
+
+static void dumpOnExit ()
+{
+    exitProfiler->dump (exitProfileName);
+}
+
+
+void Profiler::dumpAtExit (const char *fileName)
+{
+    exitProfiler = this;
+    exitProfileName = fileName;
+    std::atexit (dumpOnExit);
+}
+
+
+double Profiler::percentile (std::vector<double> &samples, double p)
+{
+    const size_t k = std::min (samples.size () - 1, (size_t) (p * samples.size ()));
+    std::nth_element (samples.begin (), samples.begin () + k, samples.end ());
+    return samples[k];
+}
@@ -0,0 +1,38 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: profilerDraw.cpp
+ * File description: Drawing of the profiling summary on a GLUT window. It's 
+ *                   apart from profiler.cpp, so the applications without 
+ *                   a window (kinectFilter_bench) don't need to link GLUT.
+ */
+
+#if defined(__APPLE__) || defined(__MACOSX)
+#include <GLUT/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+#include <kinectFilter/profiler.hpp>
+
+
+void Profiler::draw (int x, int y) const
+{
+    const std::vector<std::string> lines = summary ();
+
+    for (size_t i = 0; i < lines.size (); ++i)
+    {
+        glRasterPos2i (x, y + 15 * i);
+        for (auto c : lines[i])
+            glutBitmapCharacter (GLUT_BITMAP_HELVETICA_12, c);
+    }
+}
@@ -0,0 +1,216 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: programCache.cpp
+ * File description: Implementation of the program binary cache.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iterator>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <kinectFilter/programCache.hpp>
+
+
+namespace
+{
+
+// Identifies the cache files, and their layout (bump on any change)
+const char cacheMagic[] = "KFPB1";
+
+// 64-bit FNV-1a hash
+uint64_t hash (const std::string &data)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : data)
+        h = (h ^ c) * 1099511628211ULL;
+
+    return h;
+}
+
+std::string hex (uint64_t value)
+{
+    std::ostringstream s;
+    s << std::hex << std::setw (16) << std::setfill ('0') << value;
+
+    return s.str ();
+}
+
+std::string deviceString (cl_device_id device, cl_device_info param)
+{
+    size_t size = 0;
+    if (clGetDeviceInfo (device, param, 0, NULL, &size) != CL_SUCCESS)
+        return "";
+
+    std::string value (size, '\0');
+    clGetDeviceInfo (device, param, size, &value[0], NULL);
+
+    return value.c_str ();
+}
+
+// Returns the cache directory (creating it, if needed), or an empty string,
+// if there is nowhere to put it
+std::string cacheDir ()
+{
+    std::string dir;
+    if (const char *env = std::getenv ("KINECTFILTER_CACHE_DIR"))
+        dir = env;
+    else if (const char *xdg = std::getenv ("XDG_CACHE_HOME"))
+        dir = std::string (xdg) + "/kinectFilter";
+    else if (const char *home = std::getenv ("HOME"))
+    {
+        mkdir ((std::string (home) + "/.cache").c_str (), 0755);
+        dir = std::string (home) + "/.cache/kinectFilter";
+    }
+
+    if (dir.empty () || (mkdir (dir.c_str (), 0755) != 0 && access (dir.c_str (), W_OK) != 0))
+        return "";
+
+    return dir;
+}
+
+// Builds prog for device, and gets the log on failure
+cl_int build (cl_program prog, cl_device_id device, const std::string &options, std::string *log)
+{
+    cl_int status = clBuildProgram (prog, 1, &device, options.c_str (), NULL, NULL);
+    if (status != CL_SUCCESS && log)
+    {
+        size_t size = 0;
+        clGetProgramBuildInfo (prog, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &size);
+        log->assign (size, '\0');
+        clGetProgramBuildInfo (prog, device, CL_PROGRAM_BUILD_LOG, size, &(*log)[0], NULL);
+    }
+
+    return status;
+}
+
+// Reads a cached binary. The file starts with the magic and the full key, so
+// that a hash collision (or a truncated file) is caught before the binary is used
+bool readBinary (const std::string &path, const std::string &key, std::vector<unsigned char> &binary)
+{
+    std::ifstream file (path.c_str (), std::ios::binary);
+    if (!file)
+        return false;
+
+    std::string magic, storedKey;
+    uint64_t keySize = 0, binarySize = 0;
+    magic.resize (sizeof (cacheMagic));
+    file.read (&magic[0], magic.size ());
+    file.read (reinterpret_cast<char *> (&keySize), sizeof (keySize));
+    if (!file || magic != std::string (cacheMagic, sizeof (cacheMagic)) || keySize != key.size ())
+        return false;
+
+    storedKey.resize (keySize);
+    file.read (&storedKey[0], keySize);
+    file.read (reinterpret_cast<char *> (&binarySize), sizeof (binarySize));
+    if (!file || storedKey != key || binarySize == 0)
+        return false;
+
+    binary.resize (binarySize);
+    file.read (reinterpret_cast<char *> (binary.data ()), binarySize);
+
+    return file.gcount () == (std::streamsize) binarySize;
+}
+
+// Writes the binary of a built program to the cache. The file gets written
+// under a temporary name, and renamed into place, so that a process that
+// gets killed halfway through never leaves a partial file behind
+void writeBinary (const std::string &path, const std::string &key, cl_program prog)
+{
+    size_t binarySize = 0;
+    if (clGetProgramInfo (prog, CL_PROGRAM_BINARY_SIZES, sizeof (binarySize), &binarySize, NULL) != CL_SUCCESS ||
+        binarySize == 0)
+        return;
+
+    std::vector<unsigned char> binary (binarySize);
+    unsigned char *binaries[] = { binary.data () };
+    if (clGetProgramInfo (prog, CL_PROGRAM_BINARIES, sizeof (binaries), binaries, NULL) != CL_SUCCESS)
+        return;
+
+    std::ostringstream tmp;
+    tmp << path << ".tmp" << getpid ();
+
+    {
+        std::ofstream file (tmp.str ().c_str (), std::ios::binary);
+        uint64_t keySize = key.size (), size = binarySize;
+        file.write (cacheMagic, sizeof (cacheMagic));
+        file.write (reinterpret_cast<const char *> (&keySize), sizeof (keySize));
+        file.write (key.data (), key.size ());
+        file.write (reinterpret_cast<const char *> (&size), sizeof (size));
+        file.write (reinterpret_cast<const char *> (binary.data ()), binarySize);
+        if (!file)
+        {
+            file.close ();
+            std::remove (tmp.str ().c_str ());
+            return;
+        }
+    }
+
+    if (std::rename (tmp.str ().c_str (), path.c_str ()) != 0)
+        std::remove (tmp.str ().c_str ());
+}
+
+}
+
+
+cl_program buildCachedProgram (cl_context context, cl_device_id device,
+                               const std::string &source, const std::string &options,
+                               cl_int *status, std::string *log)
+{
+    // The source hash stands in for the source in the key
+    std::string key = deviceString (device, CL_DEVICE_NAME) + '\n' +
+                      deviceString (device, CL_DRIVER_VERSION) + '\n' +
+                      options + '\n' + hex (hash (source));
+
+    const std::string dir = cacheDir ();
+    const std::string path = dir.empty () ? "" : dir + "/" + hex (hash (key)) + ".bin";
+
+    std::vector<unsigned char> binary;
+    if (!path.empty () && readBinary (path, key, binary))
+    {
+        const unsigned char *binaries[] = { binary.data () };
+        size_t size = binary.size ();
+        cl_int binaryStatus, err;
+
+        cl_program prog = clCreateProgramWithBinary (context, 1, &device, &size, binaries, &binaryStatus, &err);
+        if (err == CL_SUCCESS && binaryStatus == CL_SUCCESS &&
+            build (prog, device, options, NULL) == CL_SUCCESS)
+        {
+            *status = CL_SUCCESS;
+            return prog;
+        }
+
+        // The binary got rejected (e.g. a driver update that kept the
+        // version string), so it gets replaced after the source build
+        if (prog)
+            clReleaseProgram (prog);
+    }
+
+    const char *src = source.c_str ();
+    size_t length = source.length ();
+    cl_program prog = clCreateProgramWithSource (context, 1, &src, &length, status);
+    if (*status != CL_SUCCESS)
+        return prog;
+
+    *status = build (prog, device, options, log);
+    if (*status == CL_SUCCESS && !path.empty ())
+        writeBinary (path, key, prog);
+
+    return prog;
+}
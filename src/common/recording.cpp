@@ -0,0 +1,381 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: recording.cpp
+ * File description: Implementation of the Recorder and ReplayDevice classes.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef KINECTFILTER_LZ4
+#include <lz4.h>
+#endif
+#include <kinectFilter/recording.hpp>
+
+
+namespace
+{
+
+const char recordingMagic[8] = "KFREC1";
+
+// The payloads are padded to 8 bytes, so that the headers stay aligned
+size_t padded (size_t size)
+{
+    return (size + 7) & ~size_t (7);
+}
+
+uint64_t hostTime ()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds> (
+        std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+}
+
+}
+
+
+Recorder::Recorder (const std::string &fileName, uint32_t width, uint32_t height, 
+                    bool compressDepth, size_t queueFrames) 
+    : compressDepth (compressDepth), failed (false), droppedFrames (0), 
+      slots (std::max (queueFrames, size_t (1))), head (0), tail (0), count (0), stopping (false)
+{
+    #ifndef KINECTFILTER_LZ4
+    this->compressDepth = false;
+    #endif
+
+    file = std::fopen (fileName.c_str (), "wb");
+    if (!file)
+        throw std::runtime_error ("Recorder: " + fileName + ": " + std::strerror (errno));
+
+    RecordingHeader header;
+    std::memcpy (header.magic, recordingMagic, sizeof (recordingMagic));
+    header.width = width;
+    header.height = height;
+    if (std::fwrite (&header, sizeof (header), 1, file) != 1)
+    {
+        std::fclose (file);
+        throw std::runtime_error ("Recorder: " + fileName + ": " + std::strerror (errno));
+    }
+
+    writer = std::thread (&Recorder::run, this);
+}
+
+
+Recorder::~Recorder ()
+{
+    {
+        std::lock_guard<std::mutex> lock (mutex);
+        stopping = true;
+    }
+    ready.notify_one ();
+    writer.join ();
+
+    std::fclose (file);
+
+    if (droppedFrames)
+        std::cerr << "Recorder: " << droppedFrames << " frames dropped (the disk couldn't keep up)" << std::endl;
+}
+
+
+void Recorder::writeRGB (const uint8_t *rgb, size_t size, uint32_t timestamp)
+{
+    enqueue (RecordedFrame::RGB, rgb, size, timestamp);
+}
+
+
+void Recorder::writeDepth (const uint16_t *depth, size_t size, uint32_t timestamp)
+{
+    enqueue (RecordedFrame::DEPTH, reinterpret_cast<const uint8_t *> (depth), size, timestamp);
+}
+
+
+void Recorder::enqueue (RecordedFrame::Stream stream, const uint8_t *payload, size_t size, uint32_t timestamp)
+{
+    const uint64_t arrival = hostTime ();
+    if (failed)
+        return;
+
+    std::lock_guard<std::mutex> producer (producerMutex);
+    {
+        std::lock_guard<std::mutex> lock (mutex);
+        if (count == slots.size ())
+        {
+            ++droppedFrames;
+            return;
+        }
+    }
+
+    // The slot at head is out of the reach of the writer until count covers it
+    Pending &pending = slots[head];
+    RecordedFrame frame = { stream, RecordedFrame::RAW, timestamp, 
+                            (uint32_t) size, (uint32_t) size, 0, arrival };
+    pending.frame = frame;
+    pending.payload.assign (payload, payload + size);
+    head = (head + 1) % slots.size ();
+
+    {
+        std::lock_guard<std::mutex> lock (mutex);
+        ++count;
+    }
+    ready.notify_one ();
+}
+
+
+void Recorder::run ()
+{
+    std::unique_lock<std::mutex> lock (mutex);
+    while (true)
+    {
+        // On stopping, the queue gets drained first
+        ready.wait (lock, [this] { return count > 0 || stopping; });
+        if (count == 0)
+            break;
+
+        lock.unlock ();
+        writeFrame (slots[tail]);
+        tail = (tail + 1) % slots.size ();
+        lock.lock ();
+
+        --count;
+    }
+}
+
+
+void Recorder::writeFrame (Pending &pending)
+{
+    RecordedFrame &frame = pending.frame;
+    if (frame.stream == RecordedFrame::RGB || !compressDepth)
+    {
+        write (frame, pending.payload.data ());
+        return;
+    }
+
+    #ifdef KINECTFILTER_LZ4
+    const uint16_t *depth = reinterpret_cast<const uint16_t *> (pending.payload.data ());
+    const size_t size = frame.rawSize;
+
+    // Neighboring pixels are mostly at the same depth, so the differences are 
+    // small, and their high bytes are nearly all 0x00 or 0xFF
+    const size_t n = size / 2;
+    planes.resize (size);
+    uint16_t previous = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        uint16_t delta = depth[i] - previous;
+        previous = depth[i];
+        planes[i] = delta & 0xFF;
+        planes[n + i] = delta >> 8;
+    }
+
+    packed.resize (LZ4_compressBound (size));
+    int packedSize = LZ4_compress_default (reinterpret_cast<const char *> (planes.data ()), 
+                                           reinterpret_cast<char *> (packed.data ()), size, packed.size ());
+    if (packedSize <= 0)
+    {
+        write (frame, pending.payload.data ());
+        return;
+    }
+
+    frame.encoding = RecordedFrame::DELTA_LZ4;
+    frame.size = packedSize;
+    write (frame, packed.data ());
+    #endif
+}
+
+
+void Recorder::write (RecordedFrame &frame, const uint8_t *payload)
+{
+    if (failed)
+        return;
+
+    static const uint8_t padding[8] = { 0 };
+    if (std::fwrite (&frame, sizeof (frame), 1, file) != 1 || 
+        std::fwrite (payload, 1, frame.size, file) != frame.size || 
+        std::fwrite (padding, 1, padded (frame.size) - frame.size, file) != padded (frame.size) - frame.size)
+    {
+        // The recording ends at the last complete frame
+        std::cerr << "Recorder: " << std::strerror (errno) << ", the recording stops" << std::endl;
+        failed = true;
+    }
+}
+
+
+ReplayDevice::ReplayDevice (const std::string &fileName, bool maxSpeed, bool loop) 
+    : data (NULL), mappedSize (0), maxSpeed (maxSpeed), loop (loop), running (false)
+{
+    int fd = open (fileName.c_str (), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error ("ReplayDevice: " + fileName + ": " + std::strerror (errno));
+
+    struct stat info;
+    if (fstat (fd, &info) != 0 || info.st_size < (off_t) sizeof (RecordingHeader))
+    {
+        close (fd);
+        throw std::runtime_error ("ReplayDevice: " + fileName + " is not a recording");
+    }
+
+    mappedSize = info.st_size;
+    void *memory = mmap (NULL, mappedSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (memory == MAP_FAILED)
+        throw std::runtime_error ("ReplayDevice: mmap " + fileName + ": " + std::strerror (errno));
+    data = static_cast<const uint8_t *> (memory);
+
+    // The frames get read in order
+    madvise (memory, mappedSize, MADV_SEQUENTIAL);
+
+    const RecordingHeader *header = reinterpret_cast<const RecordingHeader *> (data);
+    if (std::memcmp (header->magic, recordingMagic, sizeof (recordingMagic)) != 0)
+    {
+        munmap (memory, mappedSize);
+        throw std::runtime_error ("ReplayDevice: " + fileName + " is not a recording");
+    }
+
+    // Index the frames. A recording that got cut short ends at its last complete frame
+    size_t offset = sizeof (RecordingHeader);
+    while (offset + sizeof (RecordedFrame) <= mappedSize)
+    {
+        const RecordedFrame *frame = reinterpret_cast<const RecordedFrame *> (data + offset);
+        size_t next = offset + sizeof (RecordedFrame) + padded (frame->size);
+        if (next > mappedSize)
+            break;
+
+        #ifndef KINECTFILTER_LZ4
+        if (frame->encoding == RecordedFrame::DELTA_LZ4)
+        {
+            munmap (memory, mappedSize);
+            throw std::runtime_error ("ReplayDevice: " + fileName + " has compressed frames (build with LZ4)");
+        }
+        #endif
+
+        frames.push_back (offset);
+        offset = next;
+    }
+
+    if (frames.empty ())
+    {
+        munmap (memory, mappedSize);
+        throw std::runtime_error ("ReplayDevice: " + fileName + " has no frames");
+    }
+}
+
+
+ReplayDevice::~ReplayDevice ()
+{
+    stop ();
+    munmap (const_cast<uint8_t *> (data), mappedSize);
+}
+
+
+void ReplayDevice::start ()
+{
+    if (running)
+        return;
+
+    running = true;
+    thread = std::thread (&ReplayDevice::run, this);
+}
+
+
+void ReplayDevice::stop ()
+{
+    running = false;
+    if (thread.joinable ())
+        thread.join ();
+}
+
+
+uint32_t ReplayDevice::width () const
+{
+    return reinterpret_cast<const RecordingHeader *> (data)->width;
+}
+
+
+uint32_t ReplayDevice::height () const
+{
+    return reinterpret_cast<const RecordingHeader *> (data)->height;
+}
+
+
+void ReplayDevice::run ()
+{
+    const uint64_t origin = reinterpret_cast<const RecordedFrame *> (data + frames[0])->hostTime;
+
+    do
+    {
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+
+        for (size_t offset : frames)
+        {
+            const RecordedFrame *frame = reinterpret_cast<const RecordedFrame *> (data + offset);
+            const uint8_t *payload = data + offset + sizeof (RecordedFrame);
+            const bool rgb = frame->stream == RecordedFrame::RGB;
+
+            // Keep the pace of the recording, or wait for the consumer 
+            // (so that no frame gets dropped)
+            if (maxSpeed)
+                while (running && (rgb ? rgbPending () : depthPending ()))
+                    std::this_thread::yield ();
+            else
+                std::this_thread::sleep_until (start + std::chrono::nanoseconds (frame->hostTime - origin));
+
+            if (!running)
+                return;
+
+            if (rgb)
+                deliverRGB (payload, frame->rawSize, frame->timestamp);
+            else if (frame->encoding == RecordedFrame::RAW)
+                deliverDepth (reinterpret_cast<const uint16_t *> (payload), frame->rawSize, frame->timestamp);
+            else
+            {
+                decodeDepth (*frame, payload);
+                deliverDepth (depth.data (), frame->rawSize, frame->timestamp);
+            }
+        }
+    } while (loop && running);
+}
+
+
+void ReplayDevice::decodeDepth (const RecordedFrame &frame, const uint8_t *payload)
+{
+    const size_t n = frame.rawSize / 2;
+    planes.resize (frame.rawSize);
+    depth.resize (n);
+
+    #ifdef KINECTFILTER_LZ4
+    int size = LZ4_decompress_safe (reinterpret_cast<const char *> (payload), 
+                                    reinterpret_cast<char *> (planes.data ()), frame.size, frame.rawSize);
+    if (size != (int) frame.rawSize)
+    {
+        // A corrupt frame (replay a blank one)
+        std::fill (depth.begin (), depth.end (), 0);
+        return;
+    }
+    #else
+    (void) payload;
+    #endif
+
+    uint16_t previous = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        previous += planes[i] | (planes[n + i] << 8);
+        depth[i] = previous;
+    }
+}
@@ -0,0 +1,72 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: resolution.cpp
+ * File description: Implementation of the resolution selection.
+ */
+
+#include <iostream>
+#include <kinectFilter/resolution.hpp>
+
+
+void frameDimensions (const ReplayDevice *replay, freenect_resolution resolution, 
+                      int &width, int &height)
+{
+    if (replay)
+    {
+        width = replay->width ();
+        height = replay->height ();
+        return;
+    }
+
+    const freenect_frame_mode mode = freenect_find_video_mode (resolution, FREENECT_VIDEO_RGB);
+    width = mode.width;
+    height = mode.height;
+}
+
+
+void toggleResolution (KinectDevice *device, bool recording, freenect_resolution &resolution, 
+                       int levels, const Resize &resize)
+{
+    if (!device || recording)
+    {
+        std::cout << "The resolution is fixed on a replay, and during a recording" << std::endl;
+        return;
+    }
+
+    resolution = (resolution == FREENECT_RESOLUTION_HIGH) ? 
+        FREENECT_RESOLUTION_MEDIUM : FREENECT_RESOLUTION_HIGH;
+
+    device->stopVideo ();
+    device->setVideoFormat (FREENECT_VIDEO_RGB, resolution);
+
+    // The frames in flight get dropped before the slots get touched
+    int width, height;
+    frameDimensions (NULL, resolution, width, height);
+    resize (width, height, levels);
+
+    device->discardRGB ();
+
+    device->startVideo ();
+}
+
+
+void nextPyramidLevel (const ReplayDevice *replay, freenect_resolution resolution, 
+                       int &levels, const Resize &resize)
+{
+    levels = (levels + 1) % (maxPyramidLevels + 1);
+
+    int width, height;
+    frameDimensions (replay, resolution, width, height);
+    resize (width, height, levels);
+}
@@ -0,0 +1,206 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: shmRing.cpp
+ * File description: Implementation of the shared memory ring.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <kinectFilter/shmRing.hpp>
+
+
+namespace
+{
+
+const char ringMagic[8] = "KFRING1";
+
+// The descriptors and the payloads start on cache line boundaries
+const size_t alignment = 64;
+
+size_t alignUp (size_t value)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// Returns the offset of the first slot
+size_t slotsOffset ()
+{
+    return alignUp (sizeof (ShmRingHeader));
+}
+
+size_t payloadOffset ()
+{
+    return alignUp (sizeof (ShmRingSlot));
+}
+
+}
+
+
+ShmRing::ShmRing (const std::string &name, uint32_t slotCount, uint32_t slotSize) 
+    : name (name), header (NULL), next (1)
+{
+    const size_t slotStride = payloadOffset () + alignUp (slotSize);
+    mappedSize = slotsOffset () + slotCount * slotStride;
+
+    // A previous object (e.g. of a process that got killed) gets replaced
+    shm_unlink (name.c_str ());
+    int fd = shm_open (name.c_str (), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0)
+        throw std::runtime_error ("ShmRing: shm_open " + name + ": " + std::strerror (errno));
+
+    if (ftruncate (fd, mappedSize) != 0)
+    {
+        close (fd);
+        shm_unlink (name.c_str ());
+        throw std::runtime_error ("ShmRing: ftruncate " + name + ": " + std::strerror (errno));
+    }
+
+    void *memory = mmap (NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close (fd);
+    if (memory == MAP_FAILED)
+    {
+        shm_unlink (name.c_str ());
+        throw std::runtime_error ("ShmRing: mmap " + name + ": " + std::strerror (errno));
+    }
+
+    // The object starts zeroed, so head and the sequence numbers of the slots are 0
+    header = static_cast<ShmRingHeader *> (memory);
+    header->slotCount = slotCount;
+    header->slotStride = slotStride;
+    header->slotSize = slotSize;
+
+    // The magic goes in last, so that a reader never sees a half-set header
+    std::atomic_thread_fence (std::memory_order_release);
+    std::memcpy (header->magic, ringMagic, sizeof (ringMagic));
+}
+
+
+ShmRing::~ShmRing ()
+{
+    munmap (header, mappedSize);
+    shm_unlink (name.c_str ());
+}
+
+
+uint8_t *ShmRing::begin ()
+{
+    ShmRingSlot *s = slot (next);
+
+    // The readers of the previous frame in the slot see the change of the 
+    // sequence number before any of the new data
+    s->sequence.store (0, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_release);
+
+    return reinterpret_cast<uint8_t *> (s) + payloadOffset ();
+}
+
+
+void ShmRing::publish (uint32_t size, uint32_t width, uint32_t height, 
+                       ShmRingSlot::Format format, uint32_t source)
+{
+    timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+
+    ShmRingSlot *s = slot (next);
+    s->timestamp = now.tv_sec * 1000000000ULL + now.tv_nsec;
+    s->size = size;
+    s->width = width;
+    s->height = height;
+    s->format = format;
+    s->source = source;
+
+    s->sequence.store (next, std::memory_order_release);
+    header->head.store (next, std::memory_order_release);
+    ++next;
+}
+
+
+ShmRingSlot *ShmRing::slot (uint64_t sequence)
+{
+    return reinterpret_cast<ShmRingSlot *> (reinterpret_cast<uint8_t *> (header) + 
+        slotsOffset () + (sequence % header->slotCount) * header->slotStride);
+}
+
+
+ShmRingReader::ShmRingReader (const std::string &name) : header (NULL)
+{
+    int fd = shm_open (name.c_str (), O_RDONLY, 0);
+    if (fd < 0)
+        throw std::runtime_error ("ShmRingReader: shm_open " + name + ": " + std::strerror (errno));
+
+    // Map the header first, to find out the size of the ring
+    void *memory = mmap (NULL, sizeof (ShmRingHeader), PROT_READ, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED)
+    {
+        close (fd);
+        throw std::runtime_error ("ShmRingReader: mmap " + name + ": " + std::strerror (errno));
+    }
+
+    const ShmRingHeader *h = static_cast<const ShmRingHeader *> (memory);
+    if (std::memcmp (h->magic, ringMagic, sizeof (ringMagic)) != 0)
+    {
+        munmap (memory, sizeof (ShmRingHeader));
+        close (fd);
+        throw std::runtime_error ("ShmRingReader: " + name + " is not a frame ring");
+    }
+    std::atomic_thread_fence (std::memory_order_acquire);
+    mappedSize = slotsOffset () + (size_t) h->slotCount * h->slotStride;
+    munmap (memory, sizeof (ShmRingHeader));
+
+    memory = mmap (NULL, mappedSize, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (memory == MAP_FAILED)
+        throw std::runtime_error ("ShmRingReader: mmap " + name + ": " + std::strerror (errno));
+
+    header = static_cast<const ShmRingHeader *> (memory);
+}
+
+
+ShmRingReader::~ShmRingReader ()
+{
+    munmap (const_cast<ShmRingHeader *> (header), mappedSize);
+}
+
+
+uint64_t ShmRingReader::head () const
+{
+    return header->head.load (std::memory_order_acquire);
+}
+
+
+const ShmRingSlot *ShmRingReader::frame (uint64_t sequence, const uint8_t *&data) const
+{
+    const ShmRingSlot *s = reinterpret_cast<const ShmRingSlot *> (
+        reinterpret_cast<const uint8_t *> (header) + slotsOffset () + 
+        (sequence % header->slotCount) * header->slotStride);
+
+    if (sequence == 0 || s->sequence.load (std::memory_order_acquire) != sequence)
+        return NULL;
+
+    data = reinterpret_cast<const uint8_t *> (s) + payloadOffset ();
+    return s;
+}
+
+
+bool ShmRingReader::intact (const ShmRingSlot *slot, uint64_t sequence) const
+{
+    // The reads of the payload complete before the sequence number gets checked
+    std::atomic_thread_fence (std::memory_order_acquire);
+    return slot->sequence.load (std::memory_order_relaxed) == sequence;
+}
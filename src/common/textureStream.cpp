@@ -0,0 +1,148 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries: 
+ *              libfreenect, OpenGL, OpenCL. There is a number of 
+ *              applications that use a Kinect sensor as a camera, process the 
+ *              data stream from Kinect on the GPU with OpenCL, and display the 
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: textureStream.cpp
+ * File description: Implementation of the TextureStream class.
+ */
+
+#include <stdexcept>
+#include <kinectFilter/textureStream.hpp>
+
+
+TextureStream::TextureStream (GLuint texture, GLenum format, size_t slotSize, int slotCount) 
+    : texture (texture), format (format), slotSize (slotSize), width (0), height (0), 
+      current (0), mapped (NULL), persistentMap (NULL), fences (slotCount, (GLsync) 0)
+{
+    if (!GLEW_ARB_pixel_buffer_object)
+        throw std::runtime_error ("TextureStream: ARB_pixel_buffer_object isn't supported");
+
+    if (GLEW_ARB_buffer_storage && GLEW_ARB_sync)
+    {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+        buffers.resize (1);
+        glGenBuffers (1, buffers.data ());
+        glBindBuffer (GL_PIXEL_UNPACK_BUFFER, buffers[0]);
+        glBufferStorage (GL_PIXEL_UNPACK_BUFFER, slotCount * slotSize, NULL, flags);
+        persistentMap = static_cast<uint8_t *> (
+            glMapBufferRange (GL_PIXEL_UNPACK_BUFFER, 0, slotCount * slotSize, flags));
+        glBindBuffer (GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    // Without the persistent mapping, each slot is a buffer of its own
+    if (!persistentMap)
+    {
+        if (!buffers.empty ())
+            glDeleteBuffers (buffers.size (), buffers.data ());
+
+        buffers.resize (slotCount);
+        glGenBuffers (slotCount, buffers.data ());
+        for (GLuint buffer : buffers)
+        {
+            glBindBuffer (GL_PIXEL_UNPACK_BUFFER, buffer);
+            glBufferData (GL_PIXEL_UNPACK_BUFFER, slotSize, NULL, GL_STREAM_DRAW);
+        }
+        glBindBuffer (GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+}
+
+
+TextureStream::~TextureStream ()
+{
+    for (GLsync fence : fences)
+        if (fence)
+            glDeleteSync (fence);
+
+    if (persistentMap || mapped)
+    {
+        glBindBuffer (GL_PIXEL_UNPACK_BUFFER, buffers[persistentMap ? 0 : current]);
+        glUnmapBuffer (GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer (GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    glDeleteBuffers (buffers.size (), buffers.data ());
+}
+
+
+uint8_t *TextureStream::begin ()
+{
+    if (mapped)
+        return mapped;
+
+    if (persistentMap)
+    {
+        // Wait for the last transfer out of the slot
+        if (GLsync &fence = fences[current])
+        {
+            while (glClientWaitSync (fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+                ;
+            glDeleteSync (fence);
+            fence = 0;
+        }
+
+        mapped = persistentMap + current * slotSize;
+    }
+    else
+    {
+        // Orphaning the storage leaves any transfer still reading
+        // from it alone, so the mapping never waits
+        glBindBuffer (GL_PIXEL_UNPACK_BUFFER, buffers[current]);
+        glBufferData (GL_PIXEL_UNPACK_BUFFER, slotSize, NULL, GL_STREAM_DRAW);
+        mapped = static_cast<uint8_t *> (glMapBufferRange (GL_PIXEL_UNPACK_BUFFER, 0, slotSize, 
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+        glBindBuffer (GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    return mapped;
+}
+
+
+void TextureStream::commit (GLsizei width, GLsizei height)
+{
+    if (!mapped)
+        return;
+
+    glBindTexture (GL_TEXTURE_2D, texture);
+
+    // The texture gets (re)allocated only when the dimensions change
+    if (width != this->width || height != this->height)
+    {
+        glTexImage2D (GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, NULL);
+        this->width = width;
+        this->height = height;
+    }
+
+    glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
+
+    const GLvoid *offset;
+    if (persistentMap)
+    {
+        glBindBuffer (GL_PIXEL_UNPACK_BUFFER, buffers[0]);
+        offset = reinterpret_cast<const GLvoid *> (current * slotSize);
+    }
+    else
+    {
+        glBindBuffer (GL_PIXEL_UNPACK_BUFFER, buffers[current]);
+        glUnmapBuffer (GL_PIXEL_UNPACK_BUFFER);
+        offset = NULL;
+    }
+
+    glTexSubImage2D (GL_TEXTURE_2D, 0, 0, 0, width, height, format, GL_UNSIGNED_BYTE, offset);
+    glBindBuffer (GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (persistentMap)
+        fences[current] = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    mapped = NULL;
+    current = (current + 1) % fences.size ();
+}
@@ -0,0 +1,642 @@
+/**
+ * Name: KinectFilter
+ * Author: Nick Lamprianidis <nlamprian@gmail.com>
+ * Version: 2.0
+ * Description: This project brings together the following libraries:
+ *              libfreenect, OpenGL, OpenCL. There is a number of
+ *              applications that use a Kinect sensor as a camera, process the
+ *              data stream from Kinect on the GPU with OpenCL, and display the
+ *              processed stream in a graphical window.
+ * Source: https://github.com/nlamprian/KinectFilter
+ * License: Copyright (c) 2014-2015 Nick Lamprianidis
+ *          This code is licensed under the GPL v2 license
+ *
+ * Filename: kinectFilter_bench.cpp
+ * File description: Offline benchmark for the kernels in kernels.cl.
+ *                   It needs neither a Kinect nor an OpenGL context. It runs
+ *                   the kernels on synthetic (or recorded) frames, sweeping
+ *                   the device, the resolution, the filter width and the
+ *                   work-group size, and reports the throughput of each run.
+ *                   With --cpu, it runs the CPU backend (see CpuFilter) 
+ *                   as well, with each instruction set the processor supports.
+ *
+ * Usage: kinectFilter_bench [--device <platform>:<device>] [--iterations <n>]
+ *                           [--rgb <file>] [--depth <file>] [--kernels <file>]
+ *                           [--cpu] [--csv]
+ *        The recorded frames are raw 640x480 dumps (RGB888 and 16-bit depth),
+ *        as delivered by libfreenect. They get resampled to each resolution.
+ *        --kernels reads the kernel source from a file, instead of the copy
+ *        embedded in the executable.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstdint>
+#include <chrono>
+#include <functional>
+
+#define __CL_ENABLE_EXCEPTIONS
+
+#if defined(__APPLE__) || defined(__MACOSX)
+#include <OpenCL/cl.hpp>
+#else
+#include <CL/cl.hpp>
+#endif
+#include <kinectFilter/programCache.hpp>
+#include <kinectFilter/cpuFilter.hpp>
+
+
+// Benchmark parameters
+const int resolutions[][2] = { { 320, 240 }, { 640, 480 }, { 1280, 960 } };
+const int filterWidths[] = { 3, 5, 7, 9 };
+const int localDims[] = { 8, 16, 32 };
+
+// The recorded frames have the resolution of the Kinect streams
+const int recWidth = 640;
+const int recHeight = 480;
+
+int iterations = 100;
+bool csv = false;
+
+
+// The results of a single run
+struct Result
+{
+    std::string kernel;
+    int width, height;
+    int filterWidth;
+    int localDim;
+    double ms;      // Average execution time
+    double bytes;   // Bytes read and written by a run
+};
+
+
+// Prints a result, either as a table row or as a CSV line
+void printResult (const std::string &device, const Result &r)
+{
+    const double pixels = r.width * r.height;
+    const double mpps = pixels / (r.ms * 1e3);
+    const double gbps = r.bytes / (r.ms * 1e6);
+
+    if (csv)
+    {
+        std::cout << device << "," << r.kernel << "," << r.width << "x" << r.height << ","
+                  << r.filterWidth << "," << r.localDim << "," << r.ms << ","
+                  << mpps << "," << gbps << std::endl;
+        return;
+    }
+
+    std::ostringstream res, fw, lws;
+    res << r.width << "x" << r.height;
+    if (r.filterWidth) fw << r.filterWidth; else fw << "-";
+    if (r.localDim) lws << r.localDim << "x" << r.localDim; else lws << "-";
+
+    std::cout << std::left << std::setw (18) << r.kernel
+              << std::setw (11) << res.str () << std::setw (8) << fw.str ()
+              << std::setw (8) << lws.str () << std::right << std::fixed
+              << std::setprecision (3) << std::setw (10) << r.ms
+              << std::setprecision (1) << std::setw (12) << mpps
+              << std::setprecision (2) << std::setw (10) << gbps << std::endl;
+}
+
+
+// Reads a raw recorded frame, or returns an empty vector if there is no file
+template <typename T>
+std::vector<T> readFrame (const std::string &fileName, size_t count)
+{
+    std::vector<T> frame;
+    if (fileName.empty ())
+        return frame;
+
+    std::ifstream file (fileName.c_str (), std::ios::binary);
+    frame.resize (count);
+    if (!file.read (reinterpret_cast<char *> (frame.data ()), count * sizeof (T)))
+    {
+        std::cerr << "Failed to read " << count * sizeof (T)
+                  << " bytes from " << fileName << std::endl;
+        exit (EXIT_FAILURE);
+    }
+
+    return frame;
+}
+
+
+// Resamples (nearest neighbor) a recorded frame to the given resolution
+template <typename T>
+std::vector<T> resample (const std::vector<T> &frame, int channels, int width, int height)
+{
+    std::vector<T> out (channels * width * height);
+
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+        {
+            const int sx = x * recWidth / width;
+            const int sy = y * recHeight / height;
+            for (int c = 0; c < channels; ++c)
+                out[channels * (y * width + x) + c] = frame[channels * (sy * recWidth + sx) + c];
+        }
+
+    return out;
+}
+
+
+// A class that runs the kernels on a single device
+class Bench
+{
+public:
+    Bench (const cl::Device &device, const std::string &programCode) : device (device)
+    {
+        context = cl::Context (device);
+        queue = cl::CommandQueue (context, device, CL_QUEUE_PROFILING_ENABLE);
+        sampler = cl::Sampler (context, CL_FALSE, CL_ADDRESS_CLAMP_TO_EDGE, CL_FILTER_NEAREST);
+
+        cl_int status;
+        std::string log;
+        program = cl::Program (buildCachedProgram (context (), device (), programCode, "", &status, &log));
+        if (status != CL_SUCCESS)
+        {
+            std::cerr << "clBuildProgram (" << status << ")" << std::endl;
+            std::cout << log << std::endl;
+            exit (EXIT_FAILURE);
+        }
+
+        maxWorkGroupSize = device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE> ();
+        localMemSize = device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE> ();
+    }
+
+    // Runs all the kernels at the given resolution,
+    // and returns the results of every configuration
+    std::vector<Result> run (int width, int height,
+                             const std::vector<uint8_t> &rgb, const std::vector<uint16_t> &depth)
+    {
+        std::vector<Result> results;
+
+        const size_t pixels = width * height;
+        cl::ImageFormat gray (CL_R, CL_UNSIGNED_INT8);
+        cl::ImageFormat rgbaf (CL_RGBA, CL_FLOAT);
+
+        // Source data
+        std::vector<uint8_t> grayFrame (pixels);
+        for (size_t i = 0; i < pixels; ++i)
+            grayFrame[i] = (uint8_t) (0.299f * rgb[3 * i] + 0.587f * rgb[3 * i + 1] + 0.114f * rgb[3 * i + 2]);
+
+        cl::size_t<3> origin, region;
+        origin[0] = origin[1] = origin[2] = 0;
+        region[0] = width; region[1] = height; region[2] = 1;
+
+        cl::Image2D imageGray (context, CL_MEM_READ_ONLY, gray, width, height);
+        cl::Image2D imageOut (context, CL_MEM_WRITE_ONLY, gray, width, height);
+        cl::Image2D imageOutF (context, CL_MEM_WRITE_ONLY, rgbaf, width, height);
+        cl::Buffer bufferRGB (context, CL_MEM_READ_ONLY, 3 * pixels);
+        cl::Buffer bufferRGBA (context, CL_MEM_READ_WRITE, sizeof (cl_float4) * pixels);
+        cl::Buffer bufferRGBANorm (context, CL_MEM_WRITE_ONLY, sizeof (cl_float4) * pixels);
+        cl::Buffer bufferDepth (context, CL_MEM_READ_ONLY, sizeof (uint16_t) * pixels);
+        cl::Buffer bufferCloud (context, CL_MEM_WRITE_ONLY, sizeof (cl_float4) * pixels);
+        cl::Buffer bufferPacked (context, CL_MEM_WRITE_ONLY, 12 * pixels);
+        cl::Buffer bufferRays (context, CL_MEM_READ_WRITE, sizeof (cl_float2) * pixels);
+
+        queue.enqueueWriteImage (imageGray, CL_FALSE, origin, region, 0, 0, (void *) grayFrame.data ());
+        queue.enqueueWriteBuffer (bufferRGB, CL_FALSE, 0, 3 * pixels, rgb.data ());
+        queue.enqueueWriteBuffer (bufferDepth, CL_TRUE, 0, sizeof (uint16_t) * pixels, depth.data ());
+
+        // The ray table for the nominal Kinect intrinsics
+        const float f = 595.f * width / recWidth;
+        cl_float4 intrinsics = { { f, f, (width - 1) / 2.f, (height - 1) / 2.f } };
+        cl_float4 distortion = { { 0.f, 0.f, 0.f, 0.f } };
+        cl::Kernel rays (program, "computeRays");
+        rays.setArg (0, bufferRays);
+        rays.setArg (1, intrinsics);
+        rays.setArg (2, distortion);
+        rays.setArg (3, 0.f);
+        queue.enqueueNDRangeKernel (rays, cl::NullRange, cl::NDRange (width, height), cl::NullRange);
+        queue.finish ();
+
+        for (int localDim : localDims)
+        {
+            // Skip the work-group sizes the device doesn't support,
+            // and the ones that don't divide the image (the buffer
+            // kernels require the workspace to match the image exactly)
+            if ((size_t) (localDim * localDim) > maxWorkGroupSize ||
+                width % localDim || height % localDim)
+                continue;
+
+            cl::NDRange global (width, height);
+            cl::NDRange local (localDim, localDim);
+
+            for (int fw : filterWidths)
+            {
+                // A box filter of the given width
+                std::vector<float> filter (fw * fw, 1.f / (fw * fw));
+                cl::Buffer bufferFilter (context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                         sizeof (float) * filter.size (), filter.data ());
+
+                cl::Kernel conv (program, "convolution");
+                conv.setArg (0, imageGray);
+                conv.setArg (1, imageOut);
+                conv.setArg (2, height);
+                conv.setArg (3, width);
+                conv.setArg (4, bufferFilter);
+                conv.setArg (5, fw);
+                conv.setArg (6, sampler);
+                results.push_back (measure (conv, global, local, "convolution", width, height, fw,
+                                            localDim, 2. * pixels));
+
+                const size_t tileSize = sizeof (float) * (localDim + fw - 1) * (localDim + fw - 1);
+                if (tileSize > localMemSize)
+                    continue;
+
+                cl::Kernel convTiled (program, "convolutionTiled");
+                convTiled.setArg (0, imageGray);
+                convTiled.setArg (1, imageOut);
+                convTiled.setArg (2, height);
+                convTiled.setArg (3, width);
+                convTiled.setArg (4, bufferFilter);
+                convTiled.setArg (5, fw);
+                convTiled.setArg (6, cl::Local (tileSize));
+                convTiled.setArg (7, sampler);
+                results.push_back (measure (convTiled, global, local, "convolutionTiled", width, height, fw,
+                                            localDim, 2. * pixels));
+
+                cl::Kernel convRGB (program, "convolutionRGB");
+                convRGB.setArg (0, bufferRGB);
+                convRGB.setArg (1, imageOut);
+                convRGB.setArg (2, height);
+                convRGB.setArg (3, width);
+                convRGB.setArg (4, bufferFilter);
+                convRGB.setArg (5, fw);
+                convRGB.setArg (6, cl::Local (tileSize));
+                results.push_back (measure (convRGB, global, local, "convolutionRGB", width, height, fw,
+                                            localDim, 4. * pixels));
+            }
+
+            cl::Kernel norm (program, "normalizeImg");
+            norm.setArg (0, imageGray);
+            norm.setArg (1, imageOutF);
+            norm.setArg (2, height);
+            norm.setArg (3, width);
+            norm.setArg (4, sampler);
+            results.push_back (measure (norm, global, local, "normalizeImg", width, height, 0,
+                                        localDim, (1. + sizeof (cl_float4)) * pixels));
+
+            cl::Kernel rgba (program, "rgb2rgba");
+            rgba.setArg (0, bufferRGB);
+            rgba.setArg (1, bufferRGBA);
+            rgba.setArg (2, height);
+            rgba.setArg (3, width);
+            results.push_back (measure (rgba, global, local, "rgb2rgba", width, height, 0,
+                                        localDim, (3. + sizeof (cl_float4)) * pixels));
+
+            cl::Kernel rgbNorm (program, "normalizeRGB");
+            rgbNorm.setArg (0, bufferRGBA);
+            rgbNorm.setArg (1, bufferRGBANorm);
+            rgbNorm.setArg (2, height);
+            rgbNorm.setArg (3, width);
+            results.push_back (measure (rgbNorm, global, local, "normalizeRGB", width, height, 0,
+                                        localDim, 2. * sizeof (cl_float4) * pixels));
+
+            cl::Kernel rgbaNorm (program, "rgb2rgbaNorm");
+            rgbaNorm.setArg (0, bufferRGB);
+            rgbaNorm.setArg (1, bufferRGBANorm);
+            rgbaNorm.setArg (2, height);
+            rgbaNorm.setArg (3, width);
+            results.push_back (measure (rgbaNorm, global, local, "rgb2rgbaNorm", width, height, 0,
+                                        localDim, (3. + sizeof (cl_float4)) * pixels));
+
+            cl::Kernel depthTo3D (program, "depthTo3D");
+            depthTo3D.setArg (0, bufferDepth);
+            depthTo3D.setArg (1, bufferCloud);
+            depthTo3D.setArg (2, f);
+            results.push_back (measure (depthTo3D, global, local, "depthTo3D", width, height, 0,
+                                        localDim, (sizeof (uint16_t) + sizeof (cl_float4)) * pixels));
+
+            cl::Kernel depthTo3DRays (program, "depthTo3DRays");
+            depthTo3DRays.setArg (0, bufferDepth);
+            depthTo3DRays.setArg (1, bufferRays);
+            depthTo3DRays.setArg (2, bufferCloud);
+            results.push_back (measure (depthTo3DRays, global, local, "depthTo3DRays", width, height, 0,
+                                        localDim, (sizeof (uint16_t) + sizeof (cl_float2) + sizeof (cl_float4)) * pixels));
+
+            cl::Kernel depthTo3DPacked (program, "depthTo3DPacked");
+            depthTo3DPacked.setArg (0, bufferDepth);
+            depthTo3DPacked.setArg (1, bufferRGB);
+            depthTo3DPacked.setArg (2, bufferPacked);
+            depthTo3DPacked.setArg (3, bufferRays);
+            depthTo3DPacked.setArg (4, (cl_uint) 0);
+            results.push_back (measure (depthTo3DPacked, global, local, "depthTo3DPacked", width, height, 0,
+                                        localDim, (sizeof (uint16_t) + sizeof (cl_float2) + 3. + 12.) * pixels));
+        }
+
+        // The vectorized kernels produce 8 pixels per work-item, and leave 
+        // the work-group size to the runtime (reported as 0)
+        cl::Buffer bufferGray (context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, pixels, grayFrame.data ());
+        cl::Buffer bufferOut (context, CL_MEM_WRITE_ONLY, pixels);
+        cl::NDRange globalVec ((width + 7) / 8, height);
+
+        for (int fw : filterWidths)
+        {
+            std::vector<float> filter (fw * fw, 1.f / (fw * fw));
+            cl::Buffer bufferFilter (context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                     sizeof (float) * filter.size (), filter.data ());
+
+            cl::Kernel convVec (program, "convolutionVec");
+            convVec.setArg (0, bufferGray);
+            convVec.setArg (1, bufferOut);
+            convVec.setArg (2, height);
+            convVec.setArg (3, width);
+            convVec.setArg (4, bufferFilter);
+            convVec.setArg (5, fw);
+            results.push_back (measure (convVec, globalVec, cl::NullRange, "convolutionVec", width, height, fw,
+                                        0, 2. * pixels));
+
+            cl::Kernel convRGBVec (program, "convolutionRGBVec");
+            convRGBVec.setArg (0, bufferRGB);
+            convRGBVec.setArg (1, bufferOut);
+            convRGBVec.setArg (2, height);
+            convRGBVec.setArg (3, width);
+            convRGBVec.setArg (4, bufferFilter);
+            convRGBVec.setArg (5, fw);
+            results.push_back (measure (convRGBVec, globalVec, cl::NullRange, "convolutionRGBVec", width, height, fw,
+                                        0, 4. * pixels));
+        }
+
+        return results;
+    }
+
+private:
+    // Executes a kernel a number of times (after a warm-up run),
+    // and returns the average execution time measured on the device
+    Result measure (cl::Kernel &kernel, const cl::NDRange &global, const cl::NDRange &local,
+                 const char *name, int width, int height, int filterWidth, int localDim, double bytes)
+    {
+        queue.enqueueNDRangeKernel (kernel, cl::NullRange, global, local);
+        queue.finish ();
+
+        std::vector<cl::Event> events (iterations);
+        for (int i = 0; i < iterations; ++i)
+            queue.enqueueNDRangeKernel (kernel, cl::NullRange, global, local, NULL, &events[i]);
+        queue.finish ();
+
+        double ns = 0.;
+        for (cl::Event &event : events)
+            ns += event.getProfilingInfo<CL_PROFILING_COMMAND_END> () -
+                  event.getProfilingInfo<CL_PROFILING_COMMAND_START> ();
+
+        Result r = { name, width, height, filterWidth, localDim, ns * 1e-6 / iterations, bytes };
+        return r;
+    }
+
+    cl::Device device;
+    cl::Context context;
+    cl::CommandQueue queue;
+    cl::Sampler sampler;
+    cl::Program program;
+    size_t maxWorkGroupSize;
+    cl_ulong localMemSize;
+};
+
+
+// A class that runs the CPU backend of the kernels, 
+// as a baseline for the devices (see CpuFilter)
+class CpuBench
+{
+public:
+    explicit CpuBench (CpuFilter &cpu) : cpu (cpu)
+    {
+    }
+
+    // Runs the kernels that the CPU backend has at the given resolution, 
+    // and returns the results (the work-group size is reported as 0)
+    std::vector<Result> run (int width, int height,
+                             const std::vector<uint8_t> &rgb, const std::vector<uint16_t> &depth)
+    {
+        std::vector<Result> results;
+
+        const size_t pixels = width * height;
+        std::vector<uint8_t> grayFrame (pixels), output (pixels);
+        std::vector<float> rgba (4 * pixels), cloud (4 * pixels);
+        cpu.rgb2gray (rgb.data (), grayFrame.data (), height, width);
+
+        for (int fw : filterWidths)
+        {
+            std::vector<float> filter (fw * fw, 1.f / (fw * fw));
+
+            results.push_back (measure ([&] {
+                cpu.convolve (grayFrame.data (), output.data (), height, width, filter.data (), fw);
+            }, "convolutionVec", width, height, fw, 2. * pixels));
+
+            results.push_back (measure ([&] {
+                cpu.convolveRGB (rgb.data (), output.data (), height, width, filter.data (), fw);
+            }, "convolutionRGBVec", width, height, fw, 4. * pixels));
+        }
+
+        results.push_back (measure ([&] {
+            cpu.rgb2gray (rgb.data (), output.data (), height, width);
+        }, "rgb2gray", width, height, 0, 4. * pixels));
+
+        results.push_back (measure ([&] {
+            cpu.normalizeRGB (rgb.data (), rgba.data (), height, width);
+        }, "rgb2rgbaNorm", width, height, 0, (3. + 4 * sizeof (float)) * pixels));
+
+        // The ray table for the nominal Kinect intrinsics (the one computeRays 
+        // gives without distortion, the same the device runs with)
+        const float f = 595.f * width / recWidth;
+        std::vector<float> rays (2 * pixels);
+        for (int y = 0; y < height; ++y)
+            for (int x = 0; x < width; ++x)
+            {
+                rays[2 * (y * width + x)] = (x - (width - 1) / 2.f) / f;
+                rays[2 * (y * width + x) + 1] = (y - (height - 1) / 2.f) / f;
+            }
+
+        results.push_back (measure ([&] {
+            cpu.depthTo3DRays (depth.data (), rays.data (), cloud.data (), height, width);
+        }, "depthTo3DRays", width, height, 0, (sizeof (uint16_t) + 2 * sizeof (float) + 4 * sizeof (float)) * pixels));
+
+        return results;
+    }
+
+private:
+    // Executes a kernel a number of times (after a warm-up run),
+    // and returns the average wall-clock time
+    Result measure (const std::function<void ()> &kernel, const char *name, 
+                    int width, int height, int filterWidth, double bytes)
+    {
+        kernel ();
+
+        const auto start = std::chrono::steady_clock::now ();
+        for (int i = 0; i < iterations; ++i)
+            kernel ();
+        const std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now () - start;
+
+        Result r = { name, width, height, filterWidth, 0, ms.count () / iterations, bytes };
+        return r;
+    }
+
+    CpuFilter &cpu;
+};
+
+
+// Prints the header of a device's results, unless the output is CSV
+void printHeader (const std::string &device)
+{
+    if (csv)
+        return;
+
+    std::cout << "\n" << device << "\n" << std::string (device.size (), '=') << "\n";
+    std::cout << std::left << std::setw (18) << "Kernel" << std::setw (11) << "Resolution"
+              << std::setw (8) << "Filter" << std::setw (8) << "Local" << std::right
+              << std::setw (10) << "ms" << std::setw (12) << "Mpixel/s"
+              << std::setw (10) << "GB/s" << std::endl;
+}
+
+
+int main (int argc, char **argv)
+{
+    int platformIdx = -1, deviceIdx = -1;
+    std::string rgbFile, depthFile;
+    std::string kernelsFile;
+    bool cpuBaseline = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg (argv[i]);
+        if (arg == "--device" && i + 1 < argc)
+        {
+            char sep;
+            std::istringstream (argv[++i]) >> platformIdx >> sep >> deviceIdx;
+        }
+        else if (arg == "--iterations" && i + 1 < argc && std::atoi (argv[i + 1]) > 0)
+            iterations = std::atoi (argv[++i]);  // Anything less than 1 gets the usage
+        else if (arg == "--rgb" && i + 1 < argc)
+            rgbFile = argv[++i];
+        else if (arg == "--depth" && i + 1 < argc)
+            depthFile = argv[++i];
+        else if (arg == "--kernels" && i + 1 < argc)
+            kernelsFile = argv[++i];
+        else if (arg == "--cpu")
+            cpuBaseline = true;
+        else if (arg == "--csv")
+            csv = true;
+        else
+        {
+            std::cout << "Usage: " << argv[0] << " [--device <platform>:<device>] [--iterations <n>]\n"
+                      << "       [--rgb <file>] [--depth <file>] [--kernels <file>] [--cpu] [--csv]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Recorded frames, or synthetic ones (a gradient, with a ramp for the depth)
+    std::vector<uint8_t> recRGB = readFrame<uint8_t> (rgbFile, 3 * recWidth * recHeight);
+    std::vector<uint16_t> recDepth = readFrame<uint16_t> (depthFile, recWidth * recHeight);
+    if (recRGB.empty ())
+    {
+        recRGB.resize (3 * recWidth * recHeight);
+        for (int i = 0; i < recWidth * recHeight; ++i)
+        {
+            recRGB[3 * i] = (i % recWidth) * 255 / recWidth;
+            recRGB[3 * i + 1] = (i / recWidth) * 255 / recHeight;
+            recRGB[3 * i + 2] = (i * 7) & 0xFF;
+        }
+    }
+    if (recDepth.empty ())
+    {
+        recDepth.resize (recWidth * recHeight);
+        for (int i = 0; i < recWidth * recHeight; ++i)
+            recDepth[i] = 500 + (i % recWidth) * 10;
+    }
+
+    // The program source is embedded in the executable, unless another one is given
+    std::string programCode (kernelSource);
+    if (!kernelsFile.empty ())
+    {
+        std::ifstream sourceFile (kernelsFile.c_str ());
+        if (!sourceFile)
+        {
+            std::cerr << "Failed to open " << kernelsFile << std::endl;
+            return EXIT_FAILURE;
+        }
+        programCode.assign ((std::istreambuf_iterator<char> (sourceFile)), std::istreambuf_iterator<char> ());
+    }
+
+    if (csv)
+        std::cout << "device,kernel,resolution,filter_width,local,ms,mpixel_s,gb_s" << std::endl;
+
+    // The CPU baseline: the scalar code, and every vectorized one the processor supports
+    if (cpuBaseline)
+    {
+        CpuFilter cpu;
+        CpuBench bench (cpu);
+
+        const CpuFilter::Isa isas[] = { CpuFilter::SCALAR, CpuFilter::SSE2, CpuFilter::AVX2, CpuFilter::NEON };
+        for (CpuFilter::Isa isa : isas)
+        {
+            cpu.setIsa (isa);
+            if (cpu.isa () != isa)
+                continue;
+
+            std::ostringstream name;
+            name << "cpu " << CpuFilter::isaName (isa) << " (" << cpu.threads () << " threads)";
+            printHeader (name.str ());
+
+            for (const int *res : resolutions)
+            {
+                std::vector<uint8_t> rgb = resample (recRGB, 3, res[0], res[1]);
+                std::vector<uint16_t> depth = resample (recDepth, 1, res[0], res[1]);
+
+                for (const Result &r : bench.run (res[0], res[1], rgb, depth))
+                    printResult (name.str (), r);
+            }
+        }
+    }
+
+    try
+    {
+        std::vector<cl::Platform> platforms;
+        cl::Platform::get (&platforms);
+
+        for (size_t p = 0; p < platforms.size (); ++p)
+        {
+            if (platformIdx >= 0 && (int) p != platformIdx)
+                continue;
+
+            std::vector<cl::Device> devices;
+            platforms[p].getDevices (CL_DEVICE_TYPE_ALL, &devices);
+
+            for (size_t d = 0; d < devices.size (); ++d)
+            {
+                if (deviceIdx >= 0 && (int) d != deviceIdx)
+                    continue;
+
+                std::string deviceName = devices[d].getInfo<CL_DEVICE_NAME> ();
+                std::ostringstream name;
+                name << p << ":" << d << " " << deviceName;
+
+                printHeader (name.str ());
+
+                Bench bench (devices[d], programCode);
+
+                for (const int *res : resolutions)
+                {
+                    std::vector<uint8_t> rgb = resample (recRGB, 3, res[0], res[1]);
+                    std::vector<uint16_t> depth = resample (recDepth, 1, res[0], res[1]);
+
+                    for (const Result &r : bench.run (res[0], res[1], rgb, depth))
+                        printResult (name.str (), r);
+                }
+            }
+        }
+    }
+    catch (const cl::Error &error)
+    {
+        std::cerr << error.what () << " ("
+                  << error.err ()  << ")"  << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -24,14 +24,20 @@
 
 #include <iostream>
 #include <sstream>
-#include <fstream>
+#include <iomanip>
 #include <string>
 #include <vector>
-#include <mutex>
-
-#include <opencv2/core/core.hpp>
-#include <opencv2/highgui/highgui.hpp>
-#include <opencv2/imgproc/imgproc.hpp>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <csignal>
+#include <deque>
+#include <map>
+#include <algorithm>
+#include <tuple>
+#include <thread>
+#include <chrono>
+#include <stdexcept>
 
 #include <GL/glew.h>
 
@@ -45,6 +51,17 @@
 #include <GL/glut.h>
 #endif
 #include <libfreenect.hpp>
+#include <kinectFilter/profiler.hpp>
+#include <kinectFilter/kinectDevice.hpp>
+#include <kinectFilter/recording.hpp>
+#include <kinectFilter/metrics.hpp>
+#include <kinectFilter/programCache.hpp>
+#include <kinectFilter/pipeline.hpp>
+#include <kinectFilter/shmRing.hpp>
+#include <kinectFilter/textureStream.hpp>
+#include <kinectFilter/cpuPipeline.hpp>
+#include <kinectFilter/coefficients.hpp>
+#include <kinectFilter/resolution.hpp>
 
 
 // Window parameters
@@ -54,149 +71,308 @@ int glWinId;
 
 // GL texture ID
 GLuint glRGBTex;
+TextureStream *texStream = NULL;  // NULL without ARB_pixel_buffer_object
+
+// RGB stream parameters. The resolution is set with --resolution, and switched 
+// with H. The frames can get filtered at reduced scale, on a level of an image 
+// pyramid (set with --pyramid <levels>, and cycled with L), when latency matters 
+// more than detail. The window stays the same, and the texture gets scaled to it
+freenect_resolution videoResolution = FREENECT_RESOLUTION_MEDIUM;
+int pyramidLevels = 0;
 
 // Freenect
-class MyFreenectDevice;
 Freenect::Freenect freenect;
-MyFreenectDevice *device;
+KinectDevice *device = NULL;  // NULL when replaying a recording
 double freenectAngle = 0;
 
-// OpenCL
-class Filter;
-Filter *opencl;
+// The frames come from the Kinect, or from a recording (with --replay)
+FrameSource *source;
+ReplayDevice *replay = NULL;
+Recorder *recorder = NULL;
+
+// OpenCL (or the CPU, see Backend)
+class Backend;
+Backend *opencl;
+
+// Profiling (only when started with --profile)
+Profiler *profiler = NULL;
+
+// Frame-level metrics (only when started with --metrics or --metrics-file)
+Metrics *metrics = NULL;
+
+// Headless mode (only when started with --headless)
+const uint32_t headlessSlots = 8;  // Frames in the shared memory ring
+volatile std::sig_atomic_t stopRequested = 0;
 
 
 // A class for filtering an image on the GPU
 class Filter
 {
 public:
-    Filter () : global { gl_win_width, gl_win_height }, smoothed (true)
+    // Filters frames of frameWidth x frameHeight pixels, 
+    // at 1 / 2^levels of their size (see setResolution)
+    Filter (int frameWidth, int frameHeight, int levels = 0) 
+        : smoothed (true), pipelined (false), vectorized (false), method (BOX), 
+          submitted (0), retrieved (0), coefficients (NULL), frames (NULL), pool (NULL)
     {
         // Image region for transfers
-        region[0] = gl_win_width;
-        region[1] = gl_win_height;
         region[2] = 1;
 
-        // Image dimensions
-        const int width = gl_win_width;
-        const int height = gl_win_height;
+        // The pinned buffers take frames of any resolution
+        const size_t maxRGBBufferSize = 3 * sizeof (uint8_t) * maxFrameWidth * maxFrameHeight;
 
         //! Applying multiple times a box filter, approximates a Gaussian filter
-        const float box_filter[] = { 0.125f, 0.125f, 0.125f,
-                                     0.125f, 0.125f, 0.125f,
-                                     0.125f, 0.125f, 0.125f };
-        const float laplacian_filter[] = { 1.f,  1.f, 1.f,
-                                           1.f, -8.f, 1.f,
-                                           1.f,  1.f, 1.f };
-        const int filterWidth = 3;
+        filterWidth = 3;
         const int filterSize = filterWidth * filterWidth * sizeof (float);
 
         // Get the list of platforms
         cl::Platform::get (&platforms);
 
-        // Get the GPU devices in the first platform
-        platforms[0].getDevices (CL_DEVICE_TYPE_GPU, &devices);
+        // Get a GPU device, or any other device, when there are no GPUs
+        if (!selectDevice (platforms, devices))
+            throw std::runtime_error ("No OpenCL devices found");
 
-        // Create a context for the first device
+        // CPU devices, and integrated GPUs with few compute units, run the 
+        // vectorized buffer-based kernels, instead of the tiled image-based ones
+        cl_device_type deviceType = devices[0].getInfo<CL_DEVICE_TYPE> ();
+        cl_uint computeUnits = devices[0].getInfo<CL_DEVICE_MAX_COMPUTE_UNITS> ();
+        vectorized = (deviceType & CL_DEVICE_TYPE_CPU) || computeUnits <= vecMaxComputeUnits;
+
+        // Create a context for the device
         context = cl::Context (devices[0]);
 
-        // Create a command queue for the device
-        queue = cl::CommandQueue (context, devices[0]);
+        // Create a command queue for the device (with timestamps on the commands, when profiling)
+        cl_command_queue_properties properties = profiler ? CL_QUEUE_PROFILING_ENABLE : 0;
+        queue = cl::CommandQueue (context, devices[0], properties);
+
+        // Create separate command queues for the uploads and the readbacks of the 
+        // pipelined mode, so that transfers in both directions can overlap with the kernels
+        uploadQueue = cl::CommandQueue (context, devices[0], properties);
+        readQueue = cl::CommandQueue (context, devices[0], properties);
 
         // Create an image sampler
         sampler = cl::Sampler (context, CL_FALSE, CL_ADDRESS_CLAMP_TO_EDGE, CL_FILTER_NEAREST);
 
-        // Create an image format
-        cl::ImageFormat format (CL_R, CL_UNSIGNED_INT8);
-
-        // Create an image instance for the source image on the device
-        bufferSourceImage = cl::Image2D (context, CL_MEM_READ_ONLY, format, width, height);
-
-        // Create image instances for the intermediate results on the device
-        bufferInterImage1 = cl::Image2D (context, CL_MEM_READ_WRITE, format, width, height);
-        bufferInterImage2 = cl::Image2D (context, CL_MEM_READ_WRITE, format, width, height);
+        // Create pinned host buffers for the frames coming from Kinect, and keep 
+        // them mapped for the lifetime of the filter. The frames get written 
+        // straight into page-locked memory, so the uploads are plain DMA transfers
+        for (int i = 0; i < 3; ++i)
+        {
+            bufferPinnedRGB[i] = cl::Buffer (context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, maxRGBBufferSize);
+            pinnedRGB[i] = static_cast<uint8_t *> (queue.enqueueMapBuffer (
+                bufferPinnedRGB[i], CL_TRUE, CL_MAP_WRITE, 0, maxRGBBufferSize));
+        }
 
-        // Create an image instance for the output image on the device
-        bufferOutputImage = cl::Image2D (context, CL_MEM_WRITE_ONLY, format, width, height);
+        // The intermediate results come from a pool shared by the pipelines
+        pool = new MemPool (context);
 
         // Create buffers for the filters on the device
         bufferBoxFilter = cl::Buffer (context, CL_MEM_READ_ONLY, filterSize);
         bufferLaplacianFilter = cl::Buffer (context, CL_MEM_READ_ONLY, filterSize);
 
         // Copy the filters to the device
-        queue.enqueueWriteBuffer (bufferBoxFilter, CL_FALSE, 0, filterSize, box_filter);
-        queue.enqueueWriteBuffer (bufferLaplacianFilter, CL_FALSE, 0, filterSize, laplacian_filter);
+        queue.enqueueWriteBuffer (bufferBoxFilter, CL_FALSE, 0, filterSize, boxFilter3x3);
+        queue.enqueueWriteBuffer (bufferLaplacianFilter, CL_TRUE, 0, filterSize, laplacianFilter3x3);
+
+        // The program source is embedded in the executable
+        programCode = kernelSource;
+
+        // Create and compile a program
+        program = buildProgram ("");
+
+        // Create kernels
+        kernelConv = cl::Kernel (program, "convolutionTiled");
+        kernelConvRGB = cl::Kernel (program, "convolutionRGB");
+        kernelConvVec = cl::Kernel (program, "convolutionVec");
+        kernelConvRGBVec = cl::Kernel (program, "convolutionRGBVec");
+        kernelDownsample = cl::Kernel (program, "downsampleRGB");
+
+        // Pick a work-group size for the tiled convolution. 16x16 tiles keep 
+        // the halo overhead low, but not every device can fit 256 work-items
+        size_t maxWorkGroupSize = 
+            kernelConv.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE> (devices[0]);
+        localDim = (maxWorkGroupSize >= 256) ? 16 : 8;
+        local = cl::NDRange (localDim, localDim);
+
+        // Create the kernels of the edge-preserving smoothing methods
+        kernelBilateral = cl::Kernel (program, "bilateralRGB");
+        kernelGuidedCoeffs = cl::Kernel (program, "guidedCoeffsRGB");
+        kernelGuided = cl::Kernel (program, "guidedRGB");
+
+        // Both methods work on a 5x5 window like the two box filters. 
+        // The parameters are in the units of the intermediate images ([0,255])
+        const int radius = 2;
+        const float sigmaSpatial = 2.f, sigmaRange = 30.f;
+        const float eps = 0.01f * 255.f * 255.f, scale = 1.f;
+        const size_t tileSize = (localDim + 2 * radius) * (localDim + 2 * radius);
+        const size_t rowSumsSize = (localDim + 2 * radius) * localDim;
+
+        kernelBilateral.setArg (4, cl::Local (sizeof (float) * tileSize));
+        kernelBilateral.setArg (5, radius);
+        kernelBilateral.setArg (6, sigmaSpatial);
+        kernelBilateral.setArg (7, sigmaRange);
+
+        kernelGuidedCoeffs.setArg (4, cl::Local (2 * sizeof (float) * tileSize));
+        kernelGuidedCoeffs.setArg (5, cl::Local (2 * sizeof (float) * rowSumsSize));
+        kernelGuidedCoeffs.setArg (6, radius);
+        kernelGuidedCoeffs.setArg (7, eps);
+        kernelGuidedCoeffs.setArg (8, scale);
+
+        kernelGuided.setArg (5, cl::Local (2 * sizeof (float) * tileSize));
+        kernelGuided.setArg (6, cl::Local (2 * sizeof (float) * rowSumsSize));
+        kernelGuided.setArg (7, radius);
 
-        // Read the program source
-        std::ifstream sourceFile ("kernels/kernels.cl");
-        std::string programCode (std::istreambuf_iterator<char> (sourceFile), (std::istreambuf_iterator<char> ()));
-    
-        // Create a program
-        cl::Program::Sources source (1, std::make_pair (programCode.c_str (), programCode.length () + 1));
-        program = cl::Program (context, source);
+        // Set common kernel arguments
+        kernelConv.setArg (7, sampler);
 
-        try
+        // The dimensions go into the kernel arguments and the workspaces, 
+        // so they have to be set before the pipelines get built
+        setDimensions (frameWidth, frameHeight, levels);
+
+        // The Gaussian of the Fused LoG and Separable methods
+        setGaussian (1.f, 5);
+    }
+
+    // Applies the filters on a raw RGB frame from Kinect, 
+    // and stores the resulting gray-scale image in image
+    void convolve (const uint8_t *rgb, std::vector<uint8_t> &image)
+    {
+        image.resize (region[0] * region[1]);
+        convolve (rgb, image.data ());
+    }
+
+    // Same as above, with image pointing to at least 
+    // imageWidth () x imageHeight () bytes
+    void convolve (const uint8_t *rgb, uint8_t *image)
+    {
+        // Copy the source frame to the device
+        queue.enqueueWriteBuffer (frames->sourceRGB[0], CL_FALSE, 0, rgbBufferSize, rgb, NULL, profile ("Upload"));
+
+        enqueueFilters (frames->sourceRGB[0], output (0), NULL, NULL);
+
+        // Read back the output image
+        enqueueReadOutput (queue, 0, CL_TRUE, image, NULL, profile ("Readback"));
+
+        collectProfile ();
+    }
+
+    // Pipelined version of convolve. Enqueues a raw RGB frame from Kinect 
+    // for filtering, and returns without waiting for the results.
+    // With two frames in flight, the upload of frame N+1 and the readback 
+    // of frame N-1 overlap with the filtering of frame N.
+    // The frame in rgb has to stay intact until finishUpload returns. 
+    // The arrival time of the frame gets delivered along with it
+    void submit (const uint8_t *rgb, double arrival = 0.)
+    {
+        const int set = submitted % 2;
+
+        // Both sets are in use, so the oldest frame gets dropped
+        if (submitted - retrieved == 2)
         {
-            // Compile the program
-            program.build (devices);
+            readEvent[set].wait ();
+            ++retrieved;
         }
-        catch (const cl::Error &error)
-        {
-            std::cerr << error.what () << " ("
-                      << error.err ()  << ")"  << std::endl;
-            
-            std::string log;
-            program.getBuildInfo (devices[0], CL_PROGRAM_BUILD_LOG, &log);
-            std::cout << log << std::endl;
 
-            exit (EXIT_FAILURE);
-        }
+        arrivals[set] = arrival;
+        uploadQueue.enqueueWriteBuffer (frames->sourceRGB[set], CL_FALSE, 0, rgbBufferSize, rgb, 
+                                        NULL, &uploadEvent[set]);
 
-        // Create kernel
-        kernelConv = cl::Kernel (program, "convolution");
+        std::vector<cl::Event> waitUpload (1, uploadEvent[set]);
+        enqueueFilters (frames->sourceRGB[set], output (set), &waitUpload, &computeEvent[set]);
 
-        // Set common kernel arguments
-        kernelConv.setArg (2, height);
-        kernelConv.setArg (3, width);
-        kernelConv.setArg (5, filterWidth);
-        kernelConv.setArg (6, sampler);
+        std::vector<cl::Event> waitCompute (1, computeEvent[set]);
+        hostImage[set].resize (region[0] * region[1]);
+        enqueueReadOutput (readQueue, set, CL_FALSE, hostImage[set].data (), &waitCompute, &readEvent[set]);
+
+        track ("Upload", uploadEvent[set]);
+        track ("Readback", readEvent[set]);
+
+        // Get all three queues going, without waiting on any of them
+        uploadQueue.flush ();
+        queue.flush ();
+        readQueue.flush ();
+
+        ++submitted;
     }
 
-    void convolve (std::vector<uint8_t> &image)
+    // Waits for the upload of the last submitted frame to complete
+    void finishUpload ()
     {
-        // Copy the source image to the device
-        queue.enqueueWriteImage (bufferSourceImage, CL_FALSE, origin, region, 0, 0, image.data ());
+        if (submitted > 0)
+            uploadEvent[(submitted - 1) % 2].wait ();
+    }
 
-        if (smoothed)
-        {
-            kernelConv.setArg (0, bufferSourceImage);
-            kernelConv.setArg (1, bufferInterImage1);
-            kernelConv.setArg (4, bufferBoxFilter);
+    // Delivers in image the oldest frame in the pipeline, if its filtering has 
+    // completed. If both sets are in use, it waits for that frame.
+    // Returns false if no frame was delivered
+    bool retrieve (std::vector<uint8_t> &image, double *arrival = NULL)
+    {
+        const int pending = submitted - retrieved;
+        const int set = retrieved % 2;
+
+        if (pending == 0)
+            return false;
 
-            // Apply the first box firter
-            queue.enqueueNDRangeKernel (kernelConv, cl::NullRange, global, cl::NullRange);
+        if (pending == 1 && 
+            readEvent[set].getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS> () != CL_COMPLETE)
+            return false;
 
-            kernelConv.setArg (0, bufferInterImage1);
-            kernelConv.setArg (1, bufferInterImage2);
+        readEvent[set].wait ();
 
-            // Apply the second box firter
-            queue.enqueueNDRangeKernel (kernelConv, cl::NullRange, global, cl::NullRange);
+        image.swap (hostImage[set]);
+        if (arrival)
+            *arrival = arrivals[set];
+        ++retrieved;
 
-            kernelConv.setArg (0, bufferInterImage2);
-        }
-        else
-        {
-            kernelConv.setArg (0, bufferSourceImage);
-        }
+        collectProfile ();
 
-        kernelConv.setArg (1, bufferOutputImage);
-        kernelConv.setArg (4, bufferLaplacianFilter);
+        return true;
+    }
 
-        // Perform the edge detection
-        queue.enqueueNDRangeKernel (kernelConv, cl::NullRange, global, cl::NullRange);
+    ~Filter ()
+    {
+        for (int i = 0; i < 3; ++i)
+            queue.enqueueUnmapMemObject (bufferPinnedRGB[i], pinnedRGB[i]);
+        uploadQueue.finish ();
+        readQueue.finish ();
+        queue.finish ();
+        for (auto &set : frameSets)
+            delete set.second;
+        delete pool;
+    }
 
-        // Read back the output image
-        queue.enqueueReadImage (bufferOutputImage, CL_TRUE, origin, region, 0, 0, image.data ());
+    // Returns the pinned host buffers that the RGB frames get written into
+    uint8_t *const *rgbSlots ()
+    {
+        return pinnedRGB;
+    }
+
+    // Switches to frames of frameWidth x frameHeight pixels (up to 
+    // maxFrameWidth x maxFrameHeight), filtered at 1 / 2^levels of their size. 
+    // The frames in flight get dropped. The buffers of each resolution stay 
+    // in their pools, so switching back doesn't allocate anything
+    void setResolution (int frameWidth, int frameHeight, int levels)
+    {
+        uploadQueue.finish ();
+        queue.finish ();
+        readQueue.finish ();
+        retrieved = submitted;
+        collectProfile ();
+
+        setDimensions (frameWidth, frameHeight, levels);
+        setSeparableArgs ();
+        buildPipelines ();
+    }
+
+    // Returns the dimensions of the filtered images
+    int imageWidth ()
+    {
+        return region[0];
+    }
+
+    int imageHeight ()
+    {
+        return region[1];
     }
 
     // Returns the state of the flag for smoothing
@@ -213,116 +389,712 @@ public:
         return smoothed;
     }
 
+    // Returns the state of the flag for the pipelined mode
+    bool pipelining ()
+    {
+        return pipelined;
+    }
+
+    // Toggles the flag for the pipelined mode (submit/retrieve instead of convolve)
+    // Returns the new state of the flag
+    bool togglePipelining ()
+    {
+        // Drop the frames still in flight
+        uploadQueue.finish ();
+        queue.finish ();
+        readQueue.finish ();
+        retrieved = submitted;
+        collectProfile ();
+
+        pipelined = !pipelined;
+        return pipelined;
+    }
+
+    // Returns the name of the smoothing method
+    const char *smoothingMethod ()
+    {
+        static const char *names[] = { "Box", "Fused LoG", "Separable", "Bilateral", "Guided" };
+        return names[method];
+    }
+
+    // Switches to the next smoothing method (skipping the 
+    // ones that the vectorized kernels don't cover)
+    // Returns the name of the new method
+    const char *nextSmoothingMethod ()
+    {
+        do
+            method = static_cast<Method> ((method + 1) % METHOD_COUNT);
+        while (vectorized && method != BOX && method != FUSED_LOG);
+
+        return smoothingMethod ();
+    }
+
+    // Returns whether the vectorized buffer-based kernels are in use
+    bool vectorization ()
+    {
+        return vectorized;
+    }
+
+    // Sets the Gaussian of the Fused LoG and Separable methods, with the 
+    // given sigma (in pixels), over width (odd) pixels. The coefficients get 
+    // generated on the host, and the separable program gets specialized for them, 
+    // the first time a pair is used. Both are kept in a cache, so going 
+    // through the pairs again doesn't build or allocate anything
+    void setGaussian (float sigma, int width)
+    {
+        Coefficients &c = coefficientCache.get (sigma, width, [this] (float sigma, int width, Coefficients &entry) {
+            const std::vector<float> gaussian = gaussianFilter (sigma, width);
+            const std::vector<float> log = logFilter (sigma, width);
+
+            entry.logWidth = width + filterWidth - 1;
+            entry.log = cl::Buffer (context, CL_MEM_READ_ONLY, log.size () * sizeof (float));
+            queue.enqueueWriteBuffer (entry.log, CL_TRUE, 0, log.size () * sizeof (float), log.data ());
+
+            // The width and the coefficients are baked into the separable 
+            // kernels, so that the loops get unrolled
+            entry.separable = buildProgram (separableOptions (gaussian, gaussian));
+            entry.row = cl::Kernel (entry.separable, "separableRowRGB");
+            entry.column = cl::Kernel (entry.separable, "separableColumn");
+            entry.column.setArg (4, sampler);
+        });
+
+        // Wait for the frames in flight, which still use the previous kernels
+        uploadQueue.finish ();
+        queue.finish ();
+        readQueue.finish ();
+
+        coefficients = &c;
+        gaussianSigma = sigma;
+        gaussianWidth = width;
+        kernelRow = c.row;
+        kernelColumn = c.column;
+
+        setSeparableArgs ();
+        buildPipelines ();
+    }
+
+    // Returns the sigma and the width of the Gaussian (see setGaussian)
+    float smoothingSigma ()
+    {
+        return gaussianSigma;
+    }
+
+    int smoothingWidth ()
+    {
+        return gaussianWidth;
+    }
+
+    // Tells if there is any OpenCL device to filter on (see selectDevice)
+    static bool hasDevice ()
+    {
+        std::vector<cl::Platform> platforms;
+        std::vector<cl::Device> devices;
+
+        try
+        {
+            cl::Platform::get (&platforms);
+        }
+        catch (const cl::Error &)
+        {
+            // No platforms (CL_PLATFORM_NOT_FOUND_KHR from the ICD loader)
+            return false;
+        }
+
+        return selectDevice (platforms, devices);
+    }
+
 private:
+    // Smoothing methods
+    // BOX: Two box filters, followed by the Laplacian filter (3 passes)
+    // FUSED_LOG: A Gaussian and the Laplacian filter combined into a single LoG filter (1 pass)
+    // SEPARABLE: A separable Gaussian filter, followed by the Laplacian filter (3 passes)
+    // BILATERAL: An edge-preserving bilateral filter, followed by the Laplacian filter (2 passes)
+    // GUIDED: An edge-preserving guided filter (coefficients and output, with 
+    //         box sums over the tiles), followed by the Laplacian filter (3 passes)
+    enum Method { BOX, FUSED_LOG, SEPARABLE, BILATERAL, GUIDED, METHOD_COUNT };
+
+    // The uploaded LoG filter of a (sigma, width) pair of the Gaussian, 
+    // and the separable program specialized for the pair
+    struct Coefficients
+    {
+        cl::Buffer log;
+        int logWidth;
+        cl::Program separable;
+        cl::Kernel row, column;
+    };
+
+    // The device buffers for the frames of a resolution: the source RGB frames, 
+    // and the output images (buffers, for the vectorized kernels), one per frame in flight
+    struct FrameSet
+    {
+        cl::Buffer sourceRGB[2];
+        cl::Image2D outputImage[2];
+        cl::Buffer outputVec[2];
+    };
+
+    // Sets the dimensions of the frames, and of the filtered images, on the kernels 
+    // and the workspaces, and picks the frame buffers (created on first use)
+    void setDimensions (int frameWidth, int frameHeight, int levels)
+    {
+        this->frameWidth = frameWidth;
+        this->frameHeight = frameHeight;
+        this->levels = levels;
+
+        // The filters run on the top level of the pyramid
+        const int width = frameWidth >> levels;
+        const int height = frameHeight >> levels;
+
+        rgbBufferSize = 3 * sizeof (uint8_t) * frameWidth * frameHeight;
+        region[0] = width;
+        region[1] = height;
+
+        FrameSet *&set = frameSets[std::make_tuple (frameWidth, frameHeight, levels)];
+        if (!set)
+        {
+            set = new FrameSet;
+            cl::ImageFormat format (CL_R, CL_UNSIGNED_INT8);
+            for (int i = 0; i < 2; ++i)
+            {
+                set->sourceRGB[i] = cl::Buffer (context, CL_MEM_READ_ONLY, rgbBufferSize);
+                if (vectorized)
+                    set->outputVec[i] = cl::Buffer (context, CL_MEM_WRITE_ONLY, width * height);
+                else
+                    set->outputImage[i] = cl::Image2D (context, CL_MEM_WRITE_ONLY, format, width, height);
+            }
+        }
+        frames = set;
+
+        kernelBilateral.setArg (2, height);
+        kernelBilateral.setArg (3, width);
+        kernelGuidedCoeffs.setArg (2, height);
+        kernelGuidedCoeffs.setArg (3, width);
+        kernelGuided.setArg (3, height);
+        kernelGuided.setArg (4, width);
+
+        kernelConv.setArg (2, height);
+        kernelConv.setArg (3, width);
+        kernelConvRGB.setArg (2, height);
+        kernelConvRGB.setArg (3, width);
+
+        kernelConvVec.setArg (2, height);
+        kernelConvVec.setArg (3, width);
+        kernelConvRGBVec.setArg (2, height);
+        kernelConvRGBVec.setArg (3, width);
+
+        // The workspace has to be a multiple of the work-group size
+        global = cl::NDRange (roundUp (width, localDim), roundUp (height, localDim));
+
+        // Each work-item of the vectorized kernels produces vecWidth pixels of a row
+        globalVec = cl::NDRange ((width + vecWidth - 1) / vecWidth, height);
+    }
+
+    // Sets the dimensions of the filtered images on the separable kernels
+    void setSeparableArgs ()
+    {
+        kernelRow.setArg (2, (int) region[1]);
+        kernelRow.setArg (3, (int) region[0]);
+        kernelColumn.setArg (2, (int) region[1]);
+        kernelColumn.setArg (3, (int) region[0]);
+    }
+
+    // Creates a program from the kernel source and compiles it 
+    // (or loads it from the binary cache, when it has been built before)
+    cl::Program buildProgram (const std::string &options)
+    {
+        cl_int status;
+        std::string log;
+        cl::Program prog (buildCachedProgram (context (), devices[0] (), programCode, options, &status, &log));
+
+        if (status != CL_SUCCESS)
+        {
+            std::cerr << "clBuildProgram (" << status << ")" << std::endl;
+            std::cout << log << std::endl;
+
+            exit (EXIT_FAILURE);
+        }
+
+        return prog;
+    }
+
+    // Prepends to a pipeline the stages that downsample the source frame 
+    // to the top level of the pyramid (see addPyramid). Returns the name 
+    // of the frame to filter
+    std::string pyramid (Pipeline &pipeline)
+    {
+        return addPyramid (pipeline, kernelDownsample, "rgb", frameWidth, frameHeight, levels);
+    }
+
+    // Builds the filter chain of each smoothing method as a pipeline. The stages 
+    // name their intermediate images, and the pipeline assigns them from the pool
+    void buildPipelines ()
+    {
+        const int width = region[0];
+        const int height = region[1];
+        const MemSpec gray = MemSpec::image (cl::ImageFormat (CL_R, CL_UNSIGNED_INT8), width, height);
+
+        // The two convolution kernels are shared by the stages, 
+        // so the filters get set right before each launch
+        auto filter = [this] (cl::Buffer &buffer, int filterSize) {
+            return [this, &buffer, filterSize] (cl::Kernel &kernel) { setFilter (kernel, buffer, filterSize); };
+        };
+
+        pipelines.assign (METHOD_COUNT + 1, Pipeline (*pool));
+
+        if (vectorized)
+        {
+            buildVecPipelines ();
+            return;
+        }
+
+        // Each pipeline starts with the downsampling to the top level of the pyramid
+        std::string rgb;
+
+        Pipeline &box = pipelines[BOX];
+        box.intermediate ("box1", gray);
+        box.intermediate ("box2", gray);
+        rgb = pyramid (box);
+        box.addStage ("Box filter 1", kernelConvRGB, global, local)
+            .input (0, rgb).output (1, "box1").setup (filter (bufferBoxFilter, filterWidth));
+        box.addStage ("Box filter 2", kernelConv, global, local)
+            .input (0, "box1").output (1, "box2").setup (filter (bufferBoxFilter, filterWidth));
+        box.addStage ("Laplacian filter", kernelConv, global, local)
+            .input (0, "box2").output (1, "output").setup (filter (bufferLaplacianFilter, filterWidth));
+
+        // The whole chain in one pass, without any intermediate images
+        rgb = pyramid (pipelines[FUSED_LOG]);
+        pipelines[FUSED_LOG].addStage ("LoG filter", kernelConvRGB, global, local)
+            .input (0, rgb).output (1, "output").setup (filter (coefficients->log, coefficients->logWidth));
+
+        Pipeline &separable = pipelines[SEPARABLE];
+        separable.intermediate ("row", gray);
+        separable.intermediate ("column", gray);
+        rgb = pyramid (separable);
+        separable.addStage ("Row filter", kernelRow, global, local)
+            .input (0, rgb).output (1, "row");
+        separable.addStage ("Column filter", kernelColumn, global, local)
+            .input (0, "row").output (1, "column");
+        separable.addStage ("Laplacian filter", kernelConv, global, local)
+            .input (0, "column").output (1, "output").setup (filter (bufferLaplacianFilter, filterWidth));
+
+        Pipeline &bilateral = pipelines[BILATERAL];
+        bilateral.intermediate ("smooth", gray);
+        rgb = pyramid (bilateral);
+        bilateral.addStage ("Bilateral filter", kernelBilateral, global, local)
+            .input (0, rgb).output (1, "smooth");
+        bilateral.addStage ("Laplacian filter", kernelConv, global, local)
+            .input (0, "smooth").output (1, "output").setup (filter (bufferLaplacianFilter, filterWidth));
+
+        Pipeline &guided = pipelines[GUIDED];
+        guided.intermediate ("coeffs", MemSpec::buffer (2 * sizeof (float) * width * height));
+        guided.intermediate ("smooth", gray);
+        rgb = pyramid (guided);
+        guided.addStage ("Guided coefficients", kernelGuidedCoeffs, global, local)
+            .input (0, rgb).output (1, "coeffs");
+        guided.addStage ("Guided filter", kernelGuided, global, local)
+            .input (0, rgb).input (1, "coeffs").output (2, "smooth");
+        guided.addStage ("Laplacian filter", kernelConv, global, local)
+            .input (0, "smooth").output (1, "output").setup (filter (bufferLaplacianFilter, filterWidth));
+
+        // No smoothing, just the edge detection
+        rgb = pyramid (pipelines[METHOD_COUNT]);
+        pipelines[METHOD_COUNT].addStage ("Laplacian filter", kernelConvRGB, global, local)
+            .input (0, rgb).output (1, "output").setup (filter (bufferLaplacianFilter, filterWidth));
+    }
+
+    // Builds the pipelines of the vectorized kernels. Those cover the box 
+    // filters, the fused LoG filter, and the edge detection without smoothing. 
+    // The intermediate images are plain buffers
+    void buildVecPipelines ()
+    {
+        const MemSpec gray = MemSpec::buffer (region[0] * region[1]);
+
+        auto filter = [] (cl::Buffer &buffer, int filterSize) {
+            return [&buffer, filterSize] (cl::Kernel &kernel) {
+                kernel.setArg (4, buffer);
+                kernel.setArg (5, filterSize);
+            };
+        };
+
+        std::string rgb;
+
+        Pipeline &box = pipelines[BOX];
+        box.intermediate ("box1", gray);
+        box.intermediate ("box2", gray);
+        rgb = pyramid (box);
+        box.addStage ("Box filter 1", kernelConvRGBVec, globalVec)
+            .input (0, rgb).output (1, "box1").setup (filter (bufferBoxFilter, filterWidth));
+        box.addStage ("Box filter 2", kernelConvVec, globalVec)
+            .input (0, "box1").output (1, "box2").setup (filter (bufferBoxFilter, filterWidth));
+        box.addStage ("Laplacian filter", kernelConvVec, globalVec)
+            .input (0, "box2").output (1, "output").setup (filter (bufferLaplacianFilter, filterWidth));
+
+        rgb = pyramid (pipelines[FUSED_LOG]);
+        pipelines[FUSED_LOG].addStage ("LoG filter", kernelConvRGBVec, globalVec)
+            .input (0, rgb).output (1, "output").setup (filter (coefficients->log, coefficients->logWidth));
+
+        rgb = pyramid (pipelines[METHOD_COUNT]);
+        pipelines[METHOD_COUNT].addStage ("Laplacian filter", kernelConvRGBVec, globalVec)
+            .input (0, rgb).output (1, "output").setup (filter (bufferLaplacianFilter, filterWidth));
+    }
+
+    // Picks the first GPU device on any platform. Without one, it falls back 
+    // to the first device of any type (e.g. a CPU runtime). Returns false 
+    // when there are no devices at all
+    static bool selectDevice (std::vector<cl::Platform> &platforms, std::vector<cl::Device> &devices)
+    {
+        const cl_device_type types[] = { CL_DEVICE_TYPE_GPU, CL_DEVICE_TYPE_ALL };
+
+        for (cl_device_type type : types)
+        {
+            for (cl::Platform &platform : platforms)
+            {
+                try
+                {
+                    platform.getDevices (type, &devices);
+                }
+                catch (const cl::Error &)
+                {
+                    // CL_DEVICE_NOT_FOUND
+                    continue;
+                }
+
+                if (!devices.empty ())
+                    return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Returns the output image of a set
+    cl::Memory &output (int set)
+    {
+        if (vectorized)
+            return frames->outputVec[set];
+
+        return frames->outputImage[set];
+    }
+
+    // Enqueues on q the readback of the output image of a set
+    void enqueueReadOutput (cl::CommandQueue &q, int set, cl_bool blocking, uint8_t *image, 
+                            const std::vector<cl::Event> *waits, cl::Event *event)
+    {
+        if (vectorized)
+            q.enqueueReadBuffer (frames->outputVec[set], blocking, 0, region[0] * region[1], image, waits, event);
+        else
+            q.enqueueReadImage (frames->outputImage[set], blocking, origin, region, 0, 0, image, waits, event);
+    }
+
+    // Enqueues the filter chain for the selected smoothing method on the compute queue.
+    // If waits is given, the kernels wait for those events. If done is given, 
+    // it receives an event for the completion of the last kernel
+    void enqueueFilters (cl::Buffer &source, cl::Memory &output, 
+                         const std::vector<cl::Event> *waits, cl::Event *done)
+    {
+        Pipeline &pipeline = pipelines[smoothed ? method : METHOD_COUNT];
+
+        pipeline.bind ("rgb", source);
+        pipeline.bind ("output", output);
+        pipeline.enqueue (queue, waits, done, 
+                          [this] (const std::string &stage) { return profile (stage.c_str ()); });
+
+        if (done)
+            track (pipeline.lastStage ().c_str (), *done);
+    }
+
+    // Returns an event for timing a command of the given stage, 
+    // or NULL when profiling is off (see Profiler::profile)
+    cl::Event *profile (const char *stage)
+    {
+        return profiler ? profiler->profile (std::string (stage)) : NULL;
+    }
+
+    // Times an existing event as a command of the given stage
+    void track (const char *stage, const cl::Event &event)
+    {
+        if (profiler)
+            profiler->track (std::string (stage), event);
+    }
+
+    // Records the durations of the timed commands that have completed
+    void collectProfile ()
+    {
+        if (profiler)
+            profiler->collect ();
+    }
+
+    // Sets the filter, and the local memory for the tile 
+    // (which depends on the filter width), on a convolution kernel
+    void setFilter (cl::Kernel &kernel, cl::Buffer &filter, int width)
+    {
+        const size_t tileSize = sizeof (float) * 
+            (local[0] + width - 1) * (local[1] + width - 1);
+
+        kernel.setArg (4, filter);
+        kernel.setArg (5, width);
+        kernel.setArg (6, cl::Local (tileSize));
+    }
+
+    // Rounds value up to the nearest multiple of base
+    static size_t roundUp (size_t value, size_t base)
+    {
+        return ((value + base - 1) / base) * base;
+    }
+
+    // Source buffer parameters
+    size_t rgbBufferSize;
+
+    // Frame dimensions, and levels of the pyramid above the frame
+    int frameWidth, frameHeight, levels;
+
     // Image transfer parameters
     cl::size_t<3> origin;
     cl::size_t<3> region;
 
     // Workspace dimensions
-    cl::NDRange global;
+    cl::NDRange global, local, globalVec;
+    size_t localDim;
+
+    // Pixels per work-item of the vectorized kernels (VEC_WIDTH in kernels.cl), 
+    // and the largest compute-unit count of a device that gets them
+    static const int vecWidth = 8;
+    static const cl_uint vecMaxComputeUnits = 4;
 
-    bool smoothed;
+    bool smoothed, pipelined, vectorized;
+    Method method;
+
+    // Pipelined mode state
+    // The frames alternate between the two sets of source/output images
+    int submitted, retrieved;
+    cl::Event uploadEvent[2], computeEvent[2], readEvent[2];
+    std::vector<uint8_t> hostImage[2];
+    double arrivals[2];  // Of the frames in the sets (see FrameSource::rgbArrival)
+
+    // Filter widths
+    int filterWidth;
+
+    // The Gaussian of the Fused LoG and Separable methods
+    float gaussianSigma;
+    int gaussianWidth;
+    GaussianCache<Coefficients> coefficientCache;
+    Coefficients *coefficients;
 
     std::vector<cl::Platform> platforms;
     std::vector<cl::Device> devices;
     cl::Context context;
-    cl::CommandQueue queue;
+    cl::CommandQueue queue, uploadQueue, readQueue;
     cl::Sampler sampler;
-    cl::Image2D bufferSourceImage, bufferOutputImage;
-    cl::Image2D bufferInterImage1, bufferInterImage2;
+    std::map<std::tuple<int, int, int>, FrameSet *> frameSets;  // Per resolution and pyramid level
+    FrameSet *frames;
+    cl::Buffer bufferPinnedRGB[3];
+    uint8_t *pinnedRGB[3];
     cl::Buffer bufferBoxFilter, bufferLaplacianFilter;
+    std::string programCode;
     cl::Program program;
-    cl::Kernel kernelConv;
+    cl::Kernel kernelConv, kernelConvRGB;
+    cl::Kernel kernelConvVec, kernelConvRGBVec, kernelDownsample;
+    cl::Kernel kernelRow, kernelColumn;
+    cl::Kernel kernelBilateral, kernelGuidedCoeffs, kernelGuided;
+    MemPool *pool;
+    std::vector<Pipeline> pipelines;
 };
 
 
-// A class hierarchy for manipulating a mutex
-class Mutex
+// A class that filters the frames on the GPU (with a Filter), or without any 
+// OpenCL device (or with cpuOnly), on the CPU (with a CpuPipeline). The frames 
+// are of frameWidth x frameHeight pixels, filtered at 1 / 2^levels of their size
+class Backend
 {
 public:
-    void lock () { freenectMutex.lock (); }
-    void unlock () { freenectMutex.unlock (); }
+    Backend (int frameWidth, int frameHeight, int levels, bool cpuOnly = false) 
+        : gpu (NULL), cpu (NULL)
+    {
+        if (!cpuOnly && Filter::hasDevice ())
+        {
+            gpu = new Filter (frameWidth, frameHeight, levels);
+            return;
+        }
+
+        cpu = new CpuPipeline (frameWidth, frameHeight, levels, profiler);
+        std::cout << "Filtering on the " << cpu->name () << std::endl;
+    }
 
-    // A class that automates the manipulation of 
-    // the outer class instance's mutex.
-    // Mutex's mutex is locked with the creation of a ScopedLock instance 
-    // and unlocked with the destruction of the ScopedLock instance.
-    class ScopedLock
+    ~Backend ()
     {
-    public:
-        ScopedLock (Mutex &mtx) : mMutex (mtx) { mMutex.lock (); }
-        ~ScopedLock () { mMutex.unlock (); }
+        delete gpu;
+        delete cpu;
+    }
 
-    private:
-        Mutex &mMutex;
-    };
+    void convolve (const uint8_t *rgb, std::vector<uint8_t> &image)
+    {
+        if (gpu)
+            return gpu->convolve (rgb, image);
+        image.resize (cpu->imageWidth () * cpu->imageHeight ());
+        cpu->convolve (rgb, image.data ());
+    }
 
-private:
-    std::mutex freenectMutex;
-};
+    void convolve (const uint8_t *rgb, uint8_t *image)
+    {
+        if (gpu)
+            return gpu->convolve (rgb, image);
+        cpu->convolve (rgb, image);
+    }
 
+    // The pipelined mode (submit, finishUpload, retrieve) is only on the GPU
+    void submit (const uint8_t *rgb, double arrival = 0.)
+    {
+        gpu->submit (rgb, arrival);
+    }
 
-// A class that extends Freenect::FreenectDevice by defining the VideoCallback
-// callback function so we can get updates with the latest RGB frame
-class MyFreenectDevice : public Freenect::FreenectDevice
-{
-public:
-    MyFreenectDevice (freenect_context *ctx, int index)
-        : Freenect::FreenectDevice (ctx, index),
-          rgbBuffer (freenect_find_video_mode (FREENECT_RESOLUTION_MEDIUM, 
-                                                    FREENECT_VIDEO_RGB).bytes),
-          newRGBFrame (false)
+    void finishUpload ()
     {
+        gpu->finishUpload ();
     }
 
-    // Delivers the latest RGB frame
-    // Do not call directly, it's only used by the library
-    void VideoCallback (void *rgb, uint32_t timestamp)
+    bool retrieve (std::vector<uint8_t> &image, double *arrival = NULL)
     {
-        Mutex::ScopedLock lock (rgbMutex);
+        return gpu->retrieve (image, arrival);
+    }
 
-        std::copy (static_cast<uint8_t *> (rgb), 
-                   static_cast<uint8_t *> (rgb) + getVideoBufferSize (), 
-                   rgbBuffer.begin ());
-        newRGBFrame = true;
-    };
+    uint8_t *const *rgbSlots ()
+    {
+        return gpu ? gpu->rgbSlots () : cpu->rgbSlots ();
+    }
 
-    // Delivers the most recently received frame after filtering it
-    bool getRGB (std::vector<uint8_t> &buffer)
+    void setResolution (int frameWidth, int frameHeight, int levels)
     {
-        Mutex::ScopedLock lock (rgbMutex);
+        if (gpu)
+            return gpu->setResolution (frameWidth, frameHeight, levels);
+        cpu->setResolution (frameWidth, frameHeight, levels);
+    }
 
-        if (!newRGBFrame)
-            return false;
+    int imageWidth ()
+    {
+        return gpu ? gpu->imageWidth () : cpu->imageWidth ();
+    }
 
-        // Transform the frame to gray-scale
-        // OpenCV was used just for experimenting
-        // The operation could just as easily be done on the GPU
-        cv::Mat gray, rgb (gl_win_height, gl_win_width, CV_8UC3, rgbBuffer.data ());
-        cv::cvtColor (rgb, gray, CV_RGB2GRAY);
-        std::copy (gray.datastart, gray.dataend + 1, buffer.data ());
+    int imageHeight ()
+    {
+        return gpu ? gpu->imageHeight () : cpu->imageHeight ();
+    }
 
-        // Apply the filters to the image
-        opencl->convolve (buffer);
+    bool smoothing ()
+    {
+        return gpu ? gpu->smoothing () : cpu->smoothing ();
+    }
 
-        newRGBFrame = false;
+    bool toggleSmoothing ()
+    {
+        return gpu ? gpu->toggleSmoothing () : cpu->toggleSmoothing ();
+    }
 
-        return true;
+    // There is no pipelined mode on the CPU
+    bool pipelining ()
+    {
+        return gpu ? gpu->pipelining () : false;
+    }
+
+    bool togglePipelining ()
+    {
+        return gpu ? gpu->togglePipelining () : false;
+    }
+
+    const char *smoothingMethod ()
+    {
+        return gpu ? gpu->smoothingMethod () : cpu->smoothingMethod ();
+    }
+
+    const char *nextSmoothingMethod ()
+    {
+        return gpu ? gpu->nextSmoothingMethod () : cpu->nextSmoothingMethod ();
+    }
+
+    bool vectorization ()
+    {
+        return gpu ? gpu->vectorization () : false;
+    }
+
+    void setGaussian (float sigma, int width)
+    {
+        if (gpu)
+            return gpu->setGaussian (sigma, width);
+        cpu->setGaussian (sigma, width);
+    }
+
+    float smoothingSigma ()
+    {
+        return gpu ? gpu->smoothingSigma () : cpu->smoothingSigma ();
+    }
+
+    int smoothingWidth ()
+    {
+        return gpu ? gpu->smoothingWidth () : cpu->smoothingWidth ();
     }
 
 private:
-    Mutex rgbMutex;
-    std::vector<uint8_t> rgbBuffer;
-    bool newRGBFrame;
+    Filter *gpu;
+    CpuPipeline *cpu;
 };
 
+// Delivers the most recently received frame after filtering it
+// In pipelined mode, the delivered frame lags one frame behind. 
+// Otherwise, the frame gets written in direct instead, if it's given. 
+// The arrival time of the delivered frame goes in arrival, if it's given
+bool filterFrame (std::vector<uint8_t> &buffer, uint8_t *direct = NULL, double *arrival = NULL)
+{
+    const uint8_t *rgb;
+
+    if (opencl->pipelining ())
+    {
+        // The slot of the last submitted frame goes back to 
+        // the libfreenect thread on update, so its upload has to be done
+        opencl->finishUpload ();
+
+        if (source->getRGB (rgb))
+            opencl->submit (rgb, source->rgbArrival ());
+
+        return opencl->retrieve (buffer, arrival);
+    }
+
+    if (!source->getRGB (rgb))
+        return false;
+
+    if (arrival)
+        *arrival = source->rgbArrival ();
+
+    // Apply the filters to the frame
+    // The transformation to gray-scale happens on the GPU
+    // The filtering happens outside of any lock, 
+    // so the libfreenect thread is never kept waiting
+    if (direct)
+        opencl->convolve (rgb, direct);
+    else
+        opencl->convolve (rgb, buffer);
+
+    return true;
+}
+
 
 // Display callback for the window
 void drawGLScene ()
 {
-    static std::vector<uint8_t> image (gl_win_width * gl_win_height);
-
-    device->getRGB (image);
+    // The dimensions of the displayed image change with the 
+    // resolution and the pyramid level (the texture gets scaled)
+    static std::vector<uint8_t> image;
+    static int width = 0, height = 0;
+
+    // The frame gets read back straight into the unpack buffer, 
+    // except in pipelined mode, where it gets copied from the host image
+    uint8_t *slot = texStream ? texStream->begin () : NULL;
+    double arrival;
+    const bool fresh = filterFrame (image, opencl->pipelining () ? NULL : slot, &arrival);
+    if (fresh)
+    {
+        width = opencl->imageWidth ();
+        height = opencl->imageHeight ();
+        if (slot && opencl->pipelining ())
+            std::memcpy (slot, image.data (), image.size ());
+    }
 
     glClear (GL_COLOR_BUFFER_BIT);
 
@@ -336,17 +1108,70 @@ void drawGLScene ()
 
     glEnable (GL_TEXTURE_2D);
     // glBindTexture (GL_TEXTURE_2D, glRGBTex);
-    glTexImage2D (GL_TEXTURE_2D, 0, GL_LUMINANCE, gl_win_width, gl_win_height, 0,
-                  GL_LUMINANCE, GL_UNSIGNED_BYTE, image.data ());
+    const double texStart = profiler ? Profiler::now () : 0.;
+    if (texStream)
+    {
+        if (fresh)
+        {
+            texStream->commit (width, height);
+            if (profiler)
+                profiler->record ("glTexSubImage2D", Profiler::now () - texStart);
+        }
+    }
+    else
+    {
+        glTexImage2D (GL_TEXTURE_2D, 0, GL_LUMINANCE, width, height, 0,
+                      GL_LUMINANCE, GL_UNSIGNED_BYTE, image.data ());
+        if (profiler)
+            profiler->record ("glTexImage2D", Profiler::now () - texStart);
+    }
 
     std::ostringstream state;
-    state << "Smoothing: " << (opencl->smoothing () ? "ON" : "OFF");
+    state << "Smoothing: ";
+    if (opencl->smoothing ())
+        state << "ON (" << opencl->smoothingMethod () << ")";
+    else
+        state << "OFF";
 
-    glRasterPos2i (530, 30);
+    glRasterPos2i (470, 30);
+    for (auto c : state.str ())
+        glutBitmapCharacter (GLUT_BITMAP_HELVETICA_12, c);
+
+    if (profiler)
+        profiler->draw (10, 30);
+
+    state.str ("");
+    state << "Pipelining: " << (opencl->pipelining () ? "ON" : "OFF");
+
+    glRasterPos2i (470, 45);
+    for (auto c : state.str ())
+        glutBitmapCharacter (GLUT_BITMAP_HELVETICA_12, c);
+
+    state.str ("");
+    state << "Filtering: " << width << "x" << height;
+    if (pyramidLevels)
+        state << " (1/" << (1 << pyramidLevels) << ")";
+
+    glRasterPos2i (470, 60);
+    for (auto c : state.str ())
+        glutBitmapCharacter (GLUT_BITMAP_HELVETICA_12, c);
+
+    state.str ("");
+    state << "Gaussian: " << std::fixed << std::setprecision (2) << opencl->smoothingSigma () 
+          << ", " << opencl->smoothingWidth () << "px";
+
+    glRasterPos2i (470, 75);
     for (auto c : state.str ())
         glutBitmapCharacter (GLUT_BITMAP_HELVETICA_12, c);
 
     glutSwapBuffers ();
+
+    if (metrics)
+    {
+        if (fresh)
+            metrics->frameDelivered (arrival);
+        metrics->update ();
+    }
 }
 
 
@@ -368,55 +1193,110 @@ void resizeGLScene (int width, int height)
 }
 
 
+// Tilts the sensor to the given angle (nothing to do on a replay)
+void setTilt (double angle)
+{
+    if (device)
+        device->setTiltDegrees (angle);
+}
+
+
+// Sets the LED of the sensor (nothing to do on a replay)
+void setLed (freenect_led_options option)
+{
+    if (device)
+        device->setLed (option);
+}
+
+
 // Keyboard callback for the window
 void keyPressed (unsigned char key, int x, int y)
 {
+    const Resize resize = [] (int width, int height, int levels) { 
+        opencl->setResolution (width, height, levels); 
+    };
+
     switch (key)
     {
         case 0x1B:  // ESC
         case  'Q':
         case  'q':
+            delete texStream;
+            texStream = NULL;
             glutDestroyWindow (glWinId);
             break;
         case 'F':
         case 'f':
             opencl->toggleSmoothing ();
             break;
+        case 'M':
+        case 'm':
+            opencl->nextSmoothingMethod ();
+            break;
+        case 'P':
+        case 'p':
+            opencl->togglePipelining ();
+            break;
+        case 'H':
+        case 'h':
+            toggleResolution (device, recorder != NULL, videoResolution, pyramidLevels, resize);
+            break;
+        case 'L':
+        case 'l':
+            nextPyramidLevel (replay, videoResolution, pyramidLevels, resize);
+            break;
+        case '+':
+        case '=':
+            opencl->setGaussian (std::min (opencl->smoothingSigma () + sigmaStep, maxSigma), 
+                                 opencl->smoothingWidth ());
+            break;
+        case '-':
+            opencl->setGaussian (std::max (opencl->smoothingSigma () - sigmaStep, minSigma), 
+                                 opencl->smoothingWidth ());
+            break;
+        case ']':
+            opencl->setGaussian (opencl->smoothingSigma (), 
+                                 std::min (opencl->smoothingWidth () + 2, maxGaussianWidth));
+            break;
+        case '[':
+            opencl->setGaussian (opencl->smoothingSigma (), 
+                                 std::max (opencl->smoothingWidth () - 2, minGaussianWidth));
+            break;
         case  'W':
         case  'w':
             if (++freenectAngle > 30)
                 freenectAngle = 30;
-            device->setTiltDegrees (freenectAngle);
+            setTilt (freenectAngle);
             break;
         case  'S':
         case  's':
             if (--freenectAngle < -30)
                 freenectAngle = -30;
-            device->setTiltDegrees (freenectAngle);
+            setTilt (freenectAngle);
             break;
         case  'R':
         case  'r':
             freenectAngle = 0;
-            device->setTiltDegrees (freenectAngle);
+            setTilt (freenectAngle);
             break;
         case  '1':
-            device->setLed (LED_GREEN);
+            setLed (LED_GREEN);
             break;
         case  '2':
-            device->setLed (LED_RED);
+            setLed (LED_RED);
             break;
         case  '3':
-            device->setLed (LED_YELLOW);
+            setLed (LED_YELLOW);
             break;
         case  '4':
         case  '5':
-            device->setLed (LED_BLINK_GREEN);
+            setLed (LED_BLINK_GREEN);
             break;
         case  '6':
-            device->setLed (LED_BLINK_RED_YELLOW);
+            setLed (LED_BLINK_RED_YELLOW);
             break;
         case  '0':
-            device->setLed (LED_OFF);
+            setLed (LED_OFF);
             break;
     }
 }
@@ -446,6 +1326,66 @@ void initGL (int argc, char **argv)
     glBindTexture (GL_TEXTURE_2D, glRGBTex);
     glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    // The frames get streamed into the texture through pixel-unpack buffers, if possible. 
+    // A slot takes the largest filtered frame
+    if (glewInit () == GLEW_OK && GLEW_ARB_pixel_buffer_object)
+        texStream = new TextureStream (glRGBTex, GL_LUMINANCE, maxFrameWidth * maxFrameHeight);
+}
+
+
+// Signal handler that stops the headless mode
+void requestStop (int)
+{
+    stopRequested = 1;
+}
+
+
+// Filters the frames, and publishes them into the shared memory ring name 
+// (see ShmRing), without a window, until the process gets a SIGINT or SIGTERM
+void runHeadless (const char *name)
+{
+    try
+    {
+        ShmRing ring (name, headlessSlots, maxFrameWidth * maxFrameHeight);
+        std::vector<uint8_t> image;
+
+        std::signal (SIGINT, requestStop);
+        std::signal (SIGTERM, requestStop);
+
+        std::cout << "Publishing the filtered frames in " << name << std::endl;
+
+        while (!stopRequested)
+        {
+            // The frame gets read back straight into the slot of the ring, 
+            // except in pipelined mode, where it gets copied from the host image
+            uint8_t *slot = ring.begin ();
+            double arrival;
+            if (!filterFrame (image, opencl->pipelining () ? NULL : slot, &arrival))
+            {
+                if (metrics)
+                    metrics->update ();
+                std::this_thread::sleep_for (std::chrono::milliseconds (1));
+                continue;
+            }
+
+            const uint32_t size = opencl->imageWidth () * opencl->imageHeight ();
+            if (opencl->pipelining ())
+                std::memcpy (slot, image.data (), size);
+            ring.publish (size, opencl->imageWidth (), opencl->imageHeight (), ShmRingSlot::GRAY8);
+
+            if (metrics)
+            {
+                metrics->frameDelivered (arrival);
+                metrics->update ();
+            }
+        }
+    }
+    catch (const std::runtime_error &error)
+    {
+        std::cerr << error.what () << std::endl;
+        exit (EXIT_FAILURE);
+    }
 }
 
 
@@ -455,6 +1395,12 @@ void printInfo()
     std::cout << "\nAvailable Controls:\n";
     std::cout << "===================\n";
     std::cout << "Toggle Smoothing :  F\n";
+    std::cout << "Smoothing Method :  M\n";
+    std::cout << "Toggle Pipeline  :  P\n";
+    std::cout << "Resolution       :  H\n";
+    std::cout << "Pyramid Level    :  L\n";
+    std::cout << "Gaussian Sigma   :  + / -\n";
+    std::cout << "Gaussian Width   :  ] / [\n";
     std::cout << "Tilt Kinect Up   :  W\n";
     std::cout << "Tilt Kinect Down :  S\n";
     std::cout << "Reset Tilt Angle :  R\n";
@@ -469,15 +1415,110 @@ int main (int argc, char **argv)
     {
         printInfo ();
 
-        opencl = new Filter ();
+        // Profiling is enabled with --profile. --headless publishes the frames 
+        // in shared memory (--shm <name>) instead of displaying them. 
+        // --record <file> writes the Kinect stream to a file, and --replay <file> 
+        // takes the frames from one instead (at the recorded pace, 
+        // or as fast as they get filtered with --max-speed)
+        // --resolution high switches the Kinect to 1280x1024, and --pyramid <levels> 
+        // filters the frames at 1 / 2^levels of their size
+        // --metrics <seconds> logs the frame counters, the frame rate and the latency 
+        // periodically, and --metrics-file <file> writes them in the Prometheus format. 
+        // --cpu filters on the CPU (see CpuPipeline), as it happens without any OpenCL device
+        bool cpuOnly = false, headless = false, maxSpeed = false;
+        const char *shmName = "/kinectFilter_clc++";
+        const char *recordName = NULL, *replayName = NULL;
+        const char *metricsFile = NULL;
+        double metricsInterval = 0.;
+        for (int i = 1; i < argc; ++i)
+            if (std::string (argv[i]) == "--profile")
+                profiler = new Profiler ();
+            else if (std::string (argv[i]) == "--cpu")
+                cpuOnly = true;
+            else if (std::string (argv[i]) == "--headless")
+                headless = true;
+            else if (std::string (argv[i]) == "--shm" && i + 1 < argc)
+                shmName = argv[++i];
+            else if (std::string (argv[i]) == "--record" && i + 1 < argc)
+                recordName = argv[++i];
+            else if (std::string (argv[i]) == "--replay" && i + 1 < argc)
+                replayName = argv[++i];
+            else if (std::string (argv[i]) == "--max-speed")
+                maxSpeed = true;
+            else if (std::string (argv[i]) == "--metrics" && i + 1 < argc)
+                metricsInterval = std::atof (argv[++i]);
+            else if (std::string (argv[i]) == "--metrics-file" && i + 1 < argc)
+                metricsFile = argv[++i];
+            else if (std::string (argv[i]) == "--resolution" && i + 1 < argc)
+                videoResolution = std::string (argv[++i]) == "high" ? 
+                    FREENECT_RESOLUTION_HIGH : FREENECT_RESOLUTION_MEDIUM;
+            else if (std::string (argv[i]) == "--pyramid" && i + 1 < argc)
+                pyramidLevels = std::min (std::max (std::atoi (argv[++i]), 0), maxPyramidLevels);
+        if (profiler)
+            profiler->dumpAtExit ("kinectFilter_profile.csv");
+
+        // A replay takes the resolution of the recording
+        if (replayName)
+        {
+            replay = new ReplayDevice (replayName, maxSpeed);
+            if (replay->width () > (uint32_t) maxFrameWidth || replay->height () > (uint32_t) maxFrameHeight)
+                throw std::runtime_error (std::string (replayName) + " has frames larger than 1280x1024");
+        }
 
-        device = &freenect.createDevice<MyFreenectDevice> (0);
-        device->startVideo ();
+        int width, height;
+        frameDimensions (replay, videoResolution, width, height);
+        opencl = new Backend (width, height, pyramidLevels, cpuOnly);
+        if (opencl->vectorization ())
+            std::cout << "Using the vectorized kernels for CPU and small devices "
+                      << "(Box and Fused LoG smoothing)" << std::endl;
 
-        initGL (argc, argv);
-        glutMainLoop ();
+        if (replay)
+        {
+            replay->attach (opencl->rgbSlots (), NULL, profiler);
+            replay->start ();
+            source = replay;
+        }
+        else
+        {
+            device = &freenect.createDevice<KinectDevice> (0);
+            device->attach (opencl->rgbSlots (), NULL, profiler);
+            device->setVideoFormat (FREENECT_VIDEO_RGB, videoResolution);
+            if (recordName)
+            {
+                recorder = new Recorder (recordName, width, height);
+                device->record (recorder);
+            }
+            device->startVideo ();
+            source = device;
+        }
+
+        // --metrics-file alone reports every 10 seconds
+        if (metricsInterval > 0. || metricsFile)
+        {
+            metrics = new Metrics ("kinectFilter_clc++", metricsInterval > 0. ? metricsInterval : 10.);
+            metrics->addSource (source);
+            if (metricsFile)
+                metrics->setFile (metricsFile);
+        }
 
-        device->stopVideo ();
+        if (headless)
+            runHeadless (shmName);
+        else
+        {
+            initGL (argc, argv);
+            glutMainLoop ();
+        }
+
+        if (replay)
+            replay->stop ();
+        else
+        {
+            device->record (NULL);
+            device->stopVideo ();
+        }
+        delete recorder;
+        delete metrics;
+        delete replay;
         delete opencl;
 
         return 0;
@@ -488,4 +1529,9 @@ int main (int argc, char **argv)
                   << error.err ()  << ")"  << std::endl;
         exit (EXIT_FAILURE);
     }
+    catch (const std::runtime_error &error)
+    {
+        std::cerr << error.what () << std::endl;
+        exit (EXIT_FAILURE);
+    }
 }
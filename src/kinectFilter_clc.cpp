@@ -24,14 +24,20 @@
 
 #include <iostream>
 #include <sstream>
-#include <fstream>
+#include <iomanip>
 #include <string>
 #include <vector>
-#include <mutex>
-
-#include <opencv2/core/core.hpp>
-#include <opencv2/highgui/highgui.hpp>
-#include <opencv2/imgproc/imgproc.hpp>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <csignal>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <tuple>
+#include <thread>
+#include <chrono>
+#include <stdexcept>
 
 #include <GL/glew.h>
 
@@ -43,6 +49,17 @@
 #include <GL/glut.h>
 #endif
 #include <libfreenect.hpp>
+#include <kinectFilter/profiler.hpp>
+#include <kinectFilter/kinectDevice.hpp>
+#include <kinectFilter/recording.hpp>
+#include <kinectFilter/metrics.hpp>
+#include <kinectFilter/programCache.hpp>
+#include <kinectFilter/pipeline.hpp>
+#include <kinectFilter/shmRing.hpp>
+#include <kinectFilter/textureStream.hpp>
+#include <kinectFilter/cpuPipeline.hpp>
+#include <kinectFilter/coefficients.hpp>
+#include <kinectFilter/resolution.hpp>
 
 
 // Window parameters
@@ -52,93 +69,101 @@ int glWinId;
 
 // GL texture ID
 GLuint glRGBTex;
+TextureStream *texStream = NULL;  // NULL without ARB_pixel_buffer_object
+
+// RGB stream parameters. The resolution is set with --resolution, and switched 
+// with H. The frames can get filtered at reduced scale, on a level of an image 
+// pyramid (set with --pyramid <levels>, and cycled with L), when latency matters 
+// more than detail. The window stays the same, and the texture gets scaled to it
+freenect_resolution videoResolution = FREENECT_RESOLUTION_MEDIUM;
+int pyramidLevels = 0;
 
 // Freenect
-class MyFreenectDevice;
 Freenect::Freenect freenect;
-MyFreenectDevice *device;
+KinectDevice *device = NULL;  // NULL when replaying a recording
 double freenectAngle = 0;
 
+// The frames come from the Kinect, or from a recording (with --replay)
+FrameSource *source;
+ReplayDevice *replay = NULL;
+Recorder *recorder = NULL;
+
 // OpenCL
-class Filter;
-Filter *opencl;
+class Scheduler;
+Scheduler *opencl;
+
+// Profiling (only when started with --profile)
+Profiler *profiler = NULL;
+
+// Frame-level metrics (only when started with --metrics or --metrics-file)
+Metrics *metrics = NULL;
+
+// Headless mode (only when started with --headless)
+const uint32_t headlessSlots = 8;  // Frames in the shared memory ring
+volatile std::sig_atomic_t stopRequested = 0;
 
 
 // A class for filtering an image on the GPU
 class Filter
 {
 public:
-    Filter () : origin { 0, 0, 0 }, region { gl_win_width, gl_win_height, 1 }, 
-                global { gl_win_width, gl_win_height }, smoothed (true)
+    // Filters frames of frameWidth x frameHeight pixels, 
+    // at 1 / 2^levels of their size (see setResolution)
+    Filter (cl_platform_id platform, cl_device_id device, int frameWidth, int frameHeight, int levels = 0) 
+        : origin { 0, 0, 0 }, region { 0, 0, 1 }, stripe { 0, 0 }, 
+          smoothed (true), pipelined (false), method (BOX), 
+          submitted (0), retrieved (0), coefficients (NULL), frames (NULL), pool (NULL)
     {
-        // Image dimensions
-        const int width = gl_win_width;
-        const int height = gl_win_height;
+        // The pinned buffers take frames of any resolution
+        const size_t maxRGBBufferSize = 3 * sizeof (uint8_t) * maxFrameWidth * maxFrameHeight;
 
         // Applying multiple times a box filter, approximates a Gaussian filter
-        const float box_filter[] = { 0.125f, 0.125f, 0.125f,
-                                     0.125f, 0.125f, 0.125f,
-                                     0.125f, 0.125f, 0.125f };
-        const float laplacian_filter[] = { 1.f,  1.f, 1.f,
-                                           1.f, -8.f, 1.f,
-                                           1.f,  1.f, 1.f };
-        const int filterWidth = 3;
+        filterWidth = 3;
         const int filterSize = filterWidth * filterWidth * sizeof (float);
 
-        // Query for a plarform
-        cl_platform_id platform;
-        status = clGetPlatformIDs (1, &platform, NULL);
-        chk ("clGetPlatformIDs", status);
-
-        // Query for a device
-        cl_device_id device;
-        status = clGetDeviceIDs (platform, CL_DEVICE_TYPE_GPU, 1, &device, NULL);
-        chk ("clGetDeviceIDs", status);
+        deviceID = device;
 
         // Create a context
         cl_context_properties cps[] = { CL_CONTEXT_PLATFORM, (cl_context_properties) platform, 0 };
-        context = clCreateContext (cps, 1, &device, NULL, NULL, &status);
+        context = clCreateContext (cps, 1, &deviceID, NULL, NULL, &status);
         chk ("clCreateContext", status);
 
-        // Create a command queue
-        queue = clCreateCommandQueue (context, device, 0, &status);
+        // Create a command queue (with timestamps on the commands, when profiling)
+        cl_command_queue_properties properties = profiler ? CL_QUEUE_PROFILING_ENABLE : 0;
+        queue = clCreateCommandQueue (context, deviceID, properties, &status);
+        chk ("clCreateCommandQueue", status);
+
+        // Create separate command queues for the uploads and the readbacks of the 
+        // pipelined mode, so that transfers in both directions can overlap with the kernels
+        uploadQueue = clCreateCommandQueue (context, deviceID, properties, &status);
+        chk ("clCreateCommandQueue", status);
+        readQueue = clCreateCommandQueue (context, deviceID, properties, &status);
         chk ("clCreateCommandQueue", status);
 
-        // Create image descriptor
-        cl_image_desc desc;
-        desc.image_type = CL_MEM_OBJECT_IMAGE2D;
-        desc.image_width = width;
-        desc.image_height = height;
-        desc.image_depth = 0;
-        desc.image_array_size = 0;
-        desc.image_row_pitch = 0;
-        desc.image_slice_pitch = 0;
-        desc.num_mip_levels = 0;
-        desc.num_samples = 0;
-        desc.buffer = NULL;
-
-        // Create image format
-        cl_image_format format;
-        format.image_channel_order = CL_R;
-        format.image_channel_data_type = CL_UNSIGNED_INT8;
+        // The intermediate results come from a pool shared by the pipelines
+        pool = new MemPool (context);
 
         // Create an image sampler
         sampler = clCreateSampler (context, CL_FALSE, CL_ADDRESS_CLAMP_TO_EDGE, CL_FILTER_NEAREST, &status);
         chk ("clCreateSampler", status);
 
-        // Create an image object for the source image on the device
-        bufferSourceImage = clCreateImage (context, CL_MEM_READ_ONLY, &format, &desc, NULL, &status);
-        chk ("clCreateImage2D", status);
-
-        // Create image objects for the intermediate results on the device
-        bufferInterImage1 = clCreateImage (context, CL_MEM_READ_WRITE, &format, &desc, NULL, &status);
-        chk ("clCreateImage2D", status);
-        bufferInterImage2 = clCreateImage (context, CL_MEM_READ_WRITE, &format, &desc, NULL, &status);
-        chk ("clCreateImage2D", status);
+        // The source and output images of a resolution get created 
+        // on its first use (see setDimensions)
+        for (int i = 0; i < 2; ++i)
+            uploadEvent[i] = computeEvent[i] = readEvent[i] = NULL;
 
-        // Create an image object for the output image on the device
-        bufferOutputImage = clCreateImage (context, CL_MEM_WRITE_ONLY, &format, &desc, NULL, &status);
-        chk ("clCreateImage2D", status);
+        // Create pinned host buffers for the frames coming from Kinect, and keep 
+        // them mapped for the lifetime of the filter. The frames get written 
+        // straight into page-locked memory, so the uploads are plain DMA transfers
+        for (int i = 0; i < 3; ++i)
+        {
+            bufferPinnedRGB[i] = clCreateBuffer (context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, 
+                                                 maxRGBBufferSize, NULL, &status);
+            chk ("clCreateBuffer", status);
+            pinnedRGB[i] = static_cast<uint8_t *> (clEnqueueMapBuffer (queue, bufferPinnedRGB[i], CL_TRUE, CL_MAP_WRITE, 
+                                                                       0, maxRGBBufferSize, 0, NULL, NULL, &status));
+            chk ("clEnqueueMapBuffer", status);
+        }
 
         // Create buffers for the filters on the device
         bufferBoxFilter = clCreateBuffer (context, CL_MEM_READ_ONLY, filterSize, NULL, &status);
@@ -147,104 +172,370 @@ public:
         chk ("clCreateImage2D", status);
 
         // Copy the filters to the device
-        status = clEnqueueWriteBuffer (queue, bufferBoxFilter, CL_FALSE, 0, filterSize, box_filter, 0, NULL, NULL);
+        status = clEnqueueWriteBuffer (queue, bufferBoxFilter, CL_FALSE, 0, filterSize, boxFilter3x3, 0, NULL, NULL);
         chk ("clEnqueueWriteBuffer", status);
-        status = clEnqueueWriteBuffer (queue, bufferLaplacianFilter, CL_FALSE, 0, filterSize, laplacian_filter, 0, NULL, NULL);
+        status = clEnqueueWriteBuffer (queue, bufferLaplacianFilter, CL_TRUE, 0, filterSize, laplacianFilter3x3, 0, NULL, NULL);
         chk ("clEnqueueWriteBuffer", status);
 
-        // Read the program source
-        std::ifstream sourceFile ("kernels/kernels.cl");
-        std::string programCode (std::istreambuf_iterator<char> (sourceFile), (std::istreambuf_iterator<char> ()));
-        const char* programSource = programCode.c_str ();
+        // The program source is embedded in the executable
+        programCode = kernelSource;
 
-        // Create program
-        program = clCreateProgramWithSource (context, 1, &programSource, NULL, &status);
-        chk ("clCreateProgramWithSource", status);
+        // Create and compile program
+        program = buildProgram (NULL);
 
-        // Compile program
-        status = clBuildProgram (program, 1, &device, NULL, NULL, NULL);
-        if (status)
-        {
-            char log[10240] = "";
-            clGetProgramBuildInfo (program, device, CL_PROGRAM_BUILD_LOG, sizeof (log), log, NULL);
-            std::cerr << log << std::endl;
-            exit (EXIT_FAILURE);
-        }
+        // Create kernels
+        kernelConv = clCreateKernel (program, "convolutionTiled", &status);
+        chk ("clCreateKernel", status);
+        kernelConvRGB = clCreateKernel (program, "convolutionRGB", &status);
+        chk ("clCreateKernel", status);
+        kernelDownsample = clCreateKernel (program, "downsampleRGB", &status);
+        chk ("clCreateKernel", status);
 
-        // Create kernel
-        kernelConv = clCreateKernel (program, "convolution", &status);
+        // Pick a work-group size for the tiled convolution. 16x16 tiles keep 
+        // the halo overhead low, but not every device can fit 256 work-items
+        size_t maxWorkGroupSize;
+        status = clGetKernelWorkGroupInfo (kernelConv, deviceID, CL_KERNEL_WORK_GROUP_SIZE, 
+                                           sizeof (size_t), &maxWorkGroupSize, NULL);
+        chk ("clGetKernelWorkGroupInfo", status);
+        local[0] = local[1] = (maxWorkGroupSize >= 256) ? 16 : 8;
+
+        // Create the kernels of the edge-preserving smoothing methods
+        kernelBilateral = clCreateKernel (program, "bilateralRGB", &status);
+        chk ("clCreateKernel", status);
+        kernelGuidedCoeffs = clCreateKernel (program, "guidedCoeffsRGB", &status);
+        chk ("clCreateKernel", status);
+        kernelGuided = clCreateKernel (program, "guidedRGB", &status);
         chk ("clCreateKernel", status);
 
+        // Both methods work on a 5x5 window like the two box filters. 
+        // The parameters are in the units of the intermediate images ([0,255])
+        const int radius = 2;
+        windowRadius = radius;
+        const float sigmaSpatial = 2.f, sigmaRange = 30.f;
+        const float eps = 0.01f * 255.f * 255.f, scale = 1.f;
+        const size_t tileSize = (local[0] + 2 * radius) * (local[1] + 2 * radius);
+        const size_t rowSumsSize = (local[1] + 2 * radius) * local[0];
+
+        status = clSetKernelArg (kernelBilateral, 4, sizeof (float) * tileSize, NULL);
+        status |= clSetKernelArg (kernelBilateral, 5, sizeof (int), &radius);
+        status |= clSetKernelArg (kernelBilateral, 6, sizeof (float), &sigmaSpatial);
+        status |= clSetKernelArg (kernelBilateral, 7, sizeof (float), &sigmaRange);
+
+        status |= clSetKernelArg (kernelGuidedCoeffs, 4, 2 * sizeof (float) * tileSize, NULL);
+        status |= clSetKernelArg (kernelGuidedCoeffs, 5, 2 * sizeof (float) * rowSumsSize, NULL);
+        status |= clSetKernelArg (kernelGuidedCoeffs, 6, sizeof (int), &radius);
+        status |= clSetKernelArg (kernelGuidedCoeffs, 7, sizeof (float), &eps);
+        status |= clSetKernelArg (kernelGuidedCoeffs, 8, sizeof (float), &scale);
+
+        status |= clSetKernelArg (kernelGuided, 5, 2 * sizeof (float) * tileSize, NULL);
+        status |= clSetKernelArg (kernelGuided, 6, 2 * sizeof (float) * rowSumsSize, NULL);
+        status |= clSetKernelArg (kernelGuided, 7, sizeof (int), &radius);
+        chk ("clSetKernelArg", status);
+
         // Set common kernel arguments
-        status = clSetKernelArg (kernelConv, 2, sizeof (int), &height);
-        status |= clSetKernelArg (kernelConv, 3, sizeof (int), &width);
-        status |= clSetKernelArg (kernelConv, 5, sizeof (int), &filterWidth);
-        status |= clSetKernelArg (kernelConv, 6, sizeof (cl_sampler), &sampler);
+        status = clSetKernelArg (kernelConv, 7, sizeof (cl_sampler), &sampler);
         chk ("clSetKernelArg", status);
+
+        // The dimensions go into the kernel arguments and the workspaces, 
+        // so they have to be set before the pipelines get built
+        setDimensions (frameWidth, frameHeight, levels);
+
+        // The Gaussian of the Fused LoG and Separable methods (this builds the pipelines too)
+        setGaussian (1.f, 5);
     }
 
-    void convolve (std::vector<uint8_t> &image)
+    // Finds the devices to filter on, as (platform, device) pairs: the GPUs 
+    // of all the platforms (or just the first one, unless all is set). 
+    // Without a GPU, it falls back to a device of any type (e.g. a CPU runtime), 
+    // and without any device, it returns none (see CpuPipeline)
+    static std::vector<std::pair<cl_platform_id, cl_device_id> > findDevices (bool all)
     {
-        // Copy the source image to the device
-        status = clEnqueueWriteImage (queue, bufferSourceImage, CL_FALSE, origin, region, 0, 0, image.data (), 0, NULL, NULL);
-        chk ("clEnqueueWriteImage", status);
-
-        if (smoothed)
+        // Query for the platforms (there are none, without an OpenCL runtime)
+        std::vector<std::pair<cl_platform_id, cl_device_id> > found;
+        cl_platform_id platforms[8];
+        cl_uint numPlatforms;
+        if (clGetPlatformIDs (8, platforms, &numPlatforms) != CL_SUCCESS)
+            return found;
+
+        const cl_device_type types[] = { CL_DEVICE_TYPE_GPU, CL_DEVICE_TYPE_ALL };
+        for (int t = 0; t < 2 && found.empty (); ++t)
         {
-            status = clSetKernelArg (kernelConv, 0, sizeof (cl_mem), &bufferSourceImage);
-            status |= clSetKernelArg (kernelConv, 1, sizeof (cl_mem), &bufferInterImage1);
-            status |= clSetKernelArg (kernelConv, 4, sizeof (cl_mem), &bufferBoxFilter);
-            chk ("clSetKernelArg", status);
+            for (cl_uint p = 0; p < std::min (numPlatforms, 8u); ++p)
+            {
+                cl_device_id devices[8];
+                cl_uint numDevices;
+                if (clGetDeviceIDs (platforms[p], types[t], 8, devices, &numDevices) != CL_SUCCESS)
+                    continue;
+
+                for (cl_uint d = 0; d < std::min (numDevices, 8u); ++d)
+                    found.push_back (std::make_pair (platforms[p], devices[d]));
+            }
+
+            // The fallback is a single device
+            if (t == 1 && !found.empty ())
+                found.resize (1);
+        }
+        if (!all && !found.empty ())
+            found.resize (1);
+
+        return found;
+    }
 
-            // Apply the first box firter
-            status = clEnqueueNDRangeKernel (queue, kernelConv, 2, NULL, global, NULL, 0, NULL, NULL);
-            chk ("clEnqueueNDRangeKernel", status);
+    // Returns the name of the device
+    std::string deviceName ()
+    {
+        char name[256];
+        status = clGetDeviceInfo (deviceID, CL_DEVICE_NAME, sizeof (name), name, NULL);
+        chk ("clGetDeviceInfo", status);
 
-            status = clSetKernelArg (kernelConv, 0, sizeof (cl_mem), &bufferInterImage1);
-            status |= clSetKernelArg (kernelConv, 1, sizeof (cl_mem), &bufferInterImage2);
-            chk ("clSetKernelArg", status);
+        return name;
+    }
+
+    // Applies the filters on a raw RGB frame from Kinect, 
+    // and stores the resulting gray-scale image in image
+    void convolve (const uint8_t *rgb, uint8_t *image)
+    {
+        enqueueStripe (rgb, image, 0, region[1]);
+        finishStripe ();
+    }
 
-            // Apply the second box firter
-            status = clEnqueueNDRangeKernel (queue, kernelConv, 2, NULL, global, NULL, 0, NULL, NULL);
-            chk ("clEnqueueNDRangeKernel", status);
+    // Enqueues the filtering of the rows [first, last) of a raw RGB frame 
+    // from Kinect, and the readback of them into the same rows of image, 
+    // without waiting. Only the rows that the filter chain reads get uploaded. 
+    // Each pass covers the rows that the passes after it read around the stripe, 
+    // so the stripes of a frame put together are the same as the full frame. 
+    // The rows are the ones of the filtered image (the top level of the pyramid)
+    void enqueueStripe (const uint8_t *rgb, uint8_t *image, int first, int last)
+    {
+        const int width = region[0];
+        const size_t rowSize = 3 * sizeof (uint8_t) * frameWidth;
+
+        // Copy the source rows to the device (the rows of the frame 
+        // that get downsampled to the ones the filter chain reads)
+        const int halo = chainHalo ();
+        const int sourceFirst = std::max (first - halo, 0) << levels;
+        const int sourceLast = std::min (std::min (last + halo, (int) region[1]) << levels, frameHeight);
+        const size_t offset = sourceFirst * rowSize;
+        const size_t size = (sourceLast - sourceFirst) * rowSize;
+        status = clEnqueueWriteBuffer (queue, frames->sourceRGB[0], CL_FALSE, offset, size, 
+                                       pinnedSource (rgb, 2, offset, size) + offset, 
+                                       0, NULL, profile ("Upload"));
+        chk ("clEnqueueWriteBuffer", status);
 
-            status = clSetKernelArg (kernelConv, 0, sizeof (cl_mem), &bufferInterImage2);
-            chk ("clSetKernelArg", status);
-        }
-        else
+        stripe[0] = first;
+        stripe[1] = last;
+        enqueueFilters (frames->sourceRGB[0], frames->outputImage[0], NULL, NULL);
+        stripe[0] = 0;
+        stripe[1] = region[1];
+
+        // Read back the rows of the output image
+        const size_t stripeOrigin[3] = { 0, (size_t) first, 0 };
+        const size_t stripeRegion[3] = { (size_t) width, (size_t) (last - first), 1 };
+        status = clEnqueueReadImage (queue, frames->outputImage[0], CL_FALSE, stripeOrigin, stripeRegion, 0, 0, 
+                                     image + first * width, 0, NULL, profile ("Readback"));
+        chk ("clEnqueueReadImage", status);
+
+        clFlush (queue);
+    }
+
+    // Returns the frame in rgb, in pinned memory of this device. A frame in the 
+    // slots of another device (see Scheduler::rgbSlots) gets copied (the bytes 
+    // [offset, offset + size) only) into slot, a pinned buffer with no upload in 
+    // flight. The source only writes into the slots of the first device, so the 
+    // slots of the rest are free to stage their uploads
+    const uint8_t *pinnedSource (const uint8_t *rgb, int slot, size_t offset, size_t size)
+    {
+        for (int i = 0; i < 3; ++i)
+            if (rgb == pinnedRGB[i])
+                return rgb;
+
+        std::memcpy (pinnedRGB[slot] + offset, rgb + offset, size);
+        return pinnedRGB[slot];
+    }
+
+    // Waits for the stripe enqueued last to be read back
+    void finishStripe ()
+    {
+        status = clFinish (queue);
+        chk ("clFinish", status);
+
+        collectProfile ();
+    }
+
+    // Pipelined version of convolve. Enqueues a raw RGB frame from Kinect 
+    // for filtering, and returns without waiting for the results.
+    // With two frames in flight, the upload of frame N+1 and the readback 
+    // of frame N-1 overlap with the filtering of frame N.
+    // The frame in rgb has to stay intact until finishUpload returns. 
+    // The arrival time of the frame gets delivered along with it
+    void submit (const uint8_t *rgb, double arrival = 0.)
+    {
+        const int set = submitted % 2;
+
+        // Both sets are in use, so the oldest frame gets dropped
+        if (submitted - retrieved == 2)
         {
-            status = clSetKernelArg (kernelConv, 0, sizeof (cl_mem), &bufferSourceImage);
-            chk ("clSetKernelArg", status);
+            status = clWaitForEvents (1, &readEvent[set]);
+            chk ("clWaitForEvents", status);
+            ++retrieved;
         }
 
-        status = clSetKernelArg (kernelConv, 1, sizeof (cl_mem), &bufferOutputImage);
-        status |= clSetKernelArg (kernelConv, 4, sizeof (cl_mem), &bufferLaplacianFilter);
-        chk ("clSetKernelArg", status);
+        releaseEvents (set);
+        arrivals[set] = arrival;
+
+        status = clEnqueueWriteBuffer (uploadQueue, frames->sourceRGB[set], CL_FALSE, 0, rgbBufferSize, 
+                                       pinnedSource (rgb, set, 0, rgbBufferSize), 0, NULL, &uploadEvent[set]);
+        chk ("clEnqueueWriteBuffer", status);
 
-        // Perform the edge detection
-        status = clEnqueueNDRangeKernel (queue, kernelConv, 2, NULL, global, NULL, 0, NULL, NULL);
-        chk ("clEnqueueNDRangeKernel", status);
+        enqueueFilters (frames->sourceRGB[set], frames->outputImage[set], uploadEvent[set], &computeEvent[set]);
 
-        // Read back the output image
-        status = clEnqueueReadImage (queue, bufferOutputImage, CL_TRUE, origin, region, 0, 0, image.data (), 0, NULL, NULL);
+        hostImage[set].resize (region[0] * region[1]);
+        status = clEnqueueReadImage (readQueue, frames->outputImage[set], CL_FALSE, origin, region, 0, 0, 
+                                     hostImage[set].data (), 1, &computeEvent[set], &readEvent[set]);
         chk ("clEnqueueReadImage", status);
+
+        track ("Upload", uploadEvent[set]);
+        track ("Readback", readEvent[set]);
+
+        // Get all three queues going, without waiting on any of them
+        clFlush (uploadQueue);
+        clFlush (queue);
+        clFlush (readQueue);
+
+        ++submitted;
+    }
+
+    // Returns the number of submitted frames that haven't been retrieved
+    int inFlight ()
+    {
+        return submitted - retrieved;
+    }
+
+    // Waits for the upload of the last submitted frame to complete
+    void finishUpload ()
+    {
+        if (submitted == 0)
+            return;
+
+        status = clWaitForEvents (1, &uploadEvent[(submitted - 1) % 2]);
+        chk ("clWaitForEvents", status);
+    }
+
+    // Delivers in image the oldest frame in the pipeline, if its filtering has 
+    // completed. If both sets are in use, it waits for that frame.
+    // Returns false if no frame was delivered
+    bool retrieve (std::vector<uint8_t> &image, double *arrival = NULL)
+    {
+        const int pending = submitted - retrieved;
+        const int set = retrieved % 2;
+
+        if (pending == 0)
+            return false;
+
+        if (pending == 1)
+        {
+            cl_int execStatus;
+            status = clGetEventInfo (readEvent[set], CL_EVENT_COMMAND_EXECUTION_STATUS, 
+                                     sizeof (cl_int), &execStatus, NULL);
+            chk ("clGetEventInfo", status);
+            if (execStatus != CL_COMPLETE)
+                return false;
+        }
+
+        status = clWaitForEvents (1, &readEvent[set]);
+        chk ("clWaitForEvents", status);
+
+        image.swap (hostImage[set]);
+        if (arrival)
+            *arrival = arrivals[set];
+        ++retrieved;
+
+        collectProfile ();
+
+        return true;
     }
 
     ~Filter ()
     {
+        for (int i = 0; i < 3; ++i)
+        {
+            clEnqueueUnmapMemObject (queue, bufferPinnedRGB[i], pinnedRGB[i], 0, NULL, NULL);
+            clReleaseMemObject (bufferPinnedRGB[i]);
+        }
+        clFinish (uploadQueue);
+        clFinish (readQueue);
+        clFinish (queue);
+        for (int i = 0; i < 2; ++i)
+            releaseEvents (i);
+        for (auto &set : frameSets)
+        {
+            for (int i = 0; i < 2; ++i)
+            {
+                clReleaseMemObject (set.second->sourceRGB[i]);
+                clReleaseMemObject (set.second->outputImage[i]);
+            }
+            delete set.second;
+        }
+
+        pipelines.clear ();
+        delete pool;
+
+        coefficientCache.forEach ([] (Coefficients &c) {
+            clReleaseKernel (c.row);
+            clReleaseKernel (c.column);
+            clReleaseProgram (c.separable);
+            clReleaseMemObject (c.log);
+        });
         clReleaseKernel (kernelConv);
+        clReleaseKernel (kernelConvRGB);
+        clReleaseKernel (kernelDownsample);
+        clReleaseKernel (kernelBilateral);
+        clReleaseKernel (kernelGuidedCoeffs);
+        clReleaseKernel (kernelGuided);
         clReleaseProgram (program);
-        clReleaseMemObject (bufferSourceImage);
-        clReleaseMemObject (bufferInterImage1);
-        clReleaseMemObject (bufferInterImage2);
-        clReleaseMemObject (bufferOutputImage);
         clReleaseMemObject (bufferBoxFilter);
         clReleaseMemObject (bufferLaplacianFilter);
         clReleaseSampler (sampler);
+        clReleaseCommandQueue (uploadQueue);
+        clReleaseCommandQueue (readQueue);
         clReleaseCommandQueue (queue);
         clReleaseContext (context);
     }
 
+    // Returns the pinned host buffers that the RGB frames get written into
+    uint8_t *const *rgbSlots ()
+    {
+        return pinnedRGB;
+    }
+
+    // Switches to frames of frameWidth x frameHeight pixels (up to 
+    // maxFrameWidth x maxFrameHeight), filtered at 1 / 2^levels of their size. 
+    // The frames in flight get dropped. The images of each resolution stay 
+    // in their pools, so switching back doesn't allocate anything
+    void setResolution (int frameWidth, int frameHeight, int levels)
+    {
+        clFinish (uploadQueue);
+        clFinish (queue);
+        clFinish (readQueue);
+        retrieved = submitted;
+        collectProfile ();
+
+        setDimensions (frameWidth, frameHeight, levels);
+        setSeparableArgs ();
+        buildPipelines ();
+    }
+
+    // Returns the dimensions of the filtered images
+    int imageWidth ()
+    {
+        return region[0];
+    }
+
+    int imageHeight ()
+    {
+        return region[1];
+    }
+
     // Returns the state of the flag for smoothing
     bool smoothing ()
     {
@@ -259,8 +550,452 @@ public:
         return smoothed;
     }
 
+    // Returns the state of the flag for the pipelined mode
+    bool pipelining ()
+    {
+        return pipelined;
+    }
+
+    // Toggles the flag for the pipelined mode (submit/retrieve instead of convolve)
+    // Returns the new state of the flag
+    bool togglePipelining ()
+    {
+        // Drop the frames still in flight
+        clFinish (uploadQueue);
+        clFinish (queue);
+        clFinish (readQueue);
+        retrieved = submitted;
+        collectProfile ();
+
+        pipelined = !pipelined;
+        return pipelined;
+    }
+
+    // Returns the name of the smoothing method
+    const char *smoothingMethod ()
+    {
+        static const char *names[] = { "Box", "Fused LoG", "Separable", "Bilateral", "Guided" };
+        return names[method];
+    }
+
+    // Switches to the next smoothing method
+    // Returns the name of the new method
+    const char *nextSmoothingMethod ()
+    {
+        method = static_cast<Method> ((method + 1) % METHOD_COUNT);
+        return smoothingMethod ();
+    }
+
+    // Sets the Gaussian of the Fused LoG and Separable methods, with the 
+    // given sigma (in pixels), over width (odd) pixels. The LoG filter gets 
+    // uploaded, and the separable program gets specialized for the pair, 
+    // the first time it's used (see GaussianCache), and the pipelines get rebuilt
+    void setGaussian (float sigma, int width)
+    {
+        Coefficients &c = coefficientCache.get (sigma, width, [this] (float sigma, int width, Coefficients &entry) {
+            const std::vector<float> gaussian = gaussianFilter (sigma, width);
+            const std::vector<float> log = logFilter (sigma, width);
+
+            entry.logWidth = width + filterWidth - 1;
+            entry.log = clCreateBuffer (context, CL_MEM_READ_ONLY, log.size () * sizeof (float), NULL, &status);
+            chk ("clCreateBuffer", status);
+            status = clEnqueueWriteBuffer (queue, entry.log, CL_TRUE, 0, log.size () * sizeof (float), 
+                                           log.data (), 0, NULL, NULL);
+            chk ("clEnqueueWriteBuffer", status);
+
+            // The width and the coefficients are baked into the separable 
+            // kernels, so that the loops get unrolled
+            entry.separable = buildProgram (separableOptions (gaussian, gaussian).c_str ());
+            entry.row = clCreateKernel (entry.separable, "separableRowRGB", &status);
+            chk ("clCreateKernel", status);
+            entry.column = clCreateKernel (entry.separable, "separableColumn", &status);
+            chk ("clCreateKernel", status);
+
+            status = clSetKernelArg (entry.column, 4, sizeof (cl_sampler), &sampler);
+            chk ("clSetKernelArg", status);
+        });
+
+        // Wait for the frames in flight, which still use the previous kernels
+        clFinish (uploadQueue);
+        clFinish (queue);
+        clFinish (readQueue);
+
+        coefficients = &c;
+        gaussianSigma = sigma;
+        gaussianWidth = width;
+        separableRadius = width / 2;
+        kernelRow = c.row;
+        kernelColumn = c.column;
+
+        // The separable stages hold on to the previous kernels
+        setSeparableArgs ();
+        buildPipelines ();
+    }
+
+    // Returns the sigma and the width of the Gaussian (see setGaussian)
+    float smoothingSigma ()
+    {
+        return gaussianSigma;
+    }
+
+    int smoothingWidth ()
+    {
+        return gaussianWidth;
+    }
+
 private:
-    void chk (const char* funcName, int errNum)
+    // Smoothing methods
+    // BOX: Two box filters, followed by the Laplacian filter (3 passes)
+    // FUSED_LOG: A Gaussian and the Laplacian filter combined into a single LoG filter (1 pass)
+    // SEPARABLE: A separable Gaussian filter, followed by the Laplacian filter (3 passes)
+    // BILATERAL: An edge-preserving bilateral filter, followed by the Laplacian filter (2 passes)
+    // GUIDED: An edge-preserving guided filter (coefficients and output, with 
+    //         box sums over the tiles), followed by the Laplacian filter (3 passes)
+    enum Method { BOX, FUSED_LOG, SEPARABLE, BILATERAL, GUIDED, METHOD_COUNT };
+
+    // The uploaded LoG filter of a (sigma, width) pair of the Gaussian, 
+    // and the separable program specialized for the pair
+    struct Coefficients
+    {
+        cl_mem log;
+        int logWidth;
+        cl_program separable;
+        cl_kernel row, column;
+    };
+
+    // The device memory objects for the frames of a resolution: the source 
+    // RGB frames, and the output images, one per frame in flight
+    struct FrameSet
+    {
+        cl_mem sourceRGB[2];
+        cl_mem outputImage[2];
+    };
+
+    // Sets the dimensions of the frames, and of the filtered images, on the kernels 
+    // and the workspaces, and picks the frame images (created on first use)
+    void setDimensions (int frameWidth, int frameHeight, int levels)
+    {
+        this->frameWidth = frameWidth;
+        this->frameHeight = frameHeight;
+        this->levels = levels;
+
+        // The filters run on the top level of the pyramid
+        const int width = frameWidth >> levels;
+        const int height = frameHeight >> levels;
+
+        rgbBufferSize = 3 * sizeof (uint8_t) * frameWidth * frameHeight;
+        region[0] = width;
+        region[1] = height;
+        stripe[0] = 0;
+        stripe[1] = height;
+
+        FrameSet *&set = frameSets[std::make_tuple (frameWidth, frameHeight, levels)];
+        if (!set)
+        {
+            // Create image descriptor
+            cl_image_desc desc;
+            desc.image_type = CL_MEM_OBJECT_IMAGE2D;
+            desc.image_width = width;
+            desc.image_height = height;
+            desc.image_depth = 0;
+            desc.image_array_size = 0;
+            desc.image_row_pitch = 0;
+            desc.image_slice_pitch = 0;
+            desc.num_mip_levels = 0;
+            desc.num_samples = 0;
+            desc.buffer = NULL;
+
+            // Create image format
+            cl_image_format format;
+            format.image_channel_order = CL_R;
+            format.image_channel_data_type = CL_UNSIGNED_INT8;
+
+            set = new FrameSet;
+            for (int i = 0; i < 2; ++i)
+            {
+                set->sourceRGB[i] = clCreateBuffer (context, CL_MEM_READ_ONLY, rgbBufferSize, NULL, &status);
+                chk ("clCreateBuffer", status);
+                set->outputImage[i] = clCreateImage (context, CL_MEM_WRITE_ONLY, &format, &desc, NULL, &status);
+                chk ("clCreateImage2D", status);
+            }
+        }
+        frames = set;
+
+        status = clSetKernelArg (kernelBilateral, 2, sizeof (int), &height);
+        status |= clSetKernelArg (kernelBilateral, 3, sizeof (int), &width);
+        status |= clSetKernelArg (kernelGuidedCoeffs, 2, sizeof (int), &height);
+        status |= clSetKernelArg (kernelGuidedCoeffs, 3, sizeof (int), &width);
+        status |= clSetKernelArg (kernelGuided, 3, sizeof (int), &height);
+        status |= clSetKernelArg (kernelGuided, 4, sizeof (int), &width);
+        status |= clSetKernelArg (kernelConv, 2, sizeof (int), &height);
+        status |= clSetKernelArg (kernelConv, 3, sizeof (int), &width);
+        status |= clSetKernelArg (kernelConvRGB, 2, sizeof (int), &height);
+        status |= clSetKernelArg (kernelConvRGB, 3, sizeof (int), &width);
+        chk ("clSetKernelArg", status);
+
+        // The workspace has to be a multiple of the work-group size
+        global[0] = roundUp (width, local[0]);
+        global[1] = roundUp (height, local[1]);
+    }
+
+    // Sets the dimensions of the filtered images on the separable kernels
+    void setSeparableArgs ()
+    {
+        const int width = region[0];
+        const int height = region[1];
+
+        status = clSetKernelArg (kernelRow, 2, sizeof (int), &height);
+        status |= clSetKernelArg (kernelRow, 3, sizeof (int), &width);
+        status |= clSetKernelArg (kernelColumn, 2, sizeof (int), &height);
+        status |= clSetKernelArg (kernelColumn, 3, sizeof (int), &width);
+        chk ("clSetKernelArg", status);
+    }
+
+    // Prepends to a pipeline the stages that downsample the source frame to the 
+    // top level of the pyramid. The chain after them reads halo rows around the 
+    // stripe, so each level covers those rows, scaled to it. Returns the name of 
+    // the frame to filter
+    std::string addPyramid (Pipeline &pipeline, int halo)
+    {
+        std::string frame = "source";
+        for (int l = 1; l <= levels; ++l)
+        {
+            const int rows = frameHeight >> l;
+            const int cols = frameWidth >> l;
+            const int scale = levels - l;
+            std::ostringstream level;
+            level << "rgb" << l;
+
+            pipeline.intermediate (level.str (), MemSpec::buffer (3 * rows * cols));
+            pipeline.addStage ("Pyramid level " + level.str ().substr (3), kernelDownsample, cl::NDRange (cols, rows))
+                .input (0, frame).output (1, level.str ())
+                .setup ([this, rows, cols] (cl::Kernel &kernel) {
+                    status = clSetKernelArg (kernel (), 2, sizeof (int), &rows);
+                    status |= clSetKernelArg (kernel (), 3, sizeof (int), &cols);
+                    chk ("clSetKernelArg", status);
+                })
+                .range ([this, halo, scale, rows, cols] (cl::NDRange &offset, cl::NDRange &size) {
+                    const int first = std::max (stripe[0] - halo, 0) << scale;
+                    const int last = std::min (std::min (stripe[1] + halo, (int) region[1]) << scale, rows);
+                    offset = cl::NDRange (0, first);
+                    size = cl::NDRange (cols, last - first);
+                });
+            frame = level.str ();
+        }
+
+        return frame;
+    }
+
+    // Creates a program from the kernel source and compiles it 
+    // (or loads it from the binary cache, when it has been built before)
+    cl_program buildProgram (const char *options)
+    {
+        std::string log;
+
+        // Create and compile program
+        cl_program prog = buildCachedProgram (context, deviceID, programCode, 
+                                              options ? options : "", &status, &log);
+        if (status == CL_BUILD_PROGRAM_FAILURE)
+        {
+            std::cerr << log << std::endl;
+            exit (EXIT_FAILURE);
+        }
+        chk ("clBuildProgram", status);
+
+        return prog;
+    }
+
+    // Builds the filter chain of each smoothing method as a pipeline. The stages 
+    // name their intermediate images, and the pipeline assigns them from the pool. 
+    // The source and the output get bound on each run (see enqueueFilters)
+    void buildPipelines ()
+    {
+        const int width = region[0];
+        const int height = region[1];
+        const MemSpec gray = MemSpec::image (cl::ImageFormat (CL_R, CL_UNSIGNED_INT8), width, height);
+        const cl::NDRange globalRange (global[0], global[1]);
+        const cl::NDRange localRange (local[0], local[1]);
+
+        // The two convolution kernels are shared by the stages, 
+        // so the filters get set right before each launch
+        auto filter = [this] (cl_mem &buffer, int filterSize) {
+            return [this, &buffer, filterSize] (cl::Kernel &kernel) { setFilter (kernel (), buffer, filterSize); };
+        };
+
+        // Each pass covers the rows of the stripe, extended by halo rows on each 
+        // side (the ones that the passes after it read). The whole frame is a single stripe
+        auto rows = [this, height] (int halo) {
+            return [this, halo, height] (cl::NDRange &offset, cl::NDRange &size) {
+                const int first = std::max (stripe[0] - halo, 0);
+                const int last = std::min (stripe[1] + halo, height);
+                offset = cl::NDRange (0, first);
+                size = cl::NDRange (global[0], roundUp (last - first, local[1]));
+            };
+        };
+
+        pipelines.assign (METHOD_COUNT + 1, Pipeline (*pool));
+
+        // Each pipeline starts with the downsampling to the top level of the pyramid
+        std::string rgb;
+
+        Pipeline &box = pipelines[BOX];
+        box.intermediate ("box1", gray);
+        box.intermediate ("box2", gray);
+        rgb = addPyramid (box, methodHalo (BOX));
+        box.addStage ("Box filter 1", kernelConvRGB, globalRange, localRange)
+            .input (0, rgb).output (1, "box1").setup (filter (bufferBoxFilter, filterWidth))
+            .range (rows (2 * (filterWidth / 2)));
+        box.addStage ("Box filter 2", kernelConv, globalRange, localRange)
+            .input (0, "box1").output (1, "box2").setup (filter (bufferBoxFilter, filterWidth))
+            .range (rows (filterWidth / 2));
+        box.addStage ("Laplacian filter", kernelConv, globalRange, localRange)
+            .input (0, "box2").output (1, "output").setup (filter (bufferLaplacianFilter, filterWidth))
+            .range (rows (0));
+
+        // The whole chain in one pass, without any intermediate images
+        rgb = addPyramid (pipelines[FUSED_LOG], methodHalo (FUSED_LOG));
+        pipelines[FUSED_LOG].addStage ("LoG filter", kernelConvRGB, globalRange, localRange)
+            .input (0, rgb).output (1, "output").setup (filter (coefficients->log, coefficients->logWidth))
+            .range (rows (0));
+
+        Pipeline &separable = pipelines[SEPARABLE];
+        separable.intermediate ("row", gray);
+        separable.intermediate ("column", gray);
+        rgb = addPyramid (separable, methodHalo (SEPARABLE));
+        separable.addStage ("Row filter", kernelRow, globalRange, localRange)
+            .input (0, rgb).output (1, "row").range (rows (separableRadius + filterWidth / 2));
+        separable.addStage ("Column filter", kernelColumn, globalRange, localRange)
+            .input (0, "row").output (1, "column").range (rows (filterWidth / 2));
+        separable.addStage ("Laplacian filter", kernelConv, globalRange, localRange)
+            .input (0, "column").output (1, "output").setup (filter (bufferLaplacianFilter, filterWidth))
+            .range (rows (0));
+
+        Pipeline &bilateral = pipelines[BILATERAL];
+        bilateral.intermediate ("smooth", gray);
+        rgb = addPyramid (bilateral, methodHalo (BILATERAL));
+        bilateral.addStage ("Bilateral filter", kernelBilateral, globalRange, localRange)
+            .input (0, rgb).output (1, "smooth").range (rows (filterWidth / 2));
+        bilateral.addStage ("Laplacian filter", kernelConv, globalRange, localRange)
+            .input (0, "smooth").output (1, "output").setup (filter (bufferLaplacianFilter, filterWidth))
+            .range (rows (0));
+
+        Pipeline &guided = pipelines[GUIDED];
+        guided.intermediate ("coeffs", MemSpec::buffer (2 * sizeof (float) * width * height));
+        guided.intermediate ("smooth", gray);
+        rgb = addPyramid (guided, methodHalo (GUIDED));
+        guided.addStage ("Guided coefficients", kernelGuidedCoeffs, globalRange, localRange)
+            .input (0, rgb).output (1, "coeffs").range (rows (windowRadius + filterWidth / 2));
+        guided.addStage ("Guided filter", kernelGuided, globalRange, localRange)
+            .input (0, rgb).input (1, "coeffs").output (2, "smooth").range (rows (filterWidth / 2));
+        guided.addStage ("Laplacian filter", kernelConv, globalRange, localRange)
+            .input (0, "smooth").output (1, "output").setup (filter (bufferLaplacianFilter, filterWidth))
+            .range (rows (0));
+
+        // No smoothing, just the edge detection
+        rgb = addPyramid (pipelines[METHOD_COUNT], methodHalo (METHOD_COUNT));
+        pipelines[METHOD_COUNT].addStage ("Laplacian filter", kernelConvRGB, globalRange, localRange)
+            .input (0, rgb).output (1, "output").setup (filter (bufferLaplacianFilter, filterWidth))
+            .range (rows (0));
+    }
+
+    // Enqueues the filter chain for the selected smoothing method on the compute queue.
+    // If upload is given, the kernels wait for it. If done is given, it 
+    // receives an event for the completion of the last kernel
+    void enqueueFilters (cl_mem source, cl_mem output, cl_event upload, cl_event *done)
+    {
+        Pipeline &pipeline = pipelines[smoothed ? method : METHOD_COUNT];
+        pipeline.bind ("source", source);
+        pipeline.bind ("output", output);
+
+        status = pipeline.enqueue (queue, upload, done, 
+                                   [this] (const std::string &stage) { return profile (stage.c_str ()); });
+        chk ("Pipeline::enqueue", status);
+
+        if (done)
+            track (pipeline.lastStage ().c_str (), *done);
+    }
+
+    // Returns the number of rows that the filter chain of the selected 
+    // smoothing method reads around a pixel (in the filtered image)
+    int chainHalo ()
+    {
+        return methodHalo (smoothed ? method : METHOD_COUNT);
+    }
+
+    // Returns the number of rows that the filter chain of method m 
+    // reads around a pixel (METHOD_COUNT is the chain without smoothing)
+    int methodHalo (int m)
+    {
+        switch (m)
+        {
+            case BOX:
+                return 3 * (filterWidth / 2);
+            case FUSED_LOG:
+                return coefficients->logWidth / 2;
+            case SEPARABLE:
+                return separableRadius + filterWidth / 2;
+            case BILATERAL:
+                return windowRadius + filterWidth / 2;
+            case GUIDED:
+                return 2 * windowRadius + filterWidth / 2;
+            default:
+                return filterWidth / 2;
+        }
+    }
+
+    // Releases the events of a set of source/output images
+    void releaseEvents (int set)
+    {
+        cl_event *events[] = { &uploadEvent[set], &computeEvent[set], &readEvent[set] };
+        for (cl_event *e : events)
+        {
+            if (*e)
+                clReleaseEvent (*e);
+            *e = NULL;
+        }
+    }
+
+    // Returns an event for timing a command of the given stage, 
+    // or NULL when profiling is off (see Profiler::profile)
+    cl_event *profile (const char *stage)
+    {
+        return profiler ? profiler->profileRaw (stage) : NULL;
+    }
+
+    // Times an existing event as a command of the given stage
+    void track (const char *stage, cl_event event)
+    {
+        if (profiler)
+            profiler->track (stage, event);
+    }
+
+    // Records the durations of the timed commands that have completed
+    void collectProfile ()
+    {
+        if (profiler)
+            profiler->collect ();
+    }
+
+    // Sets the filter, and the local memory for the tile 
+    // (which depends on the filter width), on a convolution kernel
+    void setFilter (cl_kernel kernel, cl_mem &filter, int width)
+    {
+        const size_t tileSize = sizeof (float) * 
+            (local[0] + width - 1) * (local[1] + width - 1);
+
+        status = clSetKernelArg (kernel, 4, sizeof (cl_mem), &filter);
+        status |= clSetKernelArg (kernel, 5, sizeof (int), &width);
+        status |= clSetKernelArg (kernel, 6, tileSize, NULL);
+        chk ("clSetKernelArg", status);
+    }
+
+    // Rounds value up to the nearest multiple of base
+    static size_t roundUp (size_t value, size_t base)
+    {
+        return ((value + base - 1) / base) * base;
+    }
+
+    static void chk (const char* funcName, int errNum)
     {
         if (errNum != CL_SUCCESS)
         {
@@ -269,114 +1004,372 @@ private:
         }
     }
 
+    // Source buffer parameters
+    size_t rgbBufferSize;
+
+    // Frame dimensions, and levels of the pyramid above the frame
+    int frameWidth, frameHeight, levels;
+
     // Image transfer parameters
     size_t origin[3];
     size_t region[3];
 
     // Workspace dimensions
     size_t global[2];
+    size_t local[2];
+
+    // The rows [first, last) that the filter chain gets enqueued for
+    int stripe[2];
+
+    bool smoothed, pipelined;
+    Method method;
+
+    // Pipelined mode state
+    // The frames alternate between the two sets of source/output images
+    int submitted, retrieved;
+    cl_event uploadEvent[2], computeEvent[2], readEvent[2];
+    std::vector<uint8_t> hostImage[2];
+    double arrivals[2];  // Of the frames in the sets (see FrameSource::rgbArrival)
+
+    // Filter widths, and radii (of the separable filter, and of the 
+    // windows of the bilateral and guided filters)
+    int filterWidth;
+    int separableRadius, windowRadius;
 
-    bool smoothed;
+    // The Gaussian of the Fused LoG and Separable methods
+    float gaussianSigma;
+    int gaussianWidth;
+    GaussianCache<Coefficients> coefficientCache;
+    Coefficients *coefficients;
 
     cl_int status;
+    cl_device_id deviceID;
     cl_context context;
-    cl_command_queue queue;
+    cl_command_queue queue, uploadQueue, readQueue;
     cl_sampler sampler;
     cl_mem bufferBoxFilter, bufferLaplacianFilter;
-    cl_mem bufferSourceImage, bufferOutputImage;
-    cl_mem bufferInterImage1, bufferInterImage2;
+    std::map<std::tuple<int, int, int>, FrameSet *> frameSets;  // Per resolution and pyramid level
+    FrameSet *frames;
+    cl_mem bufferPinnedRGB[3];
+    uint8_t *pinnedRGB[3];
+    MemPool *pool;
+    std::vector<Pipeline> pipelines;
+    std::string programCode;
     cl_program program;
-    cl_kernel kernelConv;
+    cl_kernel kernelConv, kernelConvRGB, kernelDownsample;
+    cl_kernel kernelRow, kernelColumn;
+    cl_kernel kernelBilateral, kernelGuidedCoeffs, kernelGuided;
 };
 
 
-// A class hierarchy for manipulating a mutex
-class Mutex
+// A class that spreads the filtering over the devices of all the platforms, 
+// with a Filter for each. A short calibration run measures the throughput of 
+// every device. In the synchronous mode, each frame gets split into stripes of 
+// rows, in proportion to the throughputs. In the pipelined mode, whole frames 
+// go to the devices in a weighted round-robin, and get delivered in order. 
+// Without any device (or with cpuOnly), the filtering falls back to a CpuPipeline. 
+// The frames are of frameWidth x frameHeight pixels, filtered at 1 / 2^levels of their size
+class Scheduler
 {
 public:
-    void lock () { freenectMutex.lock (); }
-    void unlock () { freenectMutex.unlock (); }
+    Scheduler (int frameWidth, int frameHeight, int levels, bool allDevices, bool cpuOnly = false) 
+        : cpu (NULL)
+    {
+        if (!cpuOnly)
+            for (auto &id : Filter::findDevices (allDevices))
+                filters.push_back (new Filter (id.first, id.second, frameWidth, frameHeight, levels));
+
+        if (filters.empty ())
+        {
+            cpu = new CpuPipeline (frameWidth, frameHeight, levels, profiler);
+            std::cout << "Filtering on the " << cpu->name () << std::endl;
+            return;
+        }
+
+        calibrate (frameWidth, frameHeight);
+    }
 
-    // A class that automates the manipulation of 
-    // the outer class instance's mutex.
-    // Mutex's mutex is locked with the creation of a ScopedLock instance 
-    // and unlocked with the destruction of the ScopedLock instance.
-    class ScopedLock
+    ~Scheduler ()
     {
-    public:
-        ScopedLock (Mutex &mtx) : mMutex (mtx) { mMutex.lock (); }
-        ~ScopedLock () { mMutex.unlock (); }
+        for (Filter *filter : filters)
+            delete filter;
+        delete cpu;
+    }
 
-    private:
-        Mutex &mMutex;
-    };
+    // Filters a frame, with each device working on its own stripe of rows
+    void convolve (const uint8_t *rgb, uint8_t *image)
+    {
+        if (cpu)
+            return cpu->convolve (rgb, image);
 
-private:
-    std::mutex freenectMutex;
-};
+        for (size_t i = 0; i < filters.size (); ++i)
+            if (stripes[i] < stripes[i + 1])
+                filters[i]->enqueueStripe (rgb, image, stripes[i], stripes[i + 1]);
+
+        for (size_t i = 0; i < filters.size (); ++i)
+            if (stripes[i] < stripes[i + 1])
+                filters[i]->finishStripe ();
+    }
 
+    // Submits a frame to the next device in the weighted round-robin 
+    // (the one with the most credit). See Filter::submit
+    void submit (const uint8_t *rgb, double arrival = 0.)
+    {
+        size_t next = 0;
+        for (size_t i = 0; i < filters.size (); ++i)
+        {
+            credits[i] += weights[i];
+            if (credits[i] > credits[next])
+                next = i;
+        }
+        credits[next] -= 1.;
 
-// A class that extends Freenect::FreenectDevice by defining the VideoCallback
-// callback function so we can get updates with the latest RGB frame
-class MyFreenectDevice : public Freenect::FreenectDevice
-{
-public:
-    MyFreenectDevice (freenect_context *ctx, int index)
-        : Freenect::FreenectDevice (ctx, index),
-          rgbBuffer (freenect_find_video_mode (FREENECT_RESOLUTION_MEDIUM, 
-                                                    FREENECT_VIDEO_RGB).bytes),
-          newRGBFrame (false)
+        // With both of its sets in use, the device drops its oldest frame
+        if (filters[next]->inFlight () == 2)
+            order.erase (std::find (order.begin (), order.end (), next));
+
+        filters[next]->submit (rgb, arrival);
+        order.push_back (next);
+    }
+
+    // Waits for the upload of the last submitted frame to complete
+    void finishUpload ()
     {
+        if (!order.empty ())
+            filters[order.back ()]->finishUpload ();
     }
 
-    // Delivers the latest RGB frame
-    // Do not call directly, it's only used by the library
-    void VideoCallback (void *rgb, uint32_t timestamp)
+    // Delivers in image the oldest frame across the devices, if its 
+    // filtering has completed. See Filter::retrieve
+    bool retrieve (std::vector<uint8_t> &image, double *arrival = NULL)
     {
-        Mutex::ScopedLock lock (rgbMutex);
+        if (order.empty () || !filters[order.front ()]->retrieve (image, arrival))
+            return false;
 
-        std::copy (static_cast<uint8_t *> (rgb), 
-                   static_cast<uint8_t *> (rgb) + getVideoBufferSize (), 
-                   rgbBuffer.begin ());
-        newRGBFrame = true;
-    };
+        order.pop_front ();
+        return true;
+    }
+
+    // Returns the pinned host buffers that the RGB frames get written into 
+    // (the ones of the first device; the rest stage their uploads through 
+    // their own, see Filter::pinnedSource)
+    uint8_t *const *rgbSlots ()
+    {
+        return cpu ? cpu->rgbSlots () : filters[0]->rgbSlots ();
+    }
 
-    // Delivers the most recently received frame after filtering it
-    bool getRGB (std::vector<uint8_t> &buffer)
+    // Switches all the devices to a new resolution (see Filter::setResolution). 
+    // The stripes keep their shares of the filtered image
+    void setResolution (int frameWidth, int frameHeight, int levels)
     {
-        Mutex::ScopedLock lock (rgbMutex);
+        if (cpu)
+            return cpu->setResolution (frameWidth, frameHeight, levels);
+
+        for (Filter *filter : filters)
+            filter->setResolution (frameWidth, frameHeight, levels);
+        order.clear ();
+        setStripes ();
+    }
 
-        if (!newRGBFrame)
+    // Returns the dimensions of the filtered images
+    int imageWidth ()
+    {
+        return cpu ? cpu->imageWidth () : filters[0]->imageWidth ();
+    }
+
+    int imageHeight ()
+    {
+        return cpu ? cpu->imageHeight () : filters[0]->imageHeight ();
+    }
+
+    // The state of the filters is the same on all the devices (see Filter)
+    bool smoothing ()
+    {
+        return cpu ? cpu->smoothing () : filters[0]->smoothing ();
+    }
+
+    bool toggleSmoothing ()
+    {
+        if (cpu)
+            return cpu->toggleSmoothing ();
+        for (Filter *filter : filters)
+            filter->toggleSmoothing ();
+        return smoothing ();
+    }
+
+    // There is no pipelined mode on the CPU
+    bool pipelining ()
+    {
+        return cpu ? false : filters[0]->pipelining ();
+    }
+
+    bool togglePipelining ()
+    {
+        if (cpu)
             return false;
+        for (Filter *filter : filters)
+            filter->togglePipelining ();
+        order.clear ();
+        return pipelining ();
+    }
 
-        // Transform the frame to gray-scale
-        // OpenCV was used just for experimenting
-        // The operation could just as easily be done on the GPU
-        cv::Mat gray, rgb (gl_win_height, gl_win_width, CV_8UC3, rgbBuffer.data ());
-        cv::cvtColor (rgb, gray, CV_RGB2GRAY);
-        std::copy (gray.datastart, gray.dataend + 1, buffer.data ());
+    const char *smoothingMethod ()
+    {
+        return cpu ? cpu->smoothingMethod () : filters[0]->smoothingMethod ();
+    }
 
-        // Apply the filters to the image
-        opencl->convolve (buffer);
+    const char *nextSmoothingMethod ()
+    {
+        if (cpu)
+            return cpu->nextSmoothingMethod ();
+        for (Filter *filter : filters)
+            filter->nextSmoothingMethod ();
+        return smoothingMethod ();
+    }
 
-        newRGBFrame = false;
+    void setGaussian (float sigma, int width)
+    {
+        if (cpu)
+            return cpu->setGaussian (sigma, width);
+        for (Filter *filter : filters)
+            filter->setGaussian (sigma, width);
+    }
 
-        return true;
+    float smoothingSigma ()
+    {
+        return cpu ? cpu->smoothingSigma () : filters[0]->smoothingSigma ();
+    }
+
+    int smoothingWidth ()
+    {
+        return cpu ? cpu->smoothingWidth () : filters[0]->smoothingWidth ();
     }
 
 private:
-    Mutex rgbMutex;
-    std::vector<uint8_t> rgbBuffer;
-    bool newRGBFrame;
+    // Times a few frames on each device (on its own, with the default filter 
+    // chain), and shares the work out in proportion to the throughputs
+    void calibrate (int frameWidth, int frameHeight)
+    {
+        const int frames = 10;
+        std::vector<uint8_t> image (imageWidth () * imageHeight ());
+
+        // A single device gets everything, without a calibration run
+        std::vector<double> throughputs (1, 1.);
+        if (filters.size () > 1)
+        {
+            // The test frame goes where the source will write its frames 
+            // (it isn't attached yet), so the staging of the uploads gets timed too
+            uint8_t *rgb = filters[0]->rgbSlots ()[0];
+            std::memset (rgb, 128, 3 * frameWidth * frameHeight);
+
+            throughputs.clear ();
+            for (Filter *filter : filters)
+            {
+                filter->convolve (rgb, image.data ());  // Warm up
+
+                const double start = Profiler::now ();
+                for (int i = 0; i < frames; ++i)
+                    filter->convolve (rgb, image.data ());
+                throughputs.push_back (frames / std::max (Profiler::now () - start, 1e-3));
+            }
+        }
+
+        double total = 0.;
+        for (double throughput : throughputs)
+            total += throughput;
+
+        for (size_t i = 0; i < filters.size (); ++i)
+        {
+            weights.push_back (throughputs[i] / total);
+            credits.push_back (0.);
+
+            std::cout << "Device " << i << ": " << filters[i]->deviceName () 
+                      << " (" << std::fixed << std::setprecision (1) << 100. * weights[i] << "%)" << std::endl;
+        }
+
+        setStripes ();
+    }
+
+    // Splits the rows of the filtered image into stripes, in proportion to the weights. 
+    // The stripes are contiguous, and cover the whole image
+    void setStripes ()
+    {
+        const int height = imageHeight ();
+
+        double share = 0.;
+        stripes.assign (1, 0);
+        for (size_t i = 0; i < filters.size (); ++i)
+        {
+            share += weights[i];
+            stripes.push_back (i + 1 == filters.size () ? height : (int) (share * height + 0.5));
+        }
+    }
+
+    std::vector<Filter *> filters;
+    CpuPipeline *cpu;
+    std::vector<double> weights, credits;
+    std::vector<int> stripes;  // Stripe i covers the rows [stripes[i], stripes[i + 1])
+    std::deque<size_t> order;  // The devices of the frames in flight, in submission order
 };
 
 
+// Delivers the most recently received frame after filtering it
+// In pipelined mode, the delivered frame lags one frame behind. 
+// Otherwise, the frame gets written in direct instead, if it's given. 
+// The arrival time of the delivered frame goes in arrival, if it's given
+bool filterFrame (std::vector<uint8_t> &buffer, uint8_t *direct = NULL, double *arrival = NULL)
+{
+    const uint8_t *rgb;
+
+    if (opencl->pipelining ())
+    {
+        // The slot of the last submitted frame goes back to 
+        // the libfreenect thread on update, so its upload has to be done
+        opencl->finishUpload ();
+
+        if (source->getRGB (rgb))
+            opencl->submit (rgb, source->rgbArrival ());
+
+        return opencl->retrieve (buffer, arrival);
+    }
+
+    if (!source->getRGB (rgb))
+        return false;
+
+    if (arrival)
+        *arrival = source->rgbArrival ();
+
+    // Apply the filters to the frame
+    // The transformation to gray-scale happens on the GPU
+    // The filtering happens outside of any lock, 
+    // so the libfreenect thread is never kept waiting
+    buffer.resize (opencl->imageWidth () * opencl->imageHeight ());
+    opencl->convolve (rgb, direct ? direct : buffer.data ());
+
+    return true;
+}
+
+
 // Display callback for the window
 void drawGLScene ()
 {
-    static std::vector<uint8_t> image (gl_win_width * gl_win_height);
-
-    device->getRGB (image);
+    // The dimensions of the displayed image change with the 
+    // resolution and the pyramid level (the texture gets scaled)
+    static std::vector<uint8_t> image;
+    static int width = 0, height = 0;
+
+    // The frame gets read back straight into the unpack buffer, 
+    // except in pipelined mode, where it gets copied from the host image
+    uint8_t *slot = texStream ? texStream->begin () : NULL;
+    double arrival;
+    const bool fresh = filterFrame (image, opencl->pipelining () ? NULL : slot, &arrival);
+    if (fresh)
+    {
+        width = opencl->imageWidth ();
+        height = opencl->imageHeight ();
+    }
+    if (fresh && slot && opencl->pipelining ())
+        std::memcpy (slot, image.data (), image.size ());
 
     glClear (GL_COLOR_BUFFER_BIT);
 
@@ -390,17 +1383,70 @@ void drawGLScene ()
 
     glEnable (GL_TEXTURE_2D);
     // glBindTexture (GL_TEXTURE_2D, glRGBTex);
-    glTexImage2D (GL_TEXTURE_2D, 0, GL_LUMINANCE, gl_win_width, gl_win_height, 0,
-                  GL_LUMINANCE, GL_UNSIGNED_BYTE, image.data ());
+    const double texStart = profiler ? Profiler::now () : 0.;
+    if (texStream)
+    {
+        if (fresh)
+        {
+            texStream->commit (width, height);
+            if (profiler)
+                profiler->record ("glTexSubImage2D", Profiler::now () - texStart);
+        }
+    }
+    else
+    {
+        glTexImage2D (GL_TEXTURE_2D, 0, GL_LUMINANCE, width, height, 0,
+                      GL_LUMINANCE, GL_UNSIGNED_BYTE, image.data ());
+        if (profiler)
+            profiler->record ("glTexImage2D", Profiler::now () - texStart);
+    }
 
     std::ostringstream state;
-    state << "Smoothing: " << (opencl->smoothing () ? "ON" : "OFF");
+    state << "Smoothing: ";
+    if (opencl->smoothing ())
+        state << "ON (" << opencl->smoothingMethod () << ")";
+    else
+        state << "OFF";
 
-    glRasterPos2i (530, 30);
+    glRasterPos2i (470, 30);
+    for (auto c : state.str ())
+        glutBitmapCharacter (GLUT_BITMAP_HELVETICA_12, c);
+
+    if (profiler)
+        profiler->draw (10, 30);
+
+    state.str ("");
+    state << "Pipelining: " << (opencl->pipelining () ? "ON" : "OFF");
+
+    glRasterPos2i (470, 45);
+    for (auto c : state.str ())
+        glutBitmapCharacter (GLUT_BITMAP_HELVETICA_12, c);
+
+    state.str ("");
+    state << "Gaussian: " << std::fixed << std::setprecision (2) << opencl->smoothingSigma () 
+          << ", " << opencl->smoothingWidth () << "px";
+
+    glRasterPos2i (470, 60);
+    for (auto c : state.str ())
+        glutBitmapCharacter (GLUT_BITMAP_HELVETICA_12, c);
+
+    state.str ("");
+    state << "Filtering: " << width << "x" << height;
+    if (pyramidLevels)
+        state << " (1/" << (1 << pyramidLevels) << ")";
+
+    glRasterPos2i (470, 75);
     for (auto c : state.str ())
         glutBitmapCharacter (GLUT_BITMAP_HELVETICA_12, c);
 
     glutSwapBuffers ();
+
+    if (metrics)
+    {
+        if (fresh)
+            metrics->frameDelivered (arrival);
+        metrics->update ();
+    }
 }
 
 
@@ -422,55 +1468,110 @@ void resizeGLScene (int width, int height)
 }
 
 
+// Tilts the sensor to the given angle (nothing to do on a replay)
+void setTilt (double angle)
+{
+    if (device)
+        device->setTiltDegrees (angle);
+}
+
+
+// Sets the LED of the sensor (nothing to do on a replay)
+void setLed (freenect_led_options option)
+{
+    if (device)
+        device->setLed (option);
+}
+
+
 // Keyboard callback for the window
 void keyPressed (unsigned char key, int x, int y)
 {
+    const Resize resize = [] (int width, int height, int levels) { 
+        opencl->setResolution (width, height, levels); 
+    };
+
     switch (key)
     {
         case 0x1B:  // ESC
         case  'Q':
         case  'q':
+            delete texStream;
+            texStream = NULL;
             glutDestroyWindow (glWinId);
             break;
         case 'F':
         case 'f':
             opencl->toggleSmoothing ();
             break;
+        case 'M':
+        case 'm':
+            opencl->nextSmoothingMethod ();
+            break;
+        case 'P':
+        case 'p':
+            opencl->togglePipelining ();
+            break;
+        case 'H':
+        case 'h':
+            toggleResolution (device, recorder != NULL, videoResolution, pyramidLevels, resize);
+            break;
+        case 'L':
+        case 'l':
+            nextPyramidLevel (replay, videoResolution, pyramidLevels, resize);
+            break;
+        case '+':
+        case '=':
+            opencl->setGaussian (std::min (opencl->smoothingSigma () + sigmaStep, maxSigma), 
+                                 opencl->smoothingWidth ());
+            break;
+        case '-':
+            opencl->setGaussian (std::max (opencl->smoothingSigma () - sigmaStep, minSigma), 
+                                 opencl->smoothingWidth ());
+            break;
+        case ']':
+            opencl->setGaussian (opencl->smoothingSigma (), 
+                                 std::min (opencl->smoothingWidth () + 2, maxGaussianWidth));
+            break;
+        case '[':
+            opencl->setGaussian (opencl->smoothingSigma (), 
+                                 std::max (opencl->smoothingWidth () - 2, minGaussianWidth));
+            break;
         case  'W':
         case  'w':
             if (++freenectAngle > 30)
                 freenectAngle = 30;
-            device->setTiltDegrees (freenectAngle);
+            setTilt (freenectAngle);
             break;
         case  'S':
         case  's':
             if (--freenectAngle < -30)
                 freenectAngle = -30;
-            device->setTiltDegrees (freenectAngle);
+            setTilt (freenectAngle);
             break;
         case  'R':
         case  'r':
             freenectAngle = 0;
-            device->setTiltDegrees (freenectAngle);
+            setTilt (freenectAngle);
             break;
         case  '1':
-            device->setLed (LED_GREEN);
+            setLed (LED_GREEN);
             break;
         case  '2':
-            device->setLed (LED_RED);
+            setLed (LED_RED);
             break;
         case  '3':
-            device->setLed (LED_YELLOW);
+            setLed (LED_YELLOW);
             break;
         case  '4':
         case  '5':
-            device->setLed (LED_BLINK_GREEN);
+            setLed (LED_BLINK_GREEN);
             break;
         case  '6':
-            device->setLed (LED_BLINK_RED_YELLOW);
+            setLed (LED_BLINK_RED_YELLOW);
             break;
         case  '0':
-            device->setLed (LED_OFF);
+            setLed (LED_OFF);
             break;
     }
 }
@@ -500,6 +1601,65 @@ void initGL (int argc, char **argv)
     glBindTexture (GL_TEXTURE_2D, glRGBTex);
     glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    // The frames get streamed into the texture through pixel-unpack buffers, if possible
+    if (glewInit () == GLEW_OK && GLEW_ARB_pixel_buffer_object)
+        texStream = new TextureStream (glRGBTex, GL_LUMINANCE, maxFrameWidth * maxFrameHeight);
+}
+
+
+// Signal handler that stops the headless mode
+void requestStop (int)
+{
+    stopRequested = 1;
+}
+
+
+// Filters the frames, and publishes them into the shared memory ring name 
+// (see ShmRing), without a window, until the process gets a SIGINT or SIGTERM
+void runHeadless (const char *name)
+{
+    try
+    {
+        ShmRing ring (name, headlessSlots, maxFrameWidth * maxFrameHeight);
+        std::vector<uint8_t> image;
+
+        std::signal (SIGINT, requestStop);
+        std::signal (SIGTERM, requestStop);
+
+        std::cout << "Publishing the filtered frames in " << name << std::endl;
+
+        while (!stopRequested)
+        {
+            // The frame gets read back straight into the slot of the ring, 
+            // except in pipelined mode, where it gets copied from the host image
+            uint8_t *slot = ring.begin ();
+            double arrival;
+            if (!filterFrame (image, opencl->pipelining () ? NULL : slot, &arrival))
+            {
+                if (metrics)
+                    metrics->update ();
+                std::this_thread::sleep_for (std::chrono::milliseconds (1));
+                continue;
+            }
+
+            const uint32_t size = opencl->imageWidth () * opencl->imageHeight ();
+            if (opencl->pipelining ())
+                std::memcpy (slot, image.data (), size);
+            ring.publish (size, opencl->imageWidth (), opencl->imageHeight (), ShmRingSlot::GRAY8);
+
+            if (metrics)
+            {
+                metrics->frameDelivered (arrival);
+                metrics->update ();
+            }
+        }
+    }
+    catch (const std::runtime_error &error)
+    {
+        std::cerr << error.what () << std::endl;
+        exit (EXIT_FAILURE);
+    }
 }
 
 
@@ -509,6 +1669,12 @@ void printInfo()
     std::cout << "\nAvailable Controls:\n";
     std::cout << "===================\n";
     std::cout << "Toggle Smoothing :  F\n";
+    std::cout << "Smoothing Method :  M\n";
+    std::cout << "Toggle Pipeline  :  P\n";
+    std::cout << "Resolution       :  H\n";
+    std::cout << "Pyramid Level    :  L\n";
+    std::cout << "Gaussian Sigma   :  + / -\n";
+    std::cout << "Gaussian Width   :  ] / [\n";
     std::cout << "Tilt Kinect Up   :  W\n";
     std::cout << "Tilt Kinect Down :  S\n";
     std::cout << "Reset Tilt Angle :  R\n";
@@ -521,15 +1687,118 @@ int main (int argc, char **argv)
 {
     printInfo ();
 
-    opencl = new Filter ();
+    // Profiling is enabled with --profile, 
+    // and --single-device keeps the filtering on the first device. 
+    // --cpu filters on the CPU instead (see CpuPipeline). 
+    // --headless publishes the frames in shared memory (--shm <name>) 
+    // instead of displaying them. --record <file> writes the Kinect stream 
+    // to a file, and --replay <file> takes the frames from one instead 
+    // (at the recorded pace, or as fast as they get filtered with --max-speed). 
+    // --metrics <seconds> logs the frame counters, the frame rate and the latency 
+    // periodically, and --metrics-file <file> writes them in the Prometheus format. 
+    // --resolution high switches the Kinect to 1280x1024, and --pyramid <levels> 
+    // filters the frames at 1 / 2^levels of their size
+    bool allDevices = true, cpuOnly = false, headless = false, maxSpeed = false;
+    const char *shmName = "/kinectFilter_clc";
+    const char *recordName = NULL, *replayName = NULL;
+    const char *metricsFile = NULL;
+    double metricsInterval = 0.;
+    for (int i = 1; i < argc; ++i)
+        if (std::string (argv[i]) == "--profile")
+            profiler = new Profiler ();
+        else if (std::string (argv[i]) == "--single-device")
+            allDevices = false;
+        else if (std::string (argv[i]) == "--cpu")
+            cpuOnly = true;
+        else if (std::string (argv[i]) == "--headless")
+            headless = true;
+        else if (std::string (argv[i]) == "--shm" && i + 1 < argc)
+            shmName = argv[++i];
+        else if (std::string (argv[i]) == "--record" && i + 1 < argc)
+            recordName = argv[++i];
+        else if (std::string (argv[i]) == "--replay" && i + 1 < argc)
+            replayName = argv[++i];
+        else if (std::string (argv[i]) == "--max-speed")
+            maxSpeed = true;
+        else if (std::string (argv[i]) == "--metrics" && i + 1 < argc)
+            metricsInterval = std::atof (argv[++i]);
+        else if (std::string (argv[i]) == "--metrics-file" && i + 1 < argc)
+            metricsFile = argv[++i];
+        else if (std::string (argv[i]) == "--resolution" && i + 1 < argc)
+            videoResolution = std::string (argv[++i]) == "high" ? 
+                FREENECT_RESOLUTION_HIGH : FREENECT_RESOLUTION_MEDIUM;
+        else if (std::string (argv[i]) == "--pyramid" && i + 1 < argc)
+            pyramidLevels = std::min (std::max (std::atoi (argv[++i]), 0), maxPyramidLevels);
+    if (profiler)
+        profiler->dumpAtExit ("kinectFilter_profile.csv");
+
+    try
+    {
+        // A replay takes the resolution of the recording
+        if (replayName)
+        {
+            replay = new ReplayDevice (replayName, maxSpeed);
+            if (replay->width () > (uint32_t) maxFrameWidth || replay->height () > (uint32_t) maxFrameHeight)
+                throw std::runtime_error (std::string (replayName) + " has frames larger than 1280x1024");
+        }
 
-    device = &freenect.createDevice<MyFreenectDevice> (0);
-    device->startVideo ();
+        int width, height;
+        frameDimensions (replay, videoResolution, width, height);
+        opencl = new Scheduler (width, height, pyramidLevels, allDevices, cpuOnly);
 
-    initGL (argc, argv);
-    glutMainLoop ();
+        if (replay)
+        {
+            replay->attach (opencl->rgbSlots (), NULL, profiler);
+            replay->start ();
+            source = replay;
+        }
+        else
+        {
+            device = &freenect.createDevice<KinectDevice> (0);
+            device->attach (opencl->rgbSlots (), NULL, profiler);
+            device->setVideoFormat (FREENECT_VIDEO_RGB, videoResolution);
+            if (recordName)
+            {
+                recorder = new Recorder (recordName, width, height);
+                device->record (recorder);
+            }
+            device->startVideo ();
+            source = device;
+        }
+    }
+    catch (const std::runtime_error &error)
+    {
+        std::cerr << error.what () << std::endl;
+        exit (EXIT_FAILURE);
+    }
+
+    // --metrics-file alone reports every 10 seconds
+    if (metricsInterval > 0. || metricsFile)
+    {
+        metrics = new Metrics ("kinectFilter_clc", metricsInterval > 0. ? metricsInterval : 10.);
+        metrics->addSource (source);
+        if (metricsFile)
+            metrics->setFile (metricsFile);
+    }
 
-    device->stopVideo ();
+    if (headless)
+        runHeadless (shmName);
+    else
+    {
+        initGL (argc, argv);
+        glutMainLoop ();
+    }
+
+    if (replay)
+        replay->stop ();
+    else
+    {
+        device->record (NULL);
+        device->stopVideo ();
+    }
+    delete recorder;
+    delete metrics;
+    delete replay;
     delete opencl;
 
     return 0;
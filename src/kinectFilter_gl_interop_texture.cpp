@@ -26,14 +26,15 @@
 
 #include <iostream>
 #include <sstream>
-#include <fstream>
+#include <iomanip>
 #include <string>
 #include <vector>
-#include <mutex>
-
-#include <opencv2/core/core.hpp>
-#include <opencv2/highgui/highgui.hpp>
-#include <opencv2/imgproc/imgproc.hpp>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <tuple>
+#include <algorithm>
+#include <stdexcept>
 
 #include <GL/glew.h>
 
@@ -53,6 +54,15 @@
 #include <GL/glut.h>
 #endif
 #include <libfreenect.hpp>
+#include <kinectFilter/profiler.hpp>
+#include <kinectFilter/kinectDevice.hpp>
+#include <kinectFilter/recording.hpp>
+#include <kinectFilter/metrics.hpp>
+#include <kinectFilter/programCache.hpp>
+#include <kinectFilter/pipeline.hpp>
+#include <kinectFilter/glSync.hpp>
+#include <kinectFilter/coefficients.hpp>
+#include <kinectFilter/resolution.hpp>
 
 
 // Window parameters
@@ -61,43 +71,51 @@ const int gl_win_height = 480;
 int glWinId;
 
 // GL mem object parameters
-void initGLObjects ();
-GLuint glRGBTex;
+GLuint createGLTexture (int width, int height);
+GLuint glRGBTex;  // The texture of the current resolution (see Filter::setResolution)
+
+// RGB stream parameters. The resolution is set with --resolution, and switched 
+// with H. The frames can get filtered at reduced scale, on a level of an image 
+// pyramid (set with --pyramid <levels>, and cycled with L), when latency matters 
+// more than detail. The window stays the same, and the texture gets scaled to it
+freenect_resolution videoResolution = FREENECT_RESOLUTION_MEDIUM;
+int pyramidLevels = 0;
 
 // Freenect
-class MyFreenectDevice;
 Freenect::Freenect freenect;
-MyFreenectDevice *device;
+KinectDevice *device = NULL;  // NULL when replaying a recording
 double freenectAngle = 0;
 
+// The frames come from the Kinect, or from a recording (with --replay)
+FrameSource *source;
+ReplayDevice *replay = NULL;
+Recorder *recorder = NULL;
+
 // OpenCL
 class Filter;
 Filter *opencl;
 
+// Profiling (only when started with --profile)
+Profiler *profiler = NULL;
+
+// Frame-level metrics (only when started with --metrics or --metrics-file)
+Metrics *metrics = NULL;
+
 
 // A class for filtering an image on the GPU
 class Filter
 {
 public:
-    Filter () : global { gl_win_width, gl_win_height }, smoothed (true)
+    // Filters frames of frameWidth x frameHeight pixels, 
+    // at 1 / 2^levels of their size (see setResolution)
+    Filter (int frameWidth, int frameHeight, int levels = 0) 
+        : smoothed (true), method (BOX), coefficients (NULL), glFence (NULL), frames (NULL), pool (NULL)
     {
-        // Image region for transfers
-        region[0] = gl_win_width;
-        region[1] = gl_win_height;
-        region[2] = 1;
-
-        // Image dimensions
-        const int width = gl_win_width;
-        const int height = gl_win_height;
+        // The pinned buffers take frames of any resolution
+        const size_t maxRGBBufferSize = 3 * sizeof (uint8_t) * maxFrameWidth * maxFrameHeight;
 
         //! Applying multiple times a box filter, approximates a Gaussian filter
-        const float box_filter[] = { 0.125f, 0.125f, 0.125f,
-                                     0.125f, 0.125f, 0.125f,
-                                     0.125f, 0.125f, 0.125f };
-        const float laplacian_filter[] = { 1.f,  1.f, 1.f,
-                                           1.f, -8.f, 1.f,
-                                           1.f,  1.f, 1.f };
-        const int filterWidth = 3;
+        filterWidth = 3;
         const int filterSize = sizeof (float) * filterWidth * filterWidth;
 
         // Get the list of platforms
@@ -144,123 +162,169 @@ public:
 
         // Detect OpenCL-OpenGL Interoperability
         checkCLGLInterop (devices[0]);
+        checkGLSync (platforms[0], devices[0], clCreateEventFromGLsync, glCLEvent);
 
         // Create a context with CL-GL interop
         context = cl::Context (devices[0], props);
 
-        // Create OpenGL memory objects
-        initGLObjects ();
-
-        // Create a command queue for the device
-        queue = cl::CommandQueue (context, devices[0]);
+        // Create a command queue for the device (with timestamps on the commands, when profiling)
+        queue = cl::CommandQueue (context, devices[0], profiler ? CL_QUEUE_PROFILING_ENABLE : 0);
 
         // Create an image sampler
         sampler = cl::Sampler (context, CL_FALSE, CL_ADDRESS_CLAMP_TO_EDGE, CL_FILTER_NEAREST);
 
-        // Create an image format
-        cl::ImageFormat formatub (CL_R, CL_UNSIGNED_INT8);
-        cl::ImageFormat formatf (CL_R, CL_FLOAT);
-
-        // Create an image instance for the source image on the device
-        bufferSourceImage = cl::Image2D (context, CL_MEM_READ_ONLY, formatub, width, height);
-
-        // Create an image instances for the intermediate results on the device
-        bufferInterImage1 = cl::Image2D (context, CL_MEM_READ_WRITE, formatf, width, height);
-        bufferInterImage2 = cl::Image2D (bufferInterImage1);
+        // Create pinned host buffers for the frames coming from Kinect, and keep 
+        // them mapped for the lifetime of the filter. The frames get written 
+        // straight into page-locked memory, so the uploads are plain DMA transfers
+        for (int i = 0; i < 3; ++i)
+        {
+            bufferPinnedRGB[i] = cl::Buffer (context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, maxRGBBufferSize);
+            pinnedRGB[i] = static_cast<uint8_t *> (queue.enqueueMapBuffer (
+                bufferPinnedRGB[i], CL_TRUE, CL_MAP_WRITE, 0, maxRGBBufferSize));
+        }
 
-        // Create an image instance for the output image (shared with OpenGL) on the device
-        bufferOutputImage.emplace_back (context, CL_MEM_WRITE_ONLY, GL_TEXTURE_2D, 0, glRGBTex);
+        // The intermediate results come from a pool shared by the pipelines
+        pool = new MemPool (context);
 
         // Create buffers for the filters on the device
         bufferBoxFilter = cl::Buffer (context, CL_MEM_READ_ONLY, filterSize);
         bufferLaplacianFilter = cl::Buffer (context, CL_MEM_READ_ONLY, filterSize);
 
         // Copy the filters to the device
-        queue.enqueueWriteBuffer (bufferBoxFilter, CL_FALSE, 0, filterSize, box_filter);
-        queue.enqueueWriteBuffer (bufferLaplacianFilter, CL_FALSE, 0, filterSize, laplacian_filter);
-
-        // Read the program source
-        std::ifstream sourceFile ("kernels/kernels.cl");
-        std::string programCode (std::istreambuf_iterator<char> (sourceFile), (std::istreambuf_iterator<char> ()));
-    
-        // Create a program
-        cl::Program::Sources source (1, std::make_pair (programCode.c_str (), programCode.length () + 1));
-        program = cl::Program (context, source);
-
-        try
-        {
-            // Compile the program
-            program.build (devices);
-        }
-        catch (const cl::Error &error)
-        {
-            std::cerr << error.what () << " ("
-                      << error.err ()  << ")"  << std::endl;
-            
-            std::string log = program.getBuildInfo<CL_PROGRAM_BUILD_LOG> (devices[0]);
-            std::cout << log << std::endl;
-
-            exit (EXIT_FAILURE);
-        }
-
-        // Create kernel
-        kernelNorm = cl::Kernel (program, "normalizeImg");
-        kernelConv = cl::Kernel (program, "convolutionGL");
+        queue.enqueueWriteBuffer (bufferBoxFilter, CL_FALSE, 0, filterSize, boxFilter3x3);
+        queue.enqueueWriteBuffer (bufferLaplacianFilter, CL_TRUE, 0, filterSize, laplacianFilter3x3);
+
+        // The program source is embedded in the executable
+        programCode = kernelSource;
+
+        // Create and compile a program
+        program = buildProgram ("");
+
+        // Create kernels
+        kernelConv = cl::Kernel (program, "convolutionTiledGL");
+        kernelConvRGB = cl::Kernel (program, "convolutionRGBGL");
+        kernelDownsample = cl::Kernel (program, "downsampleRGB");
+
+        // Pick a work-group size for the tiled convolution. 16x16 tiles keep 
+        // the halo overhead low, but not every device can fit 256 work-items
+        size_t maxWorkGroupSize = 
+            kernelConv.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE> (devices[0]);
+        localDim = (maxWorkGroupSize >= 256) ? 16 : 8;
+        local = cl::NDRange (localDim, localDim);
+
+        // Create the kernels of the edge-preserving smoothing methods
+        kernelBilateral = cl::Kernel (program, "bilateralRGBGL");
+        kernelGuidedCoeffs = cl::Kernel (program, "guidedCoeffsRGB");
+        kernelGuided = cl::Kernel (program, "guidedRGBGL");
+
+        // Both methods work on a 5x5 window like the two box filters. 
+        // The parameters are in the units of the intermediate images ([0,1])
+        const int radius = 2;
+        const float sigmaSpatial = 2.f, sigmaRange = 30.f / 255.f;
+        const float eps = 0.01f, scale = 1.f / 255.f;
+        const size_t tileSize = (localDim + 2 * radius) * (localDim + 2 * radius);
+        const size_t rowSumsSize = (localDim + 2 * radius) * localDim;
+
+        kernelBilateral.setArg (4, cl::Local (sizeof (float) * tileSize));
+        kernelBilateral.setArg (5, radius);
+        kernelBilateral.setArg (6, sigmaSpatial);
+        kernelBilateral.setArg (7, sigmaRange);
+
+        kernelGuidedCoeffs.setArg (4, cl::Local (2 * sizeof (float) * tileSize));
+        kernelGuidedCoeffs.setArg (5, cl::Local (2 * sizeof (float) * rowSumsSize));
+        kernelGuidedCoeffs.setArg (6, radius);
+        kernelGuidedCoeffs.setArg (7, eps);
+        kernelGuidedCoeffs.setArg (8, scale);
+
+        kernelGuided.setArg (5, cl::Local (2 * sizeof (float) * tileSize));
+        kernelGuided.setArg (6, cl::Local (2 * sizeof (float) * rowSumsSize));
+        kernelGuided.setArg (7, radius);
 
         // Set common kernel arguments
-        kernelNorm.setArg (0, bufferSourceImage);
-        kernelNorm.setArg (1, bufferInterImage1);
-        kernelNorm.setArg (2, height);
-        kernelNorm.setArg (3, width);
-        kernelNorm.setArg (4, sampler);
+        kernelConv.setArg (7, sampler);
 
-        kernelConv.setArg (2, height);
-        kernelConv.setArg (3, width);
-        kernelConv.setArg (5, filterWidth);
-        kernelConv.setArg (6, sampler);
+        // The dimensions go into the kernel arguments and the workspaces, 
+        // so they have to be set before the pipelines get built
+        setDimensions (frameWidth, frameHeight, levels);
+
+        // The Gaussian of the Fused LoG and Separable methods (this builds the pipelines too)
+        setGaussian (1.f, 5);
     }
 
-    void convolve (uint8_t *image)
+    // Applies the filters on a raw RGB frame from Kinect, and stores 
+    // the resulting gray-scale image in the texture shared with OpenGL
+    void convolve (const uint8_t *rgb)
     {
-        // Copy the source image to the device
-        queue.enqueueWriteImage (bufferSourceImage, CL_FALSE, origin, region, 0, 0, image);
+        // Record the timings of the previous frames
+        collectProfile ();
 
-        glFinish ();  // Wait for OpenGL pending operations on the buffer to finish
+        // Copy the source frame to the device
+        queue.enqueueWriteBuffer (frames->sourceRGB, CL_FALSE, 0, rgbBufferSize, rgb, NULL, &uploadEvent);
+        track ("Upload", uploadEvent);
 
         // Take ownership of the OpenGL texture
-        queue.enqueueAcquireGLObjects ((std::vector<cl::Memory> *) &bufferOutputImage);
-
-        // Normalize the image (the final image object shared with OpenGL 
-        // has to have RGBA channels, with float channel types and normalized values [0,1])
-        queue.enqueueNDRangeKernel (kernelNorm, cl::NullRange, global, cl::NullRange);
+        acquireGLObjects ((std::vector<cl::Memory> &) frames->outputImage);
 
-        if (smoothed)
-        {
-            kernelConv.setArg (0, bufferInterImage1);
-            kernelConv.setArg (1, bufferInterImage2);
-            kernelConv.setArg (4, bufferBoxFilter);
+        // The first pass always reads the RGB frame, transforms it to gray-scale, 
+        // and normalizes it (the final image object shared with OpenGL has to 
+        // have RGBA channels, with float channel types and normalized values [0,1])
+        Pipeline &pipeline = pipelines[smoothed ? method : METHOD_COUNT];
 
-            // Apply the first box firter
-            queue.enqueueNDRangeKernel (kernelConv, cl::NullRange, global, cl::NullRange);
+        pipeline.bind ("output", frames->outputImage[0]);
+        pipeline.enqueue (queue, NULL, NULL, 
+                          [this] (const std::string &stage) { return profile (stage.c_str ()); });
 
-            kernelConv.setArg (0, bufferInterImage2);
-            kernelConv.setArg (1, bufferInterImage1);
+        // Give up ownership of the OpenGL texture
+        releaseGLObjects ((std::vector<cl::Memory> &) frames->outputImage);
+    }
 
-            // Apply the second box firter
-            queue.enqueueNDRangeKernel (kernelConv, cl::NullRange, global, cl::NullRange);
-        }
-        
-        kernelConv.setArg (0, bufferInterImage1);
-        kernelConv.setArg (1, bufferOutputImage[0]);
-        kernelConv.setArg (4, bufferLaplacianFilter);
+    // Waits for the upload of the last frame to complete, 
+    // so that its source buffer can be given back to libfreenect
+    void finishUpload ()
+    {
+        if (uploadEvent ())
+            uploadEvent.wait ();
+    }
 
-        // Perform the edge detection
-        queue.enqueueNDRangeKernel (kernelConv, cl::NullRange, global, cl::NullRange);
+    ~Filter ()
+    {
+        for (int i = 0; i < 3; ++i)
+            queue.enqueueUnmapMemObject (bufferPinnedRGB[i], pinnedRGB[i]);
+        queue.finish ();
+        for (auto &set : frameSets)
+            delete set.second;
+        delete pool;
+    }
 
-        // Give up ownership of the OpenGL texture
-        queue.enqueueReleaseGLObjects ((std::vector<cl::Memory> *) &bufferOutputImage);
+    // Returns the pinned host buffers that the RGB frames get written into
+    uint8_t *const *rgbSlots ()
+    {
+        return pinnedRGB;
+    }
 
+    // Switches to frames of frameWidth x frameHeight pixels (up to 
+    // maxFrameWidth x maxFrameHeight), filtered at 1 / 2^levels of their size. 
+    // The texture of each resolution (and the source buffer) stays around, 
+    // so switching back doesn't allocate anything
+    void setResolution (int frameWidth, int frameHeight, int levels)
+    {
         queue.finish ();
+        collectProfile ();
+
+        setDimensions (frameWidth, frameHeight, levels);
+        setSeparableArgs ();
+        buildPipelines ();
+    }
+
+    // Returns the dimensions of the filtered images
+    int imageWidth ()
+    {
+        return width;
+    }
+
+    int imageHeight ()
+    {
+        return height;
     }
 
     // Returns the state of the flag for smoothing
@@ -277,7 +341,339 @@ public:
         return smoothed;
     }
 
+    // Returns the name of the smoothing method
+    const char *smoothingMethod ()
+    {
+        static const char *names[] = { "Box", "Fused LoG", "Separable", "Bilateral", "Guided" };
+        return names[method];
+    }
+
+    // Switches to the next smoothing method
+    // Returns the name of the new method
+    const char *nextSmoothingMethod ()
+    {
+        method = static_cast<Method> ((method + 1) % METHOD_COUNT);
+        return smoothingMethod ();
+    }
+
+    // Sets the Gaussian of the Fused LoG and Separable methods, with the 
+    // given sigma (in pixels), over width (odd) pixels. The LoG filter gets 
+    // uploaded, and the separable program gets specialized for the pair, 
+    // the first time it's used (see GaussianCache), and the pipelines get rebuilt
+    void setGaussian (float sigma, int width)
+    {
+        Coefficients &c = coefficientCache.get (sigma, width, [this] (float sigma, int width, Coefficients &entry) {
+            const std::vector<float> gaussian = gaussianFilter (sigma, width);
+            const std::vector<float> log = logFilter (sigma, width);
+
+            entry.logWidth = width + filterWidth - 1;
+            entry.log = cl::Buffer (context, CL_MEM_READ_ONLY, log.size () * sizeof (float));
+            queue.enqueueWriteBuffer (entry.log, CL_TRUE, 0, log.size () * sizeof (float), log.data ());
+
+            // The width and the coefficients are baked into the separable 
+            // kernels, so that the loops get unrolled
+            entry.separable = buildProgram (separableOptions (gaussian, gaussian));
+            entry.row = cl::Kernel (entry.separable, "separableRowRGBGL");
+            entry.column = cl::Kernel (entry.separable, "separableColumnGL");
+            entry.column.setArg (4, sampler);
+        });
+
+        // Wait for the last frame, which still uses the previous kernels
+        queue.finish ();
+
+        coefficients = &c;
+        gaussianSigma = sigma;
+        gaussianWidth = width;
+        kernelRow = c.row;
+        kernelColumn = c.column;
+
+        setSeparableArgs ();
+        buildPipelines ();
+    }
+
+    // Returns the sigma and the width of the Gaussian (see setGaussian)
+    float smoothingSigma ()
+    {
+        return gaussianSigma;
+    }
+
+    int smoothingWidth ()
+    {
+        return gaussianWidth;
+    }
+
 private:
+    // Smoothing methods
+    // BOX: Two box filters, followed by the Laplacian filter (3 passes)
+    // FUSED_LOG: A Gaussian and the Laplacian filter combined into a single LoG filter (1 pass)
+    // SEPARABLE: A separable Gaussian filter, followed by the Laplacian filter (3 passes)
+    // BILATERAL: An edge-preserving bilateral filter, followed by the Laplacian filter (2 passes)
+    // GUIDED: An edge-preserving guided filter (coefficients and output, with 
+    //         box sums over the tiles), followed by the Laplacian filter (3 passes)
+    enum Method { BOX, FUSED_LOG, SEPARABLE, BILATERAL, GUIDED, METHOD_COUNT };
+
+    // The uploaded LoG filter of a (sigma, width) pair of the Gaussian, 
+    // and the separable program specialized for the pair
+    struct Coefficients
+    {
+        cl::Buffer log;
+        int logWidth;
+        cl::Program separable;
+        cl::Kernel row, column;
+    };
+
+    // The objects for the frames of a resolution: the source RGB frame, 
+    // and the texture for the output image, with its image object
+    struct FrameSet
+    {
+        cl::Buffer sourceRGB;
+        GLuint texture;
+        std::vector<cl::ImageGL> outputImage;
+    };
+
+    // Sets the dimensions of the frames, and of the filtered images, on the kernels 
+    // and the workspaces, and picks the frame objects (created on first use)
+    void setDimensions (int frameWidth, int frameHeight, int levels)
+    {
+        this->frameWidth = frameWidth;
+        this->frameHeight = frameHeight;
+        this->levels = levels;
+
+        // The filters run on the top level of the pyramid
+        width = frameWidth >> levels;
+        height = frameHeight >> levels;
+
+        rgbBufferSize = 3 * sizeof (uint8_t) * frameWidth * frameHeight;
+
+        FrameSet *&set = frameSets[std::make_tuple (frameWidth, frameHeight, levels)];
+        if (!set)
+        {
+            set = new FrameSet;
+            set->sourceRGB = cl::Buffer (context, CL_MEM_READ_ONLY, rgbBufferSize);
+
+            // Create an image instance for the output image (shared with OpenGL) on the device
+            set->texture = createGLTexture (width, height);
+            set->outputImage.emplace_back (context, CL_MEM_WRITE_ONLY, GL_TEXTURE_2D, 0, set->texture);
+        }
+        frames = set;
+        glRGBTex = set->texture;
+
+        kernelBilateral.setArg (2, height);
+        kernelBilateral.setArg (3, width);
+        kernelGuidedCoeffs.setArg (2, height);
+        kernelGuidedCoeffs.setArg (3, width);
+        kernelGuided.setArg (3, height);
+        kernelGuided.setArg (4, width);
+
+        kernelConv.setArg (2, height);
+        kernelConv.setArg (3, width);
+        kernelConvRGB.setArg (2, height);
+        kernelConvRGB.setArg (3, width);
+
+        // The workspace has to be a multiple of the work-group size
+        global = cl::NDRange (roundUp (width, localDim), roundUp (height, localDim));
+    }
+
+    // Sets the dimensions of the filtered images on the separable kernels
+    void setSeparableArgs ()
+    {
+        kernelRow.setArg (2, height);
+        kernelRow.setArg (3, width);
+        kernelColumn.setArg (2, height);
+        kernelColumn.setArg (3, width);
+    }
+
+    // Creates a program from the kernel source and compiles it 
+    // (or loads it from the binary cache, when it has been built before)
+    cl::Program buildProgram (const std::string &options)
+    {
+        cl_int status;
+        std::string log;
+        cl::Program prog (buildCachedProgram (context (), devices[0] (), programCode, options, &status, &log));
+
+        if (status != CL_SUCCESS)
+        {
+            std::cerr << "clBuildProgram (" << status << ")" << std::endl;
+            std::cout << log << std::endl;
+
+            exit (EXIT_FAILURE);
+        }
+
+        return prog;
+    }
+
+    // Returns an event for timing a command of the given stage, 
+    // or NULL when profiling is off (see Profiler::profile)
+    cl::Event *profile (const char *stage)
+    {
+        return profiler ? profiler->profile (std::string (stage)) : NULL;
+    }
+
+    // Times an existing event as a command of the given stage
+    void track (const char *stage, const cl::Event &event)
+    {
+        if (profiler)
+            profiler->track (std::string (stage), event);
+    }
+
+    // Records the durations of the timed commands that have completed
+    void collectProfile ()
+    {
+        if (profiler)
+            profiler->collect ();
+    }
+
+    // Prepends to a pipeline the stages that downsample the source frame 
+    // to the top level of the pyramid (see addPyramid). Returns the name 
+    // of the frame to filter
+    std::string pyramid (Pipeline &pipeline)
+    {
+        return addPyramid (pipeline, kernelDownsample, "rgb", frameWidth, frameHeight, levels);
+    }
+
+    // Builds the filter chain of each smoothing method as a pipeline. The stages 
+    // name their intermediate images, and the pipeline assigns them from the pool
+    void buildPipelines ()
+    {
+        const MemSpec gray = MemSpec::image (cl::ImageFormat (CL_R, CL_FLOAT), width, height);
+
+        // The two convolution kernels are shared by the stages, 
+        // so the filters get set right before each launch
+        auto filter = [this] (cl::Buffer &buffer, int filterSize) {
+            return [this, &buffer, filterSize] (cl::Kernel &kernel) { setFilter (kernel, buffer, filterSize); };
+        };
+
+        pipelines.assign (METHOD_COUNT + 1, Pipeline (*pool));
+
+        // Each pipeline starts with the downsampling to the top level of the pyramid
+        std::string rgb;
+
+        Pipeline &box = pipelines[BOX];
+        box.intermediate ("box1", gray);
+        box.intermediate ("box2", gray);
+        rgb = pyramid (box);
+        box.addStage ("Box filter 1", kernelConvRGB, global, local)
+            .input (0, rgb).output (1, "box1").setup (filter (bufferBoxFilter, filterWidth));
+        box.addStage ("Box filter 2", kernelConv, global, local)
+            .input (0, "box1").output (1, "box2").setup (filter (bufferBoxFilter, filterWidth));
+        box.addStage ("Laplacian filter", kernelConv, global, local)
+            .input (0, "box2").output (1, "output").setup (filter (bufferLaplacianFilter, filterWidth));
+
+        // The whole chain in one pass, without any intermediate images
+        rgb = pyramid (pipelines[FUSED_LOG]);
+        pipelines[FUSED_LOG].addStage ("LoG filter", kernelConvRGB, global, local)
+            .input (0, rgb).output (1, "output").setup (filter (coefficients->log, coefficients->logWidth));
+
+        Pipeline &separable = pipelines[SEPARABLE];
+        separable.intermediate ("row", gray);
+        separable.intermediate ("column", gray);
+        rgb = pyramid (separable);
+        separable.addStage ("Row filter", kernelRow, global, local)
+            .input (0, rgb).output (1, "row");
+        separable.addStage ("Column filter", kernelColumn, global, local)
+            .input (0, "row").output (1, "column");
+        separable.addStage ("Laplacian filter", kernelConv, global, local)
+            .input (0, "column").output (1, "output").setup (filter (bufferLaplacianFilter, filterWidth));
+
+        Pipeline &bilateral = pipelines[BILATERAL];
+        bilateral.intermediate ("smooth", gray);
+        rgb = pyramid (bilateral);
+        bilateral.addStage ("Bilateral filter", kernelBilateral, global, local)
+            .input (0, rgb).output (1, "smooth");
+        bilateral.addStage ("Laplacian filter", kernelConv, global, local)
+            .input (0, "smooth").output (1, "output").setup (filter (bufferLaplacianFilter, filterWidth));
+
+        Pipeline &guided = pipelines[GUIDED];
+        guided.intermediate ("coeffs", MemSpec::buffer (2 * sizeof (float) * width * height));
+        guided.intermediate ("smooth", gray);
+        rgb = pyramid (guided);
+        guided.addStage ("Guided coefficients", kernelGuidedCoeffs, global, local)
+            .input (0, rgb).output (1, "coeffs");
+        guided.addStage ("Guided filter", kernelGuided, global, local)
+            .input (0, rgb).input (1, "coeffs").output (2, "smooth");
+        guided.addStage ("Laplacian filter", kernelConv, global, local)
+            .input (0, "smooth").output (1, "output").setup (filter (bufferLaplacianFilter, filterWidth));
+
+        // No smoothing, just the edge detection
+        rgb = pyramid (pipelines[METHOD_COUNT]);
+        pipelines[METHOD_COUNT].addStage ("Laplacian filter", kernelConvRGB, global, local)
+            .input (0, rgb).output (1, "output").setup (filter (bufferLaplacianFilter, filterWidth));
+
+        for (Pipeline &pipeline : pipelines)
+            pipeline.bind ("rgb", frames->sourceRGB);
+    }
+
+    // Sets the filter, and the local memory for the tile 
+    // (which depends on the filter width), on a convolution kernel
+    void setFilter (cl::Kernel &kernel, cl::Buffer &filter, int width)
+    {
+        const size_t tileSize = sizeof (float) * 
+            (local[0] + width - 1) * (local[1] + width - 1);
+
+        kernel.setArg (4, filter);
+        kernel.setArg (5, width);
+        kernel.setArg (6, cl::Local (tileSize));
+    }
+
+    // Rounds value up to the nearest multiple of base
+    static size_t roundUp (size_t value, size_t base)
+    {
+        return ((value + base - 1) / base) * base;
+    }
+
+    // Makes the CL queue wait for the pending OpenGL operations 
+    // on the shared objects, before acquiring them
+    void acquireGLObjects (std::vector<cl::Memory> &objects)
+    {
+        if (!clCreateEventFromGLsync)
+        {
+            glFinish ();  // Wait for OpenGL pending operations on the objects to finish
+            queue.enqueueAcquireGLObjects (&objects, NULL, profile ("GL acquire"));
+            return;
+        }
+
+        // Delete the fence of the previous frame, once CL is done with it
+        if (glFence)
+        {
+            glFenceEvent.wait ();
+            glDeleteSync (glFence);
+        }
+
+        // Put a fence after the GL commands so far, and wait for it on the GPU
+        glFence = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush ();
+
+        cl_int status;
+        glFenceEvent = cl::Event (clCreateEventFromGLsync (context (), (cl_GLsync) glFence, &status));
+        if (status != CL_SUCCESS)
+            throw cl::Error (status, "clCreateEventFromGLsyncKHR");
+
+        std::vector<cl::Event> glDone (1, glFenceEvent);
+        queue.enqueueAcquireGLObjects (&objects, &glDone, profile ("GL acquire"));
+    }
+
+    // Gives the shared objects back to OpenGL, and makes 
+    // the GL commands that follow wait for the CL commands so far
+    void releaseGLObjects (std::vector<cl::Memory> &objects)
+    {
+        if (!glCLEvent)
+        {
+            queue.enqueueReleaseGLObjects (&objects, NULL, profile ("GL release"));
+            queue.finish ();
+            return;
+        }
+
+        cl::Event clDone;
+        queue.enqueueReleaseGLObjects (&objects, NULL, &clDone);
+        track ("GL release", clDone);
+        queue.flush ();
+
+        // The wait happens on the GPU, so the CPU moves on right away
+        GLsync sync = glCreateSyncFromCLeventARB ((_cl_context *) context (), (_cl_event *) clDone (), 0);
+        glWaitSync (sync, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync (sync);
+    }
+
     void checkCLGLInterop (cl::Device &device)
     {
         std::string exts = device.getInfo<CL_DEVICE_EXTENSIONS> ();
@@ -297,113 +693,86 @@ private:
     }
 
 
-    // Image transfer parameters
-    cl::size_t<3> origin;
-    cl::size_t<3> region;
+    // Source buffer parameters
+    size_t rgbBufferSize;
+
+    // Frame dimensions, levels of the pyramid above the frame, 
+    // and dimensions of the filtered images (the top level)
+    int frameWidth, frameHeight, levels;
+    int width, height;
 
     // Workspace dimensions
-    cl::NDRange global;
+    cl::NDRange global, local;
+    size_t localDim;
 
     bool smoothed;
+    Method method;
+
+    // Filter widths
+    int filterWidth;
+
+    // The Gaussian of the Fused LoG and Separable methods
+    float gaussianSigma;
+    int gaussianWidth;
+    GaussianCache<Coefficients> coefficientCache;
+    Coefficients *coefficients;
 
     std::vector<cl::Platform> platforms;
     std::vector<cl::Device> devices;
     cl::Context context;
     cl::CommandQueue queue;
+    // GL-CL synchronization
+    clCreateEventFromGLsyncKHR_fn clCreateEventFromGLsync;
+    bool glCLEvent;
+    GLsync glFence;
+    cl::Event glFenceEvent;
+    cl::Event uploadEvent;
     cl::Sampler sampler;
-    cl::Image2D bufferSourceImage;
-    cl::Image2D bufferInterImage1, bufferInterImage2;
-    std::vector<cl::ImageGL> bufferOutputImage;
+    cl::Buffer bufferPinnedRGB[3];
+    uint8_t *pinnedRGB[3];
+    std::map<std::tuple<int, int, int>, FrameSet *> frameSets;
+    FrameSet *frames;
     cl::Buffer bufferBoxFilter, bufferLaplacianFilter;
+    std::string programCode;
     cl::Program program;
-    cl::Kernel kernelNorm, kernelConv;
-};
-
-
-// A class hierarchy for manipulating a mutex
-class Mutex
-{
-public:
-    void lock () { freenectMutex.lock (); }
-    void unlock () { freenectMutex.unlock (); }
-
-    // A class that automates the manipulation of 
-    // the outer class instance's mutex.
-    // Mutex's mutex is locked with the creation of a ScopedLock instance 
-    // and unlocked with the destruction of the ScopedLock instance.
-    class ScopedLock
-    {
-    public:
-        ScopedLock (Mutex &mtx) : mMutex (mtx) { mMutex.lock (); }
-        ~ScopedLock () { mMutex.unlock (); }
-
-    private:
-        Mutex &mMutex;
-    };
-
-private:
-    std::mutex freenectMutex;
+    cl::Kernel kernelConv, kernelConvRGB, kernelDownsample;
+    cl::Kernel kernelRow, kernelColumn;
+    cl::Kernel kernelBilateral, kernelGuidedCoeffs, kernelGuided;
+    MemPool *pool;
+    std::vector<Pipeline> pipelines;
 };
 
 
-// A class that extends Freenect::FreenectDevice by defining the VideoCallback
-// callback function so we can get updates with the latest RGB frame
-class MyFreenectDevice : public Freenect::FreenectDevice
+// Processes the most recently received frame, if it's a new one
+// The arrival time of the frame goes in arrival
+bool updateFrame (double &arrival)
 {
-public:
-    MyFreenectDevice (freenect_context *ctx, int index)
-        : Freenect::FreenectDevice (ctx, index),
-          rgbBuffer (freenect_find_video_mode (FREENECT_RESOLUTION_MEDIUM, 
-                                                    FREENECT_VIDEO_RGB).bytes),
-          newRGBFrame (false)
-    {
-    }
-
-    // Delivers the latest RGB frame
-    // Do not call directly, it's only used by the library
-    void VideoCallback (void *rgb, uint32_t timestamp)
-    {
-        Mutex::ScopedLock lock (rgbMutex);
-
-        std::copy (static_cast<uint8_t *> (rgb), 
-                   static_cast<uint8_t *> (rgb) + getVideoBufferSize (), 
-                   rgbBuffer.begin ());
-        newRGBFrame = true;
-    };
-
-    // Delivers the most recently received frame after filtering it
-    bool updateRGB ()
-    {
-        Mutex::ScopedLock lock (rgbMutex);
+    const uint8_t *rgb;
 
-        if (!newRGBFrame)
-            return false;
+    // The slot of the last frame goes back to the libfreenect 
+    // thread on update, so its upload has to be done
+    opencl->finishUpload ();
 
-        // Transform the frame to gray-scale
-        // OpenCV was used just for experimenting
-        // The operation could just as easily be done on the GPU
-        cv::Mat gray, rgb (gl_win_height, gl_win_width, CV_8UC3, rgbBuffer.data ());
-        cv::cvtColor (rgb, gray, CV_RGB2GRAY);
+    if (!source->getRGB (rgb))
+        return false;
 
-        // Apply the filters to the frame
-        opencl->convolve (gray.datastart);
+    arrival = source->rgbArrival ();
 
-        newRGBFrame = false;
+    // Apply the filters to the frame
+    // The transformation to gray-scale happens on the GPU
+    // The filtering happens outside of any lock, 
+    // so the libfreenect thread is never kept waiting
+    opencl->convolve (rgb);
 
-        return true;
-    }
-
-private:
-    Mutex rgbMutex;
-    std::vector<uint8_t> rgbBuffer;
-    bool newRGBFrame;
-};
+    return true;
+}
 
 
 // Display callback for the window
 void drawGLScene ()
 {
-    device->updateRGB ();
+    double arrival;
+    const bool fresh = updateFrame (arrival);
 
     glClear (GL_COLOR_BUFFER_BIT);
 
@@ -415,17 +784,49 @@ void drawGLScene ()
     glVertex2i (0, gl_win_height); glTexCoord2f (0.f, 0.f);
     glEnd ();
 
+    // The texture changes with the resolution
     glEnable (GL_TEXTURE_2D);
-    // glBindTexture (GL_TEXTURE_2D, glRGBTex);
+    glBindTexture (GL_TEXTURE_2D, glRGBTex);
 
     std::ostringstream state;
-    state << "Smoothing: " << (opencl->smoothing () ? "ON" : "OFF");
+    state << "Smoothing: ";
+    if (opencl->smoothing ())
+        state << "ON (" << opencl->smoothingMethod () << ")";
+    else
+        state << "OFF";
+
+    glRasterPos2i (470, 30);
+    for (auto c : state.str ())
+        glutBitmapCharacter (GLUT_BITMAP_HELVETICA_12, c);
+
+    if (profiler)
+        profiler->draw (10, 30);
+
+    state.str ("");
+    state << "Gaussian: " << std::fixed << std::setprecision (2) << opencl->smoothingSigma () 
+          << ", " << opencl->smoothingWidth () << "px";
 
-    glRasterPos2i (530, 30);
+    glRasterPos2i (470, 45);
+    for (auto c : state.str ())
+        glutBitmapCharacter (GLUT_BITMAP_HELVETICA_12, c);
+
+    state.str ("");
+    state << "Filtering: " << opencl->imageWidth () << "x" << opencl->imageHeight ();
+    if (pyramidLevels)
+        state << " (1/" << (1 << pyramidLevels) << ")";
+
+    glRasterPos2i (470, 60);
     for (auto c : state.str ())
         glutBitmapCharacter (GLUT_BITMAP_HELVETICA_12, c);
 
     glutSwapBuffers ();
+
+    if (metrics)
+    {
+        if (fresh)
+            metrics->frameDelivered (arrival);
+        metrics->update ();
+    }
 }
 
 
@@ -447,9 +848,29 @@ void resizeGLScene (int width, int height)
 }
 
 
+// Tilts the sensor to the given angle (nothing to do on a replay)
+void setTilt (double angle)
+{
+    if (device)
+        device->setTiltDegrees (angle);
+}
+
+
+// Sets the LED of the sensor (nothing to do on a replay)
+void setLed (freenect_led_options option)
+{
+    if (device)
+        device->setLed (option);
+}
+
+
 // Keyboard callback for the window
 void keyPressed (unsigned char key, int x, int y)
 {
+    const Resize resize = [] (int width, int height, int levels) { 
+        opencl->setResolution (width, height, levels); 
+    };
+
     switch (key)
     {
         case 0x1B:  // ESC
@@ -461,41 +882,70 @@ void keyPressed (unsigned char key, int x, int y)
         case 'f':
             opencl->toggleSmoothing ();
             break;
+        case 'M':
+        case 'm':
+            opencl->nextSmoothingMethod ();
+            break;
+        case '+':
+        case '=':
+            opencl->setGaussian (std::min (opencl->smoothingSigma () + sigmaStep, maxSigma), 
+                                 opencl->smoothingWidth ());
+            break;
+        case '-':
+            opencl->setGaussian (std::max (opencl->smoothingSigma () - sigmaStep, minSigma), 
+                                 opencl->smoothingWidth ());
+            break;
+        case ']':
+            opencl->setGaussian (opencl->smoothingSigma (), 
+                                 std::min (opencl->smoothingWidth () + 2, maxGaussianWidth));
+            break;
+        case '[':
+            opencl->setGaussian (opencl->smoothingSigma (), 
+                                 std::max (opencl->smoothingWidth () - 2, minGaussianWidth));
+            break;
+        case 'H':
+        case 'h':
+            toggleResolution (device, recorder != NULL, videoResolution, pyramidLevels, resize);
+            break;
+        case 'L':
+        case 'l':
+            nextPyramidLevel (replay, videoResolution, pyramidLevels, resize);
+            break;
         case  'W':
         case  'w':
             if (++freenectAngle > 30)
                 freenectAngle = 30;
-            device->setTiltDegrees (freenectAngle);
+            setTilt (freenectAngle);
             break;
         case  'S':
         case  's':
             if (--freenectAngle < -30)
                 freenectAngle = -30;
-            device->setTiltDegrees (freenectAngle);
+            setTilt (freenectAngle);
             break;
         case  'R':
         case  'r':
             freenectAngle = 0;
-            device->setTiltDegrees (freenectAngle);
+            setTilt (freenectAngle);
             break;
         case  '1':
-            device->setLed (LED_GREEN);
+            setLed (LED_GREEN);
             break;
         case  '2':
-            device->setLed (LED_RED);
+            setLed (LED_RED);
             break;
         case  '3':
-            device->setLed (LED_YELLOW);
+            setLed (LED_YELLOW);
             break;
         case  '4':
         case  '5':
-            device->setLed (LED_BLINK_GREEN);
+            setLed (LED_BLINK_GREEN);
             break;
         case  '6':
-            device->setLed (LED_BLINK_RED_YELLOW);
+            setLed (LED_BLINK_RED_YELLOW);
             break;
         case  '0':
-            device->setLed (LED_OFF);
+            setLed (LED_OFF);
             break;
     }
 }
@@ -520,21 +970,26 @@ void initGL (int argc, char **argv)
     glEnable (GL_BLEND);
     glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glShadeModel (GL_SMOOTH);
+
+    glewInit ();
 }
 
 
-// Initializes OpenGL buffers
+// Creates a texture for the output images of width x height pixels
 // Note: Call this after the OpenCL context has been created
-void initGLObjects ()
+GLuint createGLTexture (int width, int height)
 {
-    glGenTextures (1, &glRGBTex);
-    glBindTexture (GL_TEXTURE_2D, glRGBTex);
-    glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA32F, gl_win_width, gl_win_height, 0,
+    GLuint texture;
+    glGenTextures (1, &texture);
+    glBindTexture (GL_TEXTURE_2D, texture);
+    glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0,
                   GL_RGBA, GL_FLOAT, NULL);
     glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     // glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
     // glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
+
+    return texture;
 }
 
 
@@ -544,6 +999,11 @@ void printInfo ()
     std::cout << "\nAvailable Controls:\n";
     std::cout << "===================\n";
     std::cout << "Toggle Smoothing :  F\n";
+    std::cout << "Smoothing Method :  M\n";
+    std::cout << "Gaussian Sigma   :  + / -\n";
+    std::cout << "Gaussian Width   :  ] / [\n";
+    std::cout << "Resolution       :  H\n";
+    std::cout << "Pyramid Level    :  L\n";
     std::cout << "Tilt Kinect Up   :  W\n";
     std::cout << "Tilt Kinect Down :  S\n";
     std::cout << "Reset Tilt Angle :  R\n";
@@ -558,18 +1018,97 @@ int main (int argc, char **argv)
     {
         printInfo ();
 
-        device = &freenect.createDevice<MyFreenectDevice> (0);
-        device->startVideo ();
+        // Profiling is enabled with --profile. --record <file> writes the Kinect 
+        // stream to a file, and --replay <file> takes the frames from one instead 
+        // (at the recorded pace, or as fast as they get filtered with --max-speed). 
+        // --metrics <seconds> logs the frame counters, the frame rate and the latency 
+        // periodically, and --metrics-file <file> writes them in the Prometheus format. 
+        // --resolution high switches the Kinect to 1280x1024, and --pyramid <levels> 
+        // filters the frames at 1 / 2^levels of their size
+        bool maxSpeed = false;
+        const char *recordName = NULL, *replayName = NULL;
+        const char *metricsFile = NULL;
+        double metricsInterval = 0.;
+        for (int i = 1; i < argc; ++i)
+            if (std::string (argv[i]) == "--profile")
+                profiler = new Profiler ();
+            else if (std::string (argv[i]) == "--record" && i + 1 < argc)
+                recordName = argv[++i];
+            else if (std::string (argv[i]) == "--replay" && i + 1 < argc)
+                replayName = argv[++i];
+            else if (std::string (argv[i]) == "--max-speed")
+                maxSpeed = true;
+            else if (std::string (argv[i]) == "--metrics" && i + 1 < argc)
+                metricsInterval = std::atof (argv[++i]);
+            else if (std::string (argv[i]) == "--metrics-file" && i + 1 < argc)
+                metricsFile = argv[++i];
+            else if (std::string (argv[i]) == "--resolution" && i + 1 < argc)
+                videoResolution = std::string (argv[++i]) == "high" ? 
+                    FREENECT_RESOLUTION_HIGH : FREENECT_RESOLUTION_MEDIUM;
+            else if (std::string (argv[i]) == "--pyramid" && i + 1 < argc)
+                pyramidLevels = std::min (std::max (std::atoi (argv[++i]), 0), maxPyramidLevels);
+        if (profiler)
+            profiler->dumpAtExit ("kinectFilter_profile.csv");
+
+        // A replay takes the resolution of the recording
+        if (replayName)
+        {
+            replay = new ReplayDevice (replayName, maxSpeed);
+            if (replay->width () > (uint32_t) maxFrameWidth || replay->height () > (uint32_t) maxFrameHeight)
+                throw std::runtime_error (std::string (replayName) + " has frames larger than 1280x1024");
+        }
 
         initGL (argc, argv);
 
         // OpenCL environment must be created after the OpenGL environment 
         // has been initialized and before OpenGL starts rendering
-        opencl = new Filter ();
+        int width, height;
+        frameDimensions (replay, videoResolution, width, height);
+        opencl = new Filter (width, height, pyramidLevels);
+
+        // The source writes its frames into buffers of the OpenCL context, 
+        // so it gets attached after the OpenCL environment has been created
+        if (replay)
+        {
+            replay->attach (opencl->rgbSlots (), NULL, profiler);
+            replay->start ();
+            source = replay;
+        }
+        else
+        {
+            device = &freenect.createDevice<KinectDevice> (0);
+            device->attach (opencl->rgbSlots (), NULL, profiler);
+            device->setVideoFormat (FREENECT_VIDEO_RGB, videoResolution);
+            if (recordName)
+            {
+                recorder = new Recorder (recordName, width, height);
+                device->record (recorder);
+            }
+            device->startVideo ();
+            source = device;
+        }
+
+        // --metrics-file alone reports every 10 seconds
+        if (metricsInterval > 0. || metricsFile)
+        {
+            metrics = new Metrics ("kinectFilter_gl_interop_texture", metricsInterval > 0. ? metricsInterval : 10.);
+            metrics->addSource (source);
+            if (metricsFile)
+                metrics->setFile (metricsFile);
+        }
 
         glutMainLoop ();
 
-        device->stopVideo ();
+        if (replay)
+            replay->stop ();
+        else
+        {
+            device->record (NULL);
+            device->stopVideo ();
+        }
+        delete recorder;
+        delete replay;
+        delete metrics;
         delete opencl;
 
         return 0;
@@ -580,4 +1119,9 @@ int main (int argc, char **argv)
                   << error.err ()  << ")"  << std::endl;
         exit (EXIT_FAILURE);
     }
+    catch (const std::runtime_error &error)
+    {
+        std::cerr << error.what () << std::endl;
+        exit (EXIT_FAILURE);
+    }
 }
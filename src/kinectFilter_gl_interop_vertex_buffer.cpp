@@ -29,7 +29,14 @@
 #include <fstream>
 #include <string>
 #include <vector>
-#include <mutex>
+#include <algorithm>
+#include <cstdlib>
+#include <csignal>
+#include <deque>
+#include <map>
+#include <thread>
+#include <chrono>
+#include <stdexcept>
 
 #include <GL/glew.h>
 
@@ -49,6 +56,14 @@
 #include <GL/glut.h>
 #endif
 #include <libfreenect.hpp>
+#include <kinectFilter/profiler.hpp>
+#include <kinectFilter/kinectDevice.hpp>
+#include <kinectFilter/recording.hpp>
+#include <kinectFilter/metrics.hpp>
+#include <kinectFilter/programCache.hpp>
+#include <kinectFilter/pipeline.hpp>
+#include <kinectFilter/glSync.hpp>
+#include <kinectFilter/shmRing.hpp>
 
 
 // Window parameters
@@ -65,24 +80,169 @@ float zoom = 1.f;
 void initGLObjects ();
 GLuint glDepthBuf;
 GLuint glRGBBuf;
+GLuint glPackedBuf;
+GLuint glDrawCmdBuf;  // glDrawArraysIndirect command for the compacted point cloud
 bool color = true;
 
+// Shader program for the packed point cloud
+void initGLShaders ();
+GLuint glPointProgram;
+GLint glPositionAttrib, glColorAttrib;
+
+// Size of a packed vertex: short4 position (in mm), uchar4 color
+const size_t packedVertexSize = 4 * sizeof (int16_t) + 4 * sizeof (uint8_t);
+
+// Voxel grid parameters (the cell sizes, in mm, cycle at runtime; 0 is off)
+const float voxelSizes[] = { 0.f, 10.f, 20.f, 40.f, 80.f };
+const int voxelSizeCount = sizeof (voxelSizes) / sizeof (voxelSizes[0]);
+const size_t voxelTableSize = 1 << 19;  // Slots in the hash table (power of 2)
+
+// Temporal filter parameters (number of depth frames in the history)
+const int temporalFrames = 5;
+
+// Multi-sensor parameters. The sensors share the OpenCL context, and each 
+// one writes its point cloud into its own region of the vertex buffers
+const int maxSensors = 4;
+int sensorCount = 1;    // Set with --sensors
+bool spreadGPUs = false;  // Set with --spread (a queue per sensor on each GPU of the GL context)
+GLsizeiptr drawCmdStride = 4 * sizeof (GLuint);  // Offset between the draw commands of the sensors
+
+// Frame pairing parameters. The frames of each stream are kept in a short queue, 
+// and an RGB frame gets processed with the Depth frame closest to it in time. 
+// The timestamps of libfreenect count the ticks of the 60 MHz clock of the sensor
+const int pairSlots = 6;  // Buffers per stream (the queue holds 4 frames)
+uint32_t pairTolerance = 1000000;  // ~16 ms, half a frame (set with --pair-tolerance <ms>)
+
 // Freenect
-class MyFreenectDevice;
 Freenect::Freenect freenect;
-MyFreenectDevice *device;
+std::vector<KinectDevice *> kinects;  // One per live sensor
 double freenectAngle = 0;
 
+// The frames of a sensor come from a Kinect, or from a recording (with --replay)
+std::vector<FrameSource *> sources;  // One per sensor
+std::vector<ReplayDevice *> replays;
+std::vector<Recorder *> recorders;
+
 // OpenCL
 class Filter;
 Filter *opencl;
 
+// Profiling (only when started with --profile)
+Profiler *profiler = NULL;
+
+// Frame-level metrics (only when started with --metrics or --metrics-file)
+Metrics *metrics = NULL;
+
+// Headless mode (only when started with --headless)
+const uint32_t headlessSlots = 8;  // Point clouds in the shared memory ring, per sensor
+volatile std::sig_atomic_t stopRequested = 0;
+
+
+// Reads parameters from a file with "name value" lines. Missing ones keep 
+// their values, and lines starting with # are ignored
+bool readParams (const char *fileName, std::map<std::string, float *> &params)
+{
+    std::ifstream file (fileName);
+    if (!file)
+        return false;
+
+    std::string line;
+    while (std::getline (file, line))
+    {
+        std::istringstream fields (line);
+        std::string name;
+        float value;
+        if (line.empty () || line[0] == '#' || !(fields >> name >> value))
+            continue;
+
+        if (params.find (name) == params.end ())
+        {
+            std::cerr << "Unknown calibration parameter: " << name << std::endl;
+            return false;
+        }
+        *params[name] = value;
+    }
+
+    return true;
+}
+
+
+// The intrinsic parameters of the depth camera. The defaults are the nominal 
+// ones of the Kinect (a single focal length, and the center of the image 
+// as the principal point). Calibrated values are read with --calib
+struct Intrinsics
+{
+    Intrinsics () 
+        : fx (595.f), fy (595.f), cx ((gl_width - 1) / 2.f), cy ((gl_height - 1) / 2.f), 
+          k1 (0.f), k2 (0.f), p1 (0.f), p2 (0.f), k3 (0.f)
+    {
+    }
+
+    // Reads the parameters (fx, fy, cx, cy, k1, k2, p1, p2, k3) from a file
+    bool load (const char *fileName)
+    {
+        std::map<std::string, float *> params = {
+            { "fx", &fx }, { "fy", &fy }, { "cx", &cx }, { "cy", &cy }, 
+            { "k1", &k1 }, { "k2", &k2 }, { "p1", &p1 }, { "p2", &p2 }, { "k3", &k3 } 
+        };
+
+        return readParams (fileName, params);
+    }
+
+    float fx, fy, cx, cy;
+    float k1, k2, p1, p2, k3;
+};
+
+
+// The pose of a sensor, that takes its point cloud to the common frame 
+// (a rotation, and a translation in mm). The default is the identity. 
+// Calibrated poses are read with --pose
+struct Pose
+{
+    Pose () 
+        : r11 (1.f), r12 (0.f), r13 (0.f), r21 (0.f), r22 (1.f), r23 (0.f), 
+          r31 (0.f), r32 (0.f), r33 (1.f), tx (0.f), ty (0.f), tz (0.f)
+    {
+    }
+
+    // Reads the parameters (r11 ... r33, row-major, and tx, ty, tz) from a file
+    bool load (const char *fileName)
+    {
+        std::map<std::string, float *> params = {
+            { "r11", &r11 }, { "r12", &r12 }, { "r13", &r13 }, 
+            { "r21", &r21 }, { "r22", &r22 }, { "r23", &r23 }, 
+            { "r31", &r31 }, { "r32", &r32 }, { "r33", &r33 }, 
+            { "tx", &tx }, { "ty", &ty }, { "tz", &tz } 
+        };
+
+        return readParams (fileName, params);
+    }
+
+    // Writes out the pose as a (column-major) OpenGL matrix
+    void matrix (GLfloat m[16]) const
+    {
+        const GLfloat values[16] = { r11, r21, r31, 0.f, 
+                                     r12, r22, r32, 0.f, 
+                                     r13, r23, r33, 0.f, 
+                                      tx,  ty,  tz, 1.f };
+        std::copy (values, values + 16, m);
+    }
+
+    float r11, r12, r13, r21, r22, r23, r31, r32, r33;
+    float tx, ty, tz;
+};
+
+// The calibration of each sensor
+std::vector<Intrinsics> intrinsics (maxSensors);
+std::vector<Pose> poses (maxSensors);
+
 
 // A class for filtering an image on the GPU
 class Filter
 {
 public:
-    Filter () : global { gl_width, gl_height }, rgb_norm (false)
+    Filter () : global { gl_width, gl_height }, rgb_norm (false), packed (true), compact (true), voxelSizeIdx (0), temporal (false), 
+                glFence (NULL), ring (NULL)
     {
         // Image region for transfers
         region[0] = gl_width;
@@ -94,7 +254,6 @@ public:
         const int height = gl_height;
 
         rgbBufferSize = 3 * sizeof (uint8_t) * width * height;
-        rgbaBufferSize = 4 * sizeof (float) * width * height;
         depthBufferSize = sizeof (uint16_t) * width * height;
 
         // Get the list of platforms
@@ -131,117 +290,175 @@ public:
         // Get the GPU devices in the first platform
         platforms[0].getDevices (CL_DEVICE_TYPE_GPU, &devices);
         #else
-        // Get the CL device associated with the GL context
-        cl_device_id device;
+        // Get the CL device associated with the GL context (or, with --spread, 
+        // all the devices that can share its objects)
         clGetGLContextInfoKHR_fn clGetGLContextInfo = (clGetGLContextInfoKHR_fn) 
             clGetExtensionFunctionAddressForPlatform ((platforms[0]) (), "clGetGLContextInfoKHR");
-        clGetGLContextInfo (props, CL_CURRENT_DEVICE_FOR_GL_CONTEXT_KHR, sizeof (cl_device_id), &device, NULL);
-        devices.emplace_back (device);
+        size_t size = sizeof (cl_device_id);
+        if (spreadGPUs)
+            clGetGLContextInfo (props, CL_DEVICES_FOR_GL_CONTEXT_KHR, 0, NULL, &size);
+        std::vector<cl_device_id> ids (size / sizeof (cl_device_id));
+        clGetGLContextInfo (props, spreadGPUs ? CL_DEVICES_FOR_GL_CONTEXT_KHR : CL_CURRENT_DEVICE_FOR_GL_CONTEXT_KHR, 
+                            size, ids.data (), NULL);
+        for (cl_device_id id : ids)
+            devices.emplace_back (id);
         #endif
 
+        // The sensors share a single device, unless asked to spread over the GPUs 
+        // (and there is no use for more devices than sensors)
+        devices.resize (spreadGPUs ? std::min ((int) devices.size (), sensorCount) : 1);
+
         // Detect OpenCL-OpenGL Interoperability
-        checkCLGLInterop (devices[0]);
+        for (cl::Device &device : devices)
+            checkCLGLInterop (device);
+        checkGLSync (platforms[0], devices[0], clCreateEventFromGLsync, glCLEvent);
 
         // Create a context with CL-GL interop
-        context = cl::Context (devices[0], props);
+        context = cl::Context (devices, props);
+
+        // The draw commands of the sensors get written through sub-buffers, 
+        // so their offsets have to meet the base address alignment of the devices
+        for (cl::Device &device : devices)
+        {
+            cl_uint align = device.getInfo<CL_DEVICE_MEM_BASE_ADDR_ALIGN> ();
+            drawCmdStride = std::max (drawCmdStride, (GLsizeiptr) (align / 8));
+        }
 
         // Create OpenGL memory objects
         initGLObjects ();
 
-        // Create a command queue for the device
-        queue = cl::CommandQueue (context, devices[0]);
-
-        // Create a buffer instance for the source rgb image on the device
-        bufferSourceRGB = cl::Buffer (context, CL_MEM_READ_ONLY, rgbBufferSize);
-
-        // Create a buffer instance for the intermediate results on the device
-        bufferInterRGBA = cl::Buffer (context, CL_MEM_READ_WRITE, rgbaBufferSize);
-
-        // Create a buffer instance for the color image (shared with OpenGL) on the device
+        // Create buffer instances for the color image and the point cloud 
+        // (shared with OpenGL) on the device
         bufferGLShared.emplace_back (context, CL_MEM_WRITE_ONLY, glRGBBuf);
-
-        // Create a buffer instance for the source depth image on the device
-        bufferSourceDepth = cl::Buffer (context, CL_MEM_READ_ONLY, depthBufferSize);
-
-        // Create a buffer instance for the point cloud (shared with OpenGL) on the device
         bufferGLShared.emplace_back (context, CL_MEM_WRITE_ONLY, glDepthBuf);
 
-        // Read the program source
-        std::ifstream sourceFile ("kernels/kernels.cl");
-        std::string programCode (std::istreambuf_iterator<char> (sourceFile), (std::istreambuf_iterator<char> ()));
-    
-        // Create a program
-        cl::Program::Sources source (1, std::make_pair (programCode.c_str (), programCode.length () + 1));
-        program = cl::Program (context, source);
+        // Create a buffer instance for the packed point cloud (shared with OpenGL) on the device
+        bufferGLPacked.emplace_back (context, CL_MEM_WRITE_ONLY, glPackedBuf);
 
-        try
-        {
-            // Compile the program
-            program.build (devices);
-        }
-        catch (const cl::Error &error)
+        // Create a buffer instance for the draw commands of the compacted point clouds 
+        // (shared with OpenGL) on the device. The first element of each is the vertex count
+        bufferGLPacked.emplace_back (context, CL_MEM_READ_WRITE, glDrawCmdBuf);
+
+        // Create and compile a program, for each device, from the source embedded 
+        // in the executable (or load it from the binary cache, when it has been built before)
+        for (cl::Device &device : devices)
         {
-            std::cerr << error.what () << " ("
-                      << error.err ()  << ")"  << std::endl;
-            
-            std::string log = program.getBuildInfo<CL_PROGRAM_BUILD_LOG> (devices[0]);
-            std::cout << log << std::endl;
+            cl_int status;
+            std::string log;
+            programs.push_back (cl::Program (buildCachedProgram (context (), device (), kernelSource, "", &status, &log)));
 
-            exit (EXIT_FAILURE);
-        }
+            if (status != CL_SUCCESS)
+            {
+                std::cerr << "clBuildProgram (" << status << ")" << std::endl;
+                std::cout << log << std::endl;
 
-        // Create kernel
-        kernelRGBA = cl::Kernel (program, "rgb2rgba");
-        kernelRGBNorm = cl::Kernel (program, "normalizeRGB");
-        kernelDepthTo3D = cl::Kernel (program, "depthTo3D");
+                exit (EXIT_FAILURE);
+            }
+        }
 
-        // Set common kernel arguments
-        kernelRGBA.setArg (0, bufferSourceRGB);
-        kernelRGBA.setArg (2, height);
-        kernelRGBA.setArg (3, width);
+        // Set up the sensors (taking turns on the devices)
+        sensors.resize (sensorCount);
+        for (int i = 0; i < sensorCount; ++i)
+            initSensor (i, devices[i % devices.size ()], programs[i % programs.size ()]);
 
-        kernelRGBNorm.setArg (0, bufferInterRGBA);
-        kernelRGBNorm.setArg (1, bufferGLShared[0]);
-        kernelRGBNorm.setArg (2, height);
-        kernelRGBNorm.setArg (3, width);
+        // The GL objects get acquired and released on the queue of the first sensor
+        queue = sensors[0].queue;
 
-        kernelDepthTo3D.setArg (0, bufferSourceDepth);
-        kernelDepthTo3D.setArg (1, bufferGLShared[1]);
-        kernelDepthTo3D.setArg (2, 595.f);
+        for (Sensor &s : sensors)
+            s.queue.finish ();
     }
 
-    void processFrames (std::vector<uint8_t> &rgb, std::vector<uint16_t> &depth)
+    // Processes the frames of the sensors that have a new one. rgb[i] and depth[i] 
+    // are the latest pair of frames of sensor i, and fresh[i] tells if it's a new pair
+    void processFrames (const std::vector<const uint8_t *> &rgb, const std::vector<const uint16_t *> &depth, 
+                        const std::vector<bool> &fresh)
     {
-        glFinish ();  // Wait for OpenGL pending operations on the buffers to finish
+        // Record the timings of the previous frames
+        collectProfile ();
+
+        std::vector<cl::Memory> &glObjects = packed ? 
+            (std::vector<cl::Memory> &) bufferGLPacked : (std::vector<cl::Memory> &) bufferGLShared;
 
         // Take ownership of the OpenGL buffers
-        queue.enqueueAcquireGLObjects ((std::vector<cl::Memory> *) &bufferGLShared);
+        acquireGLObjects (glObjects);
 
-        // Copy the source images to the device
-        queue.enqueueWriteBuffer (bufferSourceRGB, CL_FALSE, 0, rgbBufferSize, rgb.data ());
-        queue.enqueueWriteBuffer (bufferSourceDepth, CL_FALSE, 0, depthBufferSize, depth.data ());
+        // The queues of the other sensors wait for the acquisition. The queue gets 
+        // flushed, since an event of a queue that never got flushed may never 
+        // complete for another queue (e.g. for the blocking reads of publishCloud)
+        std::vector<cl::Event> acquired (1), done;
+        if (sensorCount > 1)
+        {
+            queue.enqueueMarkerWithWaitList (NULL, &acquired[0]);
+            queue.flush ();
+        }
 
-        if (rgb_norm)
-            kernelRGBA.setArg (1, bufferInterRGBA);
-        else
-            kernelRGBA.setArg (1, bufferGLShared[0]);
+        for (int i = 0; i < sensorCount; ++i)
+        {
+            if (!fresh[i])
+                continue;
+
+            Sensor &s = sensors[i];
+            if (sensorCount > 1)
+            {
+                std::ostringstream suffix;
+                suffix << " [" << i << "]";
+                stageSuffix = suffix.str ();
+            }
+
+            processSensor (i, rgb[i], depth[i], i > 0 ? &acquired : NULL);
+
+            if (i > 0)
+            {
+                s.queue.enqueueMarkerWithWaitList (NULL, &s.doneEvent);
+                s.queue.flush ();
+                done.push_back (s.doneEvent);
+            }
+        }
+        stageSuffix.clear ();
+
+        // Give up ownership of the OpenGL buffers (once all the sensors are done)
+        releaseGLObjects (glObjects, done.empty () ? NULL : &done);
+    }
 
-        // Restructure the data to include the A channel, and normalize 
-        // (the final buffer object shared with OpenGL has to have RGBA 
-        // channels, with float channel types and normalized values [0,1])
-        queue.enqueueNDRangeKernel (kernelRGBA, cl::NullRange, global, cl::NullRange);
+    // Waits for the upload of the last frames to complete, 
+    // so that their source buffers can be given back to libfreenect
+    void finishUpload ()
+    {
+        for (Sensor &s : sensors)
+            if (s.uploadEvent ())
+                s.uploadEvent.wait ();
+    }
 
-        // Perform RGB normalization        
-        if (rgb_norm)
-            queue.enqueueNDRangeKernel (kernelRGBNorm, cl::NullRange, global, cl::NullRange);
+    ~Filter ()
+    {
+        for (Sensor &s : sensors)
+        {
+            for (int i = 0; i < pairSlots; ++i)
+                s.queue.enqueueUnmapMemObject (s.bufferPinnedRGB[i], s.pinnedRGB[i]);
+            for (int i = 0; i < pairSlots; ++i)
+                s.queue.enqueueUnmapMemObject (s.bufferPinnedDepth[i], s.pinnedDepth[i]);
+            s.queue.finish ();
+            delete s.pool;
+        }
+    }
 
-        // Transform depth image to 3D point cloud
-        queue.enqueueNDRangeKernel (kernelDepthTo3D, cl::NullRange, global, cl::NullRange);
+    // Sets the ring that the packed point clouds get published into (on top 
+    // of being drawn), after each frame. NULL stops the publishing
+    void publishTo (ShmRing *ring)
+    {
+        this->ring = ring;
+    }
 
-        // Give up ownership of the OpenGL buffers
-        queue.enqueueReleaseGLObjects ((std::vector<cl::Memory> *) &bufferGLShared);
+    // Returns the pinned host buffers that the RGB frames of a sensor get written into
+    uint8_t *const *rgbSlots (int sensor)
+    {
+        return sensors[sensor].pinnedRGB;
+    }
 
-        queue.finish ();
+    // Returns the pinned host buffers that the Depth frames of a sensor get written into
+    uint16_t *const *depthSlots (int sensor)
+    {
+        return sensors[sensor].pinnedDepth;
     }
 
     // Returns the state of the flag for RGB normalization
@@ -258,7 +475,406 @@ public:
         return rgb_norm;
     }
 
+    // Returns the state of the flag for the packed vertex format
+    bool packedVertices ()
+    {
+        return packed;
+    }
+
+    // Toggles between the packed, interleaved vertex buffer, 
+    // and the separate float4 position and color buffers
+    // Returns the new state of the flag
+    bool togglePackedVertices ()
+    {
+        packed = !packed;
+        return packed;
+    }
+
+    // Returns whether the packed point cloud gets compacted (only the valid points, 
+    // or one point per voxel), and has its vertex count in the draw command
+    bool compaction ()
+    {
+        return packed && (compact || voxelSizeIdx);
+    }
+
+    // Toggles the culling of the invalid (zero-depth) points 
+    // Returns the new state of the flag
+    bool toggleCompaction ()
+    {
+        compact = !compact;
+        return compact;
+    }
+
+    // Toggles the temporal filtering of the depth frames 
+    // (the history starts over when it gets enabled)
+    // Returns the new state of the flag
+    bool toggleTemporalFilter ()
+    {
+        temporal = !temporal;
+        for (Sensor &s : sensors)
+            s.historyHead = s.historyFrames = 0;
+        return temporal;
+    }
+
+    // Switches to the next cell size of the voxel grid (it applies to the packed 
+    // vertex format). Returns the new cell size in mm, or 0 if the grid is off
+    float cycleVoxelSize ()
+    {
+        voxelSizeIdx = (voxelSizeIdx + 1) % voxelSizeCount;
+        return voxelSizes[voxelSizeIdx];
+    }
+
 private:
+    // The state of a sensor. Each sensor has its own command queue (on its own 
+    // device, with --spread), and its own buffers and kernels, so the sensors 
+    // get processed concurrently. The results go to the region of the shared 
+    // buffers that belongs to the sensor
+    struct Sensor
+    {
+        cl::CommandQueue queue;
+        cl::Event uploadEvent, doneEvent;
+        int historyHead, historyFrames;
+        cl_uint drawCmd[4];  // The reset draw command (count, instances, first, reserved)
+        cl::Buffer bufferSourceRGB;
+        cl::Buffer bufferSourceDepth, bufferRays;
+        cl::Buffer bufferVoxelKeys, bufferVoxels;
+        cl::Buffer bufferDepthHistory;
+        cl::Buffer bufferPinnedRGB[pairSlots], bufferPinnedDepth[pairSlots];
+        uint8_t *pinnedRGB[pairSlots];
+        uint16_t *pinnedDepth[pairSlots];
+        cl::Buffer bufferColor, bufferCloud, bufferPacked, bufferDrawCmd;
+        cl::Kernel kernelRGBA, kernelRGBNorm;
+        cl::Kernel kernelDepthTo3D, kernelDepthTo3DPacked, kernelDepthTo3DCompact;
+        cl::Kernel kernelVoxelAccumulate, kernelVoxelResolve;
+        cl::Kernel kernelTemporal;
+        MemPool *pool;
+        std::vector<Pipeline> pipelines;
+    };
+
+    // Creates the buffers and kernels of sensor i, on the given device
+    void initSensor (int i, cl::Device &device, cl::Program &program)
+    {
+        const int width = gl_width;
+        const int height = gl_height;
+
+        Sensor &s = sensors[i];
+        s.historyHead = s.historyFrames = 0;
+        s.drawCmd[0] = 0;
+        s.drawCmd[1] = 1;
+        s.drawCmd[2] = i * width * height;
+        s.drawCmd[3] = 0;
+
+        // Create a command queue for the device (with timestamps on the commands, when profiling)
+        s.queue = cl::CommandQueue (context, device, profiler ? CL_QUEUE_PROFILING_ENABLE : 0);
+
+        // Create a buffer instance for the source rgb image on the device
+        s.bufferSourceRGB = cl::Buffer (context, CL_MEM_READ_ONLY, rgbBufferSize);
+
+        // Create pinned host buffers for the frames coming from Kinect, and keep 
+        // them mapped for the lifetime of the filter. The frames get written 
+        // straight into page-locked memory, so the uploads are plain DMA transfers
+        for (int j = 0; j < pairSlots; ++j)
+        {
+            s.bufferPinnedRGB[j] = cl::Buffer (context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, rgbBufferSize);
+            s.pinnedRGB[j] = static_cast<uint8_t *> (s.queue.enqueueMapBuffer (
+                s.bufferPinnedRGB[j], CL_TRUE, CL_MAP_WRITE, 0, rgbBufferSize));
+        }
+
+        // The intermediate results come from a pool shared by the pipelines
+        s.pool = new MemPool (context);
+
+        // Create a buffer instance for the source depth image on the device
+        s.bufferSourceDepth = cl::Buffer (context, CL_MEM_READ_ONLY, depthBufferSize);
+
+        // Same for the depth frames
+        for (int j = 0; j < pairSlots; ++j)
+        {
+            s.bufferPinnedDepth[j] = cl::Buffer (context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, depthBufferSize);
+            s.pinnedDepth[j] = static_cast<uint16_t *> (s.queue.enqueueMapBuffer (
+                s.bufferPinnedDepth[j], CL_TRUE, CL_MAP_WRITE, 0, depthBufferSize));
+        }
+
+        // Create a buffer instance for the history of depth frames (for the temporal filter)
+        s.bufferDepthHistory = cl::Buffer (context, CL_MEM_READ_WRITE, temporalFrames * depthBufferSize);
+
+        // Create a buffer instance for the table with the rays through the pixels
+        s.bufferRays = cl::Buffer (context, CL_MEM_READ_WRITE, 2 * sizeof (float) * width * height);
+
+        // Create buffer instances for the voxel grid (keys and accumulators). 
+        // The grid starts empty, and voxelResolve clears it after each frame
+        s.bufferVoxelKeys = cl::Buffer (context, CL_MEM_READ_WRITE, sizeof (cl_uint) * voxelTableSize);
+        s.bufferVoxels = cl::Buffer (context, CL_MEM_READ_WRITE, 8 * sizeof (cl_int) * voxelTableSize);
+        s.queue.enqueueFillBuffer (s.bufferVoxelKeys, (cl_uint) 0xFFFFFFFF, 0, sizeof (cl_uint) * voxelTableSize);
+        s.queue.enqueueFillBuffer (s.bufferVoxels, (cl_int) 0, 0, 8 * sizeof (cl_int) * voxelTableSize);
+
+        // The regions of the shared buffers that the sensor writes into
+        s.bufferColor = sensorRegion (bufferGLShared[0], i, 4 * sizeof (float) * width * height);
+        s.bufferCloud = sensorRegion (bufferGLShared[1], i, 4 * sizeof (float) * width * height);
+        s.bufferPacked = sensorRegion (bufferGLPacked[0], i, packedVertexSize * width * height);
+        s.bufferDrawCmd = sensorRegion (bufferGLPacked[1], i, drawCmdStride, sizeof (s.drawCmd));
+
+        // Create kernel
+        s.kernelRGBA = cl::Kernel (program, "rgb2rgba");
+        s.kernelRGBNorm = cl::Kernel (program, "rgb2rgbaNorm");
+        s.kernelDepthTo3D = cl::Kernel (program, "depthTo3DRays");
+        s.kernelDepthTo3DPacked = cl::Kernel (program, "depthTo3DPacked");
+        s.kernelDepthTo3DCompact = cl::Kernel (program, "depthTo3DPackedCompact");
+        s.kernelVoxelAccumulate = cl::Kernel (program, "voxelAccumulate");
+        s.kernelVoxelResolve = cl::Kernel (program, "voxelResolve");
+        s.kernelTemporal = cl::Kernel (program, "temporalMedian");
+
+        // Set common kernel arguments
+        s.kernelRGBA.setArg (2, height);
+        s.kernelRGBA.setArg (3, width);
+
+        s.kernelRGBNorm.setArg (2, height);
+        s.kernelRGBNorm.setArg (3, width);
+
+        s.kernelDepthTo3D.setArg (1, s.bufferRays);
+
+        buildPipelines (s);
+
+        s.kernelDepthTo3DPacked.setArg (0, s.bufferSourceDepth);
+        s.kernelDepthTo3DPacked.setArg (1, s.bufferSourceRGB);
+        s.kernelDepthTo3DPacked.setArg (2, s.bufferPacked);
+        s.kernelDepthTo3DPacked.setArg (3, s.bufferRays);
+
+        s.kernelDepthTo3DCompact.setArg (0, s.bufferSourceDepth);
+        s.kernelDepthTo3DCompact.setArg (1, s.bufferSourceRGB);
+        s.kernelDepthTo3DCompact.setArg (2, s.bufferPacked);
+        s.kernelDepthTo3DCompact.setArg (3, s.bufferRays);
+        s.kernelDepthTo3DCompact.setArg (5, s.bufferDrawCmd);
+
+        s.kernelVoxelAccumulate.setArg (0, s.bufferSourceDepth);
+        s.kernelVoxelAccumulate.setArg (1, s.bufferSourceRGB);
+        s.kernelVoxelAccumulate.setArg (2, s.bufferRays);
+        s.kernelVoxelAccumulate.setArg (5, s.bufferVoxelKeys);
+        s.kernelVoxelAccumulate.setArg (6, s.bufferVoxels);
+        s.kernelVoxelAccumulate.setArg (7, (cl_uint) (voxelTableSize - 1));
+
+        s.kernelVoxelResolve.setArg (0, s.bufferVoxelKeys);
+        s.kernelVoxelResolve.setArg (1, s.bufferVoxels);
+        s.kernelVoxelResolve.setArg (2, s.bufferPacked);
+        s.kernelVoxelResolve.setArg (3, s.bufferDrawCmd);
+
+        s.kernelTemporal.setArg (0, s.bufferDepthHistory);
+        s.kernelTemporal.setArg (2, s.bufferSourceDepth);
+
+        // Compute the ray table (once, the intrinsics don't change)
+        cl::Kernel kernelRays (program, "computeRays");
+        cl_float4 params = { { intrinsics[i].fx, intrinsics[i].fy, intrinsics[i].cx, intrinsics[i].cy } };
+        cl_float4 distortion = { { intrinsics[i].k1, intrinsics[i].k2, intrinsics[i].p1, intrinsics[i].p2 } };
+        kernelRays.setArg (0, s.bufferRays);
+        kernelRays.setArg (1, params);
+        kernelRays.setArg (2, distortion);
+        kernelRays.setArg (3, intrinsics[i].k3);
+        s.queue.enqueueNDRangeKernel (kernelRays, cl::NullRange, global, cl::NullRange);
+    }
+
+    // Returns the region of a shared buffer that belongs to sensor i (the regions 
+    // are stride bytes apart, and size bytes long). With a single sensor, 
+    // that's the whole buffer
+    cl::Buffer sensorRegion (cl::BufferGL &buffer, int i, size_t stride, size_t size = 0)
+    {
+        if (sensorCount == 1)
+            return buffer;
+
+        // The access flags are inherited from the shared buffer
+        cl_buffer_region r = { i * stride, size ? size : stride };
+        return buffer.createSubBuffer (0, CL_BUFFER_CREATE_TYPE_REGION, &r);
+    }
+
+    // Enqueues the processing of the frames of sensor i on its queue. The commands 
+    // on the shared buffers wait for the events in acquired, when given
+    void processSensor (int i, const uint8_t *rgb, const uint16_t *depth, 
+                        const std::vector<cl::Event> *acquired)
+    {
+        Sensor &s = sensors[i];
+
+        // Copy the source images to the device
+        s.queue.enqueueWriteBuffer (s.bufferSourceRGB, CL_FALSE, 0, rgbBufferSize, rgb, NULL, profile ("Upload RGB"));
+        if (temporal)
+        {
+            // The raw frame goes into the history, and the filtered 
+            // one into the source buffer of the stages that follow. A fresh 
+            // pair always brings a new Depth frame (see FrameSource::getPair), 
+            // so a Depth frame never goes into the history twice
+            s.queue.enqueueWriteBuffer (s.bufferDepthHistory, CL_FALSE, s.historyHead * depthBufferSize, 
+                                        depthBufferSize, depth, NULL, &s.uploadEvent);
+            track ("Upload depth", s.uploadEvent);
+
+            s.historyHead = (s.historyHead + 1) % temporalFrames;
+            s.historyFrames = std::min (s.historyFrames + 1, temporalFrames);
+
+            s.kernelTemporal.setArg (1, (cl_uint) s.historyFrames);
+            s.queue.enqueueNDRangeKernel (s.kernelTemporal, cl::NullRange, global, cl::NullRange, NULL, profile ("temporalMedian"));
+        }
+        else
+        {
+            s.queue.enqueueWriteBuffer (s.bufferSourceDepth, CL_FALSE, 0, depthBufferSize, depth, NULL, &s.uploadEvent);
+            track ("Upload depth", s.uploadEvent);
+        }
+
+        // The uploads don't touch the shared buffers, so they don't wait for them
+        if (acquired)
+            s.queue.enqueueBarrierWithWaitList (acquired);
+
+        if (compaction ())
+        {
+            // Reset the draw command
+            s.queue.enqueueWriteBuffer (s.bufferDrawCmd, CL_FALSE, 0, sizeof (s.drawCmd), s.drawCmd);
+
+            if (voxelSizeIdx)
+            {
+                // Downsample the point cloud to one (averaged) point per occupied voxel
+                s.kernelVoxelAccumulate.setArg (3, (cl_uint) rgb_norm);
+                s.kernelVoxelAccumulate.setArg (4, voxelSizes[voxelSizeIdx]);
+                s.queue.enqueueNDRangeKernel (s.kernelVoxelAccumulate, cl::NullRange, global, cl::NullRange, NULL, profile ("voxelAccumulate"));
+                s.queue.enqueueNDRangeKernel (s.kernelVoxelResolve, cl::NullRange, cl::NDRange (voxelTableSize), cl::NullRange, NULL, profile ("voxelResolve"));
+            }
+            else
+            {
+                // Transform depth image to packed 3D point cloud, keeping only the valid points
+                s.kernelDepthTo3DCompact.setArg (4, (cl_uint) rgb_norm);
+                s.queue.enqueueNDRangeKernel (s.kernelDepthTo3DCompact, cl::NullRange, global, cl::NullRange, NULL, profile ("depthTo3DPackedCompact"));
+            }
+        }
+        else if (packed)
+        {
+            // Transform depth image to packed 3D point cloud, 
+            // with the colors (optionally normalized) interleaved
+            s.kernelDepthTo3DPacked.setArg (4, (cl_uint) rgb_norm);
+            s.queue.enqueueNDRangeKernel (s.kernelDepthTo3DPacked, cl::NullRange, global, cl::NullRange, NULL, profile ("depthTo3DPacked"));
+        }
+        else
+        {
+            // Restructure the data to include the A channel, (optionally) perform 
+            // RGB normalization, and transform the depth image to 3D point cloud 
+            // (the final buffer object shared with OpenGL has to have RGBA 
+            // channels, with float channel types and normalized values [0,1])
+            s.pipelines[rgb_norm].enqueue (s.queue, NULL, NULL, 
+                                           [this] (const std::string &stage) { return profile (stage.c_str ()); });
+        }
+
+        // The headless mode publishes the packed point clouds
+        if (packed && ring)
+            publishCloud (i);
+    }
+
+    // Reads the packed point cloud of sensor i back into the next slot of the ring 
+    // (only the points in the draw command, when compacted), and publishes it
+    void publishCloud (int i)
+    {
+        Sensor &s = sensors[i];
+
+        cl_uint count = gl_width * gl_height;
+        if (compaction ())
+            s.queue.enqueueReadBuffer (s.bufferDrawCmd, CL_TRUE, 0, sizeof (count), &count);
+
+        s.queue.enqueueReadBuffer (s.bufferPacked, CL_TRUE, 0, count * packedVertexSize, ring->begin (), 
+                                   NULL, profile ("Publish"));
+        ring->publish (count * packedVertexSize, count, 1, ShmRingSlot::PACKED_POINTS, i);
+    }
+
+    // Builds the float path (separate color and position buffers) of a sensor 
+    // as pipelines, one without and one with RGB normalization. The normalization 
+    // is fused into the transformation to RGBA, so neither has any intermediate buffers
+    void buildPipelines (Sensor &s)
+    {
+        s.pipelines.assign (2, Pipeline (*s.pool));
+
+        s.pipelines[0].addStage ("rgb2rgba", s.kernelRGBA, global)
+            .input (0, "rgb").output (1, "color");
+
+        s.pipelines[1].addStage ("rgb2rgbaNorm", s.kernelRGBNorm, global)
+            .input (0, "rgb").output (1, "color");
+
+        for (Pipeline &pipeline : s.pipelines)
+        {
+            pipeline.addStage ("depthTo3DRays", s.kernelDepthTo3D, global)
+                .input (0, "depth").output (2, "cloud");
+
+            pipeline.bind ("rgb", s.bufferSourceRGB);
+            pipeline.bind ("depth", s.bufferSourceDepth);
+            pipeline.bind ("color", s.bufferColor);
+            pipeline.bind ("cloud", s.bufferCloud);
+        }
+    }
+
+    // Returns an event for timing a command of the given stage, 
+    // or NULL when profiling is off (see Profiler::profile)
+    cl::Event *profile (const char *stage)
+    {
+        return profiler ? profiler->profile (std::string (stage) + stageSuffix) : NULL;
+    }
+
+    // Times an existing event as a command of the given stage
+    void track (const char *stage, const cl::Event &event)
+    {
+        if (profiler)
+            profiler->track (std::string (stage) + stageSuffix, event);
+    }
+
+    // Records the durations of the timed commands that have completed
+    void collectProfile ()
+    {
+        if (profiler)
+            profiler->collect ();
+    }
+
+    // Makes the CL queue wait for the pending OpenGL operations 
+    // on the shared objects, before acquiring them
+    void acquireGLObjects (std::vector<cl::Memory> &objects)
+    {
+        if (!clCreateEventFromGLsync)
+        {
+            glFinish ();  // Wait for OpenGL pending operations on the objects to finish
+            queue.enqueueAcquireGLObjects (&objects, NULL, profile ("GL acquire"));
+            return;
+        }
+
+        // Delete the fence of the previous frame, once CL is done with it
+        if (glFence)
+        {
+            glFenceEvent.wait ();
+            glDeleteSync (glFence);
+        }
+
+        // Put a fence after the GL commands so far, and wait for it on the GPU
+        glFence = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush ();
+
+        cl_int status;
+        glFenceEvent = cl::Event (clCreateEventFromGLsync (context (), (cl_GLsync) glFence, &status));
+        if (status != CL_SUCCESS)
+            throw cl::Error (status, "clCreateEventFromGLsyncKHR");
+
+        std::vector<cl::Event> glDone (1, glFenceEvent);
+        queue.enqueueAcquireGLObjects (&objects, &glDone, profile ("GL acquire"));
+    }
+
+    // Gives the shared objects back to OpenGL (after the events in waits, when given), 
+    // and makes the GL commands that follow wait for the CL commands so far
+    void releaseGLObjects (std::vector<cl::Memory> &objects, const std::vector<cl::Event> *waits = NULL)
+    {
+        if (!glCLEvent)
+        {
+            queue.enqueueReleaseGLObjects (&objects, waits, profile ("GL release"));
+            queue.finish ();
+            return;
+        }
+
+        cl::Event clDone;
+        queue.enqueueReleaseGLObjects (&objects, waits, &clDone);
+        track ("GL release", clDone);
+        queue.flush ();
+
+        // The wait happens on the GPU, so the CPU moves on right away
+        GLsync sync = glCreateSyncFromCLeventARB ((_cl_context *) context (), (_cl_event *) clDone (), 0);
+        glWaitSync (sync, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync (sync);
+    }
+
     void checkCLGLInterop (cl::Device &device)
     {
         std::string exts = device.getInfo<CL_DEVICE_EXTENSIONS> ();
@@ -279,7 +895,7 @@ private:
 
 
     // Source buffer parameters
-    size_t rgbBufferSize, rgbaBufferSize, depthBufferSize;
+    size_t rgbBufferSize, depthBufferSize;
 
     // Image transfer parameters
     cl::size_t<3> origin;
@@ -289,157 +905,147 @@ private:
     cl::NDRange global;
 
     bool rgb_norm;
+    bool packed;
+    bool compact;
+    int voxelSizeIdx;
+    bool temporal;
 
     std::vector<cl::Platform> platforms;
     std::vector<cl::Device> devices;
     cl::Context context;
     cl::CommandQueue queue;
-    cl::Buffer bufferSourceRGB, bufferInterRGBA;
-    cl::Buffer bufferSourceDepth;
+    std::string stageSuffix;  // Tells the sensors apart in the profile
+    // GL-CL synchronization
+    clCreateEventFromGLsyncKHR_fn clCreateEventFromGLsync;
+    bool glCLEvent;
+    GLsync glFence;
+    cl::Event glFenceEvent;
     std::vector<cl::BufferGL> bufferGLShared;
-    cl::Program program;
-    cl::Kernel kernelRGBA, kernelRGBNorm;
-    cl::Kernel kernelDepthTo3D;
+    std::vector<cl::BufferGL> bufferGLPacked;
+    std::vector<cl::Program> programs;
+    std::vector<Sensor> sensors;
+    ShmRing *ring;
 };
 
 
-// A class hierarchy for manipulating a mutex
-class Mutex
-{
-public:
-    void lock () { freenectMutex.lock (); }
-    void unlock () { freenectMutex.unlock (); }
-
-    // A class that automates the manipulation of 
-    // the outer class instance's mutex.
-    // Mutex's mutex is locked with the creation of a ScopedLock instance 
-    // and unlocked with the destruction of the ScopedLock instance.
-    class ScopedLock
-    {
-    public:
-        ScopedLock (Mutex &mtx) : mMutex (mtx) { mMutex.lock (); }
-        ~ScopedLock () { mMutex.unlock (); }
-
-    private:
-        Mutex &mMutex;
-    };
-
-private:
-    std::mutex freenectMutex;
-};
-
-
-// A class that extends Freenect::FreenectDevice by defining the VideoCallback
-// callback function so we can get updates with the latest RGB frame
-class MyFreenectDevice : public Freenect::FreenectDevice
+// If new frames are available, it processes them on the GPU
+// Returns false if there were none. The arrival time of the oldest 
+// of the new frames goes in arrival, if it's given
+bool updateFrames (double *arrival = NULL)
 {
-public:
-    MyFreenectDevice (freenect_context *ctx, int index)
-        : Freenect::FreenectDevice (ctx, index),
-          rgbBuffer (freenect_find_video_mode (FREENECT_RESOLUTION_MEDIUM, 
-                                                    FREENECT_VIDEO_RGB).bytes),
-          depthBuffer (freenect_find_depth_mode (FREENECT_RESOLUTION_MEDIUM, 
-                                                    FREENECT_DEPTH_REGISTERED).bytes / 2),
-          newRGBFrame (false), newDepthFrame (false)
-    {
-        setDepthFormat(FREENECT_DEPTH_REGISTERED);
-    }
+    std::vector<const uint8_t *> rgb (sensorCount);
+    std::vector<const uint16_t *> depth (sensorCount);
+    std::vector<bool> fresh (sensorCount);
+    bool any = false;
 
-    // Delivers the latest RGB frame
-    // Do not call directly, it's only used by the library
-    void VideoCallback (void *rgb, uint32_t timestamp)
-    {
-        Mutex::ScopedLock lock (rgbMutex);
-
-        std::copy (static_cast<uint8_t *> (rgb), 
-                   static_cast<uint8_t *> (rgb) + getVideoBufferSize (), 
-                   rgbBuffer.begin ());
-        newRGBFrame = true;
-    };
-
-    // Delivers the latest Depth frame
-    // Do not call directly, it's only used by the library
-    void DepthCallback (void *depth, uint32_t timestamp)
-    {
-        Mutex::ScopedLock lock (depthMutex);
+    opencl->finishUpload ();
 
-        std::copy (static_cast<uint16_t*> (depth), 
-                   static_cast<uint16_t*> (depth) + getDepthBufferSize() / 2, 
-                   depthBuffer.begin());
-        newDepthFrame = true;
-    }
-
-    // Delivers the most recently received RGB frame
-    bool getRGB (std::vector<uint8_t> &buffer)
+    // The frames of a pair stay valid until the next update. A sensor with 
+    // no new pair keeps its point cloud from the last one
+    for (int i = 0; i < sensorCount; ++i)
     {
-        Mutex::ScopedLock lock (rgbMutex);
-
-        if (!newRGBFrame)
-            return false;
-
-        buffer.swap (rgbBuffer);
-        newRGBFrame = false;
-
-        return true;
+        fresh[i] = sources[i]->getPair (rgb[i], depth[i], pairTolerance);
+        if (fresh[i] && arrival)
+        {
+            double oldest = std::min (sources[i]->rgbArrival (), sources[i]->depthArrival ());
+            *arrival = any ? std::min (*arrival, oldest) : oldest;
+        }
+        any = any || fresh[i];
     }
 
-    // Delivers the most recently received Depth frame
-    bool getDepth (std::vector<uint16_t> &buffer)
+    if (any)
     {
-        Mutex::ScopedLock lock (depthMutex);
-
-        if (!newDepthFrame)
-            return false;
-
-        buffer.swap (depthBuffer);
-        newDepthFrame = false;
-
-        return true;
+        opencl->processFrames (rgb, depth, fresh);    
     }
 
-private:
-    Mutex rgbMutex, depthMutex;
-    std::vector<uint8_t> rgbBuffer;
-    std::vector<uint16_t> depthBuffer;
-    bool newRGBFrame, newDepthFrame;
-};
+    return any;
+}
 
 
-// If new frames are available, it processes them on the GPU
-void updateFrames ()
+// Puts the pose of a sensor on top of the modelview matrix, so that 
+// its points get drawn in the common frame (pop it when done)
+void pushPose (int sensor)
 {
-    static std::vector<uint8_t> rgb (freenect_find_video_mode (
-        FREENECT_RESOLUTION_MEDIUM, FREENECT_VIDEO_RGB).bytes);
-    static std::vector<uint16_t> depth (freenect_find_depth_mode (
-        FREENECT_RESOLUTION_MEDIUM, FREENECT_DEPTH_REGISTERED).bytes / 2);
+    GLfloat m[16];
+    poses[sensor].matrix (m);
 
-    if (device->getRGB (rgb) && device->getDepth (depth))
-    {
-        opencl->processFrames (rgb, depth);    
-    }
+    glPushMatrix ();
+    glMultMatrixf (m);
 }
 
 
 // Display callback for the window
 void drawGLScene ()
 {
-    updateFrames ();
+    double arrival;
+    const bool fresh = updateFrames (&arrival);
 
     glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    glBindBuffer (GL_ARRAY_BUFFER, glDepthBuf);
-    glVertexPointer (4, GL_FLOAT, 0, NULL);
-    glEnableClientState (GL_VERTEX_ARRAY);
-    
-    glBindBuffer (GL_ARRAY_BUFFER, glRGBBuf);
-    glColorPointer (4, GL_FLOAT, 0, NULL);
-    glEnableClientState (GL_COLOR_ARRAY);
-    
-    glDrawArrays (GL_POINTS, 0, gl_width * gl_height);
+    if (opencl->packedVertices ())
+    {
+        // Both attributes come from the interleaved vertex buffer
+        glUseProgram (glPointProgram);
+        glBindBuffer (GL_ARRAY_BUFFER, glPackedBuf);
+        glVertexAttribPointer (glPositionAttrib, 4, GL_SHORT, GL_FALSE, packedVertexSize, NULL);
+        glVertexAttribPointer (glColorAttrib, 4, GL_UNSIGNED_BYTE, GL_TRUE, packedVertexSize, 
+                               (const GLvoid *) (4 * sizeof (int16_t)));
+        glEnableVertexAttribArray (glPositionAttrib);
+        glEnableVertexAttribArray (glColorAttrib);
+
+        for (int i = 0; i < sensorCount; ++i)
+        {
+            pushPose (i);
+
+            const GLint first = i * gl_width * gl_height;
+            if (!opencl->compaction ())
+                glDrawArrays (GL_POINTS, first, gl_width * gl_height);
+            else if (GLEW_ARB_draw_indirect)
+            {
+                // The vertex count stays on the GPU
+                glBindBuffer (GL_DRAW_INDIRECT_BUFFER, glDrawCmdBuf);
+                glDrawArraysIndirect (GL_POINTS, (const GLvoid *) (i * drawCmdStride));
+                glBindBuffer (GL_DRAW_INDIRECT_BUFFER, 0);
+            }
+            else
+            {
+                // Read the vertex count back (this waits for the compaction)
+                GLuint count;
+                glBindBuffer (GL_COPY_READ_BUFFER, glDrawCmdBuf);
+                glGetBufferSubData (GL_COPY_READ_BUFFER, i * drawCmdStride, sizeof (count), &count);
+                glBindBuffer (GL_COPY_READ_BUFFER, 0);
+                glDrawArrays (GL_POINTS, first, count);
+            }
+
+            glPopMatrix ();
+        }
 
-    glDisableClientState (GL_VERTEX_ARRAY);
-    glDisableClientState (GL_COLOR_ARRAY);
-    glBindBuffer (GL_ARRAY_BUFFER, 0);
+        glDisableVertexAttribArray (glPositionAttrib);
+        glDisableVertexAttribArray (glColorAttrib);
+        glBindBuffer (GL_ARRAY_BUFFER, 0);
+        glUseProgram (0);
+    }
+    else
+    {
+        glBindBuffer (GL_ARRAY_BUFFER, glDepthBuf);
+        glVertexPointer (4, GL_FLOAT, 0, NULL);
+        glEnableClientState (GL_VERTEX_ARRAY);
+        
+        glBindBuffer (GL_ARRAY_BUFFER, glRGBBuf);
+        glColorPointer (4, GL_FLOAT, 0, NULL);
+        glEnableClientState (GL_COLOR_ARRAY);
+        
+        for (int i = 0; i < sensorCount; ++i)
+        {
+            pushPose (i);
+            glDrawArrays (GL_POINTS, i * gl_width * gl_height, gl_width * gl_height);
+            glPopMatrix ();
+        }
+
+        glDisableClientState (GL_VERTEX_ARRAY);
+        glDisableClientState (GL_COLOR_ARRAY);
+        glBindBuffer (GL_ARRAY_BUFFER, 0);
+    }
 
     // Draw the world coordinate frame
     glLineWidth (2.f);
@@ -465,7 +1071,36 @@ void drawGLScene ()
                       0.0,       0.0,  2000.0,
                       0.0,      -1.0,     0.0 );
 
+    if (profiler)
+    {
+        // Switch to window coordinates for the text
+        glMatrixMode (GL_PROJECTION);
+        glPushMatrix ();
+        glLoadIdentity ();
+        glOrtho (0.0, gl_width, gl_height, 0.0, -1.0, 1.0);
+        glMatrixMode (GL_MODELVIEW);
+        glPushMatrix ();
+        glLoadIdentity ();
+        glDisable (GL_DEPTH_TEST);
+
+        glColor3ub (0, 0, 0);
+        profiler->draw (10, 30);
+
+        glEnable (GL_DEPTH_TEST);
+        glPopMatrix ();
+        glMatrixMode (GL_PROJECTION);
+        glPopMatrix ();
+        glMatrixMode (GL_MODELVIEW);
+    }
+
     glutSwapBuffers ();
+
+    if (metrics)
+    {
+        if (fresh)
+            metrics->frameDelivered (arrival);
+        metrics->update ();
+    }
 }
 
 
@@ -487,6 +1122,22 @@ void resizeGLScene (int width, int height)
 }
 
 
+// Tilts all the sensors to the given angle
+void setTilt (double angle)
+{
+    for (KinectDevice *kinect : kinects)
+        kinect->setTiltDegrees (angle);
+}
+
+
+// Sets the LED of all the sensors
+void setLed (freenect_led_options option)
+{
+    for (KinectDevice *kinect : kinects)
+        kinect->setLed (option);
+}
+
+
 // Keyboard callback for the window
 void keyPressed (unsigned char key, int x, int y)
 {
@@ -501,41 +1152,66 @@ void keyPressed (unsigned char key, int x, int y)
         case 'c':
             opencl->toggleRGBNormalization ();
             break;
+        case 'X':
+        case 'x':
+            std::cout << "Invalid point culling: " 
+                      << (opencl->toggleCompaction () ? "on" : "off") << std::endl;
+            break;
+        case 'T':
+        case 't':
+            std::cout << "Temporal depth filter: " 
+                      << (opencl->toggleTemporalFilter () ? "on" : "off") << std::endl;
+            break;
+        case 'G':
+        case 'g':
+        {
+            float size = opencl->cycleVoxelSize ();
+            if (size > 0.f)
+                std::cout << "Voxel grid: " << size << " mm" << std::endl;
+            else
+                std::cout << "Voxel grid: off" << std::endl;
+            break;
+        }
+        case 'V':
+        case 'v':
+            std::cout << "Vertex format: " 
+                      << (opencl->togglePackedVertices () ? "packed" : "float") << std::endl;
+            break;
         case  'W':
         case  'w':
             if (++freenectAngle > 30)
                 freenectAngle = 30;
-            device->setTiltDegrees (freenectAngle);
+            setTilt (freenectAngle);
             break;
         case  'S':
         case  's':
             if (--freenectAngle < -30)
                 freenectAngle = -30;
-            device->setTiltDegrees (freenectAngle);
+            setTilt (freenectAngle);
             break;
         case  'R':
         case  'r':
             freenectAngle = 0;
-            device->setTiltDegrees (freenectAngle);
+            setTilt (freenectAngle);
             break;
         case  '1':
-            device->setLed (LED_GREEN);
+            setLed (LED_GREEN);
             break;
         case  '2':
-            device->setLed (LED_RED);
+            setLed (LED_RED);
             break;
         case  '3':
-            device->setLed (LED_YELLOW);
+            setLed (LED_YELLOW);
             break;
         case  '4':
         case  '5':
-            device->setLed (LED_BLINK_GREEN);
+            setLed (LED_BLINK_GREEN);
             break;
         case  '6':
-            device->setLed (LED_BLINK_RED_YELLOW);
+            setLed (LED_BLINK_RED_YELLOW);
             break;
         case  '0':
-            device->setLed (LED_OFF);
+            setLed (LED_OFF);
             break;
     }
 }
@@ -600,6 +1276,7 @@ void initGL (int argc, char **argv)
     glutMouseFunc (&mouseButtonPressed);
 
     glewInit ();
+    initGLShaders ();
 
     glClearColor (0.65f, 0.65f, 0.65f, 1.f);
     glEnable (GL_BLEND);
@@ -611,20 +1288,138 @@ void initGL (int argc, char **argv)
 }
 
 
-// Initializes OpenGL buffers
+// Initializes OpenGL buffers (with room for the points of all the sensors)
 // Note: Call this after the OpenCL context has been created
 void initGLObjects ()
 {
+    const GLsizeiptr points = sensorCount * gl_width * gl_height;
+
     glGenBuffers (1, &glRGBBuf);
     glBindBuffer (GL_ARRAY_BUFFER, glRGBBuf);
-    glBufferData (GL_ARRAY_BUFFER, 4 * sizeof (float) * gl_width * gl_height, NULL, GL_DYNAMIC_DRAW);
+    glBufferData (GL_ARRAY_BUFFER, 4 * sizeof (float) * points, NULL, GL_DYNAMIC_DRAW);
     glGenBuffers (1, &glDepthBuf);
     glBindBuffer (GL_ARRAY_BUFFER, glDepthBuf);
-    glBufferData (GL_ARRAY_BUFFER, 4 * sizeof (float) * gl_width * gl_height, NULL, GL_DYNAMIC_DRAW);
+    glBufferData (GL_ARRAY_BUFFER, 4 * sizeof (float) * points, NULL, GL_DYNAMIC_DRAW);
+    glGenBuffers (1, &glPackedBuf);
+    glBindBuffer (GL_ARRAY_BUFFER, glPackedBuf);
+    glBufferData (GL_ARRAY_BUFFER, packedVertexSize * points, NULL, GL_DYNAMIC_DRAW);
+    glGenBuffers (1, &glDrawCmdBuf);
+    glBindBuffer (GL_ARRAY_BUFFER, glDrawCmdBuf);
+    glBufferData (GL_ARRAY_BUFFER, sensorCount * drawCmdStride, NULL, GL_DYNAMIC_DRAW);
     glBindBuffer (GL_ARRAY_BUFFER, 0);
 }
 
 
+// Compiles a shader, and exits with the info log on failure
+GLuint compileShader (GLenum type, const char *source)
+{
+    GLuint shader = glCreateShader (type);
+    glShaderSource (shader, 1, &source, NULL);
+    glCompileShader (shader);
+
+    GLint status;
+    glGetShaderiv (shader, GL_COMPILE_STATUS, &status);
+    if (status != GL_TRUE)
+    {
+        char log[4096];
+        glGetShaderInfoLog (shader, sizeof (log), NULL, log);
+        std::cerr << "Failed to compile shader:\n" << log << std::endl;
+        exit (EXIT_FAILURE);
+    }
+
+    return shader;
+}
+
+
+// Initializes the shader program for the packed point cloud. The positions 
+// are integers (in mm), and get transformed by the fixed-function matrices
+void initGLShaders ()
+{
+    const char *vertexSource = 
+        "#version 120\n"
+        "attribute vec4 position;\n"
+        "attribute vec4 color;\n"
+        "varying vec4 fragColor;\n"
+        "void main () {\n"
+        "    fragColor = color;\n"
+        "    gl_Position = gl_ModelViewProjectionMatrix * position;\n"
+        "}\n";
+
+    const char *fragmentSource = 
+        "#version 120\n"
+        "varying vec4 fragColor;\n"
+        "void main () {\n"
+        "    gl_FragColor = fragColor;\n"
+        "}\n";
+
+    glPointProgram = glCreateProgram ();
+    glAttachShader (glPointProgram, compileShader (GL_VERTEX_SHADER, vertexSource));
+    glAttachShader (glPointProgram, compileShader (GL_FRAGMENT_SHADER, fragmentSource));
+    glLinkProgram (glPointProgram);
+
+    GLint status;
+    glGetProgramiv (glPointProgram, GL_LINK_STATUS, &status);
+    if (status != GL_TRUE)
+    {
+        char log[4096];
+        glGetProgramInfoLog (glPointProgram, sizeof (log), NULL, log);
+        std::cerr << "Failed to link shader program:\n" << log << std::endl;
+        exit (EXIT_FAILURE);
+    }
+
+    glPositionAttrib = glGetAttribLocation (glPointProgram, "position");
+    glColorAttrib = glGetAttribLocation (glPointProgram, "color");
+}
+
+
+// Signal handler that stops the headless mode
+void requestStop (int)
+{
+    stopRequested = 1;
+}
+
+
+// Processes the frames, and publishes the packed point clouds into the shared 
+// memory ring name (see ShmRing, the source of each cloud is its sensor), 
+// without drawing them, until the process gets a SIGINT or SIGTERM
+void runHeadless (const char *name)
+{
+    try
+    {
+        ShmRing ring (name, headlessSlots * sensorCount, packedVertexSize * gl_width * gl_height);
+        opencl->publishTo (&ring);
+
+        std::signal (SIGINT, requestStop);
+        std::signal (SIGTERM, requestStop);
+
+        std::cout << "Publishing the point clouds in " << name << std::endl;
+
+        while (!stopRequested)
+        {
+            double arrival;
+            const bool fresh = updateFrames (&arrival);
+            if (metrics)
+            {
+                if (fresh)
+                    metrics->frameDelivered (arrival);
+                metrics->update ();
+            }
+
+            if (!fresh)
+                std::this_thread::sleep_for (std::chrono::milliseconds (1));
+        }
+
+        opencl->finishUpload ();
+        opencl->publishTo (NULL);
+    }
+    catch (const std::runtime_error &error)
+    {
+        std::cerr << error.what () << std::endl;
+        exit (EXIT_FAILURE);
+    }
+}
+
+
 // Displays the available controls 
 void printInfo ()
 {
@@ -633,8 +1428,12 @@ void printInfo ()
     std::cout << "Rotate                   :  Mouse Left Button\n";
     std::cout << "Zoom In/Out              :  Mouse Wheel\n";
     std::cout << "Toggle RGB Normalization :  C\n";
-    std::cout << "Tilt Kinect Up           :  W\n";
-    std::cout << "Tilt Kinect Down         :  S\n";
+    std::cout << "Toggle Packed Vertices   :  V\n";
+    std::cout << "Toggle Point Culling     :  X\n";
+    std::cout << "Cycle Voxel Grid Size    :  G\n";
+    std::cout << "Toggle Temporal Filter   :  T\n";
+    std::cout << "Tilt Kinects Up          :  W\n";
+    std::cout << "Tilt Kinects Down        :  S\n";
     std::cout << "Reset Tilt Angle         :  R\n";
     std::cout << "Update LED State         :  0-6\n";
     std::cout << "Quit                     :  Q or Esc\n\n";
@@ -647,20 +1446,152 @@ int main (int argc, char **argv)
     {
         printInfo ();
 
-        device = &freenect.createDevice<MyFreenectDevice> (0);
-        device->startVideo ();
-        device->startDepth ();
+        // Profiling is enabled with --profile. The number of sensors is set with 
+        // --sensors <n>, and --spread gives them a device each (when there are 
+        // enough GPUs that share the GL context). Calibrated intrinsics and poses 
+        // are read with --calib <file> and --pose <file>, the k-th for sensor k
+        // --headless publishes the point clouds in shared memory (--shm <name>) 
+        // instead of drawing them. --replay <file> takes the frames of a sensor 
+        // from a recording (the replays take the first sensors, at the recorded 
+        // pace, or as fast as they get processed with --max-speed), and 
+        // --record <file> writes the streams of a Kinect to a file, the k-th 
+        // for the k-th Kinect. --pair-tolerance <ms> sets how far apart in time 
+        // the RGB and Depth frames of a pair can be. --metrics <seconds> logs the 
+        // frame counters, the frame rate and the latency periodically, and 
+        // --metrics-file <file> writes them in the Prometheus format
+        int calibs = 0, posed = 0;
+        bool headless = false, maxSpeed = false;
+        const char *shmName = "/kinectFilter_cloud";
+        const char *metricsFile = NULL;
+        double metricsInterval = 0.;
+        std::vector<const char *> recordNames, replayNames;
+        for (int i = 1; i < argc; ++i)
+            if (std::string (argv[i]) == "--profile")
+                profiler = new Profiler ();
+            else if (std::string (argv[i]) == "--headless")
+                headless = true;
+            else if (std::string (argv[i]) == "--shm" && i + 1 < argc)
+                shmName = argv[++i];
+            else if (std::string (argv[i]) == "--spread")
+                spreadGPUs = true;
+            else if (std::string (argv[i]) == "--record" && i + 1 < argc)
+                recordNames.push_back (argv[++i]);
+            else if (std::string (argv[i]) == "--replay" && i + 1 < argc)
+                replayNames.push_back (argv[++i]);
+            else if (std::string (argv[i]) == "--max-speed")
+                maxSpeed = true;
+            else if (std::string (argv[i]) == "--metrics" && i + 1 < argc)
+                metricsInterval = std::atof (argv[++i]);
+            else if (std::string (argv[i]) == "--metrics-file" && i + 1 < argc)
+                metricsFile = argv[++i];
+            else if (std::string (argv[i]) == "--pair-tolerance" && i + 1 < argc)
+                pairTolerance = std::atof (argv[++i]) * 60000;
+            else if (std::string (argv[i]) == "--sensors" && i + 1 < argc)
+            {
+                sensorCount = std::atoi (argv[++i]);
+                if (sensorCount < 1 || sensorCount > maxSensors)
+                {
+                    std::cerr << "The number of sensors has to be in [1, " << maxSensors << "]" << std::endl;
+                    exit (EXIT_FAILURE);
+                }
+            }
+            else if (std::string (argv[i]) == "--calib" && i + 1 < argc)
+            {
+                if (calibs == maxSensors || !intrinsics[calibs++].load (argv[++i]))
+                {
+                    std::cerr << "Failed to read the calibration file " << argv[i] << std::endl;
+                    exit (EXIT_FAILURE);
+                }
+            }
+            else if (std::string (argv[i]) == "--pose" && i + 1 < argc)
+            {
+                if (posed == maxSensors || !poses[posed++].load (argv[++i]))
+                {
+                    std::cerr << "Failed to read the pose file " << argv[i] << std::endl;
+                    exit (EXIT_FAILURE);
+                }
+            }
+        if (profiler)
+            profiler->dumpAtExit ("kinectFilter_profile.csv");
+
+        const int replayed = std::min<int> (replayNames.size (), sensorCount);
+        if (freenect.deviceCount () < sensorCount - replayed)
+        {
+            std::cerr << "Found " << freenect.deviceCount () << " Kinect sensor(s), " 
+                      << sensorCount - replayed << " requested" << std::endl;
+            exit (EXIT_FAILURE);
+        }
 
+        // The headless mode still needs an OpenGL context for the 
+        // shared buffers, but its window never gets shown
         initGL (argc, argv);
+        if (headless)
+            glutHideWindow ();
 
         // OpenCL environment must be created after the OpenGL environment 
         // has been initialized and before OpenGL starts rendering
         opencl = new Filter ();
 
-        glutMainLoop ();
+        // The sources write their frames into buffers of the OpenCL context, 
+        // so they have to be created after the OpenCL environment
+        for (int i = 0; i < replayed; ++i)
+        {
+            ReplayDevice *replay = new ReplayDevice (replayNames[i], maxSpeed);
+            if (replay->width () != gl_width || replay->height () != gl_height)
+                throw std::runtime_error (std::string (replayNames[i]) + " isn't a 640x480 recording");
+
+            replay->attachPaired (opencl->rgbSlots (i), opencl->depthSlots (i), pairSlots, profiler);
+            replay->start ();
+            replays.push_back (replay);
+            sources.push_back (replay);
+        }
+
+        for (int i = replayed; i < sensorCount; ++i)
+        {
+            const int k = i - replayed;
+            KinectDevice *kinect = &freenect.createDevice<KinectDevice> (k);
+            kinect->attachPaired (opencl->rgbSlots (i), opencl->depthSlots (i), pairSlots, profiler);
+            if (k < (int) recordNames.size ())
+            {
+                recorders.push_back (new Recorder (recordNames[k], gl_width, gl_height));
+                kinect->record (recorders.back ());
+            }
+            kinect->setDepthFormat (FREENECT_DEPTH_REGISTERED);
+            kinect->startVideo ();
+            kinect->startDepth ();
+            kinects.push_back (kinect);
+            sources.push_back (kinect);
+        }
+
+        // --metrics-file alone reports every 10 seconds
+        if (metricsInterval > 0. || metricsFile)
+        {
+            metrics = new Metrics ("kinectFilter_gl_interop_vertex_buffer", metricsInterval > 0. ? metricsInterval : 10.);
+            for (FrameSource *source : sources)
+                metrics->addSource (source);
+            if (metricsFile)
+                metrics->setFile (metricsFile);
+        }
+
+        if (headless)
+            runHeadless (shmName);
+        else
+            glutMainLoop ();
 
-        device->stopVideo ();
-        device->stopDepth ();
+        for (ReplayDevice *replay : replays)
+        {
+            replay->stop ();
+            delete replay;
+        }
+        for (KinectDevice *kinect : kinects)
+        {
+            kinect->record (NULL);
+            kinect->stopVideo ();
+            kinect->stopDepth ();
+        }
+        for (Recorder *recorder : recorders)
+            delete recorder;
+        delete metrics;
         delete opencl;
 
         return 0;
@@ -671,4 +1602,9 @@ int main (int argc, char **argv)
                   << error.err ()  << ")"  << std::endl;
         exit (EXIT_FAILURE);
     }
+    catch (const std::runtime_error &error)
+    {
+        std::cerr << error.what () << std::endl;
+        exit (EXIT_FAILURE);
+    }
 }